@@ -34,6 +34,7 @@ int AM_OpenIndexScan(int fileDesc, char attrType, int attrLength, int op, char *
     int errVal;
     AM_LEAFHEADER head, *header;
     int searchpageNum;
+    PF_Handle handle;
 
     /* validate fd */
     if (fileDesc < 0) {
@@ -74,13 +75,13 @@ int AM_OpenIndexScan(int fileDesc, char attrType, int attrLength, int op, char *
         AM_scanTable[scanDesc].nextIndex = 1;
         AM_scanTable[scanDesc].actindex = 1;
 
-        errVal = PF_GetThisPage(fileDesc, AM_LeftPageNum, &pageBuf);
+        errVal = PF_PinPage(fileDesc, AM_LeftPageNum, &pageBuf, &handle);
         AM_Check;
 
         bcopy(pageBuf + AM_sl + attrLength,
               &AM_scanTable[scanDesc].nextRecIdPtr, AM_ss);
 
-        errVal = PF_UnfixPage(fileDesc, AM_LeftPageNum, FALSE);
+        errVal = PF_UnpinHandle(handle, FALSE);
         AM_Check;
         return scanDesc;
     }
@@ -89,6 +90,7 @@ int AM_OpenIndexScan(int fileDesc, char attrType, int attrLength, int op, char *
     status = AM_Search(fileDesc, attrType, attrLength, value,
                        &pageNum, &pageBuf, &index);
     searchpageNum = pageNum;
+    AM_EmptyStack(); /* the search path is only needed by inserts */
 
     if (status < 0) {
         AM_scanTable[scanDesc].status = FREE;
@@ -106,12 +108,12 @@ int AM_OpenIndexScan(int fileDesc, char attrType, int attrLength, int op, char *
     /* if beyond last key, but leaf has next page */
     if (index > header->numKeys) {
         if (header->nextLeafPage != AM_NULL_PAGE) {
-            errVal = PF_GetThisPage(fileDesc, header->nextLeafPage, &pageBuf);
+            errVal = PF_PinPage(fileDesc, header->nextLeafPage, &pageBuf, &handle);
             AM_Check;
 
             bcopy(pageBuf, header, AM_sl);
 
-            errVal = PF_UnfixPage(fileDesc, header->nextLeafPage, FALSE);
+            errVal = PF_UnpinHandle(handle, FALSE);
             AM_Check;
 
             pageNum = header->nextLeafPage;
@@ -149,7 +151,7 @@ int AM_OpenIndexScan(int fileDesc, char attrType, int attrLength, int op, char *
             AM_scanTable[scanDesc].actindex = 1;
 
             if (searchpageNum != AM_LeftPageNum) {
-                errVal = PF_GetThisPage(fileDesc, AM_LeftPageNum, &pageBuf);
+                errVal = PF_PinPage(fileDesc, AM_LeftPageNum, &pageBuf, &handle);
                 AM_Check;
             }
 
@@ -157,7 +159,7 @@ int AM_OpenIndexScan(int fileDesc, char attrType, int attrLength, int op, char *
                   &AM_scanTable[scanDesc].nextRecIdPtr, AM_ss);
 
             if (searchpageNum != AM_LeftPageNum) {
-                errVal = PF_UnfixPage(fileDesc, AM_LeftPageNum, FALSE);
+                errVal = PF_UnpinHandle(handle, FALSE);
                 AM_Check;
             }
 
@@ -178,14 +180,14 @@ int AM_OpenIndexScan(int fileDesc, char attrType, int attrLength, int op, char *
                     AM_scanTable[scanDesc].nextIndex = 1;
                     AM_scanTable[scanDesc].actindex = 1;
 
-                    errVal = PF_GetThisPage(fileDesc, header->nextLeafPage,
-                                            &pageBuf);
+                    errVal = PF_PinPage(fileDesc, header->nextLeafPage,
+                                        &pageBuf, &handle);
                     AM_Check;
 
                     bcopy(pageBuf + AM_sl + attrLength,
                           &AM_scanTable[scanDesc].nextRecIdPtr, AM_ss);
 
-                    errVal = PF_UnfixPage(fileDesc, header->nextLeafPage, FALSE);
+                    errVal = PF_UnpinHandle(handle, FALSE);
                     AM_Check;
                 } else {
                     AM_scanTable[scanDesc].status = OVER;
@@ -206,7 +208,7 @@ int AM_OpenIndexScan(int fileDesc, char attrType, int attrLength, int op, char *
             AM_scanTable[scanDesc].actindex = 1;
 
             if (searchpageNum != AM_LeftPageNum) {
-                errVal = PF_GetThisPage(fileDesc, AM_LeftPageNum, &pageBuf);
+                errVal = PF_PinPage(fileDesc, AM_LeftPageNum, &pageBuf, &handle);
                 AM_Check;
             }
 
@@ -214,7 +216,7 @@ int AM_OpenIndexScan(int fileDesc, char attrType, int attrLength, int op, char *
                   &AM_scanTable[scanDesc].nextRecIdPtr, AM_ss);
 
             if (searchpageNum != AM_LeftPageNum) {
-                errVal = PF_UnfixPage(fileDesc, AM_LeftPageNum, FALSE);
+                errVal = PF_UnpinHandle(handle, FALSE);
                 AM_Check;
             }
 
@@ -239,7 +241,7 @@ int AM_OpenIndexScan(int fileDesc, char attrType, int attrLength, int op, char *
                 AM_scanTable[scanDesc].actindex = 1;
 
                 if (searchpageNum != AM_LeftPageNum) {
-                    errVal = PF_GetThisPage(fileDesc, AM_LeftPageNum, &pageBuf);
+                    errVal = PF_PinPage(fileDesc, AM_LeftPageNum, &pageBuf, &handle);
                     AM_Check;
                 }
 
@@ -247,7 +249,7 @@ int AM_OpenIndexScan(int fileDesc, char attrType, int attrLength, int op, char *
                       &AM_scanTable[scanDesc].nextRecIdPtr, AM_ss);
 
                 if (searchpageNum != AM_LeftPageNum) {
-                    errVal = PF_UnfixPage(fileDesc, AM_LeftPageNum, FALSE);
+                    errVal = PF_UnpinHandle(handle, FALSE);
                     AM_Check;
                 }
             } else {
@@ -275,6 +277,7 @@ int AM_FindNextEntry(int scanDesc)
     int recId;
     char *pageBuf;
     int errVal;
+    PF_Handle handle;
     AM_LEAFHEADER head, *header;
     int recSize;
     int compareVal;
@@ -295,21 +298,18 @@ int AM_FindNextEntry(int scanDesc)
 
     header = &head;
 
-    errVal = PF_GetThisPage(
+    errVal = PF_PinPage(
         AM_scanTable[scanDesc].fileDesc,
         AM_scanTable[scanDesc].nextpageNum,
-        &pageBuf
+        &pageBuf,
+        &handle
     );
     AM_Check;
 
     bcopy(pageBuf, header, AM_sl);
     recSize = header->attrLength + AM_ss;
 
-    errVal = PF_UnfixPage(
-        AM_scanTable[scanDesc].fileDesc,
-        AM_scanTable[scanDesc].nextpageNum,
-        FALSE
-    );
+    errVal = PF_UnpinHandle(handle, FALSE);
     AM_Check;
 
     /* skip empty pages */
@@ -319,18 +319,15 @@ int AM_FindNextEntry(int scanDesc)
             return AME_EOF;
         }
 
-        errVal = PF_GetThisPage(
+        errVal = PF_PinPage(
             AM_scanTable[scanDesc].fileDesc,
             header->nextLeafPage,
-            &pageBuf
+            &pageBuf,
+            &handle
         );
         AM_Check;
 
-        errVal = PF_UnfixPage(
-            AM_scanTable[scanDesc].fileDesc,
-            header->nextLeafPage,
-            FALSE
-        );
+        errVal = PF_UnpinHandle(handle, FALSE);
         AM_Check;
 
         AM_scanTable[scanDesc].nextpageNum = header->nextLeafPage;
@@ -387,10 +384,11 @@ int AM_FindNextEntry(int scanDesc)
                 AM_scanTable[scanDesc].nextIndex = 1;
                 AM_scanTable[scanDesc].actindex = 1;
 
-                errVal = PF_GetThisPage(
+                errVal = PF_PinPage(
                     AM_scanTable[scanDesc].fileDesc,
                     header->nextLeafPage,
-                    &pageBuf
+                    &pageBuf,
+                    &handle
                 );
                 AM_Check;
 
@@ -402,11 +400,7 @@ int AM_FindNextEntry(int scanDesc)
 
                 bcopy(pageBuf, header, AM_sl);
 
-                errVal = PF_UnfixPage(
-                    AM_scanTable[scanDesc].fileDesc,
-                    header->nextLeafPage,
-                    FALSE
-                );
+                errVal = PF_UnpinHandle(handle, FALSE);
                 AM_Check;
             }
         }
@@ -492,10 +486,11 @@ int AM_FindNextEntry(int scanDesc)
             AM_scanTable[scanDesc].nextIndex = 1;
             AM_scanTable[scanDesc].actindex = 1;
 
-            errVal = PF_GetThisPage(
+            errVal = PF_PinPage(
                 AM_scanTable[scanDesc].fileDesc,
                 header->nextLeafPage,
-                &pageBuf
+                &pageBuf,
+                &handle
             );
             AM_Check;
 
@@ -505,11 +500,7 @@ int AM_FindNextEntry(int scanDesc)
                 AM_ss
             );
 
-            errVal = PF_UnfixPage(
-                AM_scanTable[scanDesc].fileDesc,
-                header->nextLeafPage,
-                FALSE
-            );
+            errVal = PF_UnpinHandle(handle, FALSE);
             AM_Check;
 
             bcopy(
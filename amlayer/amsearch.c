@@ -3,17 +3,23 @@
 #include "am.h"
 #include "pf.h"
 
-/* searches for a key in a B+ tree */
+/* searches for a key in a B+ tree; the leaf is left fixed for the caller,
+   the internal nodes on the way down are unpinned through their handles.
+   Each child is pinned through its parent (PF_PinChild()), before the
+   parent is unpinned, so that with swizzling on a resident child is
+   reached without a hash probe */
 int AM_Search(int fileDesc, char attrType, int attrLength, char *value,
               int *pageNum, char **pageBuf, int *indexPtr)
 {
     int errVal;
     int nextPage;
     int retval;
+    PF_Handle handle, child;
     AM_LEAFHEADER lhead, *lheader = &lhead;
     AM_INTHEADER  ihead, *iheader = &ihead;
 
-    errVal = PF_GetFirstPage(fileDesc, pageNum, pageBuf);
+    *pageNum = AM_RootPageNum;
+    errVal = PF_PinPage(fileDesc, *pageNum, pageBuf, &handle);
     AM_Check;
 
     if (**pageBuf == 'l') {
@@ -30,13 +36,16 @@ int AM_Search(int fileDesc, char attrType, int attrLength, char *value,
         nextPage = AM_BinSearch(*pageBuf, attrType, attrLength, value, indexPtr, iheader);
         AM_PushStack(*pageNum, *indexPtr);
 
-        errVal = PF_UnfixPage(fileDesc, *pageNum, FALSE);
-        AM_Check;
-
         *pageNum = nextPage;
 
-        errVal = PF_GetThisPage(fileDesc, *pageNum, pageBuf);
+        errVal = PF_PinChild(fileDesc, handle, *indexPtr, *pageNum, pageBuf, &child);
+        if (errVal != PFE_OK)
+            PF_UnpinHandle(handle, FALSE);
+        AM_Check;
+
+        errVal = PF_UnpinHandle(handle, FALSE);
         AM_Check;
+        handle = child;
 
         if (**pageBuf == 'l') {
             bcopy(*pageBuf, (char *)lheader, AM_sl);
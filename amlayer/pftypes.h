@@ -1,49 +1,144 @@
 #ifndef PFTYPES_H_
 #define PFTYPES_H_
 
+#include <stddef.h>
+
 #define PF_PAGE_SIZE 4096
 /**************************** File Page Decls *****************************/
+/* log sequence number: byte offset of a record in the write-ahead log, 0 if none */
+typedef unsigned long long PF_LSN;
+
 typedef struct PFhdr_str {
+    int magic;      /* PF_MAGIC */
+    int version;    /* PF_VERSION, of the page layout */
     int firstfree;  /* first free page in the linked list */
     int numpages;   /* total number of pages in the file */
+    PF_LSN lsn;     /* LSN of the last logged header change */
 } PFhdr_str;
 
 #define PF_HDR_SIZE sizeof(PFhdr_str)
 
+/* Files of another layout (such as the 4096-byte pages of files made before
+   pages carried an LSN) are refused by PF_OpenFile() */
+#define PF_MAGIC   0x50464831  /* "PFH1" */
+#define PF_VERSION 1
+
 /* Page markers */
 #define PF_PAGE_LIST_END -1
 #define PF_PAGE_USED     -2
 
+/* A page as stored in the file (the whole struct) and in a buffer frame */
 typedef struct PFfpage {
     int nextfree;
+    unsigned int checksum;  /* PFpageChecksum() as last written */
+    PF_LSN lsn;      /* LSN of the last logged change to the page */
     char pagebuf[PF_PAGE_SIZE];
 } PFfpage;
 
+/* byte offset of page "pagenum" in its file: pages are whole PFfpages after the header */
+#define PFpageOffset(pagenum) ((off_t)PF_HDR_SIZE + (off_t)(pagenum) * (off_t)sizeof(PFfpage))
+
+/****************************** Statistics ********************************/
+#define PF_HIST_BUCKETS 32
+
+/* log2-bucketed latency histogram: bucket[i] counts samples in
+   [2^i, 2^(i+1)) nanoseconds; the last bucket is open ended */
+typedef struct PF_Hist {
+    unsigned long count;
+    unsigned long long total_ns;
+    unsigned long long max_ns;
+    unsigned long bucket[PF_HIST_BUCKETS];
+} PF_Hist;
+
+typedef struct PF_Stats {
+    unsigned long hits;             /* buffer hits in PFbufGet */
+    unsigned long misses;           /* buffer misses (page read from file) */
+    unsigned long evictions;        /* frames taken from this file */
+    unsigned long dirty_writebacks; /* dirty pages written back */
+    unsigned long probes;           /* page-table (hash) lookups */
+    unsigned long reopens;          /* parked unix descriptors reopened */
+    unsigned long victim_writes;    /* misses that wrote a dirty victim before reading */
+    unsigned long cleaner_writes;   /* dirty pages written back by the cleaner thread */
+    unsigned long long bytes_read;
+    unsigned long long bytes_written;
+    PF_Hist read_lat;               /* physical page reads */
+    PF_Hist write_lat;              /* physical page writes */
+    PF_Hist fsync_lat;              /* fsync after a page write */
+} PF_Stats;
+
+/* events counted by PFstatsEvent() */
+#define PF_STAT_HIT       0
+#define PF_STAT_MISS      1
+#define PF_STAT_EVICT     2
+#define PF_STAT_WRITEBACK 3
+#define PF_STAT_PROBE     4
+#define PF_STAT_REOPEN    5
+#define PF_STAT_VICTIMWRITE 6
+#define PF_STAT_CLEANED   7
+
 /*************************** Opened File Table ****************************/
-#define PF_FTAB_SIZE 20
+#define PF_FTAB_SIZE 20    /* initial # of entries; the table doubles when full */
+#define PF_MAX_UNIXFDS 64  /* default cap on unix descriptors held at once */
 
 typedef struct PFftab_ele {
     char *fname;
-    int unixfd;
+    int unixfd;      /* unix fd, or -1 while the descriptor is parked */
     PFhdr_str hdr;
     short hdrchanged;
+    PF_Stats stats;  /* per-file statistics, zeroed on open */
+    int nextfree;    /* next free entry while fname is NULL, -1 ends the list */
+    int namenext;    /* next entry in the same name hash chain, -1 ends it */
+    int fdprev;      /* LRU list of entries holding a unix fd */
+    int fdnext;
+    int logid;       /* file id in the write-ahead log, -1 until first logged */
+    short needsync;  /* written since the last fsync (write-ahead log or double-write open) */
 } PFftab_ele;
 
 /************************** Buffer Page Decls *****************************/
-#define PF_MAX_BUFS 20
+#define PF_MAX_BUFS 20     /* initial size of the buffer pool, see PF_ResizeBufferPool() */
+#define PF_RESIZE_CHUNK 8  /* max pages released per step of a shrink */
+#define PF_VICTIM_WINDOW 8 /* coldest unfixed pages searched for a clean victim */
 
 typedef struct PFbpage {
     struct PFbpage *nextpage;
     struct PFbpage *prevpage;
     unsigned short dirty:1;
     unsigned short fixed:1;
+    unsigned short reused:1;  /* referenced again since it was read in */
+    unsigned short snap:1;    /* a snapshot's private frame, not in the pool */
+    unsigned short cleaning:1; /* a copy is being written by the cleaner thread */
+    unsigned short redirty:1; /* unfixed dirty again since the cleaner took its copy */
     int page;
     int fd;
-    PFfpage fpage;
+    PFfpage *fpage;         /* page body, in the frame arena */
+    struct PFchunk *chunk;  /* arena chunk owning the frame */
+    PFfpage *before;        /* image at fix time, while fixed in a transaction */
+    PF_LSN reclsn;          /* first log record that dirtied it since it was written, or 0 */
+    PFfpage *snapbefore;    /* image at fix time, while fixed and a snapshot still sees it */
+    unsigned int version;   /* odd while the PF thread has the frame to itself */
+    int shared;             /* # of PF_ReadShared() pins */
+    struct PFbpage **swips; /* frames of the children pinned through it by slot
+                               (PF_PinChild()), or NULL */
 } PFbpage;
 
+#define PF_SWIP_SLOTS 512  /* child slots of a page that can be swizzled */
+
+/* Access to a word that threads using PF_ReadShared() read without a lock */
+#define PFload(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define PFstore(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+/* A pinned page: valid from PF_PinPage() until the matching PF_UnpinHandle() */
+typedef PFbpage *PF_Handle;
+
+/* Called by PF_CompactFile() once page "oldpage" of file "fd" has been
+   copied to "newpage", to update references to it; returns PFE_OK, or a
+   PF error code that stops the compaction */
+typedef int (*PF_RelocFcn)(int fd, int oldpage, int newpage, void *arg);
+
 /******************** Hash Table Decls ****************************/
-#define PF_HASH_TBL_SIZE 20
+#define PF_HASH_TBL_SIZE 20  /* initial # of buckets; doubled as entries grow */
+#define PF_HASH_LOAD 2       /* max average chain length before doubling */
+#define PF_HASH_MAXPROBE 64  /* entries PFhashFindShared() visits before giving up */
 
 typedef struct PFhash_entry {
     struct PFhash_entry *nextentry;
@@ -53,13 +148,368 @@ typedef struct PFhash_entry {
     PFbpage *bpage;
 } PFhash_entry;
 
-#define PFhash(fd, page) (((fd) + (page)) % PF_HASH_TBL_SIZE)
+#define PFhash(fd, page, size) (((fd) + (page)) % (size))
 
 /******************* Interface functions from Hash Table ****************/
 extern void PFhashInit(void);
 extern PFbpage *PFhashFind(int fd, int page);
+extern PFbpage *PFhashFindShared(int fd, int page);
 extern int PFhashInsert(int fd, int page, PFbpage *bpage);
 extern int PFhashDelete(int fd, int page);
 extern void PFhashPrint(void);
 
+/****************************** Victim Cache *******************************/
+/* admission policies for PF_VCacheOpen() */
+#define PF_VC_ADMIT_ALL    0  /* cache every evicted page */
+#define PF_VC_ADMIT_REUSED 1  /* cache only pages referenced again while buffered */
+
+typedef struct PF_VCacheStats {
+    unsigned long lookups;     /* buffer misses checked against the cache */
+    unsigned long hits;        /* misses served from the cache file */
+    unsigned long admits;      /* evicted pages written to the cache file */
+    unsigned long rejects;     /* evicted pages refused by the admission policy */
+    unsigned long replaced;    /* cached pages overwritten to make room */
+    unsigned long invalidated; /* cached pages dropped (file closed, page reallocated) */
+} PF_VCacheStats;
+
+/******************* Interface functions from vcache.c ******************/
+extern int PFvcacheOn;
+extern int PFvcacheRead(int fd, int page, PFfpage *fpage);
+extern void PFvcacheAdmit(int fd, int page, PFfpage *fpage, int reused);
+extern void PFvcacheDropPage(int fd, int page);
+extern void PFvcacheDropFile(int fd);
+
+/**************************** Double-Write Buffer ***************************/
+#define PF_DW_PAGES   64   /* pages per batch, and slots in the scratch file */
+#define PF_DW_NAMELEN 240  /* bytes for the name of a page's file in a slot */
+
+/* a slot of the scratch file: a page and where it goes */
+typedef struct PFdw_slot {
+    unsigned int crc;       /* PFcrc32() of the slot with crc = 0 */
+    unsigned int batch;     /* batch number; the newest copy of a page wins */
+    int pagenum;
+    int fd;                 /* PF fd while batched; meaningless in the file */
+    char fname[PF_DW_NAMELEN];
+    PFfpage page;
+} PFdw_slot;
+
+typedef struct PF_DWStats {
+    unsigned long pages;      /* page writes taken into a batch */
+    unsigned long merged;     /* of which replaced a copy already in the batch */
+    unsigned long hits;       /* page reads served from the batch */
+    unsigned long batches;    /* batches written (one scratch fsync each) */
+    unsigned long fsyncs;     /* data file fsyncs after batches */
+    unsigned long direct;     /* pages written in place, fsync per page (name too long) */
+    unsigned long restored;   /* torn pages repaired by PF_DWOpen() */
+} PF_DWStats;
+
+/******************* Interface functions from dblwr.c *******************/
+extern int PFdwOn;
+extern int PFdwWrite(int fd, int pagenum, const PFfpage *fpage);
+extern int PFdwRead(int fd, int pagenum, PFfpage *fpage);
+extern int PFdwFlush(void);
+extern int PFdwForget(void);
+
+/****************************** Page Cleaner *******************************/
+#define PF_CLEAN_SLOTS 64  /* page copies queued for the cleaner thread */
+
+/* slot states */
+#define PF_CLEAN_FREE    0
+#define PF_CLEAN_QUEUED  1
+#define PF_CLEAN_WRITING 2
+#define PF_CLEAN_DONE    3
+
+/* a dirty page handed to the cleaner thread: a copy and where it goes */
+typedef struct PFclean_slot {
+    int state;
+    PFbpage *bpage;          /* frame the copy was taken from */
+    int fd;                  /* PF fd of the page */
+    int page;
+    int unixfd;              /* descriptor of the thread's own, closed after the write */
+    int sync;                /* fsync after writing (no write-ahead log) */
+    PF_LSN lsn;              /* log to flush first, 0 for none */
+    int error;               /* PFE_OK, or why the write failed */
+    unsigned long long write_ns, sync_ns;
+    PFfpage image;
+} PFclean_slot;
+
+/******************* Interface functions from clean.c *******************/
+extern int PFcleanOn;
+extern int PFcleanSchedule(PFbpage *bpage);
+extern void PFcleanReap(void);
+extern void PFcleanWait(PFbpage *bpage);
+extern int PFcleanWaitAny(void);
+extern void PFcleanDrain(void);
+extern int PFbufSetVictimWindow(int npages);
+extern int PFfileDup(int fd);
+extern void PFfileWritten(int fd, unsigned long long write_ns, unsigned long long sync_ns, int synced);
+
+/******************************* Snapshots *********************************/
+#define PF_SNAP_FRAMES  8     /* private page frames of a snapshot reader */
+#define PF_SNAP_BUCKETS 1024  /* hash chains of the page version table */
+
+/* an old image of a page, seen by the snapshots begun in [lo, hi] */
+typedef struct PFsnapver {
+    struct PFsnapver *next;  /* next older version */
+    unsigned long lo, hi;
+    PFfpage *image;          /* in memory, or NULL if spilled */
+    long slot;               /* page slot in the spill file, -1 if in memory */
+} PFsnapver;
+
+/* a page changed while a snapshot of its file was active */
+typedef struct PFsnappage {
+    struct PFsnappage *next; /* hash chain */
+    int fd;
+    int page;
+    unsigned long modepoch;  /* snapshot clock at its last change */
+    PFsnapver *versions;     /* newest first */
+} PFsnappage;
+
+typedef struct PFsnap {
+    int fd;                  /* -1 if the entry is free */
+    unsigned long epoch;     /* snapshot clock value it was begun with */
+    PFhdr_str hdr;           /* file header at begin */
+    int hand;                /* next frame to reuse */
+    PFbpage frames[PF_SNAP_FRAMES];
+} PFsnap;
+
+typedef struct PF_SnapStats {
+    unsigned long begun;       /* PF_BeginSnapshot() calls */
+    unsigned long captures;    /* before images taken when a writer fixed a page */
+    unsigned long created;     /* versions kept when such a page was changed */
+    unsigned long versions;    /* versions held now */
+    unsigned long spilled;     /* versions written to the spill file */
+    unsigned long reads;       /* pages resolved for snapshot readers */
+    unsigned long old_reads;   /* of which from a version */
+    unsigned long spill_reads; /* of which from the spill file */
+    unsigned long frame_hits;  /* pins served by a reader's frames */
+} PF_SnapStats;
+
+/******************* Interface functions from snap.c and buf.c **********/
+extern int PFsnapOn;  /* # of active snapshots */
+extern int PFsnapCapture(PFbpage *bpage);
+extern int PFsnapCommit(PFbpage *bpage);
+extern int PFsnapCurrent(int fd);
+extern int PFsnapFileActive(int fd);
+extern int PFsnapPin(int snap, int pagenum, char **pagebuf, PFbpage **handle);
+extern int PFsnapNext(int snap, int *pagenum, char **pagebuf);
+extern int PFsnapUnfix(int snap, int pagenum);
+extern int PFsnapUnpin(PFbpage *bpage);
+extern void PFsnapDropFile(int fd);
+extern int PFbufSnapCapture(int fd);
+
+/****************************** Frame Arena ********************************/
+#define PF_ARENA_CHUNK (2 * 1024 * 1024)  /* bytes of page bodies per chunk */
+
+/* backing of arena chunks, see PF_SetArenaMode() */
+#define PF_ARENA_HUGE 0  /* MAP_HUGETLB, else transparent huge pages */
+#define PF_ARENA_THP  1  /* transparent huge pages only */
+#define PF_ARENA_4K   2  /* no huge pages */
+
+/******************* Interface functions from arena.c *******************/
+extern PFbpage *PFarenaGetFrame(void);
+extern void PFarenaPutFrame(PFbpage *bpage);
+
+/******************* Interface functions from buf.c and psi.c ***********/
+extern int PFbufResize(int nframes, int (*writefcn)(int, int, PFfpage *));
+extern int PFbufDiscard(int fd, int pagenum);
+extern void PFbufPoolSize(int *nframes, int *target);
+extern int PFbufSetSwizzling(int on);
+extern PFbpage *PFbufSwip(PFbpage *parent, int slot);
+extern void PFbufSetSwip(PFbpage *parent, int slot, PFbpage *child);
+extern int PFpsiOn;
+extern void PFpsiTick(void);
+
+/******************* Interface functions from pf.c (statistics) **********/
+extern void PFstatsEvent(int fd, int event);
+extern void PFhistAdd(PF_Hist *hist, unsigned long long ns);
+
+/******************* Interface functions from pf.c (page I/O) ************/
+extern unsigned int PFpageChecksum(const PFfpage *fpage);
+extern int PFwritePage(int fd, int pagenum, const PFfpage *fpage);
+extern int PFfileSync(int fd);
+extern const char *PFfileName(int fd);
+extern int PFfileValid(int fd);
+
+/**************************** Write-Ahead Log *****************************/
+#define PF_WAL_MAGIC "PFWAL001"
+#define PF_WAL_BUFSIZE (1024 * 1024)  /* bytes per log buffer (there are two) */
+#define PF_LOG_MAXREC 16384           /* upper bound on a record's size */
+
+typedef struct PFwal_hdr {
+    char magic[8];    /* PF_WAL_MAGIC */
+    PF_LSN master;    /* CKPT_BEGIN of the last complete checkpoint, 0 if none */
+} PFwal_hdr;          /* the first record starts right after it */
+
+/* log record types */
+#define PF_LOG_UPDATE 1  /* byte ranges of a page: before and after images */
+#define PF_LOG_HEADER 2  /* file header: before and after PFhdr_str */
+#define PF_LOG_FILE   3  /* binds "fileid" to the file name in the payload */
+#define PF_LOG_COMMIT 4
+#define PF_LOG_ABORT  5  /* rollback started; CLRs follow */
+#define PF_LOG_END    6  /* rollback finished */
+#define PF_LOG_CKPT_BEGIN 7  /* fuzzy checkpoint: PFckpt_begin */
+#define PF_LOG_CKPT_TXNS  8  /* active transactions: PFckpt_txn array */
+#define PF_LOG_CKPT_DPT   9  /* dirty pages: PFckpt_page array */
+#define PF_LOG_CKPT_END   10
+#define PF_LOG_CLR    0x100  /* flag on UPDATE/HEADER: compensation, after image only */
+
+typedef struct PFlogrec {
+    unsigned int len;       /* bytes of the record, this header included */
+    unsigned int crc;       /* PFcrc32() of the record with crc = 0 */
+    unsigned short type;    /* PF_LOG_xxx */
+    unsigned short nranges; /* UPDATE: # of PFlogrange after the header */
+    unsigned int txn;       /* transaction id, 0 for FILE records */
+    int fileid;
+    int page;
+    PF_LSN prevlsn;         /* previous record of the same transaction */
+    PF_LSN undonext;        /* CLR: next record of the transaction to undo */
+} PFlogrec;
+
+/* UPDATE payload: nranges PFlogrange, then per range the before image and
+   the after image ("len" bytes each; a CLR has only the image to apply) */
+typedef struct PFlogrange {
+    unsigned short off;     /* byte offset in the PFfpage */
+    unsigned short len;
+} PFlogrange;
+
+/* a record and its payload, aligned for PFlogrec */
+typedef union PFlogbuf {
+    PFlogrec rec;
+    char bytes[PF_LOG_MAXREC];
+} PFlogbuf;
+
+typedef struct PFckpt_begin {
+    unsigned int nexttxn;   /* next transaction id to hand out */
+    int nextfile;           /* next file id to hand out */
+} PFckpt_begin;
+
+typedef struct PFckpt_txn {
+    unsigned int id;
+    int aborting;           /* TRUE if its ABORT record is logged */
+    PF_LSN lastlsn;
+    PF_LSN undonext;
+} PFckpt_txn;
+
+typedef struct PFckpt_page {
+    int fileid;
+    int page;               /* -1 for the file header */
+    PF_LSN reclsn;
+} PFckpt_page;
+
+/* sequential reader of the log file */
+typedef struct PFlogscan {
+    int unixfd;
+    char *buf;              /* PF_WAL_BUFSIZE bytes of the file */
+    PF_LSN bufstart;        /* LSN of buf[0] */
+    size_t buflen;
+    PF_LSN pos;             /* LSN of the next record */
+} PFlogscan;
+
+typedef struct PFtxn {
+    unsigned int id;
+    int undoing;            /* TRUE while PF_TxnAbort() rolls it back */
+    int npinned;            /* pages fixed with a before image */
+    int done;               /* TRUE once its COMMIT or END record is appended */
+    PF_LSN lastlsn;         /* last record written by the transaction */
+    PF_LSN undonext;        /* next record to undo on abort */
+    struct PFtxn *next;     /* list of active transactions */
+    struct PFtxn *prev;
+} PFtxn;
+
+typedef struct PF_WALStats {
+    unsigned long records;    /* log records appended */
+    unsigned long long bytes; /* log bytes appended */
+    unsigned long commits;
+    unsigned long aborts;
+    unsigned long flushes;    /* log fsyncs */
+    unsigned long forced;     /* of which forced by a page write (WAL before data) */
+    unsigned long group_max;  /* most commits made durable by one fsync */
+    PF_Hist fsync_lat;
+    unsigned long checkpoints;  /* PF_Checkpoint() calls completed */
+} PF_WALStats;
+
+/* what the recovery run by the last PF_WALOpen() did */
+typedef struct PF_RecoveryStats {
+    PF_LSN checkpoint;        /* analysis start: last complete checkpoint, or first record */
+    PF_LSN redo_start;        /* smallest recLSN of the dirty page table, 0 if no redo */
+    PF_LSN end;               /* end of the log */
+    unsigned long records;    /* records read by analysis */
+    unsigned long redone;     /* page and header changes reapplied */
+    unsigned long undone;     /* changes of losers rolled back */
+    unsigned long losers;     /* transactions active at the crash */
+    unsigned long dirty;      /* dirty page table entries */
+    unsigned long long analysis_ns, redo_ns, undo_ns;
+} PF_RecoveryStats;
+
+/******************* Interface functions from wal.c *********************/
+extern int PFwalOn;
+extern unsigned int PFcrc32(const void *data, size_t len, unsigned int crc);
+extern int PFwalCapture(PFbpage *bpage);
+extern int PFwalLogPage(PFbpage *bpage);
+extern void PFwalDiscard(PFbpage *bpage);
+extern int PFwalLogHeader(int fd, const PFhdr_str *before, PFhdr_str *after);
+extern int PFwalLogFile(int id, const char *fname);
+extern int PFwalFlush(PF_LSN lsn);
+extern void PFwalApply(PFfpage *fpage, const PFlogrec *rec, int undo);
+extern int PFwalRead(PF_LSN lsn, PFlogbuf *buf);
+extern int PFwalUndo(PFtxn *txn, PFlogrec *rec);
+extern PF_LSN PFwalLogTxn(PFtxn *txn, int type);
+extern PFtxn *PFwalAdoptTxn(unsigned int id, PF_LSN lastlsn, PF_LSN undonext);
+extern void PFwalEndTxn(PFtxn *txn);
+extern int PFwalScanOpen(PFlogscan *scan, int unixfd, PF_LSN from);
+extern int PFwalScanNext(PFlogscan *scan, PFlogrec **rec, PF_LSN *lsn);
+extern void PFwalScanClose(PFlogscan *scan);
+
+/******************* Interface functions from recover.c ****************/
+extern int PFrecAnalyze(int unixfd, PF_LSN master, PF_LSN *end, unsigned int *maxtxn, int *maxfile);
+extern int PFrecRestart(void);
+
+/******************* Interface functions from pf.c and buf.c (WAL support) */
+extern int PFfileLogId(int fd);
+extern int PFfileByLogId(int logid);
+extern int PFfileByName(const char *fname);
+extern void PFfileSetLogId(int fd, int logid);
+extern void PFfileSetHdr(int fd, const PFhdr_str *hdr);
+extern void PFfileGetHdr(int fd, PFhdr_str *hdr);
+extern void PFfileResetLogIds(void);
+extern int PFfileLogAll(void);
+extern int PFfileSyncAll(void);
+extern int PFbufFlushBefore(PF_LSN lsn, int (*writefcn)(int, int, PFfpage *));
+extern int PFbufDirtyTable(PFckpt_page *dpt, int max);
+
+/**************************** Trace Decls *********************************/
+#define PF_TRACE_MAGIC "PFTRACE1"
+
+/* trace operations */
+#define PF_TRACE_GET     1  /* PFbufGet: page fixed, hit tells if it was buffered */
+#define PF_TRACE_UNFIX   2  /* PFbufUnfix: page unfixed, dirty as passed */
+#define PF_TRACE_ALLOC   3  /* PFbufAlloc: new page fixed without a read */
+#define PF_TRACE_RELEASE 4  /* PFbufReleaseFile: all pages of fd dropped, page is -1 */
+
+typedef struct PFtrace_hdr {
+    char magic[8];    /* PF_TRACE_MAGIC */
+    int recsize;      /* sizeof(PFtrace_rec) */
+    int maxbufs;      /* pool size at PF_TraceStart() */
+    int use_mru;      /* USE_MRU of the traced run */
+    int pad;
+} PFtrace_hdr;
+
+typedef struct PFtrace_rec {
+    unsigned long long ts;  /* ns since PF_TraceStart() */
+    int fd;
+    int page;
+    unsigned char op;       /* PF_TRACE_xxx */
+    unsigned char dirty;
+    unsigned char hit;
+    unsigned char pad[5];
+} PFtrace_rec;
+
+/******************* Interface functions from trace.c *******************/
+extern int PFtraceOn;
+extern void PFtraceRecord(int fd, int page, int op, int dirty, int hit);
+
+#define PFtrace(fd, page, op, dirty, hit) \
+    do { if (PFtraceOn) PFtraceRecord((fd), (page), (op), (dirty), (hit)); } while (0)
+
 #endif /* PFTYPES_H_ */
@@ -1,6 +1,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sched.h>
+#include <pthread.h>
 #include "hf.h"
 #include "../pflayer/pf.h"
 
@@ -13,16 +15,108 @@ typedef struct {
 #define HDR_SIZE sizeof(HF_PageHdr)
 
 typedef struct {
-    int offset;
-    int length;
+    int offset;      // of the record's bytes; for a forwarding stub, the page moved to
+    int length;      // HF_SLOT_FREE once the record is deleted, HF_FWD_LENGTH() for a stub
 } HF_Slot;
 
+#define HF_SLOT_FREE -1
+#define HF_MAX_RECORD ((int)(PF_PAGE_SIZE - HDR_SIZE - sizeof(HF_Slot)))  // fits on an empty page
+#define HF_SLOT_MOVED 0x40000000  // length flag: a record read through another slot's stub
+
+// slot "i" of a page; slots grow down from the end of the page
+#define HF_SLOT(page, i) ((HF_Slot *)((page) + PF_PAGE_SIZE - ((i) + 1) * sizeof(HF_Slot)))
+
+// A record that outgrew its page lives in another slot; its RID's slot is
+// left as a stub that holds the other slot's page in "offset" and its
+// slot number in "length"
+#define HF_FWD_LENGTH(slotNum) (-2 - (slotNum))
+#define HF_IS_FWD(slot) ((slot)->length < HF_SLOT_FREE)
+#define HF_FWD_SLOT(slot) (-2 - (slot)->length)
+
+// bytes the slot holds on its page: none for a free slot or a stub
+#define HF_SLOT_BYTES(slot) ((slot)->length < 0 ? 0 : (slot)->length & ~HF_SLOT_MOVED)
+
+// a slot with no record of its own RID: deleted, or moved there
+#define HF_SLOT_HIDDEN(slot) ((slot)->length == HF_SLOT_FREE || \
+                              ((slot)->length >= 0 && ((slot)->length & HF_SLOT_MOVED)))
+
+// Page 0 of an HF file describes it, so that an open reads one page. Its
+// page count is written with the pages added, so with the log open it is
+// part of the same transaction as they are. Its record counts are kept in
+// memory and written by HF_CloseFile(): the first change after an open
+// only clears "clean", and an open that finds it clear counts the records
+// again.
+typedef struct {
+    int magic;        // HF_MAGIC
+    int version;      // HF_VERSION, of the file's format
+    int totalPages;
+    int recordCount;
+    int forwarded;    // stubs in the file
+    int fsmRoot;      // first map page
+    int clean;        // the counts are exact: the file was closed after its last change
+} HF_Meta;
+
+#define HF_META_PAGE 0
+#define HF_MAGIC 0x48465031
+#define HF_VERSION 2
+
+// Free-space map: the room a data page has for one more record, as one of
+// HF_FSM_CLASSES classes, 4 bits per page. The map page at HF_FIRST_MAP
+// holds the classes of the HF_FSM_PAGES pages after it, and the next map
+// page follows them.
+#define HF_FSM_CLASSES 16
+#define HF_FSM_PAGES (2 * PF_PAGE_SIZE)
+#define HF_FIRST_MAP 1
+#define HF_IS_MAP(p) ((p) >= HF_FIRST_MAP && ((p) - HF_FIRST_MAP) % (HF_FSM_PAGES + 1) == 0)
+#define HF_MAP_OF(p) ((p) - ((p) - HF_FIRST_MAP) % (HF_FSM_PAGES + 1))
+#define HF_IS_DATA(p) ((p) > HF_META_PAGE && !HF_IS_MAP(p))
+
 typedef struct {
-    int unixfd;
+    int inUse;       // entry holds an open file
+    int unixfd;      // PF file descriptor
     int totalPages;
+    int recordCount;
+    int forwarded;   // stubs in the file
+    unsigned long follows;  // stubs followed by reads since open
+    int metaPages;   // totalPages as the metadata page has it, -1 until it is read
+    int metaClean;   // the metadata page says the counts are exact
+
+    // the free-space map, cached as its map pages are needed: the class of
+    // each page (-1 for other pages, and pages not read yet) and, for each
+    // class, a list of its pages
+    int fsmLoaded;          // map pages read, from the first on
+    int fsmSize;            // pages the arrays have room for
+    signed char *fsmClass;
+    int *fsmNext, *fsmPrev;
+    int fsmHead[HF_FSM_CLASSES];
 } HF_File;
 
-static HF_File HFtable[HF_MAX_FILE];
+/* table of open heap files; starts with HF_MAX_FILE entries and doubles */
+static HF_File *HFtable = NULL;
+static int HFtabsize = 0;
+
+#define HF_INVALID_FD(hffd) ((hffd) < 0 || (hffd) >= HFtabsize || !HFtable[hffd].inUse)
+
+// Find a free HFtable entry, growing the table if it is full
+static int HF_FindFree(void)
+{
+    int hffd;
+
+    for (hffd = 0; hffd < HFtabsize; hffd++) {
+        if (!HFtable[hffd].inUse)
+            return hffd;
+    }
+
+    int newsize = HFtabsize ? 2 * HFtabsize : HF_MAX_FILE;
+    HF_File *newtab = realloc(HFtable, newsize * sizeof(HF_File));
+    if (newtab == NULL)
+        return -1;
+    memset(newtab + HFtabsize, 0, (newsize - HFtabsize) * sizeof(HF_File));
+    HFtable = newtab;
+    hffd = HFtabsize;
+    HFtabsize = newsize;
+    return hffd;
+}
 
 // Initialize page 
 static void HF_InitPage(char *page)
@@ -33,10 +127,221 @@ static void HF_InitPage(char *page)
     h->freeEnd = PF_PAGE_SIZE;
 }
 
+// least room of each class; the classes are finer where records are small
+static const int HF_FsmRoom[HF_FSM_CLASSES] = {
+    0, 32, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048, 2560, 3072, 3584
+};
+
+// Make room in the free-space map cache for "n" pages
+static int HF_FsmGrow(HF_File *hf, int n)
+{
+    if (n <= hf->fsmSize)
+        return HF_OK;
+
+    int newsize = hf->fsmSize ? hf->fsmSize : 64;
+    while (newsize < n)
+        newsize *= 2;
+    signed char *cls = realloc(hf->fsmClass, newsize);
+    if (cls == NULL)
+        return PFE_NOMEM;
+    hf->fsmClass = cls;
+    int *next = realloc(hf->fsmNext, newsize * sizeof(int));
+    if (next == NULL)
+        return PFE_NOMEM;
+    hf->fsmNext = next;
+    int *prev = realloc(hf->fsmPrev, newsize * sizeof(int));
+    if (prev == NULL)
+        return PFE_NOMEM;
+    hf->fsmPrev = prev;
+
+    memset(hf->fsmClass + hf->fsmSize, -1, newsize - hf->fsmSize);
+    hf->fsmSize = newsize;
+    return HF_OK;
+}
+
+// Put page "pageNum" in the list of class "cls", taking it off its old one
+static void HF_FsmMove(HF_File *hf, int pageNum, int cls)
+{
+    int old = hf->fsmClass[pageNum];
+
+    if (old >= 0) {
+        int next = hf->fsmNext[pageNum], prev = hf->fsmPrev[pageNum];
+        if (prev >= 0)
+            hf->fsmNext[prev] = next;
+        else
+            hf->fsmHead[old] = next;
+        if (next >= 0)
+            hf->fsmPrev[next] = prev;
+    }
+    hf->fsmClass[pageNum] = cls;
+    if (cls >= 0) {
+        hf->fsmPrev[pageNum] = -1;
+        hf->fsmNext[pageNum] = hf->fsmHead[cls];
+        if (hf->fsmHead[cls] >= 0)
+            hf->fsmPrev[hf->fsmHead[cls]] = pageNum;
+        hf->fsmHead[cls] = pageNum;
+    }
+}
+
+// Read the classes of the pages the next map page covers into the cache;
+// FALSE if all of them are read
+static int HF_FsmLoadNext(HF_File *hf)
+{
+    int map = HF_FIRST_MAP + hf->fsmLoaded * (HF_FSM_PAGES + 1);
+    if (map >= hf->totalPages)
+        return 0;
+
+    char *mapPg;
+    PF_Handle handle;
+    if (PF_PinPage(hf->unixfd, map, &mapPg, &handle) < 0)
+        return 0;
+    // the pages changed since the open are classed already
+    for (int i = 0; i < HF_FSM_PAGES && map + 1 + i < hf->totalPages; i++) {
+        unsigned char bits = (unsigned char)mapPg[i / 2];
+        if (hf->fsmClass[map + 1 + i] < 0)
+            HF_FsmMove(hf, map + 1 + i, (i & 1) ? bits >> 4 : bits & 0xf);
+    }
+    PF_UnpinHandle(handle, 0);
+    hf->fsmLoaded++;
+    return 1;
+}
+
+// Class of the room "page" has for one more record, counting the space of
+// its deleted records and a new slot
+static int HF_SpaceClass(char *page)
+{
+    HF_PageHdr *h = (HF_PageHdr *)page;
+    int room = h->freeEnd - (int)HDR_SIZE - (int)sizeof(HF_Slot);
+
+    for (int i = 0; i < h->slotCount; i++)
+        room -= HF_SLOT_BYTES(HF_SLOT(page, i));
+    int cls = HF_FSM_CLASSES - 1;
+    while (cls > 0 && room < HF_FsmRoom[cls])
+        cls--;
+    return cls;
+}
+
+// Record the room left on data page "pageNum", "page" in memory, in the
+// free-space map
+static void HF_NoteSpace(HF_File *hf, int pageNum, char *page)
+{
+    int cls = HF_SpaceClass(page);
+    if (cls == hf->fsmClass[pageNum])
+        return;
+    HF_FsmMove(hf, pageNum, cls);
+
+    // a map page that cannot be written only leaves a stale class, which
+    // an insert that finds the page full corrects
+    char *mapPg;
+    PF_Handle handle;
+    int map = HF_MAP_OF(pageNum), i = pageNum - map - 1;
+    if (PF_PinPage(hf->unixfd, map, &mapPg, &handle) < 0)
+        return;
+    unsigned char *bits = (unsigned char *)mapPg + i / 2;
+    if (i & 1)
+        *bits = (*bits & 0x0f) | (cls << 4);
+    else
+        *bits = (*bits & 0xf0) | cls;
+    PF_UnpinHandle(handle, 1);
+}
+
+// A data page with room for "len" more bytes of record, or -1; the map
+// pages are read as the ones read so far know of no such page
+static int HF_FsmFind(HF_File *hf, int len)
+{
+    int least = 1;
+    while (least < HF_FSM_CLASSES && HF_FsmRoom[least] < len)
+        least++;
+    do {
+        for (int cls = least; cls < HF_FSM_CLASSES; cls++) {
+            if (hf->fsmHead[cls] >= 0)
+                return hf->fsmHead[cls];
+        }
+    } while (HF_FsmLoadNext(hf));
+    return -1;
+}
+
+// Write the file's metadata page, with "clean" set if the file is being
+// closed
+static int HF_WriteMeta(HF_File *hf, int clean)
+{
+    HF_Meta meta = { HF_MAGIC, HF_VERSION, hf->totalPages, hf->recordCount,
+                     hf->forwarded, HF_FIRST_MAP, clean };
+    char *page;
+    PF_Handle handle;
+    int err = PF_PinPage(hf->unixfd, HF_META_PAGE, &page, &handle);
+    if (err < 0)
+        return err;
+
+    if (memcmp(page, &meta, sizeof(meta)) == 0)
+        return PF_UnpinHandle(handle, 0);
+    memcpy(page, &meta, sizeof(meta));
+    hf->metaPages = hf->totalPages;
+    hf->metaClean = clean;
+    return PF_UnpinHandle(handle, 1);
+}
+
+// The file changed: the metadata page is written only if it still says
+// the counts are exact, or the file has grown, so most changes leave it be
+static int HF_SyncMeta(HF_File *hf)
+{
+    if (!hf->metaClean && hf->metaPages == hf->totalPages)
+        return HF_OK;
+    return HF_WriteMeta(hf, 0);
+}
+
+// Count the records and stubs of a file whose counts were not written
+// back, after a crash
+static int HF_Recount(HF_File *hf)
+{
+    hf->recordCount = hf->forwarded = 0;
+    for (int p = HF_META_PAGE + 1; p < hf->totalPages; p++) {
+        char *page;
+        PF_Handle handle;
+        if (!HF_IS_DATA(p))
+            continue;
+        int err = PF_PinPage(hf->unixfd, p, &page, &handle);
+        if (err < 0)
+            return err;
+
+        HF_PageHdr *h = (HF_PageHdr *)page;
+        for (int i = 0; i < h->slotCount; i++) {
+            HF_Slot *slot = HF_SLOT(page, i);
+            if (HF_IS_FWD(slot))
+                hf->forwarded++;
+            if (!HF_SLOT_HIDDEN(slot))
+                hf->recordCount++;
+        }
+        PF_UnpinHandle(handle, 0);
+    }
+    return HF_OK;
+}
+
 // Create file 
 int HF_CreateFile(const char *fname)
 {
-    return PF_CreateFile(fname);
+    int err = PF_CreateFile(fname);
+    if (err != PFE_OK)
+        return err;
+    int pfFd = PF_OpenFile(fname);
+    if (pfFd < 0)
+        return pfFd;
+
+    // the metadata page, then the first map page
+    HF_Meta meta = { HF_MAGIC, HF_VERSION, HF_FIRST_MAP + 1, 0, 0, HF_FIRST_MAP, 1 };
+    for (int i = 0; i <= HF_FIRST_MAP; i++) {
+        int pageNum;
+        char *page;
+        if ((err = PF_AllocPage(pfFd, &pageNum, &page)) != PFE_OK) {
+            PF_CloseFile(pfFd);
+            return err;
+        }
+        memset(page, 0, PF_PAGE_SIZE);
+        if (pageNum == HF_META_PAGE)
+            memcpy(page, &meta, sizeof(meta));
+        PF_UnfixPage(pfFd, pageNum, 1);
+    }
+    return PF_CloseFile(pfFd);
 }
 
 // Open file 
@@ -47,85 +352,174 @@ int HF_OpenFile(const char *fname)
         return pfFd;
     }
 
-    int hffd;
-    for (hffd = 0; hffd < HF_MAX_FILE; hffd++) {
-        if (HFtable[hffd].unixfd == 0)
-            break;
-    }
-    if (hffd == HF_MAX_FILE)
+    int hffd = HF_FindFree();
+    if (hffd < 0) {
+        PF_CloseFile(pfFd);
         return -1;
+    }
 
-    HFtable[hffd].unixfd = pfFd;
+    HF_File *hf = &HFtable[hffd];
+    hf->inUse = 1;
+    hf->unixfd = pfFd;
+    hf->follows = 0;
+    hf->metaPages = -1;
 
-    // Count pages
-    int pageCount = 0;
-    for (;;) {
-        char *pg;
-        int err = PF_GetThisPage(pfFd, pageCount, &pg);
-        if (err < 0)
-            break;
-        PF_UnfixPage(pfFd, pageCount, 0);
-        pageCount++;
+    // Read the metadata page
+    char *page;
+    PF_Handle handle;
+    HF_Meta meta;
+    int err = PF_PinPage(pfFd, HF_META_PAGE, &page, &handle);
+    if (err < 0) {
+        HF_CloseFile(hffd);
+        return err;
     }
-    HFtable[hffd].totalPages = pageCount;
+    memcpy(&meta, page, sizeof(meta));
+    PF_UnpinHandle(handle, 0);
+    if (meta.magic != HF_MAGIC || meta.version != HF_VERSION || meta.fsmRoot != HF_FIRST_MAP) {
+        HF_CloseFile(hffd);
+        return HF_BADFILE;
+    }
+    hf->totalPages = meta.totalPages;
+    hf->recordCount = meta.recordCount;
+    hf->forwarded = meta.forwarded;
+    if (!meta.clean && (err = HF_Recount(hf)) != HF_OK) {
+        HF_CloseFile(hffd);
+        return err;
+    }
+    hf->metaPages = meta.totalPages;
+    hf->metaClean = meta.clean;
 
+    // the free-space map is read as inserts need it
+    hf->fsmLoaded = 0;
+    for (int i = 0; i < HF_FSM_CLASSES; i++)
+        hf->fsmHead[i] = -1;
+    if ((err = HF_FsmGrow(hf, hf->totalPages)) != HF_OK) {
+        HF_CloseFile(hffd);
+        return err;
+    }
     return hffd;
 }
 
 // Close file 
 int HF_CloseFile(int hffd)
 {
-    if (hffd < 0 || hffd >= HF_MAX_FILE)
+    if (HF_INVALID_FD(hffd))
         return -1;
 
+    // the counts, unless the open failed before they were known
+    int err = HFtable[hffd].metaPages >= 0 ? HF_WriteMeta(&HFtable[hffd], 1) : HF_OK;
     int unixfd = HFtable[hffd].unixfd;
-    HFtable[hffd].unixfd = 0;
+    HFtable[hffd].inUse = 0;
+    HFtable[hffd].unixfd = -1;
     HFtable[hffd].totalPages = 0;
+    free(HFtable[hffd].fsmClass);
+    free(HFtable[hffd].fsmNext);
+    free(HFtable[hffd].fsmPrev);
+    HFtable[hffd].fsmClass = NULL;
+    HFtable[hffd].fsmNext = HFtable[hffd].fsmPrev = NULL;
+    HFtable[hffd].fsmSize = 0;
 
-    return PF_CloseFile(unixfd);
+    int closeErr = PF_CloseFile(unixfd);
+    return err != HF_OK ? err : closeErr;
 }
 
-// Insert record 
-int HF_InsertRecord(int hffd, const void *record, int len, HF_RID *rid)
+// Move the live records of "page" together after the header, giving the
+// space of deleted ones back to the free space; slot numbers do not change
+static void HF_CompactPage(char *page)
 {
-    HF_File *hf = &HFtable[hffd];
-    int pfFd = hf->unixfd;
-
-    int pageNum = hf->totalPages - 1;
-    char *page;
+    HF_PageHdr *h = (HF_PageHdr *)page;
+    char copy[PF_PAGE_SIZE];
+    int pos = HDR_SIZE;
 
-    if (pageNum < 0) {
-        // Allocate first page
-        int err = PF_AllocPage(pfFd, &pageNum, &page);
-        if (err < 0) return err;
-        HF_InitPage(page);
-        PF_UnfixPage(pfFd, pageNum, 1);
-        hf->totalPages = 1;
+    memcpy(copy, page, PF_PAGE_SIZE);
+    for (int i = 0; i < h->slotCount; i++) {
+        HF_Slot *slot = HF_SLOT(page, i);
+        if (slot->length < 0)
+            continue;
+        memcpy(page + pos, copy + slot->offset, HF_SLOT_BYTES(slot));
+        slot->offset = pos;
+        pos += HF_SLOT_BYTES(slot);
     }
+    h->freeStart = pos;
+}
 
-try_insert:
-    PF_GetThisPage(pfFd, pageNum, &page);
+// Bytes of the records on "page"
+static int HF_LiveBytes(char *page)
+{
     HF_PageHdr *h = (HF_PageHdr *)page;
+    int live = 0;
 
-    /* Compute available free space */
-    int freeSpace = h->freeEnd - h->freeStart;
-    int needSpace = len + sizeof(HF_Slot);
+    for (int i = 0; i < h->slotCount; i++)
+        live += HF_SLOT_BYTES(HF_SLOT(page, i));
+    return live;
+}
 
-    if (freeSpace < needSpace) {
-        PF_UnfixPage(pfFd, pageNum, 0);
+// Free slot "slotNum" of "page"; the last record's bytes are free at once,
+// the others on compaction
+static void HF_FreeSlot(char *page, int slotNum)
+{
+    HF_PageHdr *h = (HF_PageHdr *)page;
+    HF_Slot *slot = HF_SLOT(page, slotNum);
 
-        // Allocate a NEW page
-        int newPage;
-        char *newPg;
-        int err = PF_AllocPage(pfFd, &newPage, &newPg);
-        if (err < 0) return err;
+    if (slot->length >= 0 && slot->offset + HF_SLOT_BYTES(slot) == h->freeStart)
+        h->freeStart = slot->offset;
+    slot->offset = 0;
+    slot->length = HF_SLOT_FREE;
+}
 
-        HF_InitPage(newPg);
-        PF_UnfixPage(pfFd, newPage, 1);
-        hf->totalPages++;
+// Replace what slot "slotNum" of "page" holds (a record or a stub) by
+// "record", with "flags" in its length: in place if it is no longer, else
+// in the free space, compacting the page if the space of deleted records
+// makes it fit; -1, with the page unchanged, if it does not fit
+static int HF_RewriteRecord(char *page, int slotNum, const void *record, int len, int flags)
+{
+    HF_PageHdr *h = (HF_PageHdr *)page;
+    HF_Slot *slot = HF_SLOT(page, slotNum);
+    int cur = HF_SLOT_BYTES(slot);
+
+    if (slot->length >= 0 && len <= cur) {
+        memcpy(page + slot->offset, record, len);
+        if (slot->offset + cur == h->freeStart)
+            h->freeStart = slot->offset + len;
+        slot->length = len | flags;
+        return 0;
+    }
+
+    if (h->freeEnd - (int)HDR_SIZE - (HF_LiveBytes(page) - cur) < len)
+        return -1;
+    HF_FreeSlot(page, slotNum);
+    if (h->freeEnd - h->freeStart < len)
+        HF_CompactPage(page);
+    memcpy(page + h->freeStart, record, len);
+    slot->offset = h->freeStart;
+    slot->length = len | flags;
+    h->freeStart += len;
+    return 0;
+}
 
-        pageNum = newPage;
-        goto try_insert;
+// Put a record of "len" bytes on "page", with "flags" in its length, in the
+// slot of a deleted record if there is one, compacting the page if only the
+// space of deleted records makes it fit; returns its slot number, or -1 if
+// it does not fit
+static int HF_PlaceRecord(char *page, const void *record, int len, int flags)
+{
+    HF_PageHdr *h = (HF_PageHdr *)page;
+    int slotNum = h->slotCount;
+    int live = 0;
+
+    for (int i = 0; i < h->slotCount; i++) {
+        HF_Slot *slot = HF_SLOT(page, i);
+        live += HF_SLOT_BYTES(slot);
+        if (slot->length == HF_SLOT_FREE && slotNum == h->slotCount)
+            slotNum = i;
+    }
+
+    int needSpace = len + (slotNum == h->slotCount ? (int)sizeof(HF_Slot) : 0);
+    if (h->freeEnd - h->freeStart < needSpace) {
+        // deleted records still hold freeStart - HDR_SIZE - live bytes
+        if (h->freeEnd - (int)HDR_SIZE - live < needSpace)
+            return -1;
+        HF_CompactPage(page);
     }
 
     /* Insert data */
@@ -134,19 +528,364 @@ try_insert:
     h->freeStart += len;
 
     /* Insert slot */
-    h->freeEnd -= sizeof(HF_Slot);
-    HF_Slot *slot = (HF_Slot *)(page + h->freeEnd);
+    if (slotNum == h->slotCount) {
+        h->freeEnd -= sizeof(HF_Slot);
+        h->slotCount++;
+    }
+    HF_Slot *slot = HF_SLOT(page, slotNum);
     slot->offset = recOffset;
-    slot->length = len;
+    slot->length = len | flags;
+    return slotNum;
+}
 
+// Add an empty data page to the file, and a map page before it when it
+// starts the next map page's span; the data page is left fixed
+static int HF_NewPage(HF_File *hf, int *pageNum, char **page)
+{
+    int err = PF_AllocPage(hf->unixfd, pageNum, page);
+    if (err < 0)
+        return err;
+    if (HF_IS_MAP(*pageNum)) {
+        memset(*page, 0, PF_PAGE_SIZE);
+        PF_UnfixPage(hf->unixfd, *pageNum, 1);
+        hf->totalPages++;
+        if ((err = PF_AllocPage(hf->unixfd, pageNum, page)) < 0)
+            return err;
+    }
+    hf->totalPages++;
+    if ((err = HF_FsmGrow(hf, hf->totalPages)) != HF_OK) {
+        PF_UnfixPage(hf->unixfd, *pageNum, 0);
+        return err;
+    }
+    HF_InitPage(*page);
+    return HF_OK;
+}
+
+// Can a record of "len" bytes be stored at all?
+static int HF_CheckLength(int len)
+{
+    if (len <= 0)
+        return HF_BADLENGTH;
+    if (len > HF_MAX_RECORD)
+        return HF_RECTOOLONG;
+    return HF_OK;
+}
+
+// Put a record somewhere in the file, with "flags" in its slot's length:
+// on a page the free-space map has room on, else on the last page, whose
+// class may hide the room a small record needs, else on a new page. The
+// page is left fixed.
+static int HF_PlaceSomewhere(HF_File *hf, const void *record, int len, int flags,
+                             int *pageNum, char **page, int *slotNum)
+{
+    int pfFd = hf->unixfd;
+    int err;
+
+    // before the file is touched: a record that cannot fit would otherwise
+    // add a page on every try
+    *slotNum = -1;
+    if ((err = HF_CheckLength(len)) != HF_OK)
+        return err;
+    while ((*pageNum = HF_FsmFind(hf, len)) >= 0) {
+        if ((err = PF_GetThisPage(pfFd, *pageNum, page)) != PFE_OK)
+            return err;
+        if ((*slotNum = HF_PlaceRecord(*page, record, len, flags)) >= 0)
+            return HF_OK;
+        // the map was stale
+        HF_NoteSpace(hf, *pageNum, *page);
+        PF_UnfixPage(pfFd, *pageNum, 0);
+    }
+
+    if (HF_IS_DATA(*pageNum = hf->totalPages - 1)) {
+        if ((err = PF_GetThisPage(pfFd, *pageNum, page)) != PFE_OK)
+            return err;
+        if ((*slotNum = HF_PlaceRecord(*page, record, len, flags)) >= 0)
+            return HF_OK;
+        PF_UnfixPage(pfFd, *pageNum, 0);
+    }
+
+    if ((err = HF_NewPage(hf, pageNum, page)) != HF_OK)
+        return err;
+    if ((*slotNum = HF_PlaceRecord(*page, record, len, flags)) < 0) {
+        HF_NoteSpace(hf, *pageNum, *page);
+        PF_UnfixPage(pfFd, *pageNum, 1);
+        return HF_RECTOOLONG;
+    }
+    return HF_OK;
+}
+
+// Store a record somewhere in the file, with "flags" in its slot's length
+static int HF_Store(HF_File *hf, const void *record, int len, int flags, HF_RID *rid)
+{
+    int pageNum, slotNum;
+    char *page;
+    int err = HF_PlaceSomewhere(hf, record, len, flags, &pageNum, &page, &slotNum);
+    if (err != HF_OK)
+        return err;
+
+    HF_NoteSpace(hf, pageNum, page);
     rid->pageNum = pageNum;
-    rid->slotNum = h->slotCount;
+    rid->slotNum = slotNum;
     rid->recordLen = len;
 
-    h->slotCount++;
+    return PF_UnfixPage(hf->unixfd, pageNum, 1);
+}
+
+// Insert record 
+int HF_InsertRecord(int hffd, const void *record, int len, HF_RID *rid)
+{
+    if (HF_INVALID_FD(hffd))
+        return -1;
 
-    PF_UnfixPage(pfFd, pageNum, 1);
+    HF_File *hf = &HFtable[hffd];
+    int err = HF_Store(hf, record, len, 0, rid);
+    if (err != HF_OK)
+        return err;
+    hf->recordCount++;
+    return HF_SyncMeta(hf);
+}
+
+// Insert "n" records: each goes on the page the one before it went on
+// while it fits, so a page is fixed and dirtied once for all the records
+// it takes. On an error, the records before the failed one are inserted,
+// and the RIDs of the others get page number -1.
+int HF_InsertRecords(int hffd, const void *const recs[], const int lens[], int n, HF_RID rids[])
+{
+    if (HF_INVALID_FD(hffd)) {
+        for (int i = 0; i < n; i++)
+            rids[i].pageNum = -1;
+        return -1;
+    }
 
+    HF_File *hf = &HFtable[hffd];
+    int pageNum = -1, slotNum, err = HF_OK, i;
+    char *page = NULL;
+
+    for (i = 0; i < n; i++) {
+        if ((err = HF_CheckLength(lens[i])) != HF_OK)
+            break;
+        if (pageNum < 0 || (slotNum = HF_PlaceRecord(page, recs[i], lens[i], 0)) < 0) {
+            if (pageNum >= 0) {
+                HF_NoteSpace(hf, pageNum, page);
+                PF_UnfixPage(hf->unixfd, pageNum, 1);
+                pageNum = -1;
+            }
+            if ((err = HF_PlaceSomewhere(hf, recs[i], lens[i], 0, &pageNum, &page, &slotNum)) != HF_OK) {
+                pageNum = -1;
+                break;
+            }
+        }
+        rids[i].pageNum = pageNum;
+        rids[i].slotNum = slotNum;
+        rids[i].recordLen = lens[i];
+    }
+    if (pageNum >= 0) {
+        HF_NoteSpace(hf, pageNum, page);
+        PF_UnfixPage(hf->unixfd, pageNum, 1);
+    }
+
+    hf->recordCount += i;
+    for (int j = i; j < n; j++)
+        rids[j].pageNum = -1;
+    int syncErr = HF_SyncMeta(hf);
+    return err != HF_OK ? err : syncErr;
+}
+
+// Pin the page of "rid" and find its slot; HF_NORECORD if the RID holds no
+// record of its own (out of range, deleted, or moved there from another RID)
+static int HF_PinRecord(HF_File *hf, HF_RID rid, char **page, PF_Handle *handle, HF_Slot **slot)
+{
+    if (!HF_IS_DATA(rid.pageNum) || rid.pageNum >= hf->totalPages)
+        return HF_NORECORD;
+    int err = PF_PinPage(hf->unixfd, rid.pageNum, page, handle);
+    if (err < 0)
+        return err;
+
+    HF_PageHdr *h = (HF_PageHdr *)*page;
+    if (rid.slotNum < 0 || rid.slotNum >= h->slotCount ||
+        HF_SLOT_HIDDEN(HF_SLOT(*page, rid.slotNum))) {
+        PF_UnpinHandle(*handle, 0);
+        return HF_NORECORD;
+    }
+    *slot = HF_SLOT(*page, rid.slotNum);
+    return HF_OK;
+}
+
+// Copy the record of slot "slotNum" of page "pageNum", which a stub leads to
+static int HF_ReadMoved(HF_File *hf, int pageNum, int slotNum, void *recBuf, int *recLen)
+{
+    char *page;
+    PF_Handle handle;
+    int err = PF_PinPage(hf->unixfd, pageNum, &page, &handle);
+    if (err < 0)
+        return err;
+
+    HF_Slot *slot = HF_SLOT(page, slotNum);
+    *recLen = HF_SLOT_BYTES(slot);
+    memcpy(recBuf, page + slot->offset, *recLen);
+    hf->follows++;
+    return PF_UnpinHandle(handle, 0);
+}
+
+// Free slot "slotNum" of page "pageNum", where a stub led
+static int HF_FreeMoved(HF_File *hf, int pageNum, int slotNum)
+{
+    char *page;
+    PF_Handle handle;
+    int err = PF_PinPage(hf->unixfd, pageNum, &page, &handle);
+    if (err < 0)
+        return err;
+
+    HF_FreeSlot(page, slotNum);
+    HF_NoteSpace(hf, pageNum, page);
+    return PF_UnpinHandle(handle, 1);
+}
+
+// Read record 
+int HF_GetRecord(int hffd, HF_RID rid, void *recBuf, int *recLen)
+{
+    if (HF_INVALID_FD(hffd))
+        return -1;
+
+    HF_File *hf = &HFtable[hffd];
+    char *page;
+    PF_Handle handle;
+    HF_Slot *slot;
+    int err = HF_PinRecord(hf, rid, &page, &handle, &slot);
+    if (err != HF_OK)
+        return err;
+
+    if (HF_IS_FWD(slot)) {
+        int fwdPage = slot->offset, fwdSlot = HF_FWD_SLOT(slot);
+        PF_UnpinHandle(handle, 0);
+        return HF_ReadMoved(hf, fwdPage, fwdSlot, recBuf, recLen);
+    }
+    *recLen = HF_SLOT_BYTES(slot);
+    memcpy(recBuf, page + slot->offset, *recLen);
+    return PF_UnpinHandle(handle, 0);
+}
+
+// Delete record: its slot becomes a tombstone, so the other RIDs of the
+// page stay valid; the space is reused by later inserts
+int HF_DeleteRecord(int hffd, HF_RID rid)
+{
+    if (HF_INVALID_FD(hffd))
+        return -1;
+
+    HF_File *hf = &HFtable[hffd];
+    char *page;
+    PF_Handle handle;
+    HF_Slot *slot;
+    int err = HF_PinRecord(hf, rid, &page, &handle, &slot);
+    if (err != HF_OK)
+        return err;
+
+    if (HF_IS_FWD(slot)) {
+        if ((err = HF_FreeMoved(hf, slot->offset, HF_FWD_SLOT(slot))) != PFE_OK) {
+            PF_UnpinHandle(handle, 0);
+            return err;
+        }
+        hf->forwarded--;
+    }
+    HF_FreeSlot(page, rid.slotNum);
+    HF_NoteSpace(hf, rid.pageNum, page);
+    if ((err = PF_UnpinHandle(handle, 1)) != PFE_OK)
+        return err;
+    hf->recordCount--;
+    return HF_SyncMeta(hf);
+}
+
+// Update record: in place when the new version fits on the RID's page
+// (compacting it if need be), else in another page, leaving a stub in the
+// RID's slot so that the RID stays valid. A record is never more than one
+// stub away from its RID: one that fits on its RID's page again goes back
+// there, and one that moves again is re-pointed from its stub.
+static int HF_Update(HF_File *hf, HF_RID rid, const void *record, int len)
+{
+    char *page, *fwdPg;
+    PF_Handle handle, fwdHandle;
+    HF_Slot *slot;
+    HF_RID to;
+    int fwdPage = -1, fwdSlot = -1;
+    int err = HF_PinRecord(hf, rid, &page, &handle, &slot);
+    if (err != HF_OK)
+        return err;
+
+    if (HF_IS_FWD(slot)) {
+        fwdPage = slot->offset;
+        fwdSlot = HF_FWD_SLOT(slot);
+        if ((err = PF_PinPage(hf->unixfd, fwdPage, &fwdPg, &fwdHandle)) < 0) {
+            PF_UnpinHandle(handle, 0);
+            return err;
+        }
+        // back on the RID's page if it fits there again
+        if (HF_RewriteRecord(page, rid.slotNum, record, len, 0) == 0) {
+            HF_FreeSlot(fwdPg, fwdSlot);
+            HF_NoteSpace(hf, fwdPage, fwdPg);
+            HF_NoteSpace(hf, rid.pageNum, page);
+            hf->forwarded--;
+            PF_UnpinHandle(fwdHandle, 1);
+            return PF_UnpinHandle(handle, 1);
+        }
+        // else where it lives now
+        if (HF_RewriteRecord(fwdPg, fwdSlot, record, len, HF_SLOT_MOVED) == 0) {
+            HF_NoteSpace(hf, fwdPage, fwdPg);
+            PF_UnpinHandle(handle, 0);
+            return PF_UnpinHandle(fwdHandle, 1);
+        }
+        PF_UnpinHandle(fwdHandle, 0);
+    } else if (HF_RewriteRecord(page, rid.slotNum, record, len, 0) == 0) {
+        HF_NoteSpace(hf, rid.pageNum, page);
+        return PF_UnpinHandle(handle, 1);
+    }
+
+    // it fits on neither page, even counting the bytes it frees, so the
+    // store below lands on another one
+    PF_UnpinHandle(handle, 0);
+    if ((err = HF_Store(hf, record, len, HF_SLOT_MOVED, &to)) != HF_OK)
+        return err;
+    if ((err = PF_PinPage(hf->unixfd, rid.pageNum, &page, &handle)) < 0)
+        return err;
+    HF_FreeSlot(page, rid.slotNum);
+    slot = HF_SLOT(page, rid.slotNum);
+    slot->offset = to.pageNum;
+    slot->length = HF_FWD_LENGTH(to.slotNum);
+    HF_NoteSpace(hf, rid.pageNum, page);
+    if ((err = PF_UnpinHandle(handle, 1)) != PFE_OK)
+        return err;
+
+    if (fwdPage < 0) {
+        hf->forwarded++;
+        return HF_OK;
+    }
+    return HF_FreeMoved(hf, fwdPage, fwdSlot);
+}
+
+int HF_UpdateRecord(int hffd, HF_RID rid, const void *record, int len)
+{
+    if (HF_INVALID_FD(hffd))
+        return -1;
+
+    HF_File *hf = &HFtable[hffd];
+    int err = HF_CheckLength(len);
+    if (err != HF_OK)
+        return err;
+    err = HF_Update(hf, rid, record, len);
+    if (err != HF_OK)
+        return err;
+    return HF_SyncMeta(hf);
+}
+
+// Statistics of an open file
+int HF_GetStats(int hffd, HF_Stats *stats)
+{
+    if (HF_INVALID_FD(hffd))
+        return -1;
+
+    stats->totalPages = HFtable[hffd].totalPages;
+    stats->records = HFtable[hffd].recordCount;
+    stats->forwarded = HFtable[hffd].forwarded;
+    stats->follows = HFtable[hffd].follows;
     return HF_OK;
 }
 
@@ -159,54 +898,742 @@ int HF_ScanOpen(int hffd, HF_Scan *scan)
     scan->curSlot = 0;
     scan->totalPages = hf->totalPages;
     scan->isOpen = 1;
+    scan->snap = 0;
+    scan->filter = NULL;
+    scan->page = NULL;
+    scan->moved = NULL;
+    scan->npinned = 0;
     return HF_OK;
 }
 
-// Scan next 
-int HF_ScanNext(HF_Scan *scan, HF_RID *rid, void *recBuf, int *recLen)
+// Scan open on a snapshot: records inserted after the open are not seen
+int HF_ScanOpenSnapshot(int hffd, HF_Scan *scan)
 {
-    if (!scan->isOpen)
-        return HF_SCAN_CLOSED;
+    if (HF_INVALID_FD(hffd))
+        return -1;
+
+    int snap = PF_BeginSnapshot(HFtable[hffd].unixfd);
+    if (snap < 0)
+        return snap;
+    HF_ScanOpen(hffd, scan);
+    scan->snap = snap;
+    return HF_OK;
+}
+
+// A typed record starts with its field count, a bitmap of its null fields
+// and a table of n+1 offsets: field i lies from offset i up to offset i+1,
+// so that a field is found without reading the ones before it. The fields
+// follow in order, the numeric ones in binary; a null one takes no bytes.
+// Records lie at any offset in a page, so the header is read with memcpy().
+#define HF_NULLS(n) (((n) + 7) / 8)  // bytes of the null bitmap
+#define HF_REFS(n) (sizeof(unsigned short) + HF_NULLS(n))  // where the table starts
+#define HF_FIELDS(n) (HF_REFS(n) + ((n) + 1) * sizeof(unsigned short))  // where the fields start
+
+// Schema of "nfields" fields of the given types
+int HF_SchemaInit(HF_Schema *schema, int nfields, const int types[])
+{
+    if (nfields < 0 || nfields > HF_MAX_FIELDS)
+        return HF_BADSCHEMA;
+
+    for (int i = 0; i < nfields; i++) {
+        if (types[i] != HF_INT && types[i] != HF_REAL && types[i] != HF_TEXT)
+            return HF_BADSCHEMA;
+        schema->type[i] = types[i];
+    }
+    schema->nfields = nfields;
+    return HF_OK;
+}
 
+// Bytes of field "i" of a record of "schema"; "lens" is read for text only
+static int HF_FieldBytes(const HF_Schema *schema, const int lens[], int i)
+{
+    switch (schema->type[i]) {
+        case HF_INT: return sizeof(int);
+        case HF_REAL: return sizeof(double);
+        default: return lens[i];
+    }
+}
+
+// Typed record of "schema" in "rec": field i is "values[i]", an int or a
+// double for a numeric field and "lens[i]" bytes for a text one; NULL
+// makes it a null field
+int HF_MakeRecord(const HF_Schema *schema, const void *const values[], const int lens[], void *rec, int *recLen)
+{
+    int n = schema->nfields;
+    int size = HF_FIELDS(n);
+    unsigned char *r = rec;
+
+    for (int i = 0; i < n; i++)
+        if (values[i] != NULL)
+            size += HF_FieldBytes(schema, lens, i);
+    if (size > *recLen || size > 0xffff)
+        return HF_RECTOOLONG;
+
+    unsigned short count = n;
+    memcpy(r, &count, sizeof(count));
+    memset(r + sizeof(count), 0, HF_NULLS(n));
+
+    unsigned short at = HF_FIELDS(n);
+    for (int i = 0; i < n; i++) {
+        memcpy(r + HF_REFS(n) + i * sizeof(at), &at, sizeof(at));
+        if (values[i] == NULL) {
+            r[sizeof(count) + i / 8] |= 1 << (i % 8);
+            continue;
+        }
+        int bytes = HF_FieldBytes(schema, lens, i);
+        memcpy(r + at, values[i], bytes);
+        at += bytes;
+    }
+    memcpy(r + HF_REFS(n) + n * sizeof(at), &at, sizeof(at));
+    *recLen = size;
+    return HF_OK;
+}
+
+// Field "i" of the typed record "rec" of "recLen" bytes, where it lies;
+// NULL if it is null, the record has no such field, or its header or the
+// field does not lie within "recLen" bytes, as when it is not a typed record
+const void *HF_GetField(const void *rec, int recLen, int i, int *len)
+{
+    const unsigned char *r = rec;
+    unsigned short n, from, to;
+
+    if (recLen < (int)sizeof(n))
+        return NULL;
+    memcpy(&n, r, sizeof(n));
+    if (n > HF_MAX_FIELDS || (int)HF_FIELDS(n) > recLen ||
+        i < 0 || i >= n || (r[sizeof(n) + i / 8] & (1 << (i % 8))))
+        return NULL;
+    memcpy(&from, r + HF_REFS(n) + i * sizeof(from), sizeof(from));
+    memcpy(&to, r + HF_REFS(n) + (i + 1) * sizeof(to), sizeof(to));
+    if (from < HF_FIELDS(n) || from > to || to > recLen)
+        return NULL;
+    *len = to - from;
+    return r + from;
+}
+
+// Numeric field "i" of the typed record "rec"
+int HF_GetInt(const void *rec, int recLen, int i, int *value)
+{
+    int len;
+    const void *field = HF_GetField(rec, recLen, i, &len);
+    if (field == NULL || len != sizeof(int))
+        return HF_NULLFIELD;
+    memcpy(value, field, sizeof(int));
+    return HF_OK;
+}
+
+int HF_GetReal(const void *rec, int recLen, int i, double *value)
+{
+    int len;
+    const void *field = HF_GetField(rec, recLen, i, &len);
+    if (field == NULL || len != sizeof(double))
+        return HF_NULLFIELD;
+    memcpy(value, field, sizeof(double));
+    return HF_OK;
+}
+
+// Scan open with a filter: only the records it matches are returned, and
+// the others are not copied out of their pages
+int HF_ScanOpenFiltered(int hffd, HF_Scan *scan, const HF_Filter *filter)
+{
+    if (HF_INVALID_FD(hffd))
+        return -1;
+
+    HF_ScanOpen(hffd, scan);
+    scan->filter = filter;
+    return HF_OK;
+}
+
+// Filter with no terms: it matches every record
+void HF_FilterInit(HF_Filter *filter)
+{
+    filter->nterms = 0;
+    filter->schema = NULL;
+}
+
+// The filter tests typed records of "schema": it finds their fields through
+// their tables, and compares numeric ones as they are stored
+void HF_FilterTyped(HF_Filter *filter, const HF_Schema *schema)
+{
+    filter->schema = schema;
+}
+
+// Add the term "field op value" to the filter
+int HF_FilterAdd(HF_Filter *filter, int field, int op, int type, const char *value)
+{
+    if (filter->nterms == HF_FILTER_TERMS || field < 0 || op < HF_EQ || op > HF_GE ||
+        (type != HF_STRING && type != HF_NUMBER) || strlen(value) >= HF_FILTER_VALUE)
+        return HF_BADFILTER;
+
+    HF_Term *term = &filter->term[filter->nterms];
+    term->field = field;
+    term->op = op;
+    term->type = type;
+    strcpy(term->value, value);
+    term->valueLen = strlen(value);
+    if (type == HF_NUMBER) {
+        char *end;
+        term->number = strtod(value, &end);
+        if (end == value || *end != '\0')
+            return HF_BADFILTER;
+    }
+    filter->nterms++;
+    return HF_OK;
+}
+
+// Field "field" of the ';'-separated record "rec" of "len" bytes, which
+// ends at a NUL if it has one; NULL if it has fewer fields
+static const char *HF_Field(const char *rec, int len, int field, int *fieldLen)
+{
+    const char *end = memchr(rec, '\0', len);
+    if (end == NULL)
+        end = rec + len;
+
+    for (; field > 0; field--) {
+        const char *semi = memchr(rec, ';', end - rec);
+        if (semi == NULL)
+            return NULL;
+        rec = semi + 1;
+    }
+    const char *semi = memchr(rec, ';', end - rec);
+    *fieldLen = (semi != NULL ? semi : end) - rec;
+    return rec;
+}
+
+// Does the record "rec" of "len" bytes, in its page, match "filter"?
+static int HF_Match(const HF_Filter *filter, const char *rec, int len)
+{
+    if (filter == NULL)
+        return 1;
+
+    for (int i = 0; i < filter->nterms; i++) {
+        const HF_Term *term = &filter->term[i];
+        int fieldLen, cmp;
+        int fieldType = HF_TEXT;
+        const char *field;
+        if (filter->schema != NULL) {
+            field = HF_GetField(rec, len, term->field, &fieldLen);
+            if (term->field < filter->schema->nfields)
+                fieldType = filter->schema->type[term->field];
+        } else
+            field = HF_Field(rec, len, term->field, &fieldLen);
+        if (field == NULL || (fieldType != HF_TEXT && term->type != HF_NUMBER))
+            return 0;
+        if ((fieldType == HF_INT && fieldLen != sizeof(int)) ||
+            (fieldType == HF_REAL && fieldLen != sizeof(double)))
+            return 0;
+
+        if (fieldType != HF_TEXT) {
+            double v;
+            if (fieldType == HF_INT) {
+                int iv;
+                memcpy(&iv, field, sizeof(iv));
+                v = iv;
+            } else
+                memcpy(&v, field, sizeof(v));
+            cmp = (v > term->number) - (v < term->number);
+        } else if (term->type == HF_NUMBER) {
+            // strtod() needs the field on its own
+            char num[HF_FILTER_VALUE], *end;
+            if (fieldLen == 0 || fieldLen >= HF_FILTER_VALUE)
+                return 0;
+            memcpy(num, field, fieldLen);
+            num[fieldLen] = '\0';
+            double v = strtod(num, &end);
+            if (*end != '\0')
+                return 0;
+            cmp = (v > term->number) - (v < term->number);
+        } else {
+            cmp = memcmp(field, term->value, fieldLen < term->valueLen ? fieldLen : term->valueLen);
+            if (cmp == 0)
+                cmp = fieldLen - term->valueLen;
+        }
+
+        switch (term->op) {
+            case HF_EQ: if (cmp != 0) return 0; break;
+            case HF_NE: if (cmp == 0) return 0; break;
+            case HF_LT: if (cmp >= 0) return 0; break;
+            case HF_LE: if (cmp > 0) return 0; break;
+            case HF_GT: if (cmp <= 0) return 0; break;
+            case HF_GE: if (cmp < 0) return 0; break;
+        }
+    }
+    return 1;
+}
+
+// Next record on the scan's pages
+static int HF_ScanStep(HF_Scan *scan, HF_RID *rid, void *recBuf, int *recLen)
+{
     HF_File *hf = &HFtable[scan->fd];
     int pfFd = hf->unixfd;
 
     for (;;) {
         if (scan->curPage >= scan->totalPages)
             return HF_SCAN_CLOSED;
+        if (!HF_IS_DATA(scan->curPage)) {
+            scan->curPage++;
+            continue;
+        }
 
         char *page;
-        int err = PF_GetThisPage(pfFd, scan->curPage, &page);
+        PF_Handle handle;
+        int err = PF_PinPage(pfFd, scan->curPage, &page, &handle);
         if (err < 0)
-            return HF_SCAN_CLOSED;
+            return err;
 
         HF_PageHdr *h = (HF_PageHdr *)page;
 
-        if (scan->curSlot < h->slotCount) {
-            HF_Slot *slot = (HF_Slot *)(page + h->freeEnd + (h->slotCount - 1 - scan->curSlot) * sizeof(HF_Slot));
+        // deleted records are skipped, and moved ones are read through
+        // their stubs, under their RIDs
+        while (scan->curSlot < h->slotCount) {
+            HF_Slot *slot = HF_SLOT(page, scan->curSlot);
+            PF_Handle fwdHandle = NULL;
+            char *recPg = page;
+
+            if (HF_SLOT_HIDDEN(slot)) {
+                scan->curSlot++;
+                continue;
+            }
+            if (HF_IS_FWD(slot)) {
+                err = PF_PinPage(pfFd, slot->offset, &recPg, &fwdHandle);
+                if (err < 0) {
+                    PF_UnpinHandle(handle, 0);
+                    return err;
+                }
+                slot = HF_SLOT(recPg, HF_FWD_SLOT(slot));
+                hf->follows++;
+            }
+
+            int match = HF_Match(scan->filter, recPg + slot->offset, HF_SLOT_BYTES(slot));
+            if (match) {
+                *recLen = HF_SLOT_BYTES(slot);
+                memcpy(recBuf, recPg + slot->offset, *recLen);
+                rid->pageNum = scan->curPage;
+                rid->slotNum = scan->curSlot;
+                rid->recordLen = *recLen;
+            }
+            if (fwdHandle != NULL)
+                PF_UnpinHandle(fwdHandle, 0);
+            scan->curSlot++;
+            if (match) {
+                PF_UnpinHandle(handle, 0);
+                return HF_OK;
+            }
+        }
+
+        scan->curPage++;
+        scan->curSlot = 0;
+        PF_UnpinHandle(handle, 0);
+    }
+}
 
-            *recLen = slot->length;
-            memcpy(recBuf, page + slot->offset, *recLen);
+// Scan next 
+int HF_ScanNext(HF_Scan *scan, HF_RID *rid, void *recBuf, int *recLen)
+{
+    if (!scan->isOpen)
+        return HF_SCAN_CLOSED;
+    HF_ScanRelease(scan);
+    if (scan->snap == 0)
+        return HF_ScanStep(scan, rid, recBuf, recLen);
+
+    // pages past the snapshot's last page are invalid in it and end the scan
+    PF_UseSnapshot(scan->snap);
+    int err = HF_ScanStep(scan, rid, recBuf, recLen);
+    PF_UseSnapshot(0);
+    return err;
+}
+
+// Next record of the scan's pages, in place: the page stays pinned while
+// the scan is on it, and a moved record's page until the next call
+static int HF_ViewStep(HF_Scan *scan, HF_RID *rid, const void **rec, int *recLen)
+{
+    HF_File *hf = &HFtable[scan->fd];
+
+    if (scan->moved != NULL) {
+        PF_UnpinHandle(scan->moved, 0);
+        scan->moved = NULL;
+    }
+    while (scan->npinned > 0)
+        PF_UnpinHandle(scan->pinned[--scan->npinned], 0);
+
+    for (;;) {
+        if (scan->page == NULL) {
+            if (scan->curPage >= scan->totalPages)
+                return HF_SCAN_CLOSED;
+            if (!HF_IS_DATA(scan->curPage)) {
+                scan->curPage++;
+                continue;
+            }
+            int err = PF_PinPage(hf->unixfd, scan->curPage, &scan->pageBuf, &scan->page);
+            if (err < 0) {
+                scan->page = NULL;
+                return err;
+            }
+        }
+
+        char *page = scan->pageBuf;
+        HF_PageHdr *h = (HF_PageHdr *)page;
+
+        while (scan->curSlot < h->slotCount) {
+            HF_Slot *slot = HF_SLOT(page, scan->curSlot);
+            char *recPg = page;
+
+            if (HF_SLOT_HIDDEN(slot)) {
+                scan->curSlot++;
+                continue;
+            }
+            if (HF_IS_FWD(slot)) {
+                int err = PF_PinPage(hf->unixfd, slot->offset, &recPg, &scan->moved);
+                if (err < 0) {
+                    scan->moved = NULL;
+                    return err;
+                }
+                slot = HF_SLOT(recPg, HF_FWD_SLOT(slot));
+                hf->follows++;
+            }
 
             rid->pageNum = scan->curPage;
             rid->slotNum = scan->curSlot;
-            rid->recordLen = *recLen;
-
             scan->curSlot++;
-
-            PF_UnfixPage(pfFd, scan->curPage, 0);
-            return HF_OK;
+            if (HF_Match(scan->filter, recPg + slot->offset, HF_SLOT_BYTES(slot))) {
+                *rec = recPg + slot->offset;
+                *recLen = HF_SLOT_BYTES(slot);
+                rid->recordLen = *recLen;
+                return HF_OK;
+            }
+            if (scan->moved != NULL) {
+                PF_UnpinHandle(scan->moved, 0);
+                scan->moved = NULL;
+            }
         }
 
+        HF_ScanRelease(scan);
         scan->curPage++;
         scan->curSlot = 0;
-        PF_UnfixPage(pfFd, scan->curPage - 1, 0);
     }
 }
 
+// Scan next, without a copy
+int HF_ScanNextView(HF_Scan *scan, HF_RID *rid, const void **rec, int *recLen)
+{
+    if (!scan->isOpen)
+        return HF_SCAN_CLOSED;
+    if (scan->snap == 0)
+        return HF_ViewStep(scan, rid, rec, recLen);
+
+    PF_UseSnapshot(scan->snap);
+    int err = HF_ViewStep(scan, rid, rec, recLen);
+    PF_UseSnapshot(0);
+    return err;
+}
+
+// Page "pageNum" of the scan's file, pinned for the batch being filled
+// unless it is already; HF_SCAN_CLOSED if the batch holds as many pages as
+// it may, or the PF error
+static int HF_BatchPin(HF_Scan *scan, int pageNum, char **page)
+{
+    for (int i = 0; i < scan->npinned; i++) {
+        if (scan->pinnedPage[i] == pageNum) {
+            *page = scan->pinnedBuf[i];
+            return HF_OK;
+        }
+    }
+    if (scan->npinned == HF_BATCH_PAGES)
+        return HF_SCAN_CLOSED;
+
+    int i = scan->npinned;
+    int err = PF_PinPage(HFtable[scan->fd].unixfd, pageNum, &scan->pinnedBuf[i], &scan->pinned[i]);
+    if (err < 0)
+        return err;
+    scan->pinnedPage[i] = pageNum;
+    *page = scan->pinnedBuf[i];
+    scan->npinned++;
+    return HF_OK;
+}
+
+// Next records of the scan's pages, in place
+static int HF_BatchStep(HF_Scan *scan, HF_RecordBatch *batch, int max)
+{
+    HF_File *hf = &HFtable[scan->fd];
+
+    batch->count = 0;
+    while (batch->count < max && scan->curPage < scan->totalPages) {
+        if (!HF_IS_DATA(scan->curPage)) {
+            scan->curPage++;
+            continue;
+        }
+
+        char *page, *fwdPg;
+        int before = batch->count, pinned = scan->npinned;
+        int err = HF_BatchPin(scan, scan->curPage, &page);
+        if (err == HF_SCAN_CLOSED)
+            break;
+        if (err < 0)
+            return batch->count > 0 ? HF_OK : err;
+        HF_PageHdr *h = (HF_PageHdr *)page;
+
+        while (batch->count < max && scan->curSlot < h->slotCount) {
+            HF_Slot *slot = HF_SLOT(page, scan->curSlot);
+            char *recPg = page;
+
+            if (HF_SLOT_HIDDEN(slot)) {
+                scan->curSlot++;
+                continue;
+            }
+            int fwdPinned = scan->npinned;
+            if (HF_IS_FWD(slot)) {
+                // the rest waits for the next batch if its page cannot be
+                // pinned; a batch with nothing in it returns the PF error
+                err = HF_BatchPin(scan, slot->offset, &fwdPg);
+                if (err != HF_OK)
+                    return batch->count > 0 ? HF_OK : err;
+                slot = HF_SLOT(fwdPg, HF_FWD_SLOT(slot));
+                recPg = fwdPg;
+                hf->follows++;
+            }
+            if (!HF_Match(scan->filter, recPg + slot->offset, HF_SLOT_BYTES(slot))) {
+                if (scan->npinned > fwdPinned) {
+                    scan->npinned--;
+                    PF_UnpinHandle(scan->pinned[scan->npinned], 0);
+                }
+                scan->curSlot++;
+                continue;
+            }
+
+            int n = batch->count++;
+            batch->rec[n] = recPg + slot->offset;
+            batch->len[n] = HF_SLOT_BYTES(slot);
+            batch->rid[n].pageNum = scan->curPage;
+            batch->rid[n].slotNum = scan->curSlot;
+            batch->rid[n].recordLen = batch->len[n];
+            scan->curSlot++;
+        }
+
+        // a page none of the batch's records are on is not kept pinned
+        if (batch->count == before && scan->npinned > pinned) {
+            scan->npinned--;
+            PF_UnpinHandle(scan->pinned[scan->npinned], 0);
+        }
+        if (scan->curSlot >= h->slotCount) {
+            scan->curPage++;
+            scan->curSlot = 0;
+        }
+        if (scan->npinned == HF_BATCH_PAGES)
+            break;
+    }
+    return batch->count > 0 ? HF_OK : HF_SCAN_CLOSED;
+}
+
+// Scan next "max" records (at most HF_BATCH_MAX), in place; the pages they
+// are on stay pinned until the next call, or HF_ScanRelease()
+int HF_ScanNextBatch(HF_Scan *scan, HF_RecordBatch *batch, int max)
+{
+    batch->count = 0;
+    if (!scan->isOpen)
+        return HF_SCAN_CLOSED;
+    HF_ScanRelease(scan);
+    if (max > HF_BATCH_MAX)
+        max = HF_BATCH_MAX;
+    if (scan->snap == 0)
+        return HF_BatchStep(scan, batch, max);
+
+    PF_UseSnapshot(scan->snap);
+    int err = HF_BatchStep(scan, batch, max);
+    PF_UseSnapshot(0);
+    return err;
+}
+
+// Unpin the pages of the scan's last record view or batch; the scan goes
+// on from the next record
+int HF_ScanRelease(HF_Scan *scan)
+{
+    if (scan->moved != NULL)
+        PF_UnpinHandle(scan->moved, 0);
+    if (scan->page != NULL)
+        PF_UnpinHandle(scan->page, 0);
+    scan->moved = NULL;
+    scan->page = NULL;
+    while (scan->npinned > 0)
+        PF_UnpinHandle(scan->pinned[--scan->npinned], 0);
+    return HF_OK;
+}
+
 // Scan close 
 int HF_ScanClose(HF_Scan *scan)
 {
+    if (scan->isOpen)
+        HF_ScanRelease(scan);
+    if (scan->isOpen && scan->snap != 0)
+        PF_EndSnapshot(scan->snap);
+    scan->snap = 0;
     scan->isOpen = 0;
     return HF_OK;
 }
+
+// PF calls of parallel scan workers: only buffer misses take the lock
+static pthread_mutex_t HFpfLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Read page "pageNum" shared, without the lock if it is in the buffer pool;
+// else the page is read in under the lock. The caller must hold no shared
+// page. The lookup under the lock can miss a page that is buffered (it
+// gives up after PF_HASH_MAXPROBE entries), and fixing that page waits for
+// its shared readers. A worker that held one while it waited for the lock
+// could therefore deadlock with the lock holder.
+static int HF_ReadShared(int pfFd, int pageNum, char **page, PF_Handle *handle)
+{
+    for (;;) {
+        int err = PF_ReadShared(pfFd, pageNum, page, handle);
+        if (err == PFE_OK)
+            return PFE_OK;
+        if (err != PFE_PAGENOTINBUF && err != PFE_PAGEFIXED)
+            return err;
+        if (err == PFE_PAGENOTINBUF) {
+            pthread_mutex_lock(&HFpfLock);
+            // another worker may have read it in meanwhile
+            if ((err = PF_ReadShared(pfFd, pageNum, page, handle)) == PFE_PAGENOTINBUF) {
+                char *buf;
+                if ((err = PF_GetThisPage(pfFd, pageNum, &buf)) == PFE_OK) {
+                    PF_UnfixPage(pfFd, pageNum, 0);
+                    err = PF_ReadShared(pfFd, pageNum, page, handle);
+                }
+            }
+            pthread_mutex_unlock(&HFpfLock);
+            if (err == PFE_OK)
+                return PFE_OK;
+            if (err != PFE_PAGENOTINBUF && err != PFE_PAGEFIXED)
+                return err;
+        }
+        sched_yield();
+    }
+}
+
+// Parallel scan open: morsels are small enough that "nworkers" workers
+// each take several, so that they finish together. A worker holds up to
+// two pages shared, and shared pages are never evicted, so the pool needs
+// a frame more than twice "nworkers" for a miss to find a victim.
+int HF_ParallelScanOpen(int hffd, int nworkers, HF_ParallelScan *ps)
+{
+    int nframes, target;
+
+    if (HF_INVALID_FD(hffd) || nworkers < 1)
+        return -1;
+    PF_GetBufferPoolSize(&nframes, &target);
+    if (target < 2 * nworkers + 1)
+        return PFE_NOBUF;
+
+    ps->fd = hffd;
+    ps->totalPages = HFtable[hffd].totalPages;
+    ps->morsel = ps->totalPages / (nworkers * 8);
+    if (ps->morsel < 1)
+        ps->morsel = 1;
+    if (ps->morsel > HF_MORSEL_PAGES)
+        ps->morsel = HF_MORSEL_PAGES;
+    ps->nextPage = 0;
+    return HF_OK;
+}
+
+// Parallel scan close: its workers' cursors are closed
+int HF_ParallelScanClose(HF_ParallelScan *ps)
+{
+    ps->nextPage = ps->totalPages;
+    return HF_OK;
+}
+
+// Worker cursor open, in the worker's thread
+int HF_WorkerScanOpen(HF_ParallelScan *ps, HF_WorkerScan *ws)
+{
+    ws->ps = ps;
+    ws->curPage = ws->endPage = 0;
+    ws->curSlot = 0;
+    ws->page = NULL;
+    ws->moved = NULL;
+    return HF_OK;
+}
+
+// Worker scan next, in place. On an error the worker keeps its morsel,
+// and the next call tries the same record again.
+int HF_WorkerScanNext(HF_WorkerScan *ws, HF_RID *rid, const void **rec, int *recLen)
+{
+    HF_ParallelScan *ps = ws->ps;
+    HF_File *hf = &HFtable[ps->fd];
+    int err;
+
+    if (ws->moved != NULL) {
+        PF_ReleaseShared(ws->moved);
+        ws->moved = NULL;
+    }
+
+    for (;;) {
+        if (ws->page == NULL) {
+            if (ws->curPage >= ws->endPage) {
+                int first = __atomic_fetch_add(&ps->nextPage, ps->morsel, __ATOMIC_RELAXED);
+                if (first >= ps->totalPages)
+                    return HF_SCAN_CLOSED;
+                ws->curPage = first;
+                ws->endPage = first + ps->morsel < ps->totalPages ? first + ps->morsel : ps->totalPages;
+                ws->curSlot = 0;
+            }
+            if (!HF_IS_DATA(ws->curPage)) {
+                ws->curPage++;
+                continue;
+            }
+            if ((err = HF_ReadShared(hf->unixfd, ws->curPage, &ws->pageBuf, &ws->page)) != PFE_OK) {
+                ws->page = NULL;
+                return err;
+            }
+        }
+
+        char *page = ws->pageBuf;
+        HF_PageHdr *h = (HF_PageHdr *)page;
+
+        while (ws->curSlot < h->slotCount && HF_SLOT_HIDDEN(HF_SLOT(page, ws->curSlot)))
+            ws->curSlot++;
+
+        if (ws->curSlot < h->slotCount) {
+            HF_Slot *slot = HF_SLOT(page, ws->curSlot);
+
+            if (HF_IS_FWD(slot)) {
+                int fwdPage = slot->offset, fwdSlot = HF_FWD_SLOT(slot);
+                char *fwdPg;
+                // without the lock while the home page is held; else it is
+                // let go, and pinned again by the next call
+                if (PF_ReadShared(hf->unixfd, fwdPage, &fwdPg, &ws->moved) != PFE_OK) {
+                    PF_ReleaseShared(ws->page);
+                    ws->page = NULL;
+                    if ((err = HF_ReadShared(hf->unixfd, fwdPage, &fwdPg, &ws->moved)) != PFE_OK) {
+                        ws->moved = NULL;
+                        return err;
+                    }
+                }
+                slot = HF_SLOT(fwdPg, fwdSlot);
+                page = fwdPg;
+                __atomic_fetch_add(&hf->follows, 1, __ATOMIC_RELAXED);
+            }
+
+            rid->pageNum = ws->curPage;
+            rid->slotNum = ws->curSlot;
+            ws->curSlot++;
+            *rec = page + slot->offset;
+            *recLen = HF_SLOT_BYTES(slot);
+            rid->recordLen = *recLen;
+            return HF_OK;
+        }
+
+        PF_ReleaseShared(ws->page);
+        ws->page = NULL;
+        ws->curPage++;
+        ws->curSlot = 0;
+    }
+}
+
+// Worker cursor close: its pages are released
+int HF_WorkerScanClose(HF_WorkerScan *ws)
+{
+    if (ws->moved != NULL)
+        PF_ReleaseShared(ws->moved);
+    if (ws->page != NULL)
+        PF_ReleaseShared(ws->page);
+    ws->moved = NULL;
+    ws->page = NULL;
+    return HF_OK;
+}
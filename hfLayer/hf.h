@@ -5,8 +5,39 @@
 
 #define HF_SCAN_CLOSED 1
 #define HF_OK 0
+#define HF_NORECORD -100  // no record at the RID: out of range or deleted
+#define HF_RECTOOLONG -101  // the record does not fit on an empty page
+#define HF_BADFILE -102  // not an HF file, or one of another format version
+#define HF_BADFILTER -103  // a filter term that cannot be added
+#define HF_BADSCHEMA -104  // too many fields, or a field of no known type
+#define HF_NULLFIELD -105  // the field is null, past the record's last, or of another type
+#define HF_BADLENGTH -106  // a record length of 0 or less
 
-#define HF_MAX_FILE 20
+#define HF_MAX_FILE 20   // initial size of the open file table; it grows as needed
+#define HF_BATCH_MAX 256  // records in a batch
+#define HF_BATCH_PAGES 8  // pages a batch holds pinned; it ends early at that many
+#define HF_MORSEL_PAGES 32  // most pages a parallel scan hands a worker at a time
+#define HF_FILTER_TERMS 8   // terms in a filter
+#define HF_FILTER_VALUE 64  // bytes of a term's constant, with its NUL
+
+/* filter term comparisons, of a record's field with the term's constant */
+#define HF_EQ 0
+#define HF_NE 1
+#define HF_LT 2
+#define HF_LE 3
+#define HF_GT 4
+#define HF_GE 5
+
+/* how a term compares */
+#define HF_STRING 0  // bytes
+#define HF_NUMBER 1  // values; a field that is not a number does not match
+
+#define HF_MAX_FIELDS 32  // fields in a typed record
+
+/* types of a typed record's fields */
+#define HF_INT 0   // int, in binary
+#define HF_REAL 1  // double, in binary
+#define HF_TEXT 2  // bytes, of any length
 
 typedef struct {
     int pageNum;
@@ -14,23 +45,114 @@ typedef struct {
     int recordLen;
 } HF_RID;
 
+typedef struct {
+    int totalPages;         // pages in the file, the metadata and map pages too
+    int records;
+    int forwarded;          // records living in another slot than their RID's
+    unsigned long follows;  // forwarding stubs followed by reads since the open
+} HF_Stats;
+
+typedef struct {
+    int field;       // of the record's ';'-separated fields, from 0
+    int op;          // HF_EQ ... HF_GE
+    int type;        // HF_STRING or HF_NUMBER
+    char value[HF_FILTER_VALUE];
+    int valueLen;
+    double number;   // "value" as a number, for HF_NUMBER
+} HF_Term;
+
+typedef struct {
+    int nfields;
+    int type[HF_MAX_FIELDS];  // HF_INT, HF_REAL or HF_TEXT
+} HF_Schema;
+
+typedef struct {
+    int nterms;
+    HF_Term term[HF_FILTER_TERMS];  // a record matches when all of them hold
+    const HF_Schema *schema;  // of the typed records it tests, or NULL for text ones
+} HF_Filter;
+
 typedef struct {
     int fd;          // HF file descriptor
     int curPage;     // current page number
     int curSlot;     // current slot number
     int totalPages;  // total pages in HF file
     int isOpen;      // indicates scan is open
+    int snap;        // PF snapshot the scan reads, 0 for the live file
+    const HF_Filter *filter;  // records the scan returns, or NULL for all
+    PF_Handle page;  // page pinned for record views, or NULL
+    char *pageBuf;
+    PF_Handle moved; // page of the last view's moved record, or NULL
+    int npinned;     // pages the last batch holds pinned
+    int pinnedPage[HF_BATCH_PAGES];
+    char *pinnedBuf[HF_BATCH_PAGES];
+    PF_Handle pinned[HF_BATCH_PAGES];
 } HF_Scan;
 
+typedef struct {
+    int count;                      // records in the batch
+    const void *rec[HF_BATCH_MAX];  // in their pinned pages
+    int len[HF_BATCH_MAX];
+    HF_RID rid[HF_BATCH_MAX];
+} HF_RecordBatch;
+
+typedef struct {
+    int fd;          // HF file descriptor
+    int totalPages;  // pages in the file at the open
+    int morsel;      // pages handed to a worker at a time
+    int nextPage;    // first page of the next morsel; workers take them atomically
+} HF_ParallelScan;
+
+typedef struct {
+    HF_ParallelScan *ps;
+    int curPage;     // current page number
+    int endPage;     // end of the worker's current morsel
+    int curSlot;     // current slot number
+    PF_Handle page;  // page read, shared, for record views, or NULL
+    char *pageBuf;
+    PF_Handle moved; // page of the last view's moved record, or NULL
+} HF_WorkerScan;
+
 /* HF API */
 int HF_CreateFile(const char *fname);
 int HF_OpenFile(const char *fname);
 int HF_CloseFile(int hffd);
 
 int HF_InsertRecord(int hffd, const void *record, int len, HF_RID *rid);
+int HF_InsertRecords(int hffd, const void *const recs[], const int lens[], int n, HF_RID rids[]); // one page fix per page filled; on an error, RIDs of records not inserted have pageNum -1
+int HF_DeleteRecord(int hffd, HF_RID rid); // the RID's slot is left as a tombstone; other RIDs stay valid
+int HF_UpdateRecord(int hffd, HF_RID rid, const void *record, int len); // the RID stays valid, even if the record moves
+int HF_GetRecord(int hffd, HF_RID rid, void *recBuf, int *recLen);
+int HF_GetStats(int hffd, HF_Stats *stats); // page and record counts, and forwarded records: reorganize when they add up
 
 int HF_ScanOpen(int hffd, HF_Scan *scan);
+int HF_ScanOpenSnapshot(int hffd, HF_Scan *scan); // scan the file as it is now, while inserts go on
+int HF_ScanOpenFiltered(int hffd, HF_Scan *scan, const HF_Filter *filter); // records "filter" matches, tested in the page
 int HF_ScanNext(HF_Scan *scan, HF_RID *rid, void *recBuf, int *recLen);
+int HF_ScanNextView(HF_Scan *scan, HF_RID *rid, const void **rec, int *recLen); // "*rec" points into the page, pinned until the scan leaves it
+int HF_ScanNextBatch(HF_Scan *scan, HF_RecordBatch *batch, int max); // up to "max" records in place, pinned until the next call
+int HF_ScanRelease(HF_Scan *scan); // unpin the viewed pages, e.g. to change the file; the scan goes on from the next record
 int HF_ScanClose(HF_Scan *scan);
 
+void HF_FilterInit(HF_Filter *filter);
+void HF_FilterTyped(HF_Filter *filter, const HF_Schema *schema); // test typed records, made with "schema"
+int HF_FilterAdd(HF_Filter *filter, int field, int op, int type, const char *value);
+
+// Typed records: a null bitmap and a table of field offsets, then the
+// fields in order, the numeric ones in binary
+int HF_SchemaInit(HF_Schema *schema, int nfields, const int types[]);
+int HF_MakeRecord(const HF_Schema *schema, const void *const values[], const int lens[], void *rec, int *recLen); // a NULL value is a null field; "*recLen" is the room in "rec", then the record's length
+const void *HF_GetField(const void *rec, int recLen, int i, int *len); // field "i" in place, or NULL if it is null or not within "recLen" bytes
+int HF_GetInt(const void *rec, int recLen, int i, int *value);
+int HF_GetReal(const void *rec, int recLen, int i, double *value);
+
+// Parallel scans: each worker thread opens its own cursor on the scan and
+// gets records in place, from morsels of pages it takes as it needs them.
+// While workers run, other threads make no PF or HF calls.
+int HF_ParallelScanOpen(int hffd, int nworkers, HF_ParallelScan *ps); // PFE_NOBUF unless the pool has 2 * nworkers + 1 frames
+int HF_ParallelScanClose(HF_ParallelScan *ps);
+int HF_WorkerScanOpen(HF_ParallelScan *ps, HF_WorkerScan *ws);
+int HF_WorkerScanNext(HF_WorkerScan *ws, HF_RID *rid, const void **rec, int *recLen); // "*rec" is valid until the worker's next call; on a PF error, the next call retries
+int HF_WorkerScanClose(HF_WorkerScan *ws);
+
 #endif
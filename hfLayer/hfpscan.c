@@ -0,0 +1,175 @@
+/* hfpscan.c: full scans of a heap file by 1, 2, 4, ... worker threads.
+
+	hfpscan [-t threads] [-m megabytes] [-p frames] [-f file] [-k]
+
+Builds a heap file of about "megabytes" (default 64) of 100-byte records,
+unless -k is given and "file" (default hfpscan.hf) exists, then scans it
+once to warm the buffer pool of "frames" pages (default 1024). It then
+scans it with a parallel scan for 1, 2, 4, ... up to "threads" workers
+(default 8). Every worker sums a few bytes of each record it gets. Pages
+in the pool are read without a lock; misses are read in one at a time, so
+a file larger than the pool scales only as far as the disk lets it. The
+file is removed at the end unless -k is given. */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include "hf.h"
+
+#define RECLEN 100
+#define BATCH  256
+
+typedef struct {
+    HF_ParallelScan *ps;
+    unsigned long records;
+    unsigned long sink;
+    int err;               /* what ended the worker's scan */
+    char pad[64];          /* keep the counters of two threads apart */
+} Worker;
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void *worker(void *arg)
+{
+    Worker *w = arg;
+    HF_WorkerScan ws;
+    HF_RID rid;
+    const void *rec;
+    int len;
+
+    HF_WorkerScanOpen(w->ps, &ws);
+    while ((w->err = HF_WorkerScanNext(&ws, &rid, &rec, &len)) == HF_OK) {
+        const unsigned char *b = rec;
+        w->sink += b[0] + b[len / 2] + b[len - 1];
+        w->records++;
+    }
+    HF_WorkerScanClose(&ws);
+    return NULL;
+}
+
+/* records per second of a scan of "hffd" by "nthreads" workers */
+static double run(int hffd, int nthreads, unsigned long *records)
+{
+    pthread_t *tid = malloc(nthreads * sizeof(pthread_t));
+    Worker *w = calloc(nthreads, sizeof(Worker));
+    HF_ParallelScan ps;
+    double t0, t1;
+    int i;
+
+    HF_ParallelScanOpen(hffd, nthreads, &ps);
+    t0 = now_sec();
+    for (i = 0; i < nthreads; i++) {
+        w[i].ps = &ps;
+        pthread_create(&tid[i], NULL, worker, &w[i]);
+    }
+    *records = 0;
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(tid[i], NULL);
+        *records += w[i].records;
+        if (w[i].err != HF_SCAN_CLOSED)
+            fprintf(stderr, "hfpscan: worker %d stopped with error %d\n", i, w[i].err);
+    }
+    t1 = now_sec();
+    HF_ParallelScanClose(&ps);
+
+    free(tid);
+    free(w);
+    return *records / (t1 - t0);
+}
+
+static int build(const char *fname, long megabytes)
+{
+    static char recs[BATCH][RECLEN];
+    const void *ptrs[BATCH];
+    int lens[BATCH];
+    HF_RID rids[BATCH];
+    long n, total = megabytes * 1024 * 1024 / RECLEN;
+    int hffd, i;
+
+    remove(fname);
+    if (HF_CreateFile(fname) != HF_OK || (hffd = HF_OpenFile(fname)) < 0)
+        return -1;
+    for (n = 0; n < total; n += BATCH) {
+        for (i = 0; i < BATCH; i++) {
+            memset(recs[i], 'a' + (n + i) % 26, RECLEN);
+            snprintf(recs[i], RECLEN, "record %ld", n + i);
+            ptrs[i] = recs[i];
+            lens[i] = RECLEN;
+        }
+        if (HF_InsertRecords(hffd, ptrs, lens, BATCH, rids) != HF_OK) {
+            HF_CloseFile(hffd);
+            return -1;
+        }
+    }
+    return HF_CloseFile(hffd);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *fname = "hfpscan.hf";
+    long megabytes = 64;
+    int c, n, hffd, frames = 1024, maxthreads = 8, keep = 0;
+    double rate, base = 0;
+    unsigned long records;
+    HF_Stats stats;
+
+    while ((c = getopt(argc, argv, "t:m:p:f:k")) != -1) {
+        switch (c) {
+            case 't': maxthreads = atoi(optarg); break;
+            case 'm': megabytes = atol(optarg); break;
+            case 'p': frames = atoi(optarg); break;
+            case 'f': fname = optarg; break;
+            case 'k': keep = 1; break;
+            default:
+                fprintf(stderr, "usage: %s [-t threads] [-m megabytes] [-p frames] [-f file] [-k]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    PF_Init();
+    /* every worker holds up to two pages shared */
+    if (frames < 2 * maxthreads + 1)
+        frames = 2 * maxthreads + 1;
+    if (PF_ResizeBufferPool(frames) != PFE_OK) {
+        PF_PrintError("PF_ResizeBufferPool");
+        return 1;
+    }
+    if ((!keep || access(fname, F_OK) != 0) && build(fname, megabytes) != HF_OK) {
+        PF_PrintError("hfpscan: build");
+        return 1;
+    }
+    if ((hffd = HF_OpenFile(fname)) < 0) {
+        PF_PrintError("HF_OpenFile");
+        return 1;
+    }
+    HF_GetStats(hffd, &stats);
+
+    printf("%ld CPUs online; %d records in %d pages (%.1f MB), %d frames\n",
+           sysconf(_SC_NPROCESSORS_ONLN), stats.records, stats.totalPages,
+           stats.totalPages * (double)PF_PAGE_SIZE / (1024 * 1024), frames);
+    run(hffd, 1, &records);
+    printf("threads      records/s      MB/s  scaling\n");
+    for (n = 1; n <= maxthreads; n *= 2) {
+        rate = run(hffd, n, &records);
+        if (n == 1)
+            base = rate;
+        printf("%7d %14.0f %9.1f %8.2f", n, rate, rate * RECLEN / (1024 * 1024), rate / base);
+        if (records != (unsigned long)stats.records)
+            printf("  (%lu records read)", records);
+        printf("\n");
+    }
+
+    HF_CloseFile(hffd);
+    if (!keep)
+        PF_DestroyFile(fname);
+    return 0;
+}
@@ -2,16 +2,44 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/wait.h>
 #include "../hfLayer/hf.h"
 #include "../pflayer/pf.h"
 
 #define HF_FILE "hf_testfile.hf"
+#define TYPED_FILE "hf_typed.hf"
+#define WORKERS 4
+
+typedef struct {
+    HF_ParallelScan *ps;
+    int count;
+    long bytes;
+    int err;         /* what ended the worker's scan */
+} Worker;
 
 /* Simple record generator */
 static void make_record(char *buf, int i) {
     sprintf(buf, "Record number %d -- some text data...", i);
 }
 
+static void *scan_worker(void *arg) {
+    Worker *w = arg;
+    HF_WorkerScan ws;
+    HF_RID rid;
+    const void *rec;
+    int len;
+
+    HF_WorkerScanOpen(w->ps, &ws);
+    while ((w->err = HF_WorkerScanNext(&ws, &rid, &rec, &len)) == HF_OK) {
+        w->count++;
+        w->bytes += len;
+    }
+    HF_WorkerScanClose(&ws);
+    return NULL;
+}
+
 int main() {
     printf("=== HF LAYER BASIC TEST ===\n");
 
@@ -37,11 +65,15 @@ int main() {
     int NUM = 3000;   /* enough to force many page allocations */
     char rec[256];
     HF_RID rid;
+    static HF_RID rids[3000];
+    int lastPage = 0;
 
     for (int i = 0; i < NUM; i++) {
         make_record(rec, i);
 
         int err = HF_InsertRecord(fd, rec, strlen(rec) + 1, &rid);
+        rids[i] = rid;
+        if (rid.pageNum > lastPage) lastPage = rid.pageNum;
         if (err != HF_OK) {
             printf("Insert failed at %d\n", i);
             PF_PrintError("HF_InsertRecord");
@@ -84,11 +116,343 @@ int main() {
     HF_CloseFile(fd);
 
     printf("[7] Scan completed. Verified %d records.\n", count);
+    int ok = (count == NUM);
+
+    printf("[8] Deleting every third record...\n");
+    fd = HF_OpenFile(HF_FILE);
+
+    /* records that cannot be stored are refused without growing the file */
+    static char huge[PF_PAGE_SIZE];
+    HF_Stats before, after;
+    HF_GetStats(fd, &before);
+    for (int i = 0; i < 3; i++)
+        if (HF_InsertRecord(fd, huge, sizeof(huge), &rid) != HF_RECTOOLONG)
+            ok = 0;
+    if (HF_InsertRecord(fd, huge, 0, &rid) != HF_BADLENGTH || HF_InsertRecord(-1, huge, 1, &rid) != -1)
+        ok = 0;
+    HF_GetStats(fd, &after);
+    if (after.totalPages != before.totalPages || after.records != before.records) {
+        printf("Refused inserts grew the file from %d to %d pages\n", before.totalPages, after.totalPages);
+        ok = 0;
+    }
+    int deleted = 0;
+    for (int i = 0; i < NUM; i += 3) {
+        if (HF_DeleteRecord(fd, rids[i]) != HF_OK) {
+            printf("Delete failed at %d\n", i);
+            ok = 0;
+        }
+        deleted++;
+    }
+    if (HF_DeleteRecord(fd, rids[0]) != HF_NORECORD) {
+        printf("Deleting a deleted record did not fail\n");
+        ok = 0;
+    }
+
+    printf("[9] Scanning past the tombstones...\n");
+    int next = 1;
+    HF_ScanOpen(fd, &scan);
+    while (HF_ScanNext(&scan, &readRID, buffer, &recLen) == HF_OK) {
+        char expected[256];
+        make_record(expected, next);
+        if (strcmp(expected, buffer) != 0 || readRID.pageNum != rids[next].pageNum ||
+            readRID.slotNum != rids[next].slotNum) {
+            printf("MISMATCH after delete: expected record %d, got %s\n", next, buffer);
+            ok = 0;
+            break;
+        }
+        next += (next % 3 == 2) ? 2 : 1;
+    }
+    HF_ScanClose(&scan);
+    if (next < NUM) {
+        printf("Scan after delete stopped at record %d\n", next);
+        ok = 0;
+    }
+
+    printf("[10] Re-inserting %d records into the freed space...\n", deleted);
+    int grew = 0;
+    for (int i = 0; i < NUM; i += 3) {
+        make_record(rec, i);
+        if (HF_InsertRecord(fd, rec, strlen(rec) + 1, &rid) != HF_OK) {
+            printf("Re-insert failed at %d\n", i);
+            ok = 0;
+        }
+        if (rid.pageNum > lastPage) grew++;
+    }
+    count = 0;
+    HF_ScanOpen(fd, &scan);
+    while (HF_ScanNext(&scan, &readRID, buffer, &recLen) == HF_OK)
+        count++;
+    HF_ScanClose(&scan);
+    printf("Scan found %d records; %d re-inserts went past page %d.\n", count, grew, lastPage);
+    if (count != NUM)
+        ok = 0;
+
+    printf("[11] Growing every third record so that it moves...\n");
+    HF_Stats stats;
+    for (int i = 1; i < NUM; i += 3) {
+        make_record(rec, i);
+        size_t n = strlen(rec);
+        memset(rec + n, '+', 150);
+        rec[n + 150] = '\0';
+        if (HF_UpdateRecord(fd, rids[i], rec, strlen(rec) + 1) != HF_OK) {
+            printf("Update failed at %d\n", i);
+            ok = 0;
+        }
+    }
+    HF_CloseFile(fd);
+    fd = HF_OpenFile(HF_FILE);
+    for (int i = 1; i < NUM; i += 3) {
+        make_record(rec, i);
+        if (HF_GetRecord(fd, rids[i], buffer, &recLen) != HF_OK ||
+            strncmp(rec, buffer, strlen(rec)) != 0 || recLen != (int)strlen(rec) + 151) {
+            printf("Updated record %d reads back wrong\n", i);
+            ok = 0;
+            break;
+        }
+    }
+    HF_GetStats(fd, &stats);
+    printf("%d records forwarded, %lu stubs followed by the reads.\n", stats.forwarded, stats.follows);
+
+    /* batches read the moved records in place too */
+    static HF_RecordBatch batch;
+    long bytes = 0, batchBytes = 0;
+    int batched = 0;
+    count = 0;
+    HF_ScanOpen(fd, &scan);
+    while (HF_ScanNext(&scan, &readRID, buffer, &recLen) == HF_OK) {
+        count++;
+        bytes += recLen;
+    }
+    HF_ScanClose(&scan);
+    HF_ScanOpen(fd, &scan);
+    while (HF_ScanNextBatch(&scan, &batch, 64) == HF_OK) {
+        for (int k = 0; k < batch.count; k++) {
+            if (memcmp(batch.rec[k], "Record number ", 14) != 0)
+                ok = 0;
+            batchBytes += batch.len[k];
+        }
+        batched += batch.count;
+    }
+    HF_ScanClose(&scan);
+    printf("Batched scan: %d records, %ld bytes (record scan: %d, %ld).\n", batched, batchBytes, count, bytes);
+    if (batched != NUM || count != NUM || batchBytes != bytes)
+        ok = 0;
+
+    /* records 2, 20-29, 200-299 and 2000-2999, some of them moved, tested
+       in place by every kind of scan */
+    HF_Filter filter;
+    const void *view;
+    int views = 0;
+    HF_FilterInit(&filter);
+    if (HF_FilterAdd(&filter, 0, HF_GE, HF_STRING, "Record number 2") != HF_OK ||
+        HF_FilterAdd(&filter, 0, HF_LT, HF_STRING, "Record number 3") != HF_OK ||
+        HF_FilterAdd(&filter, 1, HF_EQ, HF_NUMBER, "not a number") != HF_BADFILTER)
+        ok = 0;
+    count = 0;
+    HF_ScanOpenFiltered(fd, &scan, &filter);
+    while (HF_ScanNext(&scan, &readRID, buffer, &recLen) == HF_OK)
+        count += strncmp(buffer, "Record number 2", 15) == 0;
+    HF_ScanClose(&scan);
+    HF_ScanOpenFiltered(fd, &scan, &filter);
+    while (HF_ScanNextView(&scan, &readRID, &view, &recLen) == HF_OK)
+        views++;
+    HF_ScanClose(&scan);
+    batched = 0;
+    HF_ScanOpenFiltered(fd, &scan, &filter);
+    while (HF_ScanNextBatch(&scan, &batch, 64) == HF_OK)
+        batched += batch.count;
+    HF_ScanClose(&scan);
+    printf("Filtered scans: %d records, %d views, %d batched.\n", count, views, batched);
+    if (count != 1111 || views != 1111 || batched != 1111)
+        ok = 0;
+
+    /* a page one cursor holds cannot be pinned by another, which is told
+       so rather than sent to the end of the file */
+    HF_Scan other;
+    HF_ScanOpen(fd, &scan);
+    HF_ScanOpen(fd, &other);
+    if (HF_ScanNextView(&scan, &readRID, &view, &recLen) != HF_OK ||
+        HF_ScanNextView(&other, &readRID, &view, &recLen) != PFE_PAGEFIXED ||
+        HF_ScanNext(&other, &readRID, buffer, &recLen) != PFE_PAGEFIXED ||
+        HF_ScanNextBatch(&other, &batch, 64) != PFE_PAGEFIXED)
+        ok = 0;
+    HF_ScanRelease(&scan);
+    if (HF_ScanNextView(&other, &readRID, &view, &recLen) != HF_OK || readRID.slotNum != 0)
+        ok = 0;
+    HF_ScanClose(&other);
+    HF_ScanClose(&scan);
+
+    printf("[12] Shrinking them back, and scanning...\n");
+    for (int i = 1; i < NUM; i += 3) {
+        make_record(rec, i);
+        if (HF_UpdateRecord(fd, rids[i], rec, strlen(rec) + 1) != HF_OK) {
+            printf("Update failed at %d\n", i);
+            ok = 0;
+        }
+    }
+    count = 0;
+    HF_ScanOpen(fd, &scan);
+    while (HF_ScanNext(&scan, &readRID, buffer, &recLen) == HF_OK)
+        count++;
+    HF_ScanClose(&scan);
+    HF_CloseFile(fd);
+
+    /* the counts come back from the metadata page */
+    fd = HF_OpenFile(HF_FILE);
+    HF_GetStats(fd, &stats);
+    printf("Scan found %d records; the file holds %d in %d pages, %d still forwarded.\n",
+           count, stats.records, stats.totalPages, stats.forwarded);
+    if (count != NUM || stats.records != NUM)
+        ok = 0;
+
+    printf("[13] Scanning with %d worker threads...\n", WORKERS);
+    HF_ParallelScan ps;
+    pthread_t tid[WORKERS];
+    Worker workers[WORKERS];
+    int parallel = 0;
+    long parallelBytes = 0;
+    bytes = 0;
+    HF_ScanOpen(fd, &scan);
+    while (HF_ScanNext(&scan, &readRID, buffer, &recLen) == HF_OK)
+        bytes += recLen;
+    HF_ScanClose(&scan);
+    /* the default pool is too small for 10 workers' shared pages */
+    if (HF_ParallelScanOpen(fd, 10, &ps) != PFE_NOBUF)
+        ok = 0;
+    HF_ParallelScanOpen(fd, WORKERS, &ps);
+    for (int i = 0; i < WORKERS; i++) {
+        workers[i].ps = &ps;
+        workers[i].count = 0;
+        workers[i].bytes = 0;
+        pthread_create(&tid[i], NULL, scan_worker, &workers[i]);
+    }
+    for (int i = 0; i < WORKERS; i++) {
+        pthread_join(tid[i], NULL);
+        parallel += workers[i].count;
+        parallelBytes += workers[i].bytes;
+        if (workers[i].err != HF_SCAN_CLOSED) {
+            printf("Worker %d stopped with error %d\n", i, workers[i].err);
+            ok = 0;
+        }
+    }
+    HF_ParallelScanClose(&ps);
+    HF_CloseFile(fd);
+    printf("Workers found %d records, %ld bytes (record scan: %d, %ld).\n", parallel, parallelBytes, NUM, bytes);
+    if (parallel != NUM || parallelBytes != bytes)
+        ok = 0;
+
+    printf("[14] Typed records: an int, a text and a real field, some of them null...\n");
+    HF_Schema schema;
+    int types[] = {HF_INT, HF_TEXT, HF_REAL};
+    HF_SchemaInit(&schema, 3, types);
+    remove(TYPED_FILE);
+    HF_CreateFile(TYPED_FILE);
+    fd = HF_OpenFile(TYPED_FILE);
+    for (int i = 0; i < 100; i++) {
+        double real = i / 4.0;
+        const void *values[] = {&i, rec, i % 10 == 0 ? NULL : &real};
+        int lens[] = {0, 0, 0};
+        char typed[256];
+        int typedLen = sizeof(typed);
+        make_record(rec, i);
+        lens[1] = strlen(rec);
+        if (HF_MakeRecord(&schema, values, lens, typed, &typedLen) != HF_OK ||
+            HF_InsertRecord(fd, typed, typedLen, &rids[i]) != HF_OK)
+            ok = 0;
+    }
+    int typedOk = 0, nulls = 0;
+    for (int i = 0; i < 100; i++) {
+        int value, len;
+        double real;
+        HF_GetRecord(fd, rids[i], buffer, &recLen);
+        make_record(rec, i);
+        const void *text = HF_GetField(buffer, recLen, 1, &len);
+        if (HF_GetInt(buffer, recLen, 0, &value) != HF_OK || value != i ||
+            text == NULL || len != (int)strlen(rec) || memcmp(text, rec, len) != 0)
+            continue;
+        if (HF_GetReal(buffer, recLen, 2, &real) == HF_NULLFIELD)
+            nulls++;
+        else if (real != i / 4.0)
+            continue;
+        typedOk++;
+    }
+    /* text records and a typed one cut short are not read past their ends:
+       neither matches the filter below, though the cut one's real is 7 */
+    {
+        double real = 7;
+        int i = 7, lens[] = {0, 0, 0}, len;
+        const void *values[] = {&i, rec, &real};
+        char typed[256];
+        int typedLen = sizeof(typed);
+        make_record(rec, i);
+        lens[1] = strlen(rec);
+        HF_MakeRecord(&schema, values, lens, typed, &typedLen);
+        if (HF_GetField(typed, typedLen - 1, 2, &len) != NULL ||
+            HF_GetField(typed, typedLen - 1, 1, &len) == NULL ||
+            HF_GetField(rec, strlen(rec) + 1, 0, &len) != NULL)
+            ok = 0;
+        HF_InsertRecord(fd, typed, typedLen - 1, &rid);
+        HF_InsertRecord(fd, rec, strlen(rec) + 1, &rid);
+    }
+    /* reals from 5 to 10, unless null: 21 of them, less 20, 30 and 40 */
+    HF_FilterInit(&filter);
+    HF_FilterTyped(&filter, &schema);
+    HF_FilterAdd(&filter, 2, HF_GE, HF_NUMBER, "5");
+    HF_FilterAdd(&filter, 2, HF_LE, HF_NUMBER, "10");
+    count = 0;
+    HF_ScanOpenFiltered(fd, &scan, &filter);
+    while (HF_ScanNext(&scan, &readRID, buffer, &recLen) == HF_OK)
+        count++;
+    HF_ScanClose(&scan);
+    HF_CloseFile(fd);
+    remove(TYPED_FILE);
+    printf("%d typed records read back, %d with a null real; %d matched the filter.\n", typedOk, nulls, count);
+    if (typedOk != 100 || nulls != 10 || count != 18)
+        ok = 0;
+
+    printf("[15] Inserting 5 records and exiting without closing the file...\n");
+    int forwarded = stats.forwarded;
+    pid_t pid = fork();
+    if (pid == 0) {
+        /* with plain LRU victims, the scan evicts every dirty page, the
+           metadata page among them, before the crash */
+        PF_SetVictimWindow(1);
+        fd = HF_OpenFile(HF_FILE);
+        for (int i = 0; i < 5; i++) {
+            make_record(rec, NUM + i);
+            HF_InsertRecord(fd, rec, strlen(rec) + 1, &rid);
+        }
+        HF_ScanOpen(fd, &scan);
+        while (HF_ScanNext(&scan, &readRID, buffer, &recLen) == HF_OK)
+            ;
+        _exit(0);
+    }
+    waitpid(pid, NULL, 0);
+    fd = HF_OpenFile(HF_FILE);
+    HF_GetStats(fd, &stats);
+    HF_CloseFile(fd);
+    printf("The file holds %d records, %d forwarded, counted again on open.\n", stats.records, stats.forwarded);
+    if (stats.records != NUM + 5 || stats.forwarded != forwarded)
+        ok = 0;
+
+    /* a batch that fails part way keeps the records before the failure */
+    const void *part[] = {rec, rec, rec};
+    int partLens[] = {10, 0, 10};
+    HF_RID partRids[3];
+    fd = HF_OpenFile(HF_FILE);
+    if (HF_InsertRecords(fd, part, partLens, 3, partRids) != HF_BADLENGTH ||
+        partRids[0].pageNum < 0 || partRids[1].pageNum != -1 || partRids[2].pageNum != -1)
+        ok = 0;
+    HF_GetStats(fd, &stats);
+    HF_CloseFile(fd);
+    printf("A batch failing at its second record inserted %d.\n", stats.records - (NUM + 5));
+    if (stats.records != NUM + 6)
+        ok = 0;
 
-    if (count == NUM)
+    if (ok)
         printf("\n*** HF LAYER TEST PASSED SUCCESSFULLY ***\n");
     else
-        printf("\n*** HF LAYER TEST FAILED: count mismatch (%d vs %d) ***\n", count, NUM);
+        printf("\n*** HF LAYER TEST FAILED (%d of %d records) ***\n", count, NUM);
 
     return 0;
 }
@@ -0,0 +1,225 @@
+/* arena.c: buffer frame arena. The interface routines are: PFarenaGetFrame(),
+PFarenaPutFrame(), PF_SetArenaMode() and PF_GetArenaInfo().
+
+The page bodies (PFfpage) of buffer frames are carved out of PF_ARENA_CHUNK
+(2 MB) chunks. A chunk is mapped with MAP_HUGETLB when the system has huge
+pages reserved, otherwise as 2 MB aligned anonymous memory advised with
+MADV_HUGEPAGE so that transparent huge pages can back it, and as plain 4 KB
+pages if neither works. Either way one TLB entry covers ~500 frames instead
+of one. The PFbpage descriptors of a chunk are kept apart, in one dense
+array, so that LRU walks, victim scans and hash hits touch packed metadata
+rather than the first line of a 4 KB page per frame.
+
+Frames are handed out from chunks that have free frames; a chunk whose
+frames have all been returned is unmapped, so shrinking the pool gives the
+memory back. Its descriptor array is kept for the next chunk instead of
+being freed: PF_ReadShared() may still read a descriptor it reached through
+a stale hash entry, and only finds its version odd. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include "pf.h"
+#include "pftypes.h"
+
+#ifndef MAP_HUGETLB
+#define MAP_HUGETLB 0x40000
+#endif
+
+/* distance between two page bodies: a PFfpage rounded up to a cache line */
+#define PF_FRAME_STRIDE ((sizeof(PFfpage) + 63) & ~(size_t)63)
+#define PF_CHUNK_FRAMES ((int)(PF_ARENA_CHUNK / PF_FRAME_STRIDE))
+
+typedef struct PFchunk {
+    struct PFchunk *next;  /* list of chunks with free frames */
+    struct PFchunk *prev;
+    char *data;            /* PF_ARENA_CHUNK bytes of page bodies */
+    PFbpage *frames;       /* PF_CHUNK_FRAMES descriptors */
+    PFbpage *free;         /* free descriptors, linked by nextpage */
+    int nfree;
+    int hugetlb;           /* TRUE if mapped with MAP_HUGETLB */
+} PFchunk;
+
+static int PFarenamode = PF_ARENA_HUGE;
+static PFchunk *PFpartial = NULL;  /* chunks with at least one free frame */
+static int PFnchunks = 0;          /* # of chunks mapped */
+static int PFnhugetlb = 0;         /* # of them mapped with MAP_HUGETLB */
+static PFbpage *PFspareframes = NULL; /* descriptor arrays of unmapped chunks,
+                                         linked by their first nextpage */
+
+/* Map PF_ARENA_CHUNK bytes for a chunk according to the arena mode */
+static char *PFarenaMap(int *hugetlb)
+{
+    char *p, *aligned;
+    size_t head;
+
+    *hugetlb = FALSE;
+    if (PFarenamode == PF_ARENA_HUGE) {
+        p = mmap(NULL, PF_ARENA_CHUNK, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            *hugetlb = TRUE;
+            return p;
+        }
+    }
+
+    /* over-map so a 2 MB aligned range can be kept: THP needs alignment */
+    p = mmap(NULL, 2 * PF_ARENA_CHUNK, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+    aligned = (char *)(((uintptr_t)p + PF_ARENA_CHUNK - 1) & ~(uintptr_t)(PF_ARENA_CHUNK - 1));
+    head = aligned - p;
+    if (head > 0)
+        munmap(p, head);
+    munmap(aligned + PF_ARENA_CHUNK, PF_ARENA_CHUNK - head);
+
+#ifdef MADV_HUGEPAGE
+    if (PFarenamode != PF_ARENA_4K)
+        madvise(aligned, PF_ARENA_CHUNK, MADV_HUGEPAGE);
+#endif
+#ifdef MADV_NOHUGEPAGE
+    if (PFarenamode == PF_ARENA_4K)
+        madvise(aligned, PF_ARENA_CHUNK, MADV_NOHUGEPAGE);
+#endif
+    return aligned;
+}
+
+/* Insert chunk "c" into the list of chunks with free frames */
+static void PFchunkLink(PFchunk *c)
+{
+    c->prev = NULL;
+    c->next = PFpartial;
+    if (PFpartial != NULL)
+        PFpartial->prev = c;
+    PFpartial = c;
+}
+
+/* Remove chunk "c" from the list of chunks with free frames */
+static void PFchunkUnlink(PFchunk *c)
+{
+    if (c->prev != NULL)
+        c->prev->next = c->next;
+    else
+        PFpartial = c->next;
+    if (c->next != NULL)
+        c->next->prev = c->prev;
+    c->next = c->prev = NULL;
+}
+
+/* Map a new chunk and put all its frames on its free list */
+static PFchunk *PFchunkNew(void)
+{
+    PFchunk *c;
+    int i;
+
+    if ((c = malloc(sizeof(PFchunk))) == NULL)
+        return NULL;
+    if (PFspareframes != NULL) {
+        /* versions carry on, so no stale reader can mistake a frame */
+        c->frames = PFspareframes;
+        PFspareframes = PFspareframes->nextpage;
+    } else if ((c->frames = calloc(PF_CHUNK_FRAMES, sizeof(PFbpage))) == NULL) {
+        free(c);
+        return NULL;
+    } else {
+        for (i = 0; i < PF_CHUNK_FRAMES; i++)
+            c->frames[i].version = 1;  /* not shareable until in the pool */
+    }
+    if ((c->data = PFarenaMap(&c->hugetlb)) == NULL) {
+        c->frames[0].nextpage = PFspareframes;
+        PFspareframes = c->frames;
+        free(c);
+        return NULL;
+    }
+
+    c->free = NULL;
+    for (i = PF_CHUNK_FRAMES - 1; i >= 0; i--) {
+        c->frames[i].fpage = (PFfpage *)(c->data + i * PF_FRAME_STRIDE);
+        c->frames[i].chunk = c;
+        c->frames[i].nextpage = c->free;
+        c->free = &c->frames[i];
+    }
+    c->nfree = PF_CHUNK_FRAMES;
+
+    PFnchunks++;
+    if (c->hugetlb)
+        PFnhugetlb++;
+    PFchunkLink(c);
+    return c;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Take a frame out of the arena, mapping a new chunk if no chunk has a
+	free frame. The descriptor's "fpage" points to its page body; the
+	other fields are for the caller to set.
+
+RETURN VALUE:
+	pointer to the frame descriptor, NULL if out of memory
+*****************************************************************************/
+PFbpage *PFarenaGetFrame(void)
+{
+    PFchunk *c = PFpartial;
+    PFbpage *bpage;
+
+    if (c == NULL && (c = PFchunkNew()) == NULL)
+        return NULL;
+
+    bpage = c->free;
+    c->free = bpage->nextpage;
+    if (--c->nfree == 0)
+        PFchunkUnlink(c);
+
+    bpage->nextpage = bpage->prevpage = NULL;
+    return bpage;
+}
+
+/* Return frame "bpage" to the arena; unmap its chunk if it is now unused */
+void PFarenaPutFrame(PFbpage *bpage)
+{
+    PFchunk *c = bpage->chunk;
+
+    bpage->prevpage = NULL;
+    bpage->nextpage = c->free;
+    c->free = bpage;
+    if (c->nfree++ == 0)
+        PFchunkLink(c);
+
+    if (c->nfree == PF_CHUNK_FRAMES) {
+        PFchunkUnlink(c);
+        munmap(c->data, PF_ARENA_CHUNK);
+        PFnchunks--;
+        if (c->hugetlb)
+            PFnhugetlb--;
+        c->frames[0].nextpage = PFspareframes;
+        PFspareframes = c->frames;
+        free(c);
+    }
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Choose how chunks mapped from now on are backed: PF_ARENA_HUGE tries
+	MAP_HUGETLB, then transparent huge pages; PF_ARENA_THP asks for
+	transparent huge pages only; PF_ARENA_4K forbids huge pages.
+	Chunks already mapped keep their backing.
+
+RETURN VALUE:
+	PFE_OK
+*****************************************************************************/
+int PF_SetArenaMode(int mode)
+{
+    PFarenamode = mode;
+    return PFE_OK;
+}
+
+/* # of arena chunks mapped, how many of them with MAP_HUGETLB, and frames per chunk */
+void PF_GetArenaInfo(int *nchunks, int *nhugetlb, int *chunkframes)
+{
+    *nchunks = PFnchunks;
+    *nhugetlb = PFnhugetlb;
+    *chunkframes = PF_CHUNK_FRAMES;
+}
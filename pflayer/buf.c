@@ -1,9 +1,33 @@
 /* buf.c: buffer management routines. The interface routines are:
 PFbufGet(), PFbufUnfix(), PFbufAlloc(), PFbufReleaseFile(), PFbufUsed() and
-PFbufPrint() */
+PFbufPrint(). PFbufFix(), PFbufUnfixHandle() and PFbufUsedHandle() are the
+handle forms used by PF_PinPage(): the caller keeps the PFbpage pointer while
+the page is fixed, so unfixing it needs no hash lookup. PFbufResize() changes
+the pool size at run time. While a transaction is active, a page fixed by it
+keeps its image at fix time, and unfixing it logs the changed bytes (wal.c).
+PFbufFlushBefore() and PFbufDirtyTable() serve checkpoints: a dirty page
+carries the LSN of the first record that dirtied it since it was last
+written (its recLSN). A miss takes the first clean page among the
+PFvictimwindow coldest unfixed pages as its victim, and hands the dirty ones
+it passes over to the cleaner thread when it runs (clean.c).
+
+PFbufReadShared() pins an unfixed buffered page for reading from any thread,
+without a lock: a frame's version is odd while this thread has it to itself
+(fixed, being evicted or dropped, or not in the pool), and a reader counts
+itself in "shared" and then checks that the version has not moved. Before
+taking a frame this thread makes its version odd and waits for the shared
+pins, or passes the frame over when choosing a victim.
+
+With swizzling on, a frame keeps the frames of the children PF_PinChild()
+pinned through it, by slot (its swips), and PFbufFixHint() takes such a
+frame without a hash probe if it still holds the page. A frame leaving the
+pool drops its swips and its page number, so a child's stale swip in a
+parent never matches. */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sched.h>
 #include "pf.h"
 #include "pftypes.h"
 
@@ -11,9 +35,21 @@ static int PFnumbpage = 0;          /* # of buffer pages in memory */
 static PFbpage *PFfirstbpage = NULL; /* ptr to first buffer page, or NULL */
 static PFbpage *PFlastbpage = NULL;  /* ptr to last buffer page, or NULL */
 static PFbpage *PFfreebpage = NULL;  /* list of free buffer pages */
+static int PFmaxbufs = PF_MAX_BUFS;  /* target # of buffer pages */
+static int PFvictimwindow = PF_VICTIM_WINDOW; /* unfixed pages searched for a clean victim */
+static int PFswizzle = FALSE;       /* TRUE: PFbufSetSwip() records swips */
+
+/* Forget the page of frame "bpage", which is leaving the pool, and its swips */
+static void PFbufForget(PFbpage *bpage) {
+    bpage->fd = -1;
+    bpage->page = -1;
+    free(bpage->swips);
+    bpage->swips = NULL;
+}
 
 /* Insert the buffer page pointed by "bpage" into the free list. */
 static void PFbufInsertFree(PFbpage *bpage) {
+    PFbufForget(bpage);
     bpage->nextpage = PFfreebpage;
     PFfreebpage = bpage;
 }
@@ -48,11 +84,181 @@ void PFbufUnlink(PFbpage *bpage) {
 
 int USE_MRU = 0; 
 
-/* Internal buffer allocation routine */
+/* Let PFbufReadShared() pin frame "bpage" again */
+static void PFbufShare(PFbpage *bpage) {
+    __atomic_add_fetch(&bpage->version, 1, __ATOMIC_RELEASE);
+}
+
+/* Keep PFbufReadShared() off frame "bpage": its version turns odd, and the
+   shared pins already taken are waited for if "wait", else the frame is
+   given back and FALSE returned */
+static int PFbufExclusive(PFbpage *bpage, int wait) {
+    __atomic_add_fetch(&bpage->version, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&bpage->shared, __ATOMIC_SEQ_CST) != 0) {
+        if (!wait) {
+            PFbufShare(bpage);
+            return FALSE;
+        }
+        sched_yield();
+    }
+    return TRUE;
+}
+
+/* Release up to PF_RESIZE_CHUNK buffer pages while the pool is above its
+   target: free pages first, then unfixed pages from the LRU end (written
+   back if dirty). Fixed pages stay until a later step. */
+static int PFbufShrinkStep(int (*writefcn)(int, int, PFfpage *)) {
+    PFbpage *tbpage, *prev;
+    int n = 0, error;
+
+    while (PFnumbpage > PFmaxbufs && PFfreebpage != NULL && n < PF_RESIZE_CHUNK) {
+        tbpage = PFfreebpage;
+        PFfreebpage = tbpage->nextpage;
+        PFarenaPutFrame(tbpage);
+        PFnumbpage--;
+        n++;
+    }
+
+    for (tbpage = PFlastbpage; tbpage != NULL && PFnumbpage > PFmaxbufs && n < PF_RESIZE_CHUNK; tbpage = prev) {
+        prev = tbpage->prevpage;
+        if (tbpage->fixed)
+            continue;
+
+        if (tbpage->cleaning)
+            PFcleanWait(tbpage);
+        if (tbpage->dirty) {
+            if ((error = (*writefcn)(tbpage->fd, tbpage->page, tbpage->fpage)) != PFE_OK)
+                return error;
+            tbpage->dirty = FALSE;
+            tbpage->reclsn = 0;
+            PFstatsEvent(tbpage->fd, PF_STAT_WRITEBACK);
+        }
+        /* a page pinned by shared readers goes in a later step */
+        if (!PFbufExclusive(tbpage, FALSE))
+            continue;
+        PFstatsEvent(tbpage->fd, PF_STAT_EVICT);
+        PF_page_evicted++;
+        if (PFvcacheOn)
+            PFvcacheAdmit(tbpage->fd, tbpage->page, tbpage->fpage, tbpage->reused);
+
+        if ((error = PFhashDelete(tbpage->fd, tbpage->page)) != PFE_OK) {
+            PFbufShare(tbpage);
+            return error;
+        }
+        PFbufUnlink(tbpage);
+        PFbufForget(tbpage);
+        PFarenaPutFrame(tbpage);
+        PFnumbpage--;
+        n++;
+    }
+    return PFE_OK;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Set the target size of the buffer pool to "nframes" pages. Growing
+	only raises the target: new frames are taken from the arena one at
+	a time as misses need them. Shrinking releases at most PF_RESIZE_CHUNK pages
+	now and the same number on each later buffer allocation until the
+	pool fits, so a large shrink never stalls a single call. Pages that
+	are fixed are released once they are unfixed.
+
+RETURN VALUE:
+	PFE_OK if ok
+	PF error code if a dirty page cannot be written back
+*****************************************************************************/
+int PFbufResize(int nframes, int (*writefcn)(int, int, PFfpage *)) {
+    PFmaxbufs = nframes;
+    return PFbufShrinkStep(writefcn);
+}
+
+/* Search the "npages" coldest unfixed pages for a clean victim (1 takes
+   the coldest, clean or not) */
+int PFbufSetVictimWindow(int npages) {
+    PFvictimwindow = npages;
+    return PFE_OK;
+}
+
+/* Choose the page to evict, from the LRU end (the MRU end under USE_MRU):
+   the first clean page among the PFvictimwindow coldest unfixed pages,
+   else the coldest unfixed page not being cleaned; pages pinned by shared
+   readers are passed over. While the cleaner runs the dirty pages of the
+   window are handed to it, and "*wait" is set if waiting for the cleaner
+   beats writing a dirty victim: the window holds pages being cleaned.
+   NULL if every page is fixed, shared or being cleaned. */
+static PFbpage *PFbufVictim(int *wait) {
+    PFbpage *tbpage, *dirty = NULL;
+    int n = 0;
+
+    *wait = FALSE;
+    for (tbpage = USE_MRU ? PFfirstbpage : PFlastbpage; tbpage != NULL;
+         tbpage = USE_MRU ? tbpage->nextpage : tbpage->prevpage) {
+        if (tbpage->fixed || PFload(&tbpage->shared) != 0)
+            continue;
+        if (n++ >= PFvictimwindow && dirty != NULL)
+            break;
+        if (tbpage->cleaning) {
+            if (n <= PFvictimwindow)
+                *wait = TRUE;
+            continue;
+        }
+        if (!tbpage->dirty)
+            return tbpage;
+        /* a dirty page within the window: clean it in the background */
+        if (n <= PFvictimwindow && PFcleanOn && PFcleanSchedule(tbpage)) {
+            *wait = TRUE;
+            continue;
+        }
+        if (dirty == NULL)
+            dirty = tbpage;
+    }
+    return dirty;
+}
+
+/* Record swips from now on if "on"; turning it off drops none, but no
+   new one is recorded */
+int PFbufSetSwizzling(int on) {
+    PFswizzle = on;
+    return PFE_OK;
+}
+
+/* The frame swizzled into slot "slot" of the pool page "parent", or NULL;
+   it may no longer hold the child (see PFbufFixHint()) */
+PFbpage *PFbufSwip(PFbpage *parent, int slot) {
+    if (parent->swips == NULL || slot < 0 || slot >= PF_SWIP_SLOTS)
+        return NULL;
+    return parent->swips[slot];
+}
+
+/* Swizzle slot "slot" of the fixed pool page "parent" to frame "child" */
+void PFbufSetSwip(PFbpage *parent, int slot, PFbpage *child) {
+    if (!PFswizzle || parent->snap || child->snap || slot < 0 || slot >= PF_SWIP_SLOTS)
+        return;
+    if (parent->swips == NULL &&
+        (parent->swips = calloc(PF_SWIP_SLOTS, sizeof(PFbpage *))) == NULL)
+        return;  /* no memory: the child is found by a probe, as before */
+    parent->swips[slot] = child;
+}
+
+/* Current and target # of buffer pages */
+void PFbufPoolSize(int *nframes, int *target) {
+    *nframes = PFnumbpage;
+    *target = PFmaxbufs;
+}
+
 /* Internal buffer allocation routine */
 static int PFbufInternalAlloc(PFbpage **bpage, int (*writefcn)(int, int, PFfpage *)) {
     PFbpage *tbpage = NULL;
-    int error;
+    int wait, error;
+
+    if (PFpsiOn)
+        PFpsiTick();
+    if (PFcleanOn)
+        PFcleanReap();
+
+    /* Pool above its target after a shrink: release another chunk */
+    if (PFnumbpage > PFmaxbufs && (error = PFbufShrinkStep(writefcn)) != PFE_OK)
+        return error;
 
     /* Case 1: Reuse a free page from the free list */
     if (PFfreebpage != NULL) {
@@ -61,8 +267,8 @@ static int PFbufInternalAlloc(PFbpage **bpage, int (*writefcn)(int, int, PFfpage
     }
 
     /* Case 2: Allocate a new page if buffer not yet full */
-    else if (PFnumbpage < PF_MAX_BUFS) {
-        *bpage = (PFbpage *)malloc(sizeof(PFbpage));
+    else if (PFnumbpage < PFmaxbufs) {
+        *bpage = PFarenaGetFrame();
         if (*bpage == NULL) {
             PFerrno = PFE_NOMEM;
             *bpage = NULL;
@@ -76,25 +282,26 @@ static int PFbufInternalAlloc(PFbpage **bpage, int (*writefcn)(int, int, PFfpage
         (*bpage)->fd = -1;
         (*bpage)->page = -1;
         (*bpage)->dirty = FALSE;
+        (*bpage)->reclsn = 0;
         (*bpage)->fixed = FALSE;
+        (*bpage)->reused = FALSE;
+        (*bpage)->snap = FALSE;
+        (*bpage)->cleaning = FALSE;
+        (*bpage)->redirty = FALSE;
+        (*bpage)->before = NULL;
+        (*bpage)->snapbefore = NULL;
+        (*bpage)->swips = NULL;
     }
 
     /* Case 3: Need to evict a page using LRU or MRU */
     else {
-        PF_page_evicted++;
-        if (USE_MRU) {
-            /* MRU policy: evict from head */
-            for (tbpage = PFfirstbpage; tbpage != NULL; tbpage = tbpage->nextpage) {
-                if (!tbpage->fixed)
-                    break;
-            }
-        } else {
-            /* LRU policy: evict from tail */
-            for (tbpage = PFlastbpage; tbpage != NULL; tbpage = tbpage->prevpage) {
-                if (!tbpage->fixed)
-                    break;
-            }
-        }
+        /* LRU or MRU victim, clean if the window has one; rather than
+           write a dirty one, wait for the cleaner to finish the window */
+        do {
+            while (((tbpage = PFbufVictim(&wait)) == NULL || (tbpage->dirty && wait)) &&
+                   PFcleanOn && PFcleanWaitAny())
+                ;
+        } while (tbpage != NULL && !PFbufExclusive(tbpage, FALSE));
 
         /* No available victim (all pages pinned) */
         if (tbpage == NULL) {
@@ -102,28 +309,42 @@ static int PFbufInternalAlloc(PFbpage **bpage, int (*writefcn)(int, int, PFfpage
             *bpage = NULL;
             return PFerrno;
         }
+        PF_page_evicted++;
 
-        /* If the victim page is dirty, write it to disk */
+        /* If the victim page is dirty, write it to disk before the read */
         if (tbpage->dirty) {
-            error = (*writefcn)(tbpage->fd, tbpage->page, &tbpage->fpage);
+            PFstatsEvent(tbpage->fd, PF_STAT_VICTIMWRITE);
+            error = (*writefcn)(tbpage->fd, tbpage->page, tbpage->fpage);
             if (error != PFE_OK) {
                 /* Keep consistent state and return */
+                PFbufShare(tbpage);
                 return error;
             }
             tbpage->dirty = FALSE;
+            tbpage->reclsn = 0;
+            PFstatsEvent(tbpage->fd, PF_STAT_WRITEBACK);
         }
+        PFstatsEvent(tbpage->fd, PF_STAT_EVICT);
+
+        /* the victim is clean now: offer it to the victim cache */
+        if (PFvcacheOn)
+            PFvcacheAdmit(tbpage->fd, tbpage->page, tbpage->fpage, tbpage->reused);
 
         /* Remove victim from hash and used list */
-        if ((error = PFhashDelete(tbpage->fd, tbpage->page)) != PFE_OK)
+        if ((error = PFhashDelete(tbpage->fd, tbpage->page)) != PFE_OK) {
+            PFbufShare(tbpage);
             return error;
+        }
 
         PFbufUnlink(tbpage);
 
         /* Reset all metadata before reuse */
-        tbpage->fd = -1;
-        tbpage->page = -1;
+        PFbufForget(tbpage);
         tbpage->fixed = FALSE;
         tbpage->dirty = FALSE;
+        tbpage->reclsn = 0;
+        tbpage->reused = FALSE;
+        tbpage->redirty = FALSE;
         tbpage->nextpage = tbpage->prevpage = NULL;
         *bpage = tbpage;
     }
@@ -136,69 +357,141 @@ static int PFbufInternalAlloc(PFbpage **bpage, int (*writefcn)(int, int, PFfpage
 
 
 
-/* Get a page from the file and fix it in buffer */
-int PFbufGet(int fd, int pagenum, PFfpage **fpage, int (*readfcn)(int, int, PFfpage *), int (*writefcn)(int, int, PFfpage *)) {
+/* PFbufFix() that first tries frame "hint", taken from a swip: if it
+still holds the page, the hash table is not probed. */
+int PFbufFixHint(PFbpage *hint, int fd, int pagenum, PFbpage **bpagep, int (*readfcn)(int, int, PFfpage *), int (*writefcn)(int, int, PFfpage *)) {
     PFbpage *bpage;
     int error;
 
-    if ((bpage = PFhashFind(fd, pagenum)) == NULL) {
+    if (hint != NULL && hint->fd == fd && hint->page == pagenum)
+        bpage = hint;
+    else
+        bpage = PFhashFind(fd, pagenum);
+    if (bpage == NULL) {
+        PFtrace(fd, pagenum, PF_TRACE_GET, FALSE, FALSE);
+        PFstatsEvent(fd, PF_STAT_MISS);
         if ((error = PFbufInternalAlloc(&bpage, writefcn)) != PFE_OK) {
-            *fpage = NULL;
+            *bpagep = NULL;
             return error;
         }
 
-        if ((error = (*readfcn)(fd, pagenum, &bpage->fpage)) != PFE_OK) {
+        /* a page found in the victim cache has been referenced before */
+        bpage->reused = FALSE;
+        if (PFvcacheOn && PFvcacheRead(fd, pagenum, bpage->fpage) == PFE_OK)
+            bpage->reused = TRUE;
+        else if ((error = (*readfcn)(fd, pagenum, bpage->fpage)) != PFE_OK) {
             PFbufUnlink(bpage);
             PFbufInsertFree(bpage);
-            *fpage = NULL;
+            *bpagep = NULL;
             return error;
         }
 
         if ((error = PFhashInsert(fd, pagenum, bpage)) != PFE_OK) {
             PFbufUnlink(bpage);
             PFbufInsertFree(bpage);
+            *bpagep = NULL;
             return error;
         }
 
         bpage->fd = fd;
         bpage->page = pagenum;
         bpage->dirty = FALSE;
+        bpage->reclsn = 0;
     } else if (bpage->fixed) {
-        *fpage = &bpage->fpage;
+        *bpagep = bpage;
         PFerrno = PFE_PAGEFIXED;
         return PFerrno;
+    } else {
+        PFtrace(fd, pagenum, PF_TRACE_GET, FALSE, TRUE);
+        PFstatsEvent(fd, PF_STAT_HIT);
+        PFbufExclusive(bpage, TRUE);
+        bpage->reused = TRUE;
     }
     PF_logical_reads++;
 
     bpage->fixed = TRUE;
-    *fpage = &bpage->fpage;
+    if (PFwalOn && (error = PFwalCapture(bpage)) != PFE_OK) {
+        bpage->fixed = FALSE;
+        PFbufShare(bpage);
+        *bpagep = NULL;
+        return error;
+    }
+    /* keep the image a snapshot may still need */
+    if (PFsnapOn && (error = PFsnapCapture(bpage)) != PFE_OK) {
+        if (bpage->before != NULL)
+            PFwalDiscard(bpage);
+        bpage->fixed = FALSE;
+        PFbufShare(bpage);
+        *bpagep = NULL;
+        return error;
+    }
+    *bpagep = bpage;
     return PFE_OK;
 }
 
-/* Unfix a page in buffer */
-int PFbufUnfix(int fd, int pagenum, int dirty) {
+/* Get a page from the file and fix it in buffer; "bpage" is set to its
+buffer page (also when the page is already fixed). */
+int PFbufFix(int fd, int pagenum, PFbpage **bpagep, int (*readfcn)(int, int, PFfpage *), int (*writefcn)(int, int, PFfpage *)) {
+    return PFbufFixHint(NULL, fd, pagenum, bpagep, readfcn, writefcn);
+}
+
+/* Get a page from the file and fix it in buffer */
+int PFbufGet(int fd, int pagenum, PFfpage **fpage, int (*readfcn)(int, int, PFfpage *), int (*writefcn)(int, int, PFfpage *)) {
     PFbpage *bpage;
+    int error;
 
-    if ((bpage = PFhashFind(fd, pagenum)) == NULL) {
-        PFerrno = PFE_PAGENOTINBUF;
-        return PFerrno;
-    }
+    error = PFbufFix(fd, pagenum, &bpage, readfcn, writefcn);
+    *fpage = (bpage != NULL) ? bpage->fpage : NULL;
+    return error;
+}
+
+/* Unfix the buffer page "bpage" returned by PFbufFix() */
+int PFbufUnfixHandle(PFbpage *bpage, int dirty) {
+    int error;
 
     if (!bpage->fixed) {
         PFerrno = PFE_PAGEUNFIXED;
         return PFerrno;
     }
 
-    if (dirty)
+    if (dirty) {
         bpage->dirty = TRUE;
+        if (bpage->cleaning)
+            bpage->redirty = TRUE;
+    }
+
+    /* log what changed since the page was fixed in a transaction */
+    if (bpage->before != NULL) {
+        if (bpage->dirty) {
+            if ((error = PFwalLogPage(bpage)) != PFE_OK)
+                return error;
+        } else
+            PFwalDiscard(bpage);
+    }
+    if (bpage->snapbefore != NULL && (error = PFsnapCommit(bpage)) != PFE_OK)
+        return error;
 
+    PFtrace(bpage->fd, bpage->page, PF_TRACE_UNFIX, dirty, TRUE);
     bpage->fixed = FALSE;
+    PFbufShare(bpage);
     PFbufUnlink(bpage);
     PFbufLinkHead(bpage);
 
     return PFE_OK;
 }
 
+/* Unfix a page in buffer */
+int PFbufUnfix(int fd, int pagenum, int dirty) {
+    PFbpage *bpage;
+
+    if ((bpage = PFhashFind(fd, pagenum)) == NULL) {
+        PFerrno = PFE_PAGENOTINBUF;
+        return PFerrno;
+    }
+
+    return PFbufUnfixHandle(bpage, dirty);
+}
+
 /* Allocate a buffer and associate with a page */
 int PFbufAlloc(int fd, int pagenum, PFfpage **fpage, int (*writefcn)(int, int, PFfpage *)) {
     PFbpage *bpage;
@@ -211,9 +504,13 @@ int PFbufAlloc(int fd, int pagenum, PFfpage **fpage, int (*writefcn)(int, int, P
         return PFerrno;
     }
 
+    PFtrace(fd, pagenum, PF_TRACE_ALLOC, TRUE, FALSE);
     if ((error = PFbufInternalAlloc(&bpage, writefcn)) != PFE_OK)
         return error;
 
+    if (PFvcacheOn)
+        PFvcacheDropPage(fd, pagenum);
+
     if ((error = PFhashInsert(fd, pagenum, bpage)) != PFE_OK) {
         PFbufUnlink(bpage);
         PFbufInsertFree(bpage);
@@ -226,8 +523,47 @@ int PFbufAlloc(int fd, int pagenum, PFfpage **fpage, int (*writefcn)(int, int, P
     bpage->page = pagenum;
     bpage->fixed = TRUE;
     bpage->dirty = FALSE;
+    bpage->reclsn = 0;
+    bpage->reused = FALSE;
+
+    /* a new page starts zeroed, with no LSN, so its log records replay onto zeros */
+    memset(bpage->fpage, 0, sizeof(PFfpage));
+    if (PFwalOn && (error = PFwalCapture(bpage)) != PFE_OK) {
+        bpage->fixed = FALSE;
+        PFbufShare(bpage);
+        PFbufDiscard(fd, pagenum);
+        return error;
+    }
+
+    *fpage = bpage->fpage;
+    return PFE_OK;
+}
+
+/* Drop page "pagenum" of file "fd" from the buffer without writing it back;
+   used when the page no longer exists in the file. It must not be fixed. */
+int PFbufDiscard(int fd, int pagenum) {
+    PFbpage *bpage;
+    int error;
+
+    if ((bpage = PFhashFind(fd, pagenum)) == NULL)
+        return PFE_OK;
+    if (bpage->fixed) {
+        PFerrno = PFE_PAGEFIXED;
+        return PFerrno;
+    }
+    /* the cleaner must not write the page once it is gone */
+    if (bpage->cleaning)
+        PFcleanWait(bpage);
 
-    *fpage = &bpage->fpage;
+    PFbufExclusive(bpage, TRUE);
+    if ((error = PFhashDelete(fd, pagenum)) != PFE_OK) {
+        PFbufShare(bpage);
+        return error;
+    }
+    bpage->dirty = FALSE;
+    bpage->reclsn = 0;
+    PFbufUnlink(bpage);
+    PFbufInsertFree(bpage);
     return PFE_OK;
 }
 
@@ -236,6 +572,12 @@ int PFbufReleaseFile(int fd, int (*writefcn)(int, int, PFfpage *)) {
     PFbpage *bpage = PFfirstbpage, *temppage;
     int error;
 
+    PFtrace(fd, -1, PF_TRACE_RELEASE, FALSE, FALSE);
+
+    /* cached pages of a closed file would be found under a reused fd */
+    if (PFvcacheOn)
+        PFvcacheDropFile(fd);
+
     while (bpage != NULL) {
         if (bpage->fd == fd) {
             if (bpage->fixed) {
@@ -243,10 +585,17 @@ int PFbufReleaseFile(int fd, int (*writefcn)(int, int, PFfpage *)) {
                 return PFerrno;
             }
 
-            if (bpage->dirty && (error = (*writefcn)(fd, bpage->page, &bpage->fpage)) != PFE_OK)
-                return error;
+            if (bpage->cleaning)
+                PFcleanWait(bpage);
+            if (bpage->dirty) {
+                if ((error = (*writefcn)(fd, bpage->page, bpage->fpage)) != PFE_OK)
+                    return error;
+                PFstatsEvent(fd, PF_STAT_WRITEBACK);
+            }
             bpage->dirty = FALSE;
+            bpage->reclsn = 0;
 
+            PFbufExclusive(bpage, TRUE);
             if ((error = PFhashDelete(fd, bpage->page)) != PFE_OK) {
                 printf("Internal error: PFbufReleaseFile()\n");
                 exit(1);
@@ -263,27 +612,128 @@ int PFbufReleaseFile(int fd, int (*writefcn)(int, int, PFfpage *)) {
     return PFE_OK;
 }
 
-/* Mark page as used (dirty) */
-int PFbufUsed(int fd, int pagenum) {
+/* Write back the unfixed dirty pages whose recLSN is below "lsn", so
+   that a checkpoint can move the redo start point past it */
+int PFbufFlushBefore(PF_LSN lsn, int (*writefcn)(int, int, PFfpage *)) {
     PFbpage *bpage;
+    int error;
 
-    if ((bpage = PFhashFind(fd, pagenum)) == NULL) {
-        PFerrno = PFE_PAGENOTINBUF;
-        return PFerrno;
+    for (bpage = PFfirstbpage; bpage != NULL; bpage = bpage->nextpage) {
+        if (bpage->fixed || !bpage->dirty || bpage->reclsn == 0 || bpage->reclsn >= lsn)
+            continue;
+        if (bpage->cleaning) {
+            PFcleanWait(bpage);
+            if (!bpage->dirty)
+                continue;
+        }
+        if ((error = (*writefcn)(bpage->fd, bpage->page, bpage->fpage)) != PFE_OK)
+            return error;
+        bpage->dirty = FALSE;
+        bpage->reclsn = 0;
+        PFstatsEvent(bpage->fd, PF_STAT_WRITEBACK);
+    }
+    return PFE_OK;
+}
+
+/* Fill "dpt" with up to "max" dirty pages that have a recLSN, as PF fds
+   (the caller maps them to log file ids); return how many there are */
+int PFbufDirtyTable(PFckpt_page *dpt, int max) {
+    PFbpage *bpage;
+    int n = 0;
+
+    for (bpage = PFfirstbpage; bpage != NULL; bpage = bpage->nextpage) {
+        if (!bpage->dirty || bpage->reclsn == 0)
+            continue;
+        if (n < max) {
+            dpt[n].fileid = bpage->fd;
+            dpt[n].page = bpage->page;
+            dpt[n].reclsn = bpage->reclsn;
+        }
+        n++;
+    }
+    return n;
+}
+
+/* Save the image of each page of file "fd" fixed now that a snapshot just
+   begun still sees; called by PF_BeginSnapshot() */
+int PFbufSnapCapture(int fd) {
+    PFbpage *bpage;
+    int error;
+
+    for (bpage = PFfirstbpage; bpage != NULL; bpage = bpage->nextpage) {
+        if (bpage->fd == fd && bpage->fixed && (error = PFsnapCapture(bpage)) != PFE_OK)
+            return error;
+    }
+    return PFE_OK;
+}
+
+/* Pin page "pagenum" of file "fd" read-only for PF_ReadShared(); may be
+   called from any thread. NULL, with "*error" set, if the page is not in
+   the buffer (PFE_PAGENOTINBUF) or this thread has its frame to itself
+   (PFE_PAGEFIXED). PFerrno is not set. */
+PFbpage *PFbufReadShared(int fd, int pagenum, int *error) {
+    PFbpage *bpage;
+    unsigned int version;
+
+    for (;;) {
+        if ((bpage = PFhashFindShared(fd, pagenum)) == NULL) {
+            *error = PFE_PAGENOTINBUF;
+            return NULL;
+        }
+        if ((version = PFload(&bpage->version)) & 1) {
+            *error = PFE_PAGEFIXED;
+            return NULL;
+        }
+        __atomic_add_fetch(&bpage->shared, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&bpage->version, __ATOMIC_SEQ_CST) == version)
+            break;
+        /* fixed or evicted since: look again */
+        __atomic_sub_fetch(&bpage->shared, 1, __ATOMIC_RELEASE);
+    }
+
+    /* the entry found may have been stale, the frame reused since */
+    if (bpage->fd != fd || bpage->page != pagenum) {
+        PFbufReleaseShared(bpage);
+        *error = PFE_PAGENOTINBUF;
+        return NULL;
     }
+    *error = PFE_OK;
+    return bpage;
+}
 
+/* Drop a pin taken by PFbufReadShared() */
+void PFbufReleaseShared(PFbpage *bpage) {
+    __atomic_sub_fetch(&bpage->shared, 1, __ATOMIC_RELEASE);
+}
+
+/* Mark the fixed buffer page "bpage" as used (dirty) */
+int PFbufUsedHandle(PFbpage *bpage) {
     if (!bpage->fixed) {
         PFerrno = PFE_PAGEUNFIXED;
         return PFerrno;
     }
 
     bpage->dirty = TRUE;
+    if (bpage->cleaning)
+        bpage->redirty = TRUE;
     PFbufUnlink(bpage);
     PFbufLinkHead(bpage);
 
     return PFE_OK;
 }
 
+/* Mark page as used (dirty) */
+int PFbufUsed(int fd, int pagenum) {
+    PFbpage *bpage;
+
+    if ((bpage = PFhashFind(fd, pagenum)) == NULL) {
+        PFerrno = PFE_PAGENOTINBUF;
+        return PFerrno;
+    }
+
+    return PFbufUsedHandle(bpage);
+}
+
 /* Print current buffer pages */
 void PFbufPrint() {
     PFbpage *bpage;
@@ -295,6 +745,6 @@ void PFbufPrint() {
         for (bpage = PFfirstbpage; bpage != NULL; bpage = bpage->nextpage)
             printf("%d\t%d\t%d\t%d\t%p\n",
                    bpage->fd, bpage->page, (int)bpage->fixed,
-                   (int)bpage->dirty, (void *)&bpage->fpage);
+                   (int)bpage->dirty, (void *)bpage->fpage);
     }
 }
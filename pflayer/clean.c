@@ -0,0 +1,313 @@
+/* clean.c: background write-back of dirty buffer pages. The interface
+routines are: PF_CleanerStart() and PF_CleanerStop().
+
+A buffer miss needs a frame. The buffer manager takes the first clean page
+among the PF_VICTIM_WINDOW coldest unfixed pages (see PF_SetVictimWindow())
+and only writes a dirty victim inline when the window holds no clean one;
+such misses are counted as victim_writes in PF_Stats. While the cleaner
+runs, the dirty pages the window passes over are handed to it instead of
+being left for a later miss: the page is copied into one of PF_CLEAN_SLOTS
+slots and the frame marked "cleaning". The cleaner thread writes the
+copies queued at once, each after the log is flushed up to its LSN, and
+then fsyncs each file written once (not at all while the write-ahead log is
+open, whose checkpoints and PF_CloseFile() sync the files).
+
+The buffer manager is not thread safe, so the thread never touches a frame:
+a finished write is only recorded in its slot. The buffer manager reaps
+finished slots on its next frame allocation, and a page not unfixed dirty
+again since its copy was taken becomes clean. A cleaning frame is never
+evicted; writing it back or dropping it (closing its file, shrinking the
+pool, checkpoints) first waits for its copy to be written. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include "pf.h"
+#include "pftypes.h"
+
+int PFcleanOn = FALSE;                   /* TRUE while the thread runs */
+static PFclean_slot *PFcleanslots = NULL; /* PF_CLEAN_SLOTS slots */
+static int PFcleanpending = 0;           /* slots queued or being written */
+static int PFcleandone = 0;              /* slots written, not yet reaped */
+static int PFcleanstop = FALSE;          /* the thread is to exit once idle */
+static pthread_t PFcleanthread;
+static pthread_mutex_t PFcleanmutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t PFcleanwork = PTHREAD_COND_INITIALIZER;  /* slots queued, or stop */
+static pthread_cond_t PFcleanfinish = PTHREAD_COND_INITIALIZER; /* slots written */
+
+static unsigned long long PFcleanNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+/* Write the copies of the slots in "batch" ("n" of them) and fsync each
+   file once; runs in the cleaner thread without the mutex held */
+static void PFcleanWrite(int *batch, int n)
+{
+    PFclean_slot *cs, *other;
+    unsigned long long start;
+    ssize_t nwritten;
+    int i, j, error;
+
+    for (i = 0; i < n; i++) {
+        cs = &PFcleanslots[batch[i]];
+        cs->error = PFE_OK;
+        cs->sync_ns = 0;
+        if (cs->lsn != 0 && (error = PFwalFlush(cs->lsn)) != PFE_OK) {
+            cs->error = error;
+            continue;
+        }
+        start = PFcleanNow();
+        nwritten = pwrite(cs->unixfd, &cs->image, sizeof(PFfpage), PFpageOffset(cs->page));
+        cs->write_ns = PFcleanNow() - start;
+        if (nwritten != (ssize_t)sizeof(PFfpage)) {
+            cs->error = (nwritten < 0) ? PFE_UNIX : PFE_INCOMPLETEWRITE;
+            perror("PFcleanWrite: write");
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        cs = &PFcleanslots[batch[i]];
+        if (!cs->sync || cs->error != PFE_OK)
+            continue;
+        /* a file written by an earlier slot of the batch is already synced */
+        for (j = 0; j < i; j++) {
+            other = &PFcleanslots[batch[j]];
+            if (other->fd == cs->fd && other->sync && other->error == PFE_OK)
+                break;
+        }
+        if (j < i)
+            continue;
+        start = PFcleanNow();
+        error = (fsync(cs->unixfd) == -1) ? PFE_UNIX : PFE_OK;
+        cs->sync_ns = PFcleanNow() - start;
+        if (error != PFE_OK) {
+            perror("PFcleanWrite: fsync");
+            for (j = i; j < n; j++) {
+                other = &PFcleanslots[batch[j]];
+                if (other->fd == cs->fd)
+                    other->error = error;
+            }
+        }
+    }
+
+    for (i = 0; i < n; i++)
+        close(PFcleanslots[batch[i]].unixfd);
+}
+
+/* The cleaner thread: write whatever is queued, until stopped */
+static void *PFcleanMain(void *arg)
+{
+    int batch[PF_CLEAN_SLOTS], n, i;
+
+    (void)arg;
+    pthread_mutex_lock(&PFcleanmutex);
+    for (;;) {
+        for (n = 0, i = 0; i < PF_CLEAN_SLOTS; i++) {
+            if (PFcleanslots[i].state == PF_CLEAN_QUEUED) {
+                PFcleanslots[i].state = PF_CLEAN_WRITING;
+                batch[n++] = i;
+            }
+        }
+        if (n == 0) {
+            if (PFcleanstop)
+                break;
+            pthread_cond_wait(&PFcleanwork, &PFcleanmutex);
+            continue;
+        }
+
+        pthread_mutex_unlock(&PFcleanmutex);
+        PFcleanWrite(batch, n);
+        pthread_mutex_lock(&PFcleanmutex);
+
+        for (i = 0; i < n; i++)
+            PFcleanslots[batch[i]].state = PF_CLEAN_DONE;
+        PFcleanpending -= n;
+        PFcleandone += n;
+        pthread_cond_broadcast(&PFcleanfinish);
+    }
+    pthread_mutex_unlock(&PFcleanmutex);
+    return NULL;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Hand the unfixed dirty page of "bpage" to the cleaner thread: its
+	checksummed copy is queued for writing and the frame is marked as
+	being cleaned. Pages are not handed over while the double-write
+	buffer is open, whose batches already make writes cheap.
+
+RETURN VALUE:
+	TRUE if the page was queued
+	FALSE if not (no free slot, or no descriptor for the thread)
+*****************************************************************************/
+int PFcleanSchedule(PFbpage *bpage)
+{
+    PFclean_slot *cs = NULL;
+    int i, unixfd;
+
+    if (PFdwOn || PFcleanpending + PFcleandone >= PF_CLEAN_SLOTS)
+        return FALSE;
+    /* only this thread frees slots, so a free one stays free */
+    for (i = 0; i < PF_CLEAN_SLOTS; i++) {
+        if (PFcleanslots[i].state == PF_CLEAN_FREE) {
+            cs = &PFcleanslots[i];
+            break;
+        }
+    }
+    if (cs == NULL || (unixfd = PFfileDup(bpage->fd)) < 0)
+        return FALSE;
+
+    cs->bpage = bpage;
+    cs->fd = bpage->fd;
+    cs->page = bpage->page;
+    cs->unixfd = unixfd;
+    cs->sync = !PFwalOn;
+    cs->lsn = PFwalOn ? bpage->fpage->lsn : 0;
+    memcpy(&cs->image, bpage->fpage, sizeof(PFfpage));
+    cs->image.checksum = PFpageChecksum(&cs->image);
+    bpage->cleaning = TRUE;
+    bpage->redirty = FALSE;
+
+    pthread_mutex_lock(&PFcleanmutex);
+    cs->state = PF_CLEAN_QUEUED;
+    PFcleanpending++;
+    pthread_cond_signal(&PFcleanwork);
+    pthread_mutex_unlock(&PFcleanmutex);
+    return TRUE;
+}
+
+/* Record the writes the cleaner thread finished: their frames are no
+   longer being cleaned, and are clean unless dirtied since the copy */
+void PFcleanReap(void)
+{
+    PFclean_slot *cs;
+    PFbpage *bpage;
+    int i;
+
+    pthread_mutex_lock(&PFcleanmutex);
+    for (i = 0; i < PF_CLEAN_SLOTS && PFcleandone > 0; i++) {
+        cs = &PFcleanslots[i];
+        if (cs->state != PF_CLEAN_DONE)
+            continue;
+        bpage = cs->bpage;
+        bpage->cleaning = FALSE;
+        if (cs->error == PFE_OK) {
+            PFfileWritten(cs->fd, cs->write_ns, cs->sync_ns, cs->sync);
+            PFstatsEvent(cs->fd, PF_STAT_WRITEBACK);
+            PFstatsEvent(cs->fd, PF_STAT_CLEANED);
+            if (!bpage->redirty) {
+                bpage->dirty = FALSE;
+                bpage->reclsn = 0;
+            }
+        }
+        bpage->redirty = FALSE;
+        cs->state = PF_CLEAN_FREE;
+        PFcleandone--;
+    }
+    pthread_mutex_unlock(&PFcleanmutex);
+}
+
+/* Wait until the copy of "bpage" is written, and reap it */
+void PFcleanWait(PFbpage *bpage)
+{
+    int i;
+
+    pthread_mutex_lock(&PFcleanmutex);
+    for (;;) {
+        for (i = 0; i < PF_CLEAN_SLOTS; i++) {
+            if (PFcleanslots[i].state != PF_CLEAN_FREE && PFcleanslots[i].bpage == bpage)
+                break;
+        }
+        if (i == PF_CLEAN_SLOTS || PFcleanslots[i].state == PF_CLEAN_DONE)
+            break;
+        pthread_cond_wait(&PFcleanfinish, &PFcleanmutex);
+    }
+    pthread_mutex_unlock(&PFcleanmutex);
+    PFcleanReap();
+}
+
+/* Wait until some queued copy is written, and reap; FALSE if none was queued */
+int PFcleanWaitAny(void)
+{
+    int queued;
+
+    pthread_mutex_lock(&PFcleanmutex);
+    queued = PFcleanpending + PFcleandone > 0;
+    while (PFcleandone == 0 && PFcleanpending > 0)
+        pthread_cond_wait(&PFcleanfinish, &PFcleanmutex);
+    pthread_mutex_unlock(&PFcleanmutex);
+    PFcleanReap();
+    return queued;
+}
+
+/* Wait until every queued copy is written, and reap */
+void PFcleanDrain(void)
+{
+    pthread_mutex_lock(&PFcleanmutex);
+    while (PFcleanpending > 0)
+        pthread_cond_wait(&PFcleanfinish, &PFcleanmutex);
+    pthread_mutex_unlock(&PFcleanmutex);
+    PFcleanReap();
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Start the cleaner thread: from now on dirty pages that victim
+	selection passes over are written back in the background, so that
+	later misses find clean victims. Starting it again does nothing.
+
+RETURN VALUE:
+	PFE_OK if ok
+	PFE_NOMEM if out of memory
+	PFE_UNIX if the thread cannot be created
+*****************************************************************************/
+int PF_CleanerStart(void)
+{
+    int error;
+
+    if (PFcleanOn)
+        return PFE_OK;
+    if (PFcleanslots == NULL && (PFcleanslots = calloc(PF_CLEAN_SLOTS, sizeof(PFclean_slot))) == NULL) {
+        PFerrno = PFE_NOMEM;
+        return PFerrno;
+    }
+
+    PFcleanstop = FALSE;
+    if ((error = pthread_create(&PFcleanthread, NULL, PFcleanMain, NULL)) != 0) {
+        fprintf(stderr, "PF_CleanerStart: pthread_create: %s\n", strerror(error));
+        PFerrno = PFE_UNIX;
+        return PFerrno;
+    }
+    PFcleanOn = TRUE;
+    return PFE_OK;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Wait for the queued write-backs, then stop the cleaner thread. Dirty
+	victims are written inline again.
+
+RETURN VALUE:
+	PFE_OK
+*****************************************************************************/
+int PF_CleanerStop(void)
+{
+    if (!PFcleanOn)
+        return PFE_OK;
+
+    PFcleanDrain();
+    pthread_mutex_lock(&PFcleanmutex);
+    PFcleanstop = TRUE;
+    pthread_cond_signal(&PFcleanwork);
+    pthread_mutex_unlock(&PFcleanmutex);
+    pthread_join(PFcleanthread, NULL);
+    PFcleanOn = FALSE;
+    return PFE_OK;
+}
@@ -0,0 +1,363 @@
+/* dblwr.c: double-write buffer. The interface routines are: PF_DWOpen(),
+PF_DWClose(), PF_DWFlush(), PF_DWGetStats() and PF_DWResetStats().
+
+A page write interrupted by a crash can leave a page half old and half
+new, which its checksum detects but nothing can repair: the log only holds
+changed byte ranges. While the double-write buffer is open, PFwritefcn()
+hands pages to a batch in memory instead of writing them in place. A full
+batch (PF_DW_PAGES pages), or one that must reach the files because one is
+closed or a checkpoint runs, is written sequentially to a scratch file with
+a single fdatasync, then written in place, in file and page order, and each
+file written is fsynced once. Only then may the scratch file be reused, so
+at any time a page being written in place has an intact copy in the
+scratch file. PF_DWOpen() copies the pages of the last batch found there
+back to their files wherever the in-place page differs.
+
+This replaces the fsync per page write with two fsyncs per file and batch.
+Pages still in the batch are read from it. A page whose file name does not
+fit in a slot is written in place with an fsync, as without the buffer. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "pf.h"
+#include "pftypes.h"
+
+int PFdwOn = FALSE;                  /* TRUE while a scratch file is open */
+static int PFdwfd = -1;              /* unix fd of the scratch file */
+static PFdw_slot *PFdwbatch = NULL;  /* PF_DW_PAGES slots */
+static int PFdwcount = 0;            /* # of pages in the batch */
+static unsigned int PFdwseq = 0;     /* number of the last batch written */
+static int PFdwwritten = FALSE;      /* the scratch file holds a batch */
+static PF_DWStats PFdwstats;
+
+/* Find the slot of the batch holding page "pagenum" of file "fd"; -1 if none */
+static int PFdwFind(int fd, int pagenum)
+{
+    int i;
+
+    for (i = 0; i < PFdwcount; i++) {
+        if (PFdwbatch[i].fd == fd && PFdwbatch[i].pagenum == pagenum)
+            return i;
+    }
+    return -1;
+}
+
+/* CRC of slot "slot" with its crc field taken as 0 */
+static unsigned int PFdwSlotCrc(PFdw_slot *slot)
+{
+    unsigned int save = slot->crc, crc;
+
+    slot->crc = 0;
+    crc = PFcrc32(slot, sizeof(PFdw_slot), 0);
+    slot->crc = save;
+    return crc;
+}
+
+/* qsort order of batch slots: by file, then page */
+static int PFdwCompare(const void *a, const void *b)
+{
+    const PFdw_slot *x = &PFdwbatch[*(const int *)a];
+    const PFdw_slot *y = &PFdwbatch[*(const int *)b];
+
+    if (x->fd != y->fd)
+        return x->fd < y->fd ? -1 : 1;
+    return (x->pagenum > y->pagenum) - (x->pagenum < y->pagenum);
+}
+
+/* Empty the scratch file: called once its last batch is safely in place */
+static int PFdwTruncate(void)
+{
+    if (ftruncate(PFdwfd, 0) == -1 || fdatasync(PFdwfd) == -1) {
+        PFerrno = PFE_UNIX;
+        perror("PFdwTruncate");
+        return PFerrno;
+    }
+    PFdwwritten = FALSE;
+    return PFE_OK;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Repair the files named in scratch file "unixfd": read the slots, keep
+	the valid ones of the newest batch, and write each of their pages in
+	place wherever the page on disk differs (torn, never written, or
+	older). The files repaired are fsynced. Slots of older batches are
+	ignored: a batch is only written once the previous one is in place.
+
+RETURN VALUE:
+	PFE_OK if ok
+	PF error code otherwise
+*****************************************************************************/
+static int PFdwRestore(int unixfd)
+{
+    PFfpage *page;
+    ssize_t n;
+    int i, nslots, fd, repaired, error = PFE_OK;
+    unsigned int newest = 0;
+
+    n = pread(unixfd, PFdwbatch, PF_DW_PAGES * sizeof(PFdw_slot), 0);
+    if (n < 0) {
+        PFerrno = PFE_UNIX;
+        perror("PF_DWOpen: read");
+        return PFerrno;
+    }
+    nslots = (int)(n / sizeof(PFdw_slot));
+
+    for (i = 0; i < nslots; i++) {
+        PFdwbatch[i].fname[PF_DW_NAMELEN - 1] = '\0';
+        if (PFdwbatch[i].crc != PFdwSlotCrc(&PFdwbatch[i])) {
+            PFdwbatch[i].batch = 0;  /* torn slot: its batch never reached the files */
+            continue;
+        }
+        if (PFdwbatch[i].batch > newest)
+            newest = PFdwbatch[i].batch;
+    }
+    PFdwseq = newest;
+    if (newest == 0)
+        return PFE_OK;
+
+    if ((page = malloc(sizeof(PFfpage))) == NULL) {
+        PFerrno = PFE_NOMEM;
+        return PFerrno;
+    }
+    for (i = 0; i < nslots; i++) {
+        if (PFdwbatch[i].batch != newest)
+            continue;
+        /* a file destroyed since has nothing to repair */
+        if ((fd = open(PFdwbatch[i].fname, O_RDWR)) < 0)
+            continue;
+        n = pread(fd, page, sizeof(PFfpage), PFpageOffset(PFdwbatch[i].pagenum));
+        repaired = FALSE;
+        if (n != (ssize_t)sizeof(PFfpage) || memcmp(page, &PFdwbatch[i].page, sizeof(PFfpage)) != 0) {
+            if (pwrite(fd, &PFdwbatch[i].page, sizeof(PFfpage), PFpageOffset(PFdwbatch[i].pagenum))
+                    != (ssize_t)sizeof(PFfpage) || fsync(fd) == -1) {
+                PFerrno = error = PFE_UNIX;
+                perror("PF_DWOpen: restore");
+            } else
+                repaired = TRUE;
+        }
+        close(fd);
+        if (error != PFE_OK)
+            break;
+        if (repaired)
+            PFdwstats.restored++;
+    }
+    free(page);
+    return error;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Open the double-write scratch file "fname", creating it if needed.
+	If it holds a batch left by a crash, pages of that batch are first
+	written back to their files, which must exist under the same names,
+	so that no page is left torn. From then on page writes are batched
+	through the file. Call it before PF_WALOpen(), whose recovery reads
+	the pages, and before opening any file. An open scratch file is
+	closed first.
+
+RETURN VALUE:
+	PFE_OK if ok
+	PF error code otherwise
+*****************************************************************************/
+int PF_DWOpen(const char *fname)
+{
+    int error;
+
+    if (PFdwOn && (error = PF_DWClose()) != PFE_OK)
+        return error;
+
+    if ((PFdwbatch = malloc(PF_DW_PAGES * sizeof(PFdw_slot))) == NULL) {
+        PFerrno = PFE_NOMEM;
+        return PFerrno;
+    }
+    if ((PFdwfd = open(fname, O_CREAT | O_RDWR, 0664)) < 0) {
+        PFerrno = PFE_UNIX;
+        perror("PF_DWOpen: open");
+        free(PFdwbatch);
+        PFdwbatch = NULL;
+        return PFerrno;
+    }
+
+    memset(&PFdwstats, 0, sizeof(PFdwstats));
+    if ((error = PFdwRestore(PFdwfd)) != PFE_OK || (error = PFdwTruncate()) != PFE_OK) {
+        close(PFdwfd);
+        PFdwfd = -1;
+        free(PFdwbatch);
+        PFdwbatch = NULL;
+        return error;
+    }
+
+    PFdwcount = 0;
+    PFdwOn = TRUE;
+    return PFE_OK;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Write the pending batch, empty and close the scratch file. Page
+	writes are fsynced one by one again.
+
+RETURN VALUE:
+	PFE_OK if ok
+	PF error code otherwise; the buffer stays open if the batch could
+	not be written
+*****************************************************************************/
+int PF_DWClose(void)
+{
+    int error;
+
+    if (!PFdwOn)
+        return PFE_OK;
+    if ((error = PFdwFlush()) != PFE_OK)
+        return error;
+
+    PFdwOn = FALSE;
+    error = PFdwTruncate();
+    if (close(PFdwfd) == -1 && error == PFE_OK) {
+        PFerrno = error = PFE_UNIX;
+        perror("PF_DWClose: close");
+    }
+    PFdwfd = -1;
+    free(PFdwbatch);
+    PFdwbatch = NULL;
+    return error;
+}
+
+/* Write the pending batch now */
+int PF_DWFlush(void)
+{
+    return PFdwOn ? PFdwFlush() : PFE_OK;
+}
+
+/* Copy the double-write statistics into "stats" */
+void PF_DWGetStats(PF_DWStats *stats)
+{
+    *stats = PFdwstats;
+}
+
+/* Zero the double-write statistics */
+void PF_DWResetStats(void)
+{
+    memset(&PFdwstats, 0, sizeof(PFdwstats));
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Called by PFwritefcn() for page "pagenum" of file "fd", whose checksum
+	is set. The page replaces its copy in the batch, or joins the batch,
+	which is written first if it is full.
+
+RETURN VALUE:
+	PFE_OK if ok
+	PF error code otherwise
+*****************************************************************************/
+int PFdwWrite(int fd, int pagenum, const PFfpage *fpage)
+{
+    const char *fname = PFfileName(fd);
+    PFdw_slot *slot;
+    int i, error;
+
+    if (strlen(fname) >= PF_DW_NAMELEN) {
+        PFdwstats.direct++;
+        if ((error = PFwritePage(fd, pagenum, fpage)) != PFE_OK)
+            return error;
+        return PFwalOn ? PFE_OK : PFfileSync(fd);
+    }
+
+    PFdwstats.pages++;
+    if ((i = PFdwFind(fd, pagenum)) != -1) {
+        PFdwbatch[i].page = *fpage;
+        PFdwstats.merged++;
+        return PFE_OK;
+    }
+
+    if (PFdwcount == PF_DW_PAGES && (error = PFdwFlush()) != PFE_OK)
+        return error;
+
+    slot = &PFdwbatch[PFdwcount++];
+    memset(slot, 0, offsetof(PFdw_slot, page));
+    strcpy(slot->fname, fname);
+    slot->pagenum = pagenum;
+    slot->fd = fd;
+    slot->page = *fpage;
+    return PFE_OK;
+}
+
+/* Called by PFreadfcn(): copy page "pagenum" of file "fd" into "fpage" if
+   it is in the batch; PFE_HASHNOTFOUND if it is not */
+int PFdwRead(int fd, int pagenum, PFfpage *fpage)
+{
+    int i;
+
+    if ((i = PFdwFind(fd, pagenum)) == -1)
+        return PFE_HASHNOTFOUND;
+    *fpage = PFdwbatch[i].page;
+    PFdwstats.hits++;
+    return PFE_OK;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Write the batch: to the scratch file with one write and an
+	fdatasync, then each page in place, in file and page order, then an
+	fsync of each file written. The batch is empty afterwards.
+
+RETURN VALUE:
+	PFE_OK if ok
+	PF error code otherwise; the batch is kept
+*****************************************************************************/
+int PFdwFlush(void)
+{
+    int order[PF_DW_PAGES];
+    size_t len;
+    int i, s, error;
+
+    if (PFdwcount == 0)
+        return PFE_OK;
+
+    PFdwseq++;
+    for (i = 0; i < PFdwcount; i++) {
+        PFdwbatch[i].batch = PFdwseq;
+        PFdwbatch[i].crc = PFdwSlotCrc(&PFdwbatch[i]);
+        order[i] = i;
+    }
+    len = PFdwcount * sizeof(PFdw_slot);
+    if (pwrite(PFdwfd, PFdwbatch, len, 0) != (ssize_t)len || fdatasync(PFdwfd) == -1) {
+        PFerrno = PFE_UNIX;
+        perror("PFdwFlush: scratch write");
+        return PFerrno;
+    }
+    PFdwwritten = TRUE;
+    PFdwstats.batches++;
+
+    qsort(order, PFdwcount, sizeof(int), PFdwCompare);
+    for (i = 0; i < PFdwcount; i++) {
+        s = order[i];
+        if ((error = PFwritePage(PFdwbatch[s].fd, PFdwbatch[s].pagenum, &PFdwbatch[s].page)) != PFE_OK)
+            return error;
+    }
+    for (i = 0; i < PFdwcount; i++) {
+        s = order[i];
+        if (i > 0 && PFdwbatch[s].fd == PFdwbatch[order[i - 1]].fd)
+            continue;
+        if ((error = PFfileSync(PFdwbatch[s].fd)) != PFE_OK)
+            return error;
+        PFdwstats.fsyncs++;
+    }
+
+    PFdwcount = 0;
+    return PFE_OK;
+}
+
+/* Called by PF_DestroyFile(): empty the scratch file, whose last batch is
+   in place, so that a file later created under the same name is never
+   "repaired" with pages of the old one */
+int PFdwForget(void)
+{
+    return PFdwwritten ? PFdwTruncate() : PFE_OK;
+}
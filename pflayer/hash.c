@@ -2,6 +2,15 @@
  * hash.c
  * Functions to facilitate finding the buffer page given
  * a file descriptor and a page number
+ *
+ * PFhashFindShared() probes the table without any lock, from threads other
+ * than the one using the PF layer. Writers only ever publish fully built
+ * entries and tables with release stores, and nothing a reader may still
+ * hold is freed before PFhashInit(): a resized table's old buckets are kept
+ * on a retired list, and deleted entries are recycled through a free list.
+ * A reader racing with a writer may thus follow a stale link and miss a
+ * page that is there, but never touches freed memory; a hit is validated
+ * against the frame itself (PFbufReadShared()).
  */
 
  #include <stdio.h>
@@ -9,18 +18,86 @@
  #include "pf.h"
  #include "pftypes.h"
  
- /* Hash table */
- static PFhash_entry *PFhashtbl[PF_HASH_TBL_SIZE];
+ /* A bucket array; replaced whole on a resize, so that a reader always
+    sees a size that matches its buckets */
+ typedef struct PFhashtab {
+     struct PFhashtab *retired;  /* arrays replaced before this one */
+     int size;
+     PFhash_entry *bucket[];
+ } PFhashtab;
+
+ /* Hash table: PFhashtbl->size buckets, doubled when it holds more than
+    PF_HASH_LOAD entries per bucket so chains stay short as the pool grows */
+ static PFhashtab *PFhashtbl = NULL;
+ static int PFhashsize = 0;
+ static int PFhashcount = 0;  /* # of entries */
+ static PFhash_entry *PFhashfree = NULL;  /* deleted entries, for reuse, linked by preventry */
  
  /****************************************************************************
   * Initialize the hash table entries.
-  * Must be called before any of the other hash functions are used.
+  * Must be called before any of the other hash functions are used, and
+  * while no PFhashFindShared() runs.
   ****************************************************************************/
  void PFhashInit(void)
  {
-     for (int i = 0; i < PF_HASH_TBL_SIZE; i++) {
-         PFhashtbl[i] = NULL;
+     PFhash_entry *entry, *next;
+     PFhashtab *tbl, *older;
+
+     for (int i = 0; i < PFhashsize; i++) {
+         for (entry = PFhashtbl->bucket[i]; entry != NULL; entry = next) {
+             next = entry->nextentry;
+             free(entry);
+         }
+     }
+     for (entry = PFhashfree; entry != NULL; entry = next) {
+         next = entry->preventry;
+         free(entry);
+     }
+     for (tbl = PFhashtbl; tbl != NULL; tbl = older) {
+         older = tbl->retired;
+         free(tbl);
+     }
+     PFhashtbl = NULL;
+     PFhashsize = 0;
+     PFhashcount = 0;
+     PFhashfree = NULL;
+ }
+ 
+ /****************************************************************************
+  * Rehash all entries into "newsize" buckets.
+  *
+  * Returns:
+  *   PFE_OK     if successful
+  *   PFE_NOMEM  if memory allocation fails (the table is unchanged)
+  ****************************************************************************/
+ static int PFhashResize(int newsize)
+ {
+     PFhashtab *newtbl = calloc(1, sizeof(PFhashtab) + newsize * sizeof(PFhash_entry *));
+ 
+     if (newtbl == NULL) {
+         PFerrno = PFE_NOMEM;
+         return PFerrno;
+     }
+     newtbl->size = newsize;
+     newtbl->retired = PFhashtbl;
+ 
+     for (int i = 0; i < PFhashsize; i++) {
+         PFhash_entry *entry = PFhashtbl->bucket[i], *next;
+         for (; entry != NULL; entry = next) {
+             int bucket = PFhash(entry->fd, entry->page, newsize);
+             next = entry->nextentry;
+             entry->preventry = NULL;
+             PFstore(&entry->nextentry, newtbl->bucket[bucket]);
+             if (newtbl->bucket[bucket] != NULL)
+                 newtbl->bucket[bucket]->preventry = entry;
+             newtbl->bucket[bucket] = entry;
+         }
      }
+ 
+     /* the old array stays readable until PFhashInit() */
+     PFstore(&PFhashtbl, newtbl);
+     PFhashsize = newsize;
+     return PFE_OK;
  }
  
  /****************************************************************************
@@ -33,8 +110,12 @@
   ****************************************************************************/
  PFbpage *PFhashFind(int fd, int page)
  {
-     int bucket = PFhash(fd, page);
-     for (PFhash_entry *entry = PFhashtbl[bucket]; entry != NULL; entry = entry->nextentry) {
+     PFstatsEvent(fd, PF_STAT_PROBE);
+     if (PFhashsize == 0)
+         return NULL;
+ 
+     int bucket = PFhash(fd, page, PFhashsize);
+     for (PFhash_entry *entry = PFhashtbl->bucket[bucket]; entry != NULL; entry = entry->nextentry) {
          if (entry->fd == fd && entry->page == page) {
              return entry->bpage; /* Found it */
          }
@@ -42,6 +123,32 @@
      return NULL; /* Not found */
  }
  
+ /****************************************************************************
+  * PFhashFind() for threads other than the PF one: no lock is taken and
+  * nothing is written. At most PF_HASH_MAXPROBE entries are visited, since
+  * a chain being changed may lead a reader astray.
+  *
+  * Returns:
+  *   NULL if not found (the page may still be in the buffer),
+  *   Pointer to the buffer page that held the page at some point during
+  *   the call; the caller must check the frame.
+  ****************************************************************************/
+ PFbpage *PFhashFindShared(int fd, int page)
+ {
+     PFhashtab *tbl = PFload(&PFhashtbl);
+     PFhash_entry *entry;
+     int n = 0;
+ 
+     if (tbl == NULL)
+         return NULL;
+     for (entry = PFload(&tbl->bucket[PFhash(fd, page, tbl->size)]);
+          entry != NULL && n < PF_HASH_MAXPROBE; entry = PFload(&entry->nextentry), n++) {
+         if (PFload(&entry->fd) == fd && PFload(&entry->page) == page)
+             return PFload(&entry->bpage);
+     }
+     return NULL;
+ }
+ 
  /*****************************************************************************
   * Insert the (fd, page, bpage) mapping into the hash table.
   *
@@ -57,25 +164,34 @@
          return PFerrno;
      }
  
-     int bucket = PFhash(fd, page);
-     PFhash_entry *entry = malloc(sizeof(PFhash_entry));
+     if (PFhashsize == 0 && PFhashResize(PF_HASH_TBL_SIZE) != PFE_OK)
+         return PFerrno;
+     if (PFhashcount >= PF_HASH_LOAD * PFhashsize)
+         PFhashResize(2 * PFhashsize); /* on failure keep the longer chains */
+ 
+     int bucket = PFhash(fd, page, PFhashsize);
+     PFhash_entry *entry = PFhashfree;
  
-     if (entry == NULL) {
+     if (entry != NULL)
+         PFhashfree = entry->preventry;
+     else if ((entry = malloc(sizeof(PFhash_entry))) == NULL) {
          PFerrno = PFE_NOMEM;
          return PFerrno;
      }
  
-     entry->fd = fd;
-     entry->page = page;
-     entry->bpage = bpage;
-     entry->nextentry = PFhashtbl[bucket];
+     /* a reader may still be looking at a recycled entry */
+     PFstore(&entry->fd, fd);
+     PFstore(&entry->page, page);
+     PFstore(&entry->bpage, bpage);
+     PFstore(&entry->nextentry, PFhashtbl->bucket[bucket]);
      entry->preventry = NULL;
  
-     if (PFhashtbl[bucket] != NULL) {
-         PFhashtbl[bucket]->preventry = entry;
+     if (PFhashtbl->bucket[bucket] != NULL) {
+         PFhashtbl->bucket[bucket]->preventry = entry;
      }
  
-     PFhashtbl[bucket] = entry;
+     PFstore(&PFhashtbl->bucket[bucket], entry);
+     PFhashcount++;
      return PFE_OK;
  }
  
@@ -89,23 +205,31 @@
   ****************************************************************************/
  int PFhashDelete(int fd, int page)
  {
-     int bucket = PFhash(fd, page);
-     PFhash_entry *entry = PFhashtbl[bucket];
+     if (PFhashsize == 0) {
+         PFerrno = PFE_HASHNOTFOUND;
+         return PFerrno;
+     }
+ 
+     int bucket = PFhash(fd, page, PFhashsize);
+     PFhash_entry *entry = PFhashtbl->bucket[bucket];
  
      while (entry != NULL) {
          if (entry->fd == fd && entry->page == page) {
              /* Found the entry to delete */
-             if (entry == PFhashtbl[bucket]) {
-                 PFhashtbl[bucket] = entry->nextentry;
+             if (entry == PFhashtbl->bucket[bucket]) {
+                 PFstore(&PFhashtbl->bucket[bucket], entry->nextentry);
              }
              if (entry->preventry != NULL) {
-                 entry->preventry->nextentry = entry->nextentry;
+                 PFstore(&entry->preventry->nextentry, entry->nextentry);
              }
              if (entry->nextentry != NULL) {
                  entry->nextentry->preventry = entry->preventry;
              }
  
-             free(entry);
+             /* not freed: a reader on it goes on along the chain */
+             entry->preventry = PFhashfree;
+             PFhashfree = entry;
+             PFhashcount--;
              return PFE_OK;
          }
          entry = entry->nextentry;
@@ -120,12 +244,12 @@
   ****************************************************************************/
  void PFhashPrint(void)
  {
-     for (int i = 0; i < PF_HASH_TBL_SIZE; i++) {
+     for (int i = 0; i < PFhashsize; i++) {
          printf("bucket %d\n", i);
-         if (PFhashtbl[i] == NULL) {
+         if (PFhashtbl->bucket[i] == NULL) {
              printf("\tempty\n");
          } else {
-             for (PFhash_entry *entry = PFhashtbl[i]; entry != NULL; entry = entry->nextentry) {
+             for (PFhash_entry *entry = PFhashtbl->bucket[i]; entry != NULL; entry = entry->nextentry) {
                  printf("\tfd: %d, page: %d, bpage: %p\n",
                         entry->fd, entry->page, (void *)entry->bpage);
              }
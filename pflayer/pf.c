@@ -6,6 +6,8 @@
 #include <sys/types.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <errno.h>
+#include <time.h>
 #include "pf.h"
 #include "pftypes.h"
 
@@ -16,11 +18,22 @@
 
 int PFerrno = PFE_OK; /* last error message */
 
-/* table of opened files */
-static PFftab_ele PFftab[PF_FTAB_SIZE];
+/* table of opened files, grown by PFftabGrow() */
+static PFftab_ele *PFftab = NULL;
+static int PFftabsize = 0;      /* # of entries in PFftab */
+static int PFftabfree = -1;     /* first free entry, linked through nextfree */
+static int *PFnamehash = NULL;  /* PFftabsize chains of open entries, by name */
+
+/* unix descriptor pool: entries holding a descriptor are kept on an LRU
+   list; beyond PFmaxunixfds the least recently used one is parked (closed)
+   and reopened by PFunixfd() on its next I/O */
+static int PFmaxunixfds = PF_MAX_UNIXFDS;
+static int PFnumunixfds = 0;    /* # of descriptors held */
+static int PFfdhead = -1;       /* most recently used */
+static int PFfdtail = -1;       /* least recently used */
 
 /* true if file descriptor fd is invalid */
-#define PFinvalidFd(fd) ((fd) < 0 || (fd) >= PF_FTAB_SIZE || PFftab[fd].fname == NULL)
+#define PFinvalidFd(fd) ((fd) < 0 || (fd) >= PFftabsize || PFftab[fd].fname == NULL)
 
 /* true if page number "pagenum" of file "fd" is invalid */
 #define PFinvalidPagenum(fd,pagenum) ((pagenum) < 0 || (pagenum) >= PFftab[fd].hdr.numpages)
@@ -32,6 +45,9 @@ unsigned long PF_page_alloc = 0;
 unsigned long PF_page_evicted = 0;
 unsigned long PF_logical_reads = 0;   
 unsigned long PF_logical_writes = 0;
+
+/* statistics summed over all files since the last PF_ResetGlobalStats() */
+static PF_Stats PFgstats;
 /********************************************************* */
 
 /****************** Internal Support Functions *****************************/
@@ -49,6 +65,16 @@ static char *savestr(const char *str)
     return s;
 }
 
+/* FNV-1a hash of a file name */
+static unsigned int PFnameHash(const char *fname)
+{
+    unsigned int h = 2166136261u;
+
+    while (*fname)
+        h = (h ^ (unsigned char)*fname++) * 16777619u;
+    return h;
+}
+
 /****************************************************************************
 SPECIFICATIONS:
 	Find the index in PFftab[] whose "fname" field matches "fname".
@@ -58,111 +84,648 @@ RETURN VALUE:
 *****************************************************************************/
 static int PFtabFindFname(const char *fname)
 {
-    for (int i = 0; i < PF_FTAB_SIZE; i++) {
-        if (PFftab[i].fname != NULL && strcmp(PFftab[i].fname, fname) == 0)
+    int i;
+
+    if (PFftabsize == 0)
+        return -1;
+
+    for (i = PFnamehash[PFnameHash(fname) % PFftabsize]; i != -1; i = PFftab[i].namenext) {
+        if (strcmp(PFftab[i].fname, fname) == 0)
             return i;
     }
     return -1;
 }
 
+/* Link the open entry "fd" into its name hash chain */
+static void PFnameLink(int fd)
+{
+    unsigned int b = PFnameHash(PFftab[fd].fname) % PFftabsize;
+
+    PFftab[fd].namenext = PFnamehash[b];
+    PFnamehash[b] = fd;
+}
+
+/* Unlink the open entry "fd" from its name hash chain */
+static void PFnameUnlink(int fd)
+{
+    int *link = &PFnamehash[PFnameHash(PFftab[fd].fname) % PFftabsize];
+
+    while (*link != fd)
+        link = &PFftab[*link].namenext;
+    *link = PFftab[fd].namenext;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Double the open file table (or create it with PF_FTAB_SIZE entries),
+	put the new entries on the free list lowest index first and rehash
+	the open entries. Entry indices are unchanged.
+
+RETURN VALUE:
+	PFE_OK if ok
+	PFE_NOMEM if out of memory
+*****************************************************************************/
+static int PFftabGrow(void)
+{
+    int newsize = (PFftabsize == 0) ? PF_FTAB_SIZE : 2 * PFftabsize;
+    PFftab_ele *newtab;
+    int *newhash;
+    int i;
+
+    if ((newtab = realloc(PFftab, newsize * sizeof(PFftab_ele))) == NULL) {
+        PFerrno = PFE_NOMEM;
+        return PFerrno;
+    }
+    PFftab = newtab;
+
+    if ((newhash = realloc(PFnamehash, newsize * sizeof(int))) == NULL) {
+        PFerrno = PFE_NOMEM;
+        return PFerrno;
+    }
+    PFnamehash = newhash;
+
+    for (i = newsize - 1; i >= PFftabsize; i--) {
+        memset(&PFftab[i], 0, sizeof(PFftab_ele));
+        PFftab[i].fname = NULL;
+        PFftab[i].unixfd = -1;
+        PFftab[i].fdprev = PFftab[i].fdnext = -1;
+        PFftab[i].nextfree = PFftabfree;
+        PFftabfree = i;
+    }
+
+    for (i = 0; i < newsize; i++)
+        PFnamehash[i] = -1;
+    PFftabsize = newsize;
+    for (i = 0; i < PFftabsize; i++) {
+        if (PFftab[i].fname != NULL)
+            PFnameLink(i);
+    }
+    return PFE_OK;
+}
+
 /****************************************************************************
 SPECIFICATIONS:
-	Find a free entry in the open file table PFftab and return its index.
+	Take a free entry off the free list of the open file table, growing
+	the table if there is none. The entry must be returned with
+	PFftabPutFree() if it is not used.
 
 RETURN VALUE:
 	>=0 : index of free entry
-	-1  : no free entry
+	-1  : no free entry (out of memory)
 *****************************************************************************/
 static int PFftabFindFree(void)
 {
-    for (int i = 0; i < PF_FTAB_SIZE; i++) {
-        if (PFftab[i].fname == NULL)
-            return i;
+    int fd;
+
+    if (PFftabfree == -1 && PFftabGrow() != PFE_OK)
+        return -1;
+
+    fd = PFftabfree;
+    PFftabfree = PFftab[fd].nextfree;
+    return fd;
+}
+
+/* Put entry "fd" back on the free list */
+static void PFftabPutFree(int fd)
+{
+    PFftab[fd].fname = NULL;
+    PFftab[fd].nextfree = PFftabfree;
+    PFftabfree = fd;
+}
+
+/* Unlink entry "fd" from the descriptor LRU list */
+static void PFfdUnlink(int fd)
+{
+    if (PFftab[fd].fdprev != -1)
+        PFftab[PFftab[fd].fdprev].fdnext = PFftab[fd].fdnext;
+    else
+        PFfdhead = PFftab[fd].fdnext;
+
+    if (PFftab[fd].fdnext != -1)
+        PFftab[PFftab[fd].fdnext].fdprev = PFftab[fd].fdprev;
+    else
+        PFfdtail = PFftab[fd].fdprev;
+
+    PFftab[fd].fdprev = PFftab[fd].fdnext = -1;
+}
+
+/* Link entry "fd" as the head of the descriptor LRU list */
+static void PFfdLinkHead(int fd)
+{
+    PFftab[fd].fdprev = -1;
+    PFftab[fd].fdnext = PFfdhead;
+    if (PFfdhead != -1)
+        PFftab[PFfdhead].fdprev = fd;
+    PFfdhead = fd;
+    if (PFfdtail == -1)
+        PFfdtail = fd;
+}
+
+/* Close the unix descriptor of entry "fd"; the file stays open in PF */
+static int PFfdPark(int fd)
+{
+    int unixfd = PFftab[fd].unixfd;
+
+    PFfdUnlink(fd);
+    PFftab[fd].unixfd = -1;
+    PFnumunixfds--;
+    if (close(unixfd) == -1) {
+        PFerrno = PFE_UNIX;
+        perror("PFfdPark: close");
+        return PFerrno;
     }
-    return -1;
+    return PFE_OK;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Open a unix descriptor for entry "fd", whose descriptor is parked or
+	not yet opened, and make it the most recently used one. When the pool
+	is at its cap, or the process is out of descriptors, the least
+	recently used ones are parked first.
+
+RETURN VALUE:
+	>=0 : unix descriptor
+	PFE_UNIX if the file cannot be opened
+*****************************************************************************/
+static int PFfdOpen(int fd)
+{
+    int unixfd;
+
+    while (PFnumunixfds >= PFmaxunixfds && PFfdtail != -1)
+        PFfdPark(PFfdtail);
+
+    while ((unixfd = open(PFftab[fd].fname, O_RDWR)) < 0) {
+        if ((errno != EMFILE && errno != ENFILE) || PFfdtail == -1) {
+            PFerrno = PFE_UNIX;
+            perror("PFfdOpen: open");
+            return PFerrno;
+        }
+        PFfdPark(PFfdtail);
+    }
+
+    PFftab[fd].unixfd = unixfd;
+    PFnumunixfds++;
+    PFfdLinkHead(fd);
+    return unixfd;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Return the unix descriptor of the open file "fd", reopening it if it
+	was parked, and make it the most recently used one.
+
+RETURN VALUE:
+	>=0 : unix descriptor
+	PFE_UNIX if the file cannot be reopened
+*****************************************************************************/
+static int PFunixfd(int fd)
+{
+    int unixfd;
+
+    if ((unixfd = PFftab[fd].unixfd) < 0) {
+        PFstatsEvent(fd, PF_STAT_REOPEN);
+        return PFfdOpen(fd);
+    }
+
+    if (PFfdhead != fd) {
+        PFfdUnlink(fd);
+        PFfdLinkHead(fd);
+    }
+    return unixfd;
+}
+
+/* monotonic clock in nanoseconds, used for the latency histograms */
+static unsigned long long PFnow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+/* add one latency sample to "hist" */
+void PFhistAdd(PF_Hist *hist, unsigned long long ns)
+{
+    int b = 0;
+
+    if (ns > 0)
+        b = 63 - __builtin_clzll(ns);
+    if (b >= PF_HIST_BUCKETS)
+        b = PF_HIST_BUCKETS - 1;
+
+    hist->bucket[b]++;
+    hist->count++;
+    hist->total_ns += ns;
+    if (ns > hist->max_ns)
+        hist->max_ns = ns;
+}
+
+/* record a latency sample for file "fd" and in the global stats */
+#define PFstatsLatency(fd, field, ns) \
+    do { PFhistAdd(&PFftab[fd].stats.field, (ns)); PFhistAdd(&PFgstats.field, (ns)); } while (0)
+
+/****************************************************************************
+SPECIFICATIONS:
+	Count one buffer event (PF_STAT_HIT, PF_STAT_MISS, PF_STAT_EVICT,
+	PF_STAT_WRITEBACK, PF_STAT_PROBE, PF_STAT_REOPEN, PF_STAT_VICTIMWRITE
+	or PF_STAT_CLEANED) against file "fd" and the global statistics.
+	Called by the buffer manager, the cleaner, the hash table and the
+	descriptor pool.
+*****************************************************************************/
+void PFstatsEvent(int fd, int event)
+{
+    PF_Stats *fs = PFinvalidFd(fd) ? NULL : &PFftab[fd].stats;
+
+    switch (event) {
+        case PF_STAT_HIT:
+            PFgstats.hits++;
+            if (fs) fs->hits++;
+            break;
+        case PF_STAT_MISS:
+            PFgstats.misses++;
+            if (fs) fs->misses++;
+            break;
+        case PF_STAT_EVICT:
+            PFgstats.evictions++;
+            if (fs) fs->evictions++;
+            break;
+        case PF_STAT_WRITEBACK:
+            PFgstats.dirty_writebacks++;
+            if (fs) fs->dirty_writebacks++;
+            break;
+        case PF_STAT_PROBE:
+            PFgstats.probes++;
+            if (fs) fs->probes++;
+            break;
+        case PF_STAT_REOPEN:
+            PFgstats.reopens++;
+            if (fs) fs->reopens++;
+            break;
+        case PF_STAT_VICTIMWRITE:
+            PFgstats.victim_writes++;
+            if (fs) fs->victim_writes++;
+            break;
+        case PF_STAT_CLEANED:
+            PFgstats.cleaner_writes++;
+            if (fs) fs->cleaner_writes++;
+            break;
+    }
+}
+
+/* Checksum of page "fpage": CRC-32 of the whole PFfpage with its checksum
+   field taken as 0 */
+unsigned int PFpageChecksum(const PFfpage *fpage)
+{
+    static const unsigned int zero = 0;
+    unsigned int crc;
+
+    crc = PFcrc32(fpage, offsetof(PFfpage, checksum), 0);
+    crc = PFcrc32(&zero, sizeof(zero), crc);
+    crc = PFcrc32((const char *)fpage + offsetof(PFfpage, lsn),
+                  sizeof(PFfpage) - offsetof(PFfpage, lsn), crc);
+    return crc;
+}
+
+/* Is "fpage" all zeros, as a page of the file that was never written is? */
+static int PFpageZero(const PFfpage *fpage)
+{
+    static const PFfpage zero;
+    return memcmp(fpage, &zero, sizeof(PFfpage)) == 0;
 }
 
 /****************************************************************************
 SPECIFICATIONS:
 	Read the page numbered "pagenum" from the file indexed by "fd"
-	into the page buffer "buf".
+	into the page buffer "buf". While the double-write buffer is open
+	a page still waiting in its batch is taken from there. Every page
+	written by a file of PF_VERSION carries a checksum, and it is
+	verified. A page that is all zeros was never written (a hole left
+	by pages written past it) and reads as a zeroed page.
 
 RETURN VALUE:
 	PFE_OK if ok
+	PFE_EOF if the page lies past the end of the file (quietly: recovery
+	replays pages that were allocated but never written)
+	PFE_CHECKSUM if the page read does not match its checksum (a torn
+	write, see PF_DWOpen())
 	PF error code otherwise
 *****************************************************************************/
 int PFreadfcn(int fd, int pagenum, PFfpage *buf)
 {
     ssize_t nread;
     off_t offset;
+    unsigned long long start;
+    int unixfd;
+
+    if (PFdwOn && PFdwRead(fd, pagenum, buf) == PFE_OK)
+        return PFE_OK;
 
-    /* Seek to the page's byte offset: header + pagenum * PF_PAGE_SIZE */
-    offset = (off_t)PF_HDR_SIZE + (off_t)pagenum * (off_t)PF_PAGE_SIZE;
-    if (lseek(PFftab[fd].unixfd, offset, L_SET) == -1) {
+    /* Seek to the page's byte offset: header + pagenum * sizeof(PFfpage) */
+    offset = PFpageOffset(pagenum);
+    if ((unixfd = PFunixfd(fd)) < 0)
+        return unixfd;
+    if (lseek(unixfd, offset, L_SET) == -1) {
         PFerrno = PFE_UNIX;
         perror("lseek (read)");
         return PFerrno;
     }
 
-    nread = read(PFftab[fd].unixfd, (char *)buf, PF_PAGE_SIZE);
-    if (nread != (ssize_t)PF_PAGE_SIZE) {
+    start = PFnow();
+    nread = read(unixfd, (char *)buf, sizeof(PFfpage));
+    PFstatsLatency(fd, read_lat, PFnow() - start);
+    if (nread == 0) {
+        PFerrno = PFE_EOF;
+        return PFerrno;
+    }
+    if (nread != (ssize_t)sizeof(PFfpage)) {
         PFerrno = (nread < 0) ? PFE_UNIX : PFE_INCOMPLETEREAD;
         if (nread >= 0)
-            fprintf(stderr, "PFreadfcn: Incomplete read of page %d (got %zd bytes, expected %d)\n",
-                    pagenum, nread, PF_PAGE_SIZE);
+            fprintf(stderr, "PFreadfcn: Incomplete read of page %d (got %zd bytes, expected %zu)\n",
+                    pagenum, nread, sizeof(PFfpage));
         else
             perror("read");
         return PFerrno;
     }
 
     PF_physical_reads++;
+    PFftab[fd].stats.bytes_read += sizeof(PFfpage);
+    PFgstats.bytes_read += sizeof(PFfpage);
+
+    if (buf->checksum != PFpageChecksum(buf) && !PFpageZero(buf)) {
+        fprintf(stderr, "PFreadfcn: checksum mismatch on page %d of %s\n",
+                pagenum, PFftab[fd].fname);
+        PFerrno = PFE_CHECKSUM;
+        return PFerrno;
+    }
     return PFE_OK;
 }
 
 /****************************************************************************
 SPECIFICATIONS:
-	Write the page numbered "pagenum" from buffer "buf" into the file indexed by "fd".
+	Write page "fpage" in place as page "pagenum" of the file indexed by
+	"fd", without an fsync; the file is marked as needing one.
 
 RETURN VALUE:
 	PFE_OK if ok
 	PF error code otherwise
 *****************************************************************************/
-int PFwritefcn(int fd, int pagenum, PFfpage *buf)
+int PFwritePage(int fd, int pagenum, const PFfpage *fpage)
 {
     ssize_t nwritten;
-    off_t offset;
+    unsigned long long start;
+    int unixfd;
 
-    /* Seek to the page's byte offset: header + pagenum * PF_PAGE_SIZE */
-    offset = (off_t)PF_HDR_SIZE + (off_t)pagenum * (off_t)PF_PAGE_SIZE;
-    if (lseek(PFftab[fd].unixfd, offset, L_SET) == -1) {
-        PFerrno = PFE_UNIX;
-        perror("lseek (write)");
-        return PFerrno;
-    }
+    if ((unixfd = PFunixfd(fd)) < 0)
+        return unixfd;
 
-    nwritten = write(PFftab[fd].unixfd, (char *)buf, PF_PAGE_SIZE);
-    if (nwritten != (ssize_t)PF_PAGE_SIZE) {
+    start = PFnow();
+    nwritten = pwrite(unixfd, (const char *)fpage, sizeof(PFfpage), PFpageOffset(pagenum));
+    PFstatsLatency(fd, write_lat, PFnow() - start);
+    if (nwritten != (ssize_t)sizeof(PFfpage)) {
         PFerrno = (nwritten < 0) ? PFE_UNIX : PFE_INCOMPLETEWRITE;
         if (nwritten >= 0)
-            fprintf(stderr, "PFwritefcn: Incomplete write of page %d (wrote %zd bytes, expected %d)\n",
-                    pagenum, nwritten, PF_PAGE_SIZE);
+            fprintf(stderr, "PFwritePage: Incomplete write of page %d (wrote %zd bytes, expected %zu)\n",
+                    pagenum, nwritten, sizeof(PFfpage));
         else
             perror("write");
         return PFerrno;
     }
 
-    /* Ensure data is flushed to disk on the real UNIX fd */
-    if (fsync(PFftab[fd].unixfd) == -1) {
-        /* fsync failure is a Unix error */
+    PFftab[fd].needsync = TRUE;
+    PF_physical_writes++;
+    PFftab[fd].stats.bytes_written += sizeof(PFfpage);
+    PFgstats.bytes_written += sizeof(PFfpage);
+    return PFE_OK;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	fsync the file indexed by "fd" if it was written since its last fsync.
+
+RETURN VALUE:
+	PFE_OK if ok
+	PFE_UNIX if the fsync fails
+*****************************************************************************/
+int PFfileSync(int fd)
+{
+    unsigned long long start;
+    int unixfd;
+
+    if (!PFftab[fd].needsync)
+        return PFE_OK;
+    if ((unixfd = PFunixfd(fd)) < 0)
+        return unixfd;
+
+    start = PFnow();
+    if (fsync(unixfd) == -1) {
         PFerrno = PFE_UNIX;
         perror("fsync");
         return PFerrno;
     }
+    PFstatsLatency(fd, fsync_lat, PFnow() - start);
+    PFftab[fd].needsync = FALSE;
+    return PFE_OK;
+}
+
+/* A new unix descriptor of file "fd", for the cleaner thread to write
+   through while the file's own may be parked; the caller closes it */
+int PFfileDup(int fd)
+{
+    int unixfd;
+
+    if ((unixfd = PFunixfd(fd)) < 0)
+        return unixfd;
+    if ((unixfd = dup(unixfd)) < 0) {
+        PFerrno = PFE_UNIX;
+        return PFerrno;
+    }
+    return unixfd;
+}
 
+/* Account a page write of file "fd" done by the cleaner thread: "write_ns"
+   to write it and "sync_ns" to fsync the file (0 if it shared another
+   page's fsync). Without an fsync ("synced" FALSE) the file needs one. */
+void PFfileWritten(int fd, unsigned long long write_ns, unsigned long long sync_ns, int synced)
+{
+    PFstatsLatency(fd, write_lat, write_ns);
+    if (sync_ns != 0)
+        PFstatsLatency(fd, fsync_lat, sync_ns);
+    if (!synced)
+        PFftab[fd].needsync = TRUE;
     PF_physical_writes++;
+    PFftab[fd].stats.bytes_written += sizeof(PFfpage);
+    PFgstats.bytes_written += sizeof(PFfpage);
+}
+
+/* TRUE if "fd" is an open file */
+int PFfileValid(int fd)
+{
+    return !PFinvalidFd(fd);
+}
+
+/* Name of the open file "fd" */
+const char *PFfileName(int fd)
+{
+    return PFftab[fd].fname;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Write the page numbered "pagenum" from buffer "buf" into the file indexed by "fd".
+	The page's checksum is set first.
+	While the write-ahead log is open, the log is first flushed up to the
+	page's LSN. While the double-write buffer is open the page joins its
+	batch and reaches the file when the batch is written. Otherwise the
+	page is written in place, and fsynced unless the log is open: the
+	log makes it recoverable and PF_CloseFile() syncs the file once.
+
+RETURN VALUE:
+	PFE_OK if ok
+	PF error code otherwise
+*****************************************************************************/
+int PFwritefcn(int fd, int pagenum, PFfpage *buf)
+{
+    int error;
+
+    /* WAL before data: the records describing the page must be durable first */
+    if (PFwalOn && buf->lsn != 0 && (error = PFwalFlush(buf->lsn)) != PFE_OK)
+        return error;
+
+    buf->checksum = PFpageChecksum(buf);
+    if (PFdwOn)
+        return PFdwWrite(fd, pagenum, buf);
+
+    if ((error = PFwritePage(fd, pagenum, buf)) != PFE_OK)
+        return error;
+
+    /* Without a log, ensure data is flushed to disk on the real UNIX fd */
+    if (!PFwalOn)
+        return PFfileSync(fd);
+    return PFE_OK;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Return the write-ahead log file id of the open file "fd". The first
+	time the file is named in the log a FILE record binds a new id to
+	its name.
+
+RETURN VALUE:
+	file id (>= 0) if ok
+	PF error code otherwise
+*****************************************************************************/
+int PFfileLogId(int fd)
+{
+    if (PFftab[fd].logid < 0)
+        PFftab[fd].logid = PFwalLogFile(-1, PFftab[fd].fname);
+    return PFftab[fd].logid;
+}
+
+/* Bind the open file "fd" to log file id "logid" (recovery) */
+void PFfileSetLogId(int fd, int logid)
+{
+    PFftab[fd].logid = logid;
+}
+
+/* PF fd of the open file named "fname", -1 if none */
+int PFfileByName(const char *fname)
+{
+    return PFtabFindFname(fname);
+}
+
+/* PF fd of the open file with log file id "logid", -1 if none */
+int PFfileByLogId(int logid)
+{
+    int fd;
+
+    for (fd = 0; fd < PFftabsize; fd++) {
+        if (PFftab[fd].fname != NULL && PFftab[fd].logid == logid)
+            return fd;
+    }
+    return -1;
+}
+
+/* Replace the in-memory header of open file "fd" (undo of a HEADER record) */
+void PFfileSetHdr(int fd, const PFhdr_str *hdr)
+{
+    PFftab[fd].hdr = *hdr;
+    PFftab[fd].hdrchanged = TRUE;
+}
+
+/* Copy the in-memory header of open file "fd" into "hdr" */
+void PFfileGetHdr(int fd, PFhdr_str *hdr)
+{
+    *hdr = PFftab[fd].hdr;
+}
+
+/* Log a FILE record again, under its current id, for each open file that
+   has one, so that a checkpoint names every file its records refer to */
+int PFfileLogAll(void)
+{
+    int fd, error;
+
+    for (fd = 0; fd < PFftabsize; fd++) {
+        if (PFftab[fd].fname != NULL && PFftab[fd].logid >= 0 &&
+            (error = PFwalLogFile(PFftab[fd].logid, PFftab[fd].fname)) < 0)
+            return error;
+    }
+    return PFE_OK;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Write the changed headers of all open files and fsync the files
+	written since their last fsync. Called by a checkpoint after the
+	pages it writes back, which first leave the double-write batch. As
+	for pages, the log is first made durable up to the LSN of a header.
+
+RETURN VALUE:
+	PFE_OK if ok
+	PF error code otherwise
+*****************************************************************************/
+int PFfileSyncAll(void)
+{
+    int fd, unixfd, error;
+
+    if (PFdwOn && (error = PFdwFlush()) != PFE_OK)
+        return error;
+
+    for (fd = 0; fd < PFftabsize; fd++) {
+        if (PFftab[fd].fname == NULL || (!PFftab[fd].hdrchanged && !PFftab[fd].needsync))
+            continue;
+        if ((unixfd = PFunixfd(fd)) < 0)
+            return unixfd;
+        if (PFftab[fd].hdrchanged) {
+            if (PFftab[fd].hdr.lsn != 0 && (error = PFwalFlush(PFftab[fd].hdr.lsn)) != PFE_OK)
+                return error;
+            if (pwrite(unixfd, &PFftab[fd].hdr, PF_HDR_SIZE, 0) != (ssize_t)PF_HDR_SIZE) {
+                PFerrno = PFE_HDRWRITE;
+                return PFerrno;
+            }
+            PFftab[fd].hdrchanged = 0;
+            PFftab[fd].needsync = TRUE;
+        }
+        if (PFftab[fd].needsync) {
+            if (fsync(unixfd) == -1) {
+                PFerrno = PFE_UNIX;
+                perror("PFfileSyncAll: fsync");
+                return PFerrno;
+            }
+            PFftab[fd].needsync = FALSE;
+        }
+    }
     return PFE_OK;
 }
 
+/* Forget all log file ids; called when a log is opened */
+void PFfileResetLogIds(void)
+{
+    int fd;
+
+    for (fd = 0; fd < PFftabsize; fd++)
+        PFftab[fd].logid = -1;
+}
+
 /************************* Interface Routines ****************************/
 
 /****************************************************************************
@@ -176,9 +739,57 @@ void PF_Init(void)
 {
     PFhashInit(); /* init the hash table */
 
-    for (int i = 0; i < PF_FTAB_SIZE; i++) {
-        PFftab[i].fname = NULL;
+    /* forget any open files; the table is recreated on the next open */
+    for (int i = 0; i < PFftabsize; i++) {
+        if (PFftab[i].fname != NULL) {
+            if (PFftab[i].unixfd >= 0)
+                close(PFftab[i].unixfd);
+            free(PFftab[i].fname);
+        }
+    }
+    free(PFftab);
+    free(PFnamehash);
+    PFftab = NULL;
+    PFnamehash = NULL;
+    PFftabsize = 0;
+    PFftabfree = -1;
+    PFnumunixfds = 0;
+    PFfdhead = PFfdtail = -1;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Cap the number of unix descriptors held for open paged files at
+	"maxfds". Any number of files can stay open; beyond the cap the least
+	recently used descriptors are closed and transparently reopened on
+	their next I/O. Descriptors over the new cap are closed at once.
+
+RETURN VALUE:
+	PFE_OK if ok
+	PFE_UNIX if "maxfds" < 1 or a descriptor cannot be closed
+*****************************************************************************/
+int PF_SetMaxUnixFds(int maxfds)
+{
+    int error = PFE_OK;
+
+    if (maxfds < 1) {
+        PFerrno = PFE_UNIX;
+        return PFerrno;
+    }
+
+    PFmaxunixfds = maxfds;
+    while (PFnumunixfds > PFmaxunixfds) {
+        int e = PFfdPark(PFfdtail);
+        if (e != PFE_OK)
+            error = e;
     }
+    return error;
+}
+
+/* Number of unix descriptors currently held by the open file table */
+int PF_NumUnixFds(void)
+{
+    return PFnumunixfds;
 }
 /* Create the paged file */
 int PF_CreateFile(const char *fname)
@@ -197,8 +808,11 @@ int PF_CreateFile(const char *fname)
         return PFerrno;
     }
 
+    hdr.magic = PF_MAGIC;
+    hdr.version = PF_VERSION;
     hdr.firstfree = PF_PAGE_LIST_END; /* no free page yet */
     hdr.numpages = 0;
+    hdr.lsn = 0;
 
     /* write the header to the file using PF_HDR_SIZE so reading uses same size */
     written = write(fd, (char *)&hdr, PF_HDR_SIZE);
@@ -234,6 +848,7 @@ int PF_CreateFile(const char *fname)
 int PF_OpenFile(const char *fname)
 {
     int fd;
+    int unixfd;
 
     /* if file already open, return error */
     if (PFtabFindFname(fname) != -1) {
@@ -241,34 +856,48 @@ int PF_OpenFile(const char *fname)
         return PFerrno;
     }
 
-    if ((fd = PFftabFindFree()) < 0) { // no free entry in PFftab then error
+    if ((fd = PFftabFindFree()) < 0) { // no free entry in PFftab and it cannot grow then error
         PFerrno = PFE_FTABFULL;
         return PFerrno;
     }
 
-    if ((PFftab[fd].unixfd = open(fname, O_RDWR)) < 0) { // open file fails then error
-        PFerrno = PFE_UNIX;
-        perror("PF_OpenFile: open");
+    if ((PFftab[fd].fname = savestr(fname)) == NULL) {
+        PFftabPutFree(fd);
+        PFerrno = PFE_NOMEM;
         return PFerrno;
     }
 
+    if ((unixfd = PFfdOpen(fd)) < 0) { // open file fails then error
+        free(PFftab[fd].fname);
+        PFftabPutFree(fd);
+        return unixfd;
+    }
+
     /* read the file header */
     ssize_t count;
-    if ((count = read(PFftab[fd].unixfd, (char *)&PFftab[fd].hdr, PF_HDR_SIZE)) != (ssize_t)PF_HDR_SIZE) {
+    if ((count = read(unixfd, (char *)&PFftab[fd].hdr, PF_HDR_SIZE)) != (ssize_t)PF_HDR_SIZE) {
         PFerrno = (count < 0) ? PFE_UNIX : PFE_HDRREAD;
         if (count < 0) perror("PF_OpenFile: read header");
-        close(PFftab[fd].unixfd);
+        PFfdPark(fd);
+        free(PFftab[fd].fname);
+        PFftabPutFree(fd);
         return PFerrno;
     }
-
-    PFftab[fd].hdrchanged = 0; /* header not changed */
-
-    if ((PFftab[fd].fname = savestr(fname)) == NULL) {
-        close(PFftab[fd].unixfd);
-        PFerrno = PFE_NOMEM;
+    if (PFftab[fd].hdr.magic != PF_MAGIC || PFftab[fd].hdr.version != PF_VERSION) {
+        fprintf(stderr, "PF_OpenFile: %s is not a PF file of version %d\n", fname, PF_VERSION);
+        PFfdPark(fd);
+        free(PFftab[fd].fname);
+        PFftabPutFree(fd);
+        PFerrno = PFE_BADFILE;
         return PFerrno;
     }
 
+    PFftab[fd].hdrchanged = 0; /* header not changed */
+    PFftab[fd].logid = -1;
+    PFftab[fd].needsync = FALSE;
+    memset(&PFftab[fd].stats, 0, sizeof(PF_Stats));
+    PFnameLink(fd);
+
     return fd;
 }
 
@@ -290,6 +919,10 @@ int PF_DestroyFile(const char *fname)
         return PFerrno;
     }
 
+    /* the double-write scratch file must not restore pages into a later file of this name */
+    if (PFdwOn && PFdwForget() != PFE_OK)
+        return PFerrno;
+
     if (unlink(fname) != 0) {
         PFerrno = PFE_UNIX;
         return PFerrno;
@@ -301,6 +934,10 @@ int PF_DestroyFile(const char *fname)
 /****************************************************************************
 SPECIFICATIONS:
 	Close the file indexed by "fd". Pages must be unfixed first.
+	Its snapshots end.
+	The pending double-write batch is written, since it may hold pages
+	of the file. While the write-ahead log is open the file is fsynced
+	here, once, since page writes are not.
 
 RETURN VALUE:
 	PFE_OK if OK
@@ -309,6 +946,7 @@ RETURN VALUE:
 int PF_CloseFile(int fd)
 {
     int error;
+    int unixfd;
 
     if (PFinvalidFd(fd)) {
         PFerrno = PFE_FD;
@@ -317,14 +955,24 @@ int PF_CloseFile(int fd)
 
     if ((error = PFbufReleaseFile(fd, PFwritefcn)) != PFE_OK)
         return error;
+    if (PFsnapOn)
+        PFsnapDropFile(fd);
+    if (PFdwOn && (error = PFdwFlush()) != PFE_OK)
+        return error;
 
     if (PFftab[fd].hdrchanged) {
-        if (lseek(PFftab[fd].unixfd, 0, L_SET) == -1) {
+        if (PFwalOn && PFftab[fd].hdr.lsn != 0 &&
+            (error = PFwalFlush(PFftab[fd].hdr.lsn)) != PFE_OK)
+            return error;
+        if ((unixfd = PFunixfd(fd)) < 0)
+            return unixfd;
+
+        if (lseek(unixfd, 0, L_SET) == -1) {
             PFerrno = PFE_UNIX;
             return PFerrno;
         }
 
-        if (write(PFftab[fd].unixfd, (char *)&PFftab[fd].hdr, PF_HDR_SIZE) != PF_HDR_SIZE) {
+        if (write(unixfd, (char *)&PFftab[fd].hdr, PF_HDR_SIZE) != PF_HDR_SIZE) {
             PFerrno = PFE_HDRWRITE;
             return PFerrno;
         }
@@ -332,13 +980,22 @@ int PF_CloseFile(int fd)
         PFftab[fd].hdrchanged = 0;
     }
 
-    if (close(PFftab[fd].unixfd) == -1) {
-        PFerrno = PFE_UNIX;
-        return PFerrno;
+    if (PFwalOn) {
+        if ((unixfd = PFunixfd(fd)) < 0)
+            return unixfd;
+        if (fsync(unixfd) == -1) {
+            PFerrno = PFE_UNIX;
+            perror("PF_CloseFile: fsync");
+            return PFerrno;
+        }
     }
 
+    if (PFftab[fd].unixfd >= 0 && (error = PFfdPark(fd)) != PFE_OK)
+        return error;
+
+    PFnameUnlink(fd);
     free(PFftab[fd].fname);
-    PFftab[fd].fname = NULL;
+    PFftabPutFree(fd);
 
     return PFE_OK;
 }
@@ -348,13 +1005,16 @@ int PF_CloseFile(int fd)
 /* read header */
 int PFreadhdr(int fd, PFhdr_str *hdr){
     ssize_t nread;
-    if (lseek(PFftab[fd].unixfd, 0, L_SET) == -1) {
+    int unixfd;
+    if ((unixfd = PFunixfd(fd)) < 0)
+        return unixfd;
+    if (lseek(unixfd, 0, L_SET) == -1) {
         PFerrno = PFE_UNIX;
         perror("lseek (read hdr)");
         return PFerrno;
     }
 
-    nread = read(PFftab[fd].unixfd, (char *)hdr, PF_HDR_SIZE);
+    nread = read(unixfd, (char *)hdr, PF_HDR_SIZE);
     if (nread != (ssize_t)PF_HDR_SIZE) {
         PFerrno = (nread < 0) ? PFE_UNIX : PFE_INCOMPLETEREAD;
         if (nread >= 0)
@@ -368,13 +1028,16 @@ int PFreadhdr(int fd, PFhdr_str *hdr){
 /* write header */
 int PFwritehdr(int fd, PFhdr_str *hdr){
     ssize_t nwritten;
-    if (lseek(PFftab[fd].unixfd, 0, L_SET) == -1) {
+    int unixfd;
+    if ((unixfd = PFunixfd(fd)) < 0)
+        return unixfd;
+    if (lseek(unixfd, 0, L_SET) == -1) {
         PFerrno = PFE_UNIX;
         perror("lseek (write hdr)");
         return PFerrno;
     }
 
-    nwritten = write(PFftab[fd].unixfd, (char *)hdr, PF_HDR_SIZE);
+    nwritten = write(unixfd, (char *)hdr, PF_HDR_SIZE);
     if (nwritten != (ssize_t)PF_HDR_SIZE) {
         PFerrno = (nwritten < 0) ? PFE_UNIX : PFE_HDRWRITE;
         if (nwritten >= 0)
@@ -382,7 +1045,7 @@ int PFwritehdr(int fd, PFhdr_str *hdr){
         return PFerrno;
     }
     /* ensure header durability */
-    if (fsync(PFftab[fd].unixfd) == -1) {
+    if (fsync(unixfd) == -1) {
         PFerrno = PFE_UNIX;
         perror("fsync (hdr)");
         return PFerrno;
@@ -392,6 +1055,7 @@ int PFwritehdr(int fd, PFhdr_str *hdr){
 
 int PF_AllocPage(int fd, int *pagenum, char **pagebuf){
     PFfpage *fpage;	/* pointer to file page */
+PFhdr_str oldhdr;	/* header before the allocation, for the log */
 int error;
 
 	if (PFinvalidFd(fd)){
@@ -399,6 +1063,14 @@ int error;
 		return(PFerrno);
 	}
 
+	if (PFsnapOn && PFsnapCurrent(fd)){
+		/* the thread reads the file under a snapshot */
+		PFerrno = PFE_READONLY;
+		return(PFerrno);
+	}
+
+	oldhdr = PFftab[fd].hdr;
+
 	if (PFftab[fd].hdr.firstfree != PF_PAGE_LIST_END){
 		/* get a page from the free list */
 		*pagenum = PFftab[fd].hdr.firstfree;
@@ -437,6 +1109,9 @@ int error;
 	/* Mark the new page used */
 	fpage->nextfree = PF_PAGE_USED;
 
+	if (PFwalOn && (error=PFwalLogHeader(fd,&oldhdr,&PFftab[fd].hdr))!= PFE_OK)
+		return(error);
+
 	/* set return value */
 	*pagebuf = fpage->pagebuf;
 	
@@ -447,13 +1122,16 @@ int error;
 int PF_GetNextPage(int fd, int *pagenum, char **pagebuf){
     int temppage;	/* page number to scan for next valid page */
 int error;	/* error code */
-PFfpage *fpage;	/* pointer to file page */
+PFbpage *bpage;	/* buffer page of the file page */
+int snap;	/* snapshot the thread reads the file under */
 
 	if (PFinvalidFd(fd)){
 		PFerrno = PFE_FD;
 		return(PFerrno);
 	}
 
+	if (PFsnapOn && (snap=PFsnapCurrent(fd)) != 0)
+		return(PFsnapNext(snap,pagenum,pagebuf));
 
 	if (*pagenum < -1 || *pagenum >= PFftab[fd].hdr.numpages){
 		PFerrno = PFE_INVALIDPAGE;
@@ -462,18 +1140,18 @@ PFfpage *fpage;	/* pointer to file page */
 
 	/* scan the file until a valid used page is found */
 	for (temppage= *pagenum+1;temppage<PFftab[fd].hdr.numpages;temppage++){
-		if ( (error=PFbufGet(fd,temppage,&fpage,PFreadfcn,
+		if ( (error=PFbufFix(fd,temppage,&bpage,PFreadfcn,
 					PFwritefcn))!= PFE_OK)
 			return(error);
-		else if (fpage->nextfree == PF_PAGE_USED){
+		else if (bpage->fpage->nextfree == PF_PAGE_USED){
 			/* found a used page */
 			*pagenum = temppage;
-			*pagebuf = (char *)fpage->pagebuf;
+			*pagebuf = (char *)bpage->fpage->pagebuf;
 			return(PFE_OK);
 		}
 
 		/* page is free, unfix it */
-		if ((error=PFbufUnfix(fd,temppage,FALSE))!= PFE_OK)
+		if ((error=PFbufUnfixHandle(bpage,FALSE))!= PFE_OK)
 			return(error);
 	}
 
@@ -484,11 +1162,20 @@ PFfpage *fpage;	/* pointer to file page */
 
 
 int PF_UnfixPage(int fd, int pagenum, int dirty){
-    if (PFinvalidFd(fd)){
+    int snap, error;
+
+	if (PFinvalidFd(fd)){
 		PFerrno = PFE_FD;
 		return(PFerrno);
 	}
 
+	if (PFsnapOn && (snap=PFsnapCurrent(fd)) != 0){
+		/* snapshot pages are read-only */
+		if ((error=PFsnapUnfix(snap,pagenum))== PFE_OK && dirty)
+			PFerrno = error = PFE_READONLY;
+		return(error);
+	}
+
 	if (PFinvalidPagenum(fd,pagenum)){
 		PFerrno = PFE_INVALIDPAGE;
 		return(PFerrno);
@@ -499,6 +1186,7 @@ int PF_UnfixPage(int fd, int pagenum, int dirty){
 
 int PF_DisposePage(int fd, int pagenum) {
     PFfpage *fpage;	/* pointer to file page */
+PFhdr_str oldhdr;	/* header before the page is freed, for the log */
 int error;
 
 	if (PFinvalidFd(fd)){
@@ -506,6 +1194,11 @@ int error;
 		return(PFerrno);
 	}
 
+	if (PFsnapOn && PFsnapCurrent(fd)){
+		PFerrno = PFE_READONLY;
+		return(PFerrno);
+	}
+
 	if (PFinvalidPagenum(fd,pagenum)){
 		PFerrno = PFE_INVALIDPAGE;
 		return(PFerrno);
@@ -526,43 +1219,370 @@ int error;
 	}
 
 	/* put this page into the free list */
+	oldhdr = PFftab[fd].hdr;
 	fpage->nextfree = PFftab[fd].hdr.firstfree;
 	PFftab[fd].hdr.firstfree = pagenum;
 	PFftab[fd].hdrchanged = TRUE;
 
+	if (PFwalOn && (error=PFwalLogHeader(fd,&oldhdr,&PFftab[fd].hdr))!= PFE_OK){
+		PFbufUnfix(fd,pagenum,TRUE);
+		return(error);
+	}
+
 	/* unfix this page */
 	return(PFbufUnfix(fd,pagenum,TRUE));
 }
 
-int PF_GetThisPage(int fd, int pagenum, char **pagebuf)
+/****************************************************************************
+SPECIFICATIONS:
+	Follow the free list of file "fd" and set "isfree[p]" for each page
+	p on it. "isfree" has an entry per page, zeroed by the caller.
+
+RETURN VALUE:
+	# of free pages if ok
+	PFE_INVALIDPAGE if the list leaves the file, loops or holds a used page
+	PF error code otherwise
+*****************************************************************************/
+static int PFfreeMap(int fd, char *isfree)
 {
-    int error;
     PFfpage *fpage;
-    
+    int page, next, nfree = 0, error;
+
+    for (page = PFftab[fd].hdr.firstfree; page != PF_PAGE_LIST_END; page = next) {
+        if (PFinvalidPagenum(fd, page) || isfree[page]) {
+            PFerrno = PFE_INVALIDPAGE;
+            return PFerrno;
+        }
+        if ((error = PFbufGet(fd, page, &fpage, PFreadfcn, PFwritefcn)) != PFE_OK)
+            return error;
+        next = fpage->nextfree;
+        if ((error = PFbufUnfix(fd, page, FALSE)) != PFE_OK)
+            return error;
+        if (next == PF_PAGE_USED) {
+            PFerrno = PFE_INVALIDPAGE;
+            return PFerrno;
+        }
+        isfree[page] = TRUE;
+        nfree++;
+    }
+    return nfree;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Check that file "fd" may be shrunk and get the map of its free
+	pages: no page of it may be fixed (the others are written back and
+	dropped from the buffer) and no snapshot may read it. "*isfree" is
+	allocated with an entry per page and must be freed by the caller.
+
+RETURN VALUE:
+	# of free pages if ok
+	PFE_FD if "fd" is not open
+	PFE_READONLY if the calling thread reads the file under a snapshot
+	PFE_FILEOPEN if a snapshot of the file is active
+	PFE_PAGEFIXED if a page of the file is fixed
+	PF error code otherwise
+*****************************************************************************/
+static int PFshrinkStart(int fd, char **isfree)
+{
+    int nfree, error;
+
+    *isfree = NULL;
+    if (PFinvalidFd(fd)) {
+        PFerrno = PFE_FD;
+        return PFerrno;
+    }
+    if (PFsnapOn && PFsnapCurrent(fd)) {
+        PFerrno = PFE_READONLY;
+        return PFerrno;
+    }
+    if (PFsnapOn && PFsnapFileActive(fd)) {
+        /* the snapshot may still read the pages to be cut */
+        PFerrno = PFE_FILEOPEN;
+        return PFerrno;
+    }
+    if ((error = PFbufReleaseFile(fd, PFwritefcn)) != PFE_OK)
+        return error;
+
+    if ((*isfree = calloc(PFftab[fd].hdr.numpages + 1, 1)) == NULL) {
+        PFerrno = PFE_NOMEM;
+        return PFerrno;
+    }
+    if ((nfree = PFfreeMap(fd, *isfree)) < 0) {
+        free(*isfree);
+        *isfree = NULL;
+    }
+    return nfree;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Cut file "fd" after its first "numpages" pages, the header having
+	already been changed to say so. The file's pages are written back and
+	the double-write batch flushed and forgotten (its slots for the cut
+	pages would otherwise be restored past the end after a crash), so the
+	pages kept are on disk before the header is rewritten and the file
+	truncated.
+
+RETURN VALUE:
+	PFE_OK if ok
+	PF error code otherwise
+*****************************************************************************/
+static int PFshrinkFile(int fd, int numpages)
+{
+    int unixfd, error;
+
+    if ((error = PFbufReleaseFile(fd, PFwritefcn)) != PFE_OK)
+        return error;
+    if (PFdwOn && ((error = PFdwFlush()) != PFE_OK || (error = PFdwForget()) != PFE_OK))
+        return error;
+    if ((error = PFfileSync(fd)) != PFE_OK)
+        return error;
+    if (PFwalOn && PFftab[fd].hdr.lsn != 0 &&
+        (error = PFwalFlush(PFftab[fd].hdr.lsn)) != PFE_OK)
+        return error;
+    if ((error = PFwritehdr(fd, &PFftab[fd].hdr)) != PFE_OK)
+        return error;
+    PFftab[fd].hdrchanged = FALSE;
+
+    if ((unixfd = PFunixfd(fd)) < 0)
+        return unixfd;
+    if (ftruncate(unixfd, PFpageOffset(numpages)) == -1 || fsync(unixfd) == -1) {
+        PFerrno = PFE_UNIX;
+        perror("PFshrinkFile: ftruncate");
+        return PFerrno;
+    }
+    return PFE_OK;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Give the free pages at the end of file "fd" back to the file system:
+	they are unlinked from the free list, the page count is lowered to
+	just past the last used page and the file is truncated. Free pages
+	before the last used page stay on the list. No page of the file may
+	be fixed. While the write-ahead log is open the change is made in a
+	transaction of its own, so the calling thread must have none.
+
+RETURN VALUE:
+	# of pages cut (>= 0) if ok
+	PFE_FD if "fd" is not open
+	PFE_PAGEFIXED if a page of the file is fixed
+	PFE_FILEOPEN if a snapshot of the file is active
+	PFE_TXNACTIVE if the calling thread has a transaction
+	PF error code otherwise
+*****************************************************************************/
+int PF_TrimTail(int fd)
+{
+    PFfpage *fpage;
+    PFhdr_str oldhdr;
+    char *isfree;
+    int numpages, page, next, prev, nfree, txn = FALSE, error;
+
+    if ((nfree = PFshrinkStart(fd, &isfree)) < 0)
+        return nfree;
+    for (numpages = PFftab[fd].hdr.numpages; numpages > 0 && isfree[numpages - 1]; numpages--)
+        ;
+    free(isfree);
+    if (numpages == PFftab[fd].hdr.numpages)
+        return 0;
+
+    if (PFwalOn) {
+        if ((error = PF_TxnBegin()) < 0)
+            return error;
+        txn = TRUE;
+    }
+
+    /* unlink the pages past the new end from the free list */
+    oldhdr = PFftab[fd].hdr;
+    prev = -1;
+    for (page = PFftab[fd].hdr.firstfree; page != PF_PAGE_LIST_END; page = next) {
+        if ((error = PFbufGet(fd, page, &fpage, PFreadfcn, PFwritefcn)) != PFE_OK)
+            goto fail;
+        next = fpage->nextfree;
+        if ((error = PFbufUnfix(fd, page, FALSE)) != PFE_OK)
+            goto fail;
+        if (page < numpages) {
+            prev = page;
+            continue;
+        }
+        if (prev < 0) {
+            PFftab[fd].hdr.firstfree = next;
+            continue;
+        }
+        if ((error = PFbufGet(fd, prev, &fpage, PFreadfcn, PFwritefcn)) != PFE_OK)
+            goto fail;
+        fpage->nextfree = next;
+        if ((error = PFbufUnfix(fd, prev, TRUE)) != PFE_OK)
+            goto fail;
+    }
+    PFftab[fd].hdr.numpages = numpages;
+    PFftab[fd].hdrchanged = TRUE;
+    if (PFwalOn && (error = PFwalLogHeader(fd, &oldhdr, &PFftab[fd].hdr)) != PFE_OK) {
+        PFftab[fd].hdr = oldhdr;
+        goto fail;
+    }
+    if (txn && (error = PF_TxnCommit()) != PFE_OK)
+        goto fail;
+
+    if ((error = PFshrinkFile(fd, numpages)) != PFE_OK)
+        return error;
+    return oldhdr.numpages - numpages;
+
+fail:
+    if (txn)
+        PF_TxnAbort();
+    else
+        PFftab[fd].hdr = oldhdr;
+    PFerrno = error;
+    return error;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Compact file "fd": move the used pages past the last page the file
+	needs into its free pages, highest first into lowest, then empty the
+	free list, lower the page count to the # of used pages and truncate
+	the file. After each move "relocate" (if not NULL) is called with the
+	old and new page numbers and "arg", to update references to the page
+	held in other pages (it may fix pages of the file) or elsewhere.
+	Moved pages keep their contents, but their page numbers change. No
+	page of the file may be fixed.
+	While the write-ahead log is open the moves, the changes made by
+	"relocate" and the new header are one transaction of its own, so the
+	calling thread must have none; if "relocate" fails it is rolled back.
+	Without the log, pages moved before a failing "relocate" stay moved
+	(their old copies too) and the free list is rebuilt without them.
+
+RETURN VALUE:
+	# of pages cut (>= 0) if ok
+	PFE_FD if "fd" is not open
+	PFE_PAGEFIXED if a page of the file is fixed
+	PFE_FILEOPEN if a snapshot of the file is active
+	PFE_TXNACTIVE if the calling thread has a transaction
+	the error returned by "relocate"
+	PF error code otherwise
+*****************************************************************************/
+int PF_CompactFile(int fd, PF_RelocFcn relocate, void *arg)
+{
+    PFfpage *src, *dst;
+    PFhdr_str oldhdr;
+    char *isfree;
+    int used, lo, hi, nfree, txn = FALSE, error;
+
+    if ((nfree = PFshrinkStart(fd, &isfree)) <= 0) {
+        free(isfree);
+        return nfree;
+    }
+    oldhdr = PFftab[fd].hdr;
+    used = oldhdr.numpages - nfree;
+
+    if (PFwalOn) {
+        if ((error = PF_TxnBegin()) < 0) {
+            free(isfree);
+            return error;
+        }
+        txn = TRUE;
+    }
+
+    for (hi = oldhdr.numpages - 1, lo = 0; hi >= used; hi--) {
+        if (isfree[hi])
+            continue;
+        while (!isfree[lo])
+            lo++;
+
+        if ((error = PFbufGet(fd, hi, &src, PFreadfcn, PFwritefcn)) != PFE_OK)
+            goto fail;
+        if ((error = PFbufGet(fd, lo, &dst, PFreadfcn, PFwritefcn)) != PFE_OK) {
+            PFbufUnfix(fd, hi, FALSE);
+            goto fail;
+        }
+        memcpy(dst->pagebuf, src->pagebuf, PF_PAGE_SIZE);
+        dst->nextfree = PF_PAGE_USED;
+        isfree[lo] = FALSE;
+        if ((error = PFbufUnfix(fd, hi, FALSE)) != PFE_OK ||
+            (error = PFbufUnfix(fd, lo, TRUE)) != PFE_OK)
+            goto fail;
+        /* the old copy is cut with the tail, so it is never freed */
+        if (relocate != NULL && (error = (*relocate)(fd, hi, lo, arg)) != PFE_OK)
+            goto fail;
+    }
+
+    /* every free page below "used" now holds a moved page */
+    PFftab[fd].hdr.firstfree = PF_PAGE_LIST_END;
+    PFftab[fd].hdr.numpages = used;
+    PFftab[fd].hdrchanged = TRUE;
+    if (PFwalOn && (error = PFwalLogHeader(fd, &oldhdr, &PFftab[fd].hdr)) != PFE_OK) {
+        PFftab[fd].hdr = oldhdr;
+        goto fail;
+    }
+    if (txn && (error = PF_TxnCommit()) != PFE_OK)
+        goto fail;
+    free(isfree);
+
+    if ((error = PFshrinkFile(fd, used)) != PFE_OK)
+        return error;
+    return oldhdr.numpages - used;
+
+fail:
+    if (txn)
+        PF_TxnAbort();
+    else {
+        /* relink the pages still free, lowest first */
+        PFftab[fd].hdr.firstfree = PF_PAGE_LIST_END;
+        for (lo = oldhdr.numpages - 1; lo >= 0; lo--) {
+            if (!isfree[lo] || PFbufGet(fd, lo, &dst, PFreadfcn, PFwritefcn) != PFE_OK)
+                continue;
+            dst->nextfree = PFftab[fd].hdr.firstfree;
+            PFftab[fd].hdr.firstfree = lo;
+            PFbufUnfix(fd, lo, TRUE);
+        }
+        PFftab[fd].hdrchanged = TRUE;
+    }
+    free(isfree);
+    PFerrno = error;
+    return error;
+}
+
+/* PF_PinPage(), trying the frame "hint" before the hash table */
+static int PFpinPage(int fd, int pagenum, PFbpage *hint, char **pagebuf, PF_Handle *handle)
+{
+    int error, snap;
+    PFbpage *bpage;
+
+        *handle = NULL;
+
         if (PFinvalidFd(fd)){
             PFerrno = PFE_FD;
             return(PFerrno);
         }
+
+        /* the thread reads the file under a snapshot */
+        if (PFsnapOn && (snap=PFsnapCurrent(fd)) != 0)
+            return(PFsnapPin(snap,pagenum,pagebuf,handle));
     
         if (PFinvalidPagenum(fd,pagenum)){
             PFerrno = PFE_INVALIDPAGE;
             return(PFerrno);
         }
     
-        if ( (error=PFbufGet(fd,pagenum,&fpage,PFreadfcn,PFwritefcn))!= PFE_OK){
-            if (error== PFE_PAGEFIXED)
-                *pagebuf = fpage->pagebuf;
+        if ( (error=PFbufFixHint(hint,fd,pagenum,&bpage,PFreadfcn,PFwritefcn))!= PFE_OK){
+            if (error== PFE_PAGEFIXED){
+                *pagebuf = bpage->fpage->pagebuf;
+                *handle = bpage;
+            }
             return(error);
         }
     
-        if (fpage->nextfree == PF_PAGE_USED){
+        if (bpage->fpage->nextfree == PF_PAGE_USED){
             /* page is used*/
-            *pagebuf = (char *)fpage->pagebuf;
+            *pagebuf = (char *)bpage->fpage->pagebuf;
+            *handle = bpage;
             return(PFE_OK);
         }
         else {
             /* invalid page */
-            if (PFbufUnfix(fd,pagenum,FALSE)!= PFE_OK){
+            if (PFbufUnfixHandle(bpage,FALSE)!= PFE_OK){
                 printf("internal error:PFgetThis()\n");
                 exit(1);
             }
@@ -571,6 +1591,161 @@ int PF_GetThisPage(int fd, int pagenum, char **pagebuf)
         }
 }
 
+/****************************************************************************
+SPECIFICATIONS:
+	Fix page "pagenum" of file "fd" in the buffer like PF_GetThisPage(),
+	and also return its handle in "*handle". The handle stays valid until
+	the page is unfixed; PF_UnpinHandle() and PF_MarkDirty() use it to
+	reach the buffer page directly, without a page-table lookup. The page
+	may still be unfixed with PF_UnfixPage() instead.
+
+RETURN VALUE:
+	PFE_OK if ok
+	PFE_PAGEFIXED if the page is already fixed ("*pagebuf" and "*handle"
+	are still set)
+	PF error code otherwise
+*****************************************************************************/
+int PF_PinPage(int fd, int pagenum, char **pagebuf, PF_Handle *handle)
+{
+	return(PFpinPage(fd,pagenum,NULL,pagebuf,handle));
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Pin page "pagenum" of file "fd", which the page pinned as "parent"
+	references in its child slot "slot", like PF_PinPage(). With
+	swizzling on (PF_SetSwizzling()), the parent's frame remembers the
+	frame each of its slots led to, and as long as that frame still holds
+	"pagenum" the page is fixed without probing the hash table. The
+	parent must stay pinned until the call returns. A slot's swip is only
+	a hint: a child evicted or moved to another slot is found by a probe,
+	and swips are dropped with the parent's frame.
+
+RETURN VALUE:
+	as PF_PinPage()
+*****************************************************************************/
+int PF_PinChild(int fd, PF_Handle parent, int slot, int pagenum, char **pagebuf, PF_Handle *handle)
+{
+    PFbpage *hint = NULL;
+    int error;
+
+	if (parent != NULL && !parent->snap)
+		hint = PFbufSwip(parent,slot);
+	if ((error=PFpinPage(fd,pagenum,hint,pagebuf,handle))== PFE_OK && parent != NULL)
+		PFbufSetSwip(parent,slot,*handle);
+	return(error);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Turn swizzling on ("on" TRUE) or off for PF_PinChild(). Turning it
+	off keeps the swips already recorded but records no new one.
+
+RETURN VALUE:
+	PFE_OK
+*****************************************************************************/
+int PF_SetSwizzling(int on)
+{
+	return(PFbufSetSwizzling(on));
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Unfix the page pinned as "handle", marking it dirty if "dirty" is
+	TRUE. The handle must not be used afterwards.
+
+RETURN VALUE:
+	PFE_OK if ok
+	PFE_PAGEUNFIXED if the page is not fixed
+	PFE_READONLY if "dirty" is TRUE for a snapshot page (it is unfixed)
+*****************************************************************************/
+int PF_UnpinHandle(PF_Handle handle, int dirty)
+{
+    int error;
+
+	if (handle == NULL){
+		PFerrno = PFE_PAGENOTINBUF;
+		return(PFerrno);
+	}
+	if (handle->snap){
+		if ((error=PFsnapUnpin(handle))== PFE_OK && dirty)
+			PFerrno = error = PFE_READONLY;
+		return(error);
+	}
+	return(PFbufUnfixHandle(handle,dirty));
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Mark the page pinned as "handle" dirty and most recently used. It
+	stays fixed.
+
+RETURN VALUE:
+	PFE_OK if ok
+	PFE_PAGEUNFIXED if the page is not fixed
+	PFE_READONLY if it is a snapshot page
+*****************************************************************************/
+int PF_MarkDirty(PF_Handle handle)
+{
+	if (handle == NULL){
+		PFerrno = PFE_PAGENOTINBUF;
+		return(PFerrno);
+	}
+	if (handle->snap){
+		PFerrno = PFE_READONLY;
+		return(PFerrno);
+	}
+	return(PFbufUsedHandle(handle));
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Pin page "pagenum" of file "fd" for reading, if it is in the buffer
+	and not fixed, without taking a lock. Unlike the other PF routines
+	this may be called from any number of threads while one thread uses
+	the PF layer: the page stays as it is until PF_ReleaseShared(), and
+	that thread waits for the pin before fixing, writing over or evicting
+	the page. A pin must therefore be held briefly, and never while
+	waiting for that thread. The page is neither read from disk, made
+	most recently used nor counted in the statistics; a page that is not
+	buffered must be brought in by PF_GetThisPage(). "fd" is not checked
+	and must stay open while the page is pinned. PFerrno is not set.
+
+RETURN VALUE:
+	PFE_OK if ok; "*pagebuf" and "*handle" are set
+	PFE_PAGENOTINBUF if the page is not in the buffer
+	PFE_PAGEFIXED if the page is fixed or being evicted
+	PFE_INVALIDPAGE if the page is free
+*****************************************************************************/
+int PF_ReadShared(int fd, int pagenum, char **pagebuf, PF_Handle *handle)
+{
+    PFbpage *bpage;
+    int error;
+
+	if ((bpage = PFbufReadShared(fd,pagenum,&error)) == NULL)
+		return(error);
+	if (bpage->fpage->nextfree != PF_PAGE_USED){
+		PFbufReleaseShared(bpage);
+		return(PFE_INVALIDPAGE);
+	}
+	*pagebuf = bpage->fpage->pagebuf;
+	*handle = bpage;
+	return(PFE_OK);
+}
+
+/* Drop the pin "handle" taken by PF_ReadShared() */
+void PF_ReleaseShared(PF_Handle handle)
+{
+	PFbufReleaseShared(handle);
+}
+
+int PF_GetThisPage(int fd, int pagenum, char **pagebuf)
+{
+    PF_Handle handle;
+
+	return(PF_PinPage(fd,pagenum,pagebuf,&handle));
+}
+
 int PF_GetFirstPage(int fd, int *pagenum, char **pagebuf)
 {
     *pagenum = -1;
@@ -578,6 +1753,161 @@ int PF_GetFirstPage(int fd, int *pagenum, char **pagebuf)
 }
 
 
+/****************************************************************************
+SPECIFICATIONS:
+	Change the buffer pool size to "nframes" pages while files are open.
+	Growing takes effect lazily, as misses need new pages. Shrinking
+	writes back and releases unfixed pages PF_RESIZE_CHUNK at a time: one
+	chunk now and one on each later buffer allocation, until the pool
+	fits. Fixed pages are never released.
+
+RETURN VALUE:
+	PFE_OK if ok
+	PFE_NOBUF if "nframes" < 1
+	PF error code if a dirty page cannot be written back
+*****************************************************************************/
+int PF_ResizeBufferPool(int nframes)
+{
+	if (nframes < 1){
+		PFerrno = PFE_NOBUF;
+		return(PFerrno);
+	}
+	return(PFbufResize(nframes,PFwritefcn));
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Let a buffer miss search the "npages" coldest unfixed pages for a
+	clean victim, so that it reads without writing a dirty page first.
+	1 evicts the coldest page, clean or not. PF_VICTIM_WINDOW by default.
+
+RETURN VALUE:
+	PFE_OK if ok
+	PFE_NOBUF if "npages" < 1
+*****************************************************************************/
+int PF_SetVictimWindow(int npages)
+{
+	if (npages < 1){
+		PFerrno = PFE_NOBUF;
+		return(PFerrno);
+	}
+	return(PFbufSetVictimWindow(npages));
+}
+
+/* Number of pages in the buffer pool now, and the pool's target size */
+void PF_GetBufferPoolSize(int *nframes, int *target)
+{
+	PFbufPoolSize(nframes,target);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Copy the statistics of the open file "fd" into "stats".
+
+RETURN VALUE:
+	PFE_OK if ok
+	PFE_FD if "fd" is not an open file
+*****************************************************************************/
+int PF_GetStats(int fd, PF_Stats *stats)
+{
+    if (PFinvalidFd(fd)) {
+        PFerrno = PFE_FD;
+        return PFerrno;
+    }
+
+    *stats = PFftab[fd].stats;
+    return PFE_OK;
+}
+
+/* Copy the statistics summed over all files since the last reset */
+void PF_GetGlobalStats(PF_Stats *stats)
+{
+    *stats = PFgstats;
+}
+
+/* Zero the statistics of the open file "fd" */
+int PF_ResetStats(int fd)
+{
+    if (PFinvalidFd(fd)) {
+        PFerrno = PFE_FD;
+        return PFerrno;
+    }
+
+    memset(&PFftab[fd].stats, 0, sizeof(PF_Stats));
+    return PFE_OK;
+}
+
+/* Zero the global statistics together with the legacy counters */
+void PF_ResetGlobalStats(void)
+{
+    memset(&PFgstats, 0, sizeof(PF_Stats));
+    PF_physical_reads = PF_physical_writes = 0;
+    PF_logical_reads = PF_logical_writes = 0;
+    PF_page_alloc = PF_page_evicted = 0;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Return the upper bound, in nanoseconds, of the bucket holding the
+	"pct"-th percentile (0 < pct <= 100) of the samples in "hist".
+	The result is exact to within a factor of two.
+
+RETURN VALUE:
+	percentile bound in ns, 0 if the histogram is empty
+*****************************************************************************/
+unsigned long long PF_HistPercentile(const PF_Hist *hist, double pct)
+{
+    unsigned long long rank, seen = 0;
+    int i;
+
+    if (hist->count == 0)
+        return 0;
+
+    rank = (unsigned long long)(pct / 100.0 * (double)hist->count + 0.5);
+    if (rank < 1)
+        rank = 1;
+
+    for (i = 0; i < PF_HIST_BUCKETS - 1; i++) {
+        seen += hist->bucket[i];
+        if (seen >= rank)
+            return (2ULL << i) < hist->max_ns ? (2ULL << i) : hist->max_ns;
+    }
+    return hist->max_ns;
+}
+
+/* print one latency histogram summary line in microseconds */
+static void PFprintHist(FILE *fp, const char *name, const PF_Hist *hist)
+{
+    fprintf(fp, "  %-6s n=%-8lu avg=%.1fus p50<=%.1fus p99<=%.1fus max=%.1fus\n",
+            name, hist->count,
+            hist->count ? (double)hist->total_ns / hist->count / 1000.0 : 0.0,
+            PF_HistPercentile(hist, 50.0) / 1000.0,
+            PF_HistPercentile(hist, 99.0) / 1000.0,
+            hist->max_ns / 1000.0);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Print the statistics "stats" under the heading "label" to "fp".
+*****************************************************************************/
+void PF_PrintStats(FILE *fp, const char *label, const PF_Stats *stats)
+{
+    unsigned long refs = stats->hits + stats->misses;
+
+    fprintf(fp, "PF stats: %s\n", label);
+    fprintf(fp, "  hits=%lu misses=%lu hit ratio=%.2f%% evictions=%lu dirty writebacks=%lu\n",
+            stats->hits, stats->misses,
+            refs ? 100.0 * stats->hits / refs : 0.0,
+            stats->evictions, stats->dirty_writebacks);
+    fprintf(fp, "  bytes read=%llu bytes written=%llu page-table probes=%lu fd reopens=%lu\n",
+            stats->bytes_read, stats->bytes_written, stats->probes, stats->reopens);
+    fprintf(fp, "  misses that wrote a dirty victim=%lu pages written by the cleaner=%lu\n",
+            stats->victim_writes, stats->cleaner_writes);
+    PFprintHist(fp, "read", &stats->read_lat);
+    PFprintHist(fp, "write", &stats->write_lat);
+    PFprintHist(fp, "fsync", &stats->fsync_lat);
+}
+
 /****************************************************************************
 SPECIFICATIONS:
 	Print last PF error with a given string
@@ -606,7 +1936,14 @@ void PF_PrintError( char *s)
         "Page already unfixed",
         "New page to be allocated already in buffer",
         "Hash table entry not found",
-        "Page already in hash table"
+        "Page already in hash table",
+        "Write-ahead log not open",
+        "No active transaction",
+        "Transaction already active",
+        "Corrupt log record",
+        "Page checksum mismatch (torn or corrupt page)",
+        "Page read under a snapshot is read-only",
+        "Not a PF file, or one of another format version"
     };
 
     fprintf(stderr, "%s: %s", s, PFerrormsg[-PFerrno]);
@@ -35,6 +35,13 @@
 #define PFE_PAGEINBUF      -17
 #define PFE_HASHNOTFOUND   -18
 #define PFE_HASHPAGEEXIST  -19
+#define PFE_NOWAL          -20
+#define PFE_NOTXN          -21
+#define PFE_TXNACTIVE      -22
+#define PFE_LOGCORRUPT     -23
+#define PFE_CHECKSUM       -24
+#define PFE_READONLY       -25
+#define PFE_BADFILE        -26
 
 /* Page size */
 #define PF_PAGE_SIZE 4096
@@ -48,6 +55,8 @@ extern int USE_MRU;
 /* Initialization and utilities */
 void PF_Init(void); // initialize pf file table and pf hash table
 void PF_PrintError( char *s); // print the last pf error with a given string
+int PF_SetMaxUnixFds(int maxfds); // cap the unix descriptors held open; the rest are reopened on demand
+int PF_NumUnixFds(void); // number of unix descriptors currently held
 
 /* File operations */
 int PF_CreateFile(const char *fname); // create a paged file called "fname" with file header initialized to zero
@@ -67,6 +76,23 @@ int PFwritehdr(int fd, PFhdr_str *hdr);
 int PF_GetThisPage(int fd, int pagenum, char **pagebuf);
 int PF_GetFirstPage(int fd, int *pagenum, char **pagebuf);
 
+/* Free-space reclamation: give the pages of the free list back to the file system */
+int PF_TrimTail(int fd); // cut the free pages at the end of the file; returns the # of pages cut
+int PF_CompactFile(int fd, PF_RelocFcn relocate, void *arg); // move used pages down into free ones, then cut the tail
+
+/* Page handles: unpin/mark dirty through the handle, without a page-table lookup */
+int PF_PinPage(int fd, int pagenum, char **pagebuf, PF_Handle *handle); // PF_GetThisPage() that also returns the page's handle
+int PF_UnpinHandle(PF_Handle handle, int dirty); // PF_UnfixPage() by handle; the handle is invalid afterwards
+int PF_MarkDirty(PF_Handle handle); // mark the pinned page dirty and most recently used
+
+/* Swizzling: a pinned page remembers the frames of the children pinned through it */
+int PF_SetSwizzling(int on); // TRUE: PF_PinChild() follows and records child frames
+int PF_PinChild(int fd, PF_Handle parent, int slot, int pagenum, char **pagebuf, PF_Handle *handle); // PF_PinPage() of the page "parent" references at "slot"
+
+/* Shared reads: lock-free pins of buffered pages, from any thread */
+int PF_ReadShared(int fd, int pagenum, char **pagebuf, PF_Handle *handle); // pin a buffered, unfixed page read-only; never reads from disk or waits
+void PF_ReleaseShared(PF_Handle handle); // drop a PF_ReadShared() pin
+
 /* Buffer and hash debug prints */
 void PFbufPrint(void);
 void PFhashPrint(void);
@@ -75,6 +101,71 @@ int PFbufAlloc(int fd, int pagenum, PFfpage **fpage, int (*writefcn)(int, int, P
 int PFbufGet(int fd, int pagenum, PFfpage **fpage, int (*readfcn)(int, int, PFfpage *), int (*writefcn)(int, int, PFfpage *));
 int PFbufUnfix(int fd, int pagenum, int dirty);
 int PFbufUsed(int fd, int pagenum);
+int PFbufFix(int fd, int pagenum, PFbpage **bpage, int (*readfcn)(int, int, PFfpage *), int (*writefcn)(int, int, PFfpage *));
+int PFbufFixHint(PFbpage *hint, int fd, int pagenum, PFbpage **bpage, int (*readfcn)(int, int, PFfpage *), int (*writefcn)(int, int, PFfpage *));
+int PFbufUnfixHandle(PFbpage *bpage, int dirty);
+int PFbufUsedHandle(PFbpage *bpage);
+PFbpage *PFbufReadShared(int fd, int pagenum, int *error);
+void PFbufReleaseShared(PFbpage *bpage);
+
+/* Statistics */
+int PF_GetStats(int fd, PF_Stats *stats); // copy the statistics of the open file "fd"
+void PF_GetGlobalStats(PF_Stats *stats); // copy the statistics summed over all files since the last reset
+int PF_ResetStats(int fd); // zero the statistics of the open file "fd"
+void PF_ResetGlobalStats(void); // zero the global statistics and the legacy counters below
+unsigned long long PF_HistPercentile(const PF_Hist *hist, double pct); // upper bound (ns) of the pct-th percentile
+void PF_PrintStats(FILE *fp, const char *label, const PF_Stats *stats);
+
+/* Page-access tracing (replay the file with pfsim) */
+int PF_TraceStart(const char *fname); // log every buffer get/unfix/alloc to the binary trace file "fname"
+int PF_TraceStop(void); // flush and close the active trace
+
+/* Buffer pool size */
+int PF_ResizeBufferPool(int nframes); // set the pool target; shrinking releases pages in chunks of PF_RESIZE_CHUNK
+void PF_GetBufferPoolSize(int *nframes, int *target); // pages in the pool now and its target
+int PF_PSIWatchStart(const char *path, int minframes, int maxframes); // resize from a PSI memory.pressure file
+void PF_PSIWatchStop(void);
+int PF_PSIPoll(void); // check the pressure file now; returns the new target
+
+int PF_SetVictimWindow(int npages); // a miss evicts the first clean page among the "npages" coldest unfixed ones
+int PF_CleanerStart(void); // write dirty pages passed over by victim selection back from a background thread
+int PF_CleanerStop(void); // wait for the queued write-backs and stop the thread
+
+int PF_SetArenaMode(int mode); // PF_ARENA_HUGE, PF_ARENA_THP or PF_ARENA_4K backing for frames mapped from now on
+void PF_GetArenaInfo(int *nchunks, int *nhugetlb, int *chunkframes);
+
+/* Second-tier victim cache on local storage */
+int PF_VCacheOpen(const char *fname, int nslots, int admit); // cache evicted pages in "fname" (nslots pages, PF_VC_ADMIT_xxx policy)
+int PF_VCacheClose(void); // drop the cache and remove its file
+void PF_VCacheGetStats(PF_VCacheStats *stats);
+void PF_VCacheResetStats(void);
+
+/* Double-write buffer: page writes go in batches through a scratch file, torn pages are repaired */
+int PF_DWOpen(const char *fname); // restore torn pages from the scratch file "fname", then batch page writes through it; open files afterwards
+int PF_DWClose(void); // write the pending batch and go back to an fsync per page write
+int PF_DWFlush(void); // write the pending batch now
+void PF_DWGetStats(PF_DWStats *stats);
+void PF_DWResetStats(void);
+
+/* Copy-on-write snapshots: a reader sees a file as it was when its snapshot began */
+int PF_BeginSnapshot(int fd); // snapshot the open file "fd"; returns its id (>0)
+int PF_EndSnapshot(int snap); // end it and drop the page versions only it needed
+int PF_UseSnapshot(int snap); // page reads of the snapshot's file in this thread see the snapshot (read-only); 0 to stop
+int PF_SnapshotSpill(const char *fname, int mempages); // keep at most "mempages" versions in memory, the rest in "fname"
+void PF_GetSnapshotStats(PF_SnapStats *stats);
+
+/* Write-ahead log and transactions (pages fixed between begin and commit are logged) */
+int PF_WALOpen(const char *fname); // open or create the log "fname"; data pages are then written without fsync
+int PF_WALClose(void); // flush and close the log; no transaction may be active
+int PF_WALSetGroupDelay(int usec); // a commit leader waits this long for other commits to join its fsync
+void PF_WALGetStats(PF_WALStats *stats);
+void PF_WALResetStats(void);
+int PF_TxnBegin(void); // start a transaction in the calling thread; returns its id (>0)
+int PF_TxnCommit(void); // log the commit and wait until it is durable
+int PF_TxnAbort(void); // undo the transaction's changes; its files must still be open
+int PF_Checkpoint(void); // fuzzy checkpoint: log active transactions and dirty pages, move the restart point
+int PF_WALSetCheckpointInterval(long bytes); // checkpoint from PF_TxnBegin() every "bytes" of log, 0 for never
+void PF_WALGetRecoveryStats(PF_RecoveryStats *stats); // what restart recovery did in the last PF_WALOpen()
 
 extern unsigned long PF_physical_reads, PF_physical_writes;
 extern unsigned long PF_page_alloc, PF_page_evicted;
@@ -0,0 +1,187 @@
+/* pfbench.c: random buffer-hit throughput of the frame arena with huge pages
+versus 4 KB pages.
+
+	pfbench [-m MB] [-n ops] [-f file]
+
+Builds a paged file of MB megabytes (default 1024), sizes the buffer pool
+to hold all of it, reads every page once so that all later accesses hit,
+and then times "ops" random PF_GetThisPage()/PF_UnfixPage() pairs that
+each read a word at a random offset of the page. This is done once with
+the arena in PF_ARENA_4K mode and once in PF_ARENA_HUGE mode; the pool is
+drained in between so the second run maps fresh chunks. The file is
+removed at the end. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include "pf.h"
+#include "pftypes.h"
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* xorshift64 */
+static unsigned long long rng_state = 88172645463325252ULL;
+static unsigned long long rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+/* kB of anonymous memory backed by transparent huge pages, -1 if unknown */
+static long thp_kb(void)
+{
+    FILE *fp = fopen("/proc/self/smaps_rollup", "r");
+    char line[256];
+    long kb = -1;
+
+    if (fp == NULL)
+        return -1;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (sscanf(line, "AnonHugePages: %ld kB", &kb) == 1)
+            break;
+    }
+    fclose(fp);
+    return kb;
+}
+
+/* write a paged file of "npages" used pages without going through the
+   buffer pool, which would fsync every page on close */
+static int make_file(const char *fname, int npages)
+{
+    PFhdr_str hdr;
+    PFfpage *page;
+    int fd, i;
+
+    remove(fname);
+    if (PF_CreateFile(fname) != PFE_OK) {
+        PF_PrintError("PF_CreateFile");
+        return -1;
+    }
+    if ((fd = open(fname, O_WRONLY)) < 0) {
+        perror("open");
+        return -1;
+    }
+
+    hdr.magic = PF_MAGIC;
+    hdr.version = PF_VERSION;
+    hdr.firstfree = PF_PAGE_LIST_END;
+    hdr.numpages = npages;
+    hdr.lsn = 0;
+    if (write(fd, (char *)&hdr, PF_HDR_SIZE) != (ssize_t)PF_HDR_SIZE) {
+        perror("write header");
+        close(fd);
+        return -1;
+    }
+
+    page = calloc(1, sizeof(PFfpage));
+    for (i = 0; i < npages; i++) {
+        page->nextfree = PF_PAGE_USED;
+        memcpy(page->pagebuf, &i, sizeof(int));
+        page->checksum = PFpageChecksum(page);
+        if (write(fd, page, sizeof(PFfpage)) != (ssize_t)sizeof(PFfpage)) {
+            perror("write page");
+            free(page);
+            close(fd);
+            return -1;
+        }
+    }
+    free(page);
+    return close(fd);
+}
+
+static int run(const char *fname, int npages, long ops, int mode, const char *name)
+{
+    int fd, p, nchunks, nhuge, chunkframes, nframes, target;
+    long i;
+    char *buf;
+    volatile unsigned int sink = 0;
+    double t0, t1;
+
+    PF_SetArenaMode(mode);
+    PF_ResizeBufferPool(npages + 16);
+
+    if ((fd = PF_OpenFile(fname)) < 0) {
+        PF_PrintError("PF_OpenFile");
+        return -1;
+    }
+
+    /* fault every page into the pool */
+    t0 = now_sec();
+    for (p = 0; p < npages; p++) {
+        if (PF_GetThisPage(fd, p, &buf) != PFE_OK) {
+            PF_PrintError("PF_GetThisPage (warm)");
+            return -1;
+        }
+        PF_UnfixPage(fd, p, FALSE);
+    }
+    t1 = now_sec();
+    PF_GetArenaInfo(&nchunks, &nhuge, &chunkframes);
+    printf("%-6s warm-up %.2f s: %d chunks (%d frames each), %d MAP_HUGETLB, THP %ld MB\n",
+           name, t1 - t0, nchunks, chunkframes, nhuge, thp_kb() / 1024);
+
+    PF_ResetGlobalStats();
+    t0 = now_sec();
+    for (i = 0; i < ops; i++) {
+        unsigned long long r = rng();
+        p = (int)(r % (unsigned long long)npages);
+        if (PF_GetThisPage(fd, p, &buf) != PFE_OK) {
+            PF_PrintError("PF_GetThisPage");
+            return -1;
+        }
+        sink += *(unsigned int *)(buf + ((r >> 32) % (PF_PAGE_SIZE / sizeof(int))) * sizeof(int));
+        PF_UnfixPage(fd, p, FALSE);
+    }
+    t1 = now_sec();
+    printf("%-6s %ld random hits in %.3f s: %.0f hits/s, %.1f ns/hit\n",
+           name, ops, t1 - t0, ops / (t1 - t0), (t1 - t0) * 1e9 / ops);
+
+    PF_CloseFile(fd);
+
+    /* release every frame so the next run maps fresh chunks */
+    do {
+        PF_ResizeBufferPool(1);
+        PF_GetBufferPoolSize(&nframes, &target);
+    } while (nframes > 1);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *fname = "pfbench.db";
+    long mb = 1024, ops = 20000000;
+    int c, npages;
+
+    while ((c = getopt(argc, argv, "m:n:f:")) != -1) {
+        switch (c) {
+            case 'm': mb = atol(optarg); break;
+            case 'n': ops = atol(optarg); break;
+            case 'f': fname = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [-m MB] [-n ops] [-f file]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    npages = (int)(mb * 1024 * 1024 / PF_PAGE_SIZE);
+    PF_Init();
+    printf("pool of %d pages (%ld MB), %ld random hits per run\n", npages, mb, ops);
+    if (make_file(fname, npages) != 0)
+        return 1;
+
+    if (run(fname, npages, ops, PF_ARENA_4K, "4K") != 0 ||
+        run(fname, npages, ops, PF_ARENA_HUGE, "huge") != 0)
+        return 1;
+
+    PF_DestroyFile(fname);
+    return 0;
+}
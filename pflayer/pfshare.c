@@ -0,0 +1,161 @@
+/* pfshare.c: read-hit throughput on one hot page as the number of reader
+threads grows.
+
+	pfshare [-t threads] [-s seconds] [-f file]
+
+Builds a small paged file, brings its pages into the buffer pool and then,
+for 1, 2, 4, ... up to "threads" reader threads (default 64), has every
+thread read page 0 in a loop for "seconds" (default 0.5) in two ways:
+PF_GetThisPage()/PF_UnfixPage() with a mutex around each call, which is
+how threads must share the PF layer otherwise, and PF_ReadShared()/
+PF_ReleaseShared(), which take no lock. Each read sums a few words of the
+page. The file is removed at the end. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include "pf.h"
+#include "pftypes.h"
+
+#define NPAGES 16
+
+static int hot_fd;
+static volatile int running;
+static pthread_mutex_t pf_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+typedef struct {
+    int shared;            /* TRUE: PF_ReadShared(), else the mutex */
+    unsigned long reads;   /* reads done */
+    unsigned long misses;  /* PF_ReadShared() calls that did not pin */
+    unsigned int sink;
+    char pad[64];          /* keep the counters of two threads apart */
+} Reader;
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static unsigned int sum_page(const char *buf)
+{
+    const unsigned int *w = (const unsigned int *)buf;
+    return w[0] + w[17] + w[255] + w[PF_PAGE_SIZE / sizeof(int) - 1];
+}
+
+static void *reader(void *arg)
+{
+    Reader *r = arg;
+    PF_Handle handle;
+    char *buf;
+
+    while (!running)
+        ;
+    while (running) {
+        if (r->shared) {
+            if (PF_ReadShared(hot_fd, 0, &buf, &handle) != PFE_OK) {
+                r->misses++;
+                continue;
+            }
+            r->sink += sum_page(buf);
+            PF_ReleaseShared(handle);
+        } else {
+            pthread_mutex_lock(&pf_mutex);
+            if (PF_GetThisPage(hot_fd, 0, &buf) == PFE_OK) {
+                r->sink += sum_page(buf);
+                PF_UnfixPage(hot_fd, 0, FALSE);
+            }
+            pthread_mutex_unlock(&pf_mutex);
+        }
+        r->reads++;
+    }
+    return NULL;
+}
+
+/* reads per second of "nthreads" threads reading the hot page */
+static double run(int nthreads, int shared, double seconds, unsigned long *misses)
+{
+    pthread_t *tid = malloc(nthreads * sizeof(pthread_t));
+    Reader *r = calloc(nthreads, sizeof(Reader));
+    unsigned long reads = 0;
+    double t0, t1;
+    int i;
+
+    running = 0;
+    for (i = 0; i < nthreads; i++) {
+        r[i].shared = shared;
+        pthread_create(&tid[i], NULL, reader, &r[i]);
+    }
+    t0 = now_sec();
+    running = 1;
+    usleep((useconds_t)(seconds * 1e6));
+    running = 0;
+    for (i = 0; i < nthreads; i++)
+        pthread_join(tid[i], NULL);
+    t1 = now_sec();
+
+    *misses = 0;
+    for (i = 0; i < nthreads; i++) {
+        reads += r[i].reads;
+        *misses += r[i].misses;
+    }
+    free(tid);
+    free(r);
+    return reads / (t1 - t0);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *fname = "pfshare.db";
+    double seconds = 0.5, locked, shared, base = 0;
+    unsigned long misses, ignored;
+    int c, i, n, maxthreads = 64, pagenum;
+    char *buf;
+
+    while ((c = getopt(argc, argv, "t:s:f:")) != -1) {
+        switch (c) {
+            case 't': maxthreads = atoi(optarg); break;
+            case 's': seconds = atof(optarg); break;
+            case 'f': fname = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [-t threads] [-s seconds] [-f file]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    PF_Init();
+    remove(fname);
+    if (PF_CreateFile(fname) != PFE_OK || (hot_fd = PF_OpenFile(fname)) < 0) {
+        PF_PrintError("pfshare");
+        return 1;
+    }
+    for (i = 0; i < NPAGES; i++) {
+        if (PF_AllocPage(hot_fd, &pagenum, &buf) != PFE_OK) {
+            PF_PrintError("PF_AllocPage");
+            return 1;
+        }
+        memset(buf, i + 1, PF_PAGE_SIZE);
+        PF_UnfixPage(hot_fd, pagenum, TRUE);
+    }
+
+    printf("%ld CPUs online, %.2f s per run\n", sysconf(_SC_NPROCESSORS_ONLN), seconds);
+    printf("threads   mutex reads/s  shared reads/s  speedup  scaling\n");
+    for (n = 1; n <= maxthreads; n *= 2) {
+        locked = run(n, FALSE, seconds, &ignored);
+        shared = run(n, TRUE, seconds, &misses);
+        if (n == 1)
+            base = shared;
+        printf("%7d %15.0f %15.0f %7.1fx %8.2f", n, locked, shared, shared / locked, shared / base);
+        if (misses != 0)
+            printf("  (%lu not pinned)", misses);
+        printf("\n");
+    }
+
+    PF_CloseFile(hot_fd);
+    PF_DestroyFile(fname);
+    return 0;
+}
@@ -0,0 +1,661 @@
+/* pfsim.c: offline buffer replacement simulator for PF page-access traces.
+
+usage: pfsim [-s size,size,...] [-c curve.csv] tracefile
+
+Replays a trace captured with PF_TraceStart() once and reports, for every
+requested pool size, the miss ratio and dirty write-backs under LRU, MRU,
+CLOCK and ARC. The LRU miss-ratio curve for *all* pool sizes is computed in
+the same pass from reuse (stack) distances; -c writes it as CSV.
+
+A reference is a PF_TRACE_GET or PF_TRACE_ALLOC record. PF_TRACE_UNFIX
+records with dirty set mark the cached page dirty, PF_TRACE_RELEASE drops
+all pages of the file. Pinning is not modelled, so a policy never has to
+skip a victim. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pftypes.h"
+
+#define SIM_MAX_SIZES 64
+
+/************************** page -> slot hash map *************************/
+/* open addressing with linear probing and backward-shift deletion */
+
+typedef struct {
+    unsigned long long *keys;  /* SIM_EMPTY if unused */
+    int *vals;
+    unsigned long mask;
+    unsigned long count;
+} SimMap;
+
+#define SIM_EMPTY 0xFFFFFFFFFFFFFFFFULL
+#define SimKey(fd, page) (((unsigned long long)(unsigned int)(fd) << 32) | (unsigned int)(page))
+#define SimKeyFd(key) ((int)((key) >> 32))
+
+static unsigned long SimHash(unsigned long long key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return (unsigned long)key;
+}
+
+static void SimMapInit(SimMap *m, unsigned long minsize)
+{
+    unsigned long size = 16;
+    while (size < minsize * 2)
+        size <<= 1;
+    m->keys = malloc(size * sizeof(*m->keys));
+    m->vals = malloc(size * sizeof(*m->vals));
+    if (m->keys == NULL || m->vals == NULL) {
+        fprintf(stderr, "pfsim: out of memory\n");
+        exit(1);
+    }
+    memset(m->keys, 0xFF, size * sizeof(*m->keys));
+    m->mask = size - 1;
+    m->count = 0;
+}
+
+static void SimMapFree(SimMap *m)
+{
+    free(m->keys);
+    free(m->vals);
+}
+
+static void SimMapPut(SimMap *m, unsigned long long key, int val);
+
+static void SimMapGrow(SimMap *m)
+{
+    SimMap old = *m;
+    unsigned long i;
+
+    SimMapInit(m, (old.mask + 1));
+    for (i = 0; i <= old.mask; i++)
+        if (old.keys[i] != SIM_EMPTY)
+            SimMapPut(m, old.keys[i], old.vals[i]);
+    SimMapFree(&old);
+}
+
+/* return the slot of "key", or -1 */
+static int SimMapGet(const SimMap *m, unsigned long long key)
+{
+    unsigned long i = SimHash(key) & m->mask;
+
+    while (m->keys[i] != SIM_EMPTY) {
+        if (m->keys[i] == key)
+            return m->vals[i];
+        i = (i + 1) & m->mask;
+    }
+    return -1;
+}
+
+static void SimMapPut(SimMap *m, unsigned long long key, int val)
+{
+    unsigned long i;
+
+    if ((m->count + 1) * 2 > m->mask + 1)
+        SimMapGrow(m);
+
+    i = SimHash(key) & m->mask;
+    while (m->keys[i] != SIM_EMPTY && m->keys[i] != key)
+        i = (i + 1) & m->mask;
+    if (m->keys[i] == SIM_EMPTY)
+        m->count++;
+    m->keys[i] = key;
+    m->vals[i] = val;
+}
+
+static void SimMapDel(SimMap *m, unsigned long long key)
+{
+    unsigned long i = SimHash(key) & m->mask, j, home;
+
+    while (m->keys[i] != key) {
+        if (m->keys[i] == SIM_EMPTY)
+            return;
+        i = (i + 1) & m->mask;
+    }
+
+    /* shift later members of the cluster back into the hole */
+    for (j = (i + 1) & m->mask; m->keys[j] != SIM_EMPTY; j = (j + 1) & m->mask) {
+        home = SimHash(m->keys[j]) & m->mask;
+        if (((j - home) & m->mask) >= ((j - i) & m->mask)) {
+            m->keys[i] = m->keys[j];
+            m->vals[i] = m->vals[j];
+            i = j;
+        }
+    }
+    m->keys[i] = SIM_EMPTY;
+    m->count--;
+}
+
+/*************************** node lists ***********************************/
+/* doubly linked lists of nodes held in one array, linked by index */
+
+typedef struct {
+    unsigned long long key;
+    int prev, next;
+    unsigned char list;    /* which list the node is on (ARC) */
+    unsigned char dirty;
+    unsigned char ref;     /* CLOCK reference bit */
+} SimNode;
+
+typedef struct {
+    int head, tail, len;
+} SimList;
+
+static void SimListInit(SimList *l)
+{
+    l->head = l->tail = -1;
+    l->len = 0;
+}
+
+static void SimListPushHead(SimList *l, SimNode *n, int i)
+{
+    n[i].prev = -1;
+    n[i].next = l->head;
+    if (l->head >= 0)
+        n[l->head].prev = i;
+    l->head = i;
+    if (l->tail < 0)
+        l->tail = i;
+    l->len++;
+}
+
+static void SimListUnlink(SimList *l, SimNode *n, int i)
+{
+    if (n[i].prev >= 0) n[n[i].prev].next = n[i].next;
+    else l->head = n[i].next;
+    if (n[i].next >= 0) n[n[i].next].prev = n[i].prev;
+    else l->tail = n[i].prev;
+    n[i].prev = n[i].next = -1;
+    l->len--;
+}
+
+/*************************** policies *************************************/
+
+#define POL_LRU   0
+#define POL_MRU   1
+#define POL_CLOCK 2
+#define POL_ARC   3
+#define POL_COUNT 4
+
+static const char *polname[POL_COUNT] = { "LRU", "MRU", "CLOCK", "ARC" };
+
+/* ARC lists */
+#define ARC_T1 0
+#define ARC_T2 1
+#define ARC_B1 2
+#define ARC_B2 3
+
+typedef struct {
+    int policy;
+    int size;               /* pool size in frames */
+    SimMap map;             /* key -> node */
+    SimNode *node;
+    int *freenode;          /* stack of unused node indexes */
+    int nfree;
+    SimList list[4];        /* LRU/MRU use list[0]; ARC uses all four */
+    int hand;               /* CLOCK hand */
+    int p;                  /* ARC target size of T1 */
+    unsigned long misses;
+    unsigned long writebacks;
+} Sim;
+
+static void SimInit(Sim *s, int policy, int size)
+{
+    int nnodes = policy == POL_ARC ? 2 * size : size, i;
+
+    memset(s, 0, sizeof(*s));
+    s->policy = policy;
+    s->size = size;
+    SimMapInit(&s->map, nnodes);
+    s->node = calloc(nnodes, sizeof(SimNode));
+    s->freenode = malloc(nnodes * sizeof(int));
+    if (s->node == NULL || s->freenode == NULL) {
+        fprintf(stderr, "pfsim: out of memory\n");
+        exit(1);
+    }
+    for (i = nnodes - 1; i >= 0; i--) {
+        s->node[i].key = SIM_EMPTY;
+        s->freenode[s->nfree++] = i;
+    }
+    for (i = 0; i < 4; i++)
+        SimListInit(&s->list[i]);
+}
+
+static void SimFree(Sim *s)
+{
+    SimMapFree(&s->map);
+    free(s->node);
+    free(s->freenode);
+}
+
+/* drop node "i" from list "l" and from the map; count a write-back if dirty */
+static void SimDrop(Sim *s, SimList *l, int i, int writeback)
+{
+    if (l != NULL)
+        SimListUnlink(l, s->node, i);
+    if (writeback && s->node[i].dirty)
+        s->writebacks++;
+    SimMapDel(&s->map, s->node[i].key);
+    s->node[i].key = SIM_EMPTY;
+    s->node[i].dirty = 0;
+    s->freenode[s->nfree++] = i;
+}
+
+static int SimNew(Sim *s, unsigned long long key)
+{
+    int i = s->freenode[--s->nfree];
+    s->node[i].key = key;
+    s->node[i].dirty = 0;
+    s->node[i].ref = 0;
+    SimMapPut(&s->map, key, i);
+    return i;
+}
+
+/* LRU and MRU keep the most recently used page at the head */
+static void SimRefList(Sim *s, unsigned long long key, int dirty)
+{
+    SimList *l = &s->list[0];
+    int i = SimMapGet(&s->map, key);
+
+    if (i >= 0) {
+        SimListUnlink(l, s->node, i);
+    } else {
+        s->misses++;
+        if (l->len == s->size)
+            SimDrop(s, l, s->policy == POL_MRU ? l->head : l->tail, 1);
+        i = SimNew(s, key);
+    }
+    s->node[i].dirty |= dirty;
+    SimListPushHead(l, s->node, i);
+}
+
+/* CLOCK: node index doubles as frame index */
+static void SimRefClock(Sim *s, unsigned long long key, int dirty)
+{
+    int i = SimMapGet(&s->map, key);
+
+    if (i < 0) {
+        s->misses++;
+        if (s->nfree > 0) {
+            i = SimNew(s, key);
+        } else {
+            while (s->node[s->hand].ref) {
+                s->node[s->hand].ref = 0;
+                s->hand = (s->hand + 1) % s->size;
+            }
+            i = s->hand;
+            if (s->node[i].dirty)
+                s->writebacks++;
+            SimMapDel(&s->map, s->node[i].key);
+            s->node[i].key = key;
+            s->node[i].dirty = 0;
+            SimMapPut(&s->map, key, i);
+            s->hand = (s->hand + 1) % s->size;
+        }
+    }
+    s->node[i].ref = 1;
+    s->node[i].dirty |= dirty;
+}
+
+/* ARC replace step: evict from T1 or T2 into the matching ghost list */
+static void SimArcReplace(Sim *s, int inB2)
+{
+    SimList *t1 = &s->list[ARC_T1], *t2 = &s->list[ARC_T2];
+    int from, to, i;
+
+    if (t1->len > 0 && (t1->len > s->p || (inB2 && t1->len == s->p))) {
+        from = ARC_T1; to = ARC_B1;
+    } else if (t2->len > 0) {
+        from = ARC_T2; to = ARC_B2;
+    } else {
+        from = ARC_T1; to = ARC_B1;
+    }
+
+    /* a ghost hit after RELEASE events dropped every resident page */
+    if (s->list[from].len == 0)
+        return;
+
+    i = s->list[from].tail;
+    SimListUnlink(&s->list[from], s->node, i);
+    if (s->node[i].dirty)
+        s->writebacks++;
+    s->node[i].dirty = 0;
+    s->node[i].list = (unsigned char)to;
+    SimListPushHead(&s->list[to], s->node, i);
+}
+
+static void SimRefArc(Sim *s, unsigned long long key, int dirty)
+{
+    SimList *L = s->list;
+    int c = s->size, i = SimMapGet(&s->map, key), delta;
+
+    if (i >= 0 && (s->node[i].list == ARC_T1 || s->node[i].list == ARC_T2)) {
+        /* hit: move to MRU of T2 */
+        SimListUnlink(&L[s->node[i].list], s->node, i);
+        s->node[i].list = ARC_T2;
+        s->node[i].dirty |= dirty;
+        SimListPushHead(&L[ARC_T2], s->node, i);
+        return;
+    }
+
+    s->misses++;
+    if (i >= 0 && s->node[i].list == ARC_B1) {
+        delta = L[ARC_B1].len >= L[ARC_B2].len ? 1 : L[ARC_B2].len / L[ARC_B1].len;
+        s->p = s->p + delta > c ? c : s->p + delta;
+        SimArcReplace(s, 0);
+        SimListUnlink(&L[ARC_B1], s->node, i);
+    } else if (i >= 0 && s->node[i].list == ARC_B2) {
+        delta = L[ARC_B2].len >= L[ARC_B1].len ? 1 : L[ARC_B1].len / L[ARC_B2].len;
+        s->p = s->p - delta < 0 ? 0 : s->p - delta;
+        SimArcReplace(s, 1);
+        SimListUnlink(&L[ARC_B2], s->node, i);
+    } else {
+        /* complete miss */
+        if (L[ARC_T1].len + L[ARC_B1].len == c) {
+            if (L[ARC_T1].len < c) {
+                SimDrop(s, &L[ARC_B1], L[ARC_B1].tail, 0);
+                SimArcReplace(s, 0);
+            } else {
+                SimDrop(s, &L[ARC_T1], L[ARC_T1].tail, 1);
+            }
+        } else if (L[ARC_T1].len + L[ARC_B1].len + L[ARC_T2].len + L[ARC_B2].len >= c) {
+            if (L[ARC_T1].len + L[ARC_B1].len + L[ARC_T2].len + L[ARC_B2].len == 2 * c)
+                SimDrop(s, &L[ARC_B2], L[ARC_B2].tail, 0);
+            SimArcReplace(s, 0);
+        }
+        i = SimNew(s, key);
+        s->node[i].list = ARC_T1;
+        s->node[i].dirty = (unsigned char)dirty;
+        SimListPushHead(&L[ARC_T1], s->node, i);
+        return;
+    }
+
+    /* ghost hit: page comes back into T2 */
+    s->node[i].list = ARC_T2;
+    s->node[i].dirty = (unsigned char)dirty;
+    SimListPushHead(&L[ARC_T2], s->node, i);
+}
+
+static void SimRef(Sim *s, unsigned long long key, int dirty)
+{
+    switch (s->policy) {
+        case POL_LRU:
+        case POL_MRU:   SimRefList(s, key, dirty); break;
+        case POL_CLOCK: SimRefClock(s, key, dirty); break;
+        case POL_ARC:   SimRefArc(s, key, dirty); break;
+    }
+}
+
+/* mark a resident page dirty (PF_TRACE_UNFIX with dirty set) */
+static void SimDirty(Sim *s, unsigned long long key)
+{
+    int i = SimMapGet(&s->map, key);
+
+    if (i >= 0 && (s->policy != POL_ARC || s->node[i].list <= ARC_T2))
+        s->node[i].dirty = 1;
+}
+
+/* drop every page of "fd", writing back dirty ones */
+static void SimRelease(Sim *s, int fd)
+{
+    int nnodes = s->policy == POL_ARC ? 2 * s->size : s->size, i;
+    SimList *l;
+
+    for (i = 0; i < nnodes; i++) {
+        if (s->node[i].key == SIM_EMPTY || SimKeyFd(s->node[i].key) != fd)
+            continue;
+        if (s->policy == POL_CLOCK) {
+            SimDrop(s, NULL, i, 1);
+            continue;
+        }
+        l = &s->list[s->policy == POL_ARC ? s->node[i].list : 0];
+        SimDrop(s, l, i, s->policy != POL_ARC || s->node[i].list <= ARC_T2);
+    }
+}
+
+/********************** reuse distance (Mattson) **************************/
+/* Fenwick tree over reference times: a time is marked while it is the
+   latest reference of some page, so the number of marks after a page's
+   previous reference is the number of distinct pages touched since. */
+
+typedef struct {
+    int *tree;
+    long n;
+    SimMap last;               /* key -> time of latest reference */
+    unsigned long *hist;       /* hist[d]: references at distance d */
+    long histlen;
+    unsigned long cold;        /* first references */
+    long maxd;                 /* largest finite distance seen */
+    long t;
+} Reuse;
+
+static void ReuseAdd(Reuse *r, long i, int v)
+{
+    for (; i <= r->n; i += i & -i)
+        r->tree[i] += v;
+}
+
+static long ReuseSum(const Reuse *r, long i)
+{
+    long sum = 0;
+    for (; i > 0; i -= i & -i)
+        sum += r->tree[i];
+    return sum;
+}
+
+static void ReuseRef(Reuse *r, unsigned long long key)
+{
+    int last = SimMapGet(&r->last, key);
+    long d;
+
+    r->t++;
+    if (last < 0) {
+        r->cold++;
+    } else {
+        d = ReuseSum(r, r->t - 1) - ReuseSum(r, last) + 1;
+        if (d >= r->histlen) {
+            long newlen = r->histlen * 2 > d + 1 ? r->histlen * 2 : d + 1;
+            r->hist = realloc(r->hist, newlen * sizeof(unsigned long));
+            memset(r->hist + r->histlen, 0, (newlen - r->histlen) * sizeof(unsigned long));
+            r->histlen = newlen;
+        }
+        r->hist[d]++;
+        if (d > r->maxd)
+            r->maxd = d;
+        ReuseAdd(r, last, -1);
+    }
+    ReuseAdd(r, r->t, 1);
+    SimMapPut(&r->last, key, (int)r->t);
+}
+
+static void ReuseRelease(Reuse *r, int fd)
+{
+    unsigned long long *keys;
+    unsigned long i, n = 0;
+
+    if ((keys = malloc((r->last.count + 1) * sizeof(*keys))) == NULL) {
+        fprintf(stderr, "pfsim: out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i <= r->last.mask; i++)
+        if (r->last.keys[i] != SIM_EMPTY && SimKeyFd(r->last.keys[i]) == fd)
+            keys[n++] = r->last.keys[i];
+    for (i = 0; i < n; i++) {
+        ReuseAdd(r, SimMapGet(&r->last, keys[i]), -1);
+        SimMapDel(&r->last, keys[i]);
+    }
+    free(keys);
+}
+
+/* LRU misses with a pool of "size" frames */
+static unsigned long ReuseMisses(const Reuse *r, long size)
+{
+    unsigned long misses = r->cold;
+    long d;
+
+    for (d = size + 1; d < r->histlen; d++)
+        misses += r->hist[d];
+    return misses;
+}
+
+/******************************* main *************************************/
+
+static int cmp_int(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+static int parse_sizes(char *arg, int *sizes)
+{
+    int n = 0;
+    char *tok;
+
+    for (tok = strtok(arg, ","); tok != NULL && n < SIM_MAX_SIZES; tok = strtok(NULL, ",")) {
+        if (atoi(tok) > 0)
+            sizes[n++] = atoi(tok);
+    }
+    return n;
+}
+
+int main(int argc, char **argv)
+{
+    const char *tracefile = NULL, *curvefile = NULL;
+    int sizes[SIM_MAX_SIZES], nsizes = 0;
+    PFtrace_hdr hdr;
+    PFtrace_rec rec;
+    FILE *fp;
+    long nrecs, nrefs = 0;
+    unsigned long hits = 0;
+    Sim *sims;
+    Reuse reuse;
+    int i, p, k;
+    long size;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+            nsizes = parse_sizes(argv[++i], sizes);
+        else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+            curvefile = argv[++i];
+        else
+            tracefile = argv[i];
+    }
+    if (tracefile == NULL) {
+        fprintf(stderr, "usage: %s [-s size,size,...] [-c curve.csv] tracefile\n", argv[0]);
+        return 1;
+    }
+
+    if ((fp = fopen(tracefile, "rb")) == NULL) {
+        perror(tracefile);
+        return 1;
+    }
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+        memcmp(hdr.magic, PF_TRACE_MAGIC, sizeof(hdr.magic)) != 0 ||
+        hdr.recsize != (int)sizeof(PFtrace_rec)) {
+        fprintf(stderr, "%s: not a PF trace file\n", tracefile);
+        fclose(fp);
+        return 1;
+    }
+    fseek(fp, 0, SEEK_END);
+    nrecs = (ftell(fp) - (long)sizeof(hdr)) / (long)sizeof(PFtrace_rec);
+    fseek(fp, sizeof(hdr), SEEK_SET);
+
+    if (nsizes == 0) {
+        /* default: powers of two around the traced pool size */
+        for (size = 1; size <= 64L * hdr.maxbufs && nsizes < SIM_MAX_SIZES; size *= 2)
+            sizes[nsizes++] = (int)size;
+        if (nsizes < SIM_MAX_SIZES && (hdr.maxbufs & (hdr.maxbufs - 1)) != 0)
+            sizes[nsizes++] = hdr.maxbufs;
+    }
+    qsort(sizes, nsizes, sizeof(int), cmp_int);
+
+    sims = malloc(sizeof(Sim) * nsizes * POL_COUNT);
+    if (sims == NULL) {
+        fprintf(stderr, "pfsim: out of memory\n");
+        return 1;
+    }
+    for (k = 0; k < nsizes; k++)
+        for (p = 0; p < POL_COUNT; p++)
+            SimInit(&sims[k * POL_COUNT + p], p, sizes[k]);
+
+    memset(&reuse, 0, sizeof(reuse));
+    reuse.n = nrecs + 1;
+    reuse.tree = calloc(reuse.n + 1, sizeof(int));
+    reuse.histlen = 1024;
+    reuse.hist = calloc(reuse.histlen, sizeof(unsigned long));
+    SimMapInit(&reuse.last, 1024);
+    if (reuse.tree == NULL || reuse.hist == NULL) {
+        fprintf(stderr, "pfsim: out of memory\n");
+        return 1;
+    }
+
+    /* single pass over the trace, feeding every simulator */
+    while (fread(&rec, sizeof(rec), 1, fp) == 1) {
+        unsigned long long key = SimKey(rec.fd, rec.page);
+
+        switch (rec.op) {
+            case PF_TRACE_GET:
+            case PF_TRACE_ALLOC:
+                nrefs++;
+                if (rec.hit) hits++;
+                ReuseRef(&reuse, key);
+                for (k = 0; k < nsizes * POL_COUNT; k++)
+                    SimRef(&sims[k], key, rec.op == PF_TRACE_ALLOC);
+                break;
+            case PF_TRACE_UNFIX:
+                if (rec.dirty)
+                    for (k = 0; k < nsizes * POL_COUNT; k++)
+                        SimDirty(&sims[k], key);
+                break;
+            case PF_TRACE_RELEASE:
+                ReuseRelease(&reuse, rec.fd);
+                for (k = 0; k < nsizes * POL_COUNT; k++)
+                    SimRelease(&sims[k], rec.fd);
+                break;
+        }
+    }
+    fclose(fp);
+
+    printf("trace %s: %ld records, %ld references, %lu cold references\n",
+           tracefile, nrecs, nrefs, reuse.cold);
+    printf("traced run: pool=%d frames policy=%s observed hit ratio=%.2f%%\n\n",
+           hdr.maxbufs, hdr.use_mru ? "MRU" : "LRU",
+           nrefs ? 100.0 * hits / nrefs : 0.0);
+
+    printf("%-8s", "frames");
+    for (p = 0; p < POL_COUNT; p++)
+        printf(" %8s miss%% %6s wb", polname[p], "");
+    printf("\n");
+    for (k = 0; k < nsizes; k++) {
+        printf("%-8d", sizes[k]);
+        for (p = 0; p < POL_COUNT; p++) {
+            Sim *s = &sims[k * POL_COUNT + p];
+            printf(" %14.2f %9lu", nrefs ? 100.0 * s->misses / nrefs : 0.0, s->writebacks);
+        }
+        printf("\n");
+    }
+
+    if (curvefile != NULL) {
+        FILE *out = fopen(curvefile, "w");
+        if (out == NULL) {
+            perror(curvefile);
+        } else {
+            fprintf(out, "frames,lru_miss_ratio\n");
+            for (size = 1; size <= reuse.maxd; size++)
+                fprintf(out, "%ld,%.6f\n", size, nrefs ? (double)ReuseMisses(&reuse, size) / nrefs : 0.0);
+            fclose(out);
+            printf("\nLRU miss-ratio curve for 1..%ld frames written to %s\n",
+                   reuse.maxd, curvefile);
+        }
+    }
+
+    for (k = 0; k < nsizes * POL_COUNT; k++)
+        SimFree(&sims[k]);
+    free(sims);
+    free(reuse.tree);
+    free(reuse.hist);
+    SimMapFree(&reuse.last);
+    return 0;
+}
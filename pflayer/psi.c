@@ -0,0 +1,144 @@
+/* psi.c: buffer pool sizing from memory pressure. The interface routines
+are: PF_PSIWatchStart(), PF_PSIWatchStop() and PF_PSIPoll().
+
+The watcher reads a Linux pressure-stall file (a cgroup's memory.pressure
+or /proc/pressure/memory), whose first line looks like
+
+	some avg10=1.53 avg60=0.80 avg300=0.20 total=123456
+
+and moves the buffer pool target between a minimum and a maximum: it shrinks
+by a quarter while "some avg10" is above PF_PSI_HIGH percent and grows by a
+quarter while it is below PF_PSI_LOW. There is no thread: the buffer manager
+calls PFpsiTick() on every buffer allocation, which reads the clock every
+PF_PSI_TICKS calls and polls the file at most once per PF_PSI_INTERVAL_NS. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "pf.h"
+#include "pftypes.h"
+
+#define PF_PSI_TICKS 256                    /* allocations between clock reads */
+#define PF_PSI_INTERVAL_NS 1000000000ULL    /* min time between polls */
+#define PF_PSI_HIGH 10.0                    /* shrink above this avg10 (%) */
+#define PF_PSI_LOW 1.0                      /* grow below this avg10 (%) */
+#define PF_PSI_STEP 4                       /* resize by 1/PF_PSI_STEP of the pool */
+
+int PFpsiOn = FALSE;                 /* TRUE while a pressure file is watched */
+static char *PFpsipath = NULL;       /* the pressure file */
+static int PFpsimin, PFpsimax;       /* bounds of the pool target */
+static unsigned long PFpsiticks = 0;
+static unsigned long long PFpsilast = 0; /* clock at the last poll */
+
+static unsigned long long PFpsiNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Start resizing the buffer pool from the memory pressure reported in
+	the PSI file "path", keeping the target between "minframes" and
+	"maxframes". The file is polled once right away.
+
+RETURN VALUE:
+	PFE_OK if ok
+	PF error code otherwise (the watch is not started)
+*****************************************************************************/
+int PF_PSIWatchStart(const char *path, int minframes, int maxframes)
+{
+    int error;
+
+    if (minframes < 1 || maxframes < minframes) {
+        PFerrno = PFE_NOBUF;
+        return PFerrno;
+    }
+
+    PF_PSIWatchStop();
+    if ((PFpsipath = malloc(strlen(path) + 1)) == NULL) {
+        PFerrno = PFE_NOMEM;
+        return PFerrno;
+    }
+    strcpy(PFpsipath, path);
+    PFpsimin = minframes;
+    PFpsimax = maxframes;
+
+    if ((error = PF_PSIPoll()) < 0) {
+        PF_PSIWatchStop();
+        return error;
+    }
+    PFpsiticks = 0;
+    PFpsilast = PFpsiNow();
+    PFpsiOn = TRUE;
+    return PFE_OK;
+}
+
+/* Stop watching; the pool keeps its current target */
+void PF_PSIWatchStop(void)
+{
+    PFpsiOn = FALSE;
+    free(PFpsipath);
+    PFpsipath = NULL;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Read the watched pressure file now and resize the buffer pool if the
+	pressure is outside [PF_PSI_LOW, PF_PSI_HIGH].
+
+RETURN VALUE:
+	the new pool target (>0) if ok
+	PFE_UNIX if the file cannot be read or parsed
+	PF error code if resizing fails
+*****************************************************************************/
+int PF_PSIPoll(void)
+{
+    FILE *fp;
+    double avg10;
+    int nframes, target, newtarget, step, error;
+
+    if (PFpsipath == NULL || (fp = fopen(PFpsipath, "r")) == NULL) {
+        PFerrno = PFE_UNIX;
+        return PFerrno;
+    }
+    if (fscanf(fp, "some avg10=%lf", &avg10) != 1) {
+        fclose(fp);
+        PFerrno = PFE_UNIX;
+        return PFerrno;
+    }
+    fclose(fp);
+
+    PF_GetBufferPoolSize(&nframes, &target);
+    step = target / PF_PSI_STEP > 0 ? target / PF_PSI_STEP : 1;
+    newtarget = target;
+    if (avg10 > PF_PSI_HIGH)
+        newtarget = target - step;
+    else if (avg10 < PF_PSI_LOW)
+        newtarget = target + step;
+    if (newtarget < PFpsimin)
+        newtarget = PFpsimin;
+    if (newtarget > PFpsimax)
+        newtarget = PFpsimax;
+
+    if (newtarget != target && (error = PF_ResizeBufferPool(newtarget)) != PFE_OK)
+        return error;
+    return newtarget;
+}
+
+/* Called by the buffer manager on each buffer allocation while watching */
+void PFpsiTick(void)
+{
+    unsigned long long now;
+
+    if (++PFpsiticks % PF_PSI_TICKS != 0)
+        return;
+
+    now = PFpsiNow();
+    if (now - PFpsilast < PF_PSI_INTERVAL_NS)
+        return;
+    PFpsilast = now;
+    PF_PSIPoll();
+}
@@ -0,0 +1,555 @@
+/* recover.c: restart recovery from the write-ahead log. The interface
+routine is PF_WALGetRecoveryStats(); PF_WALOpen() runs PFrecAnalyze() and
+PFrecRestart().
+
+Recovery follows ARIES in three passes:
+
+	analysis  reads the log from the master checkpoint (or from the first
+		  record if there is none) to its end. It rebuilds the table
+		  of transactions without COMMIT or END, with their last and
+		  next-to-undo LSNs, and the dirty page table: each page, or
+		  file header, changed since the checkpoint, with the LSN of
+		  its first change, merged with the checkpoint's own tables.
+		  It also finds the end of the valid log.
+	redo	  reads the log from the smallest recLSN of the dirty page
+		  table and repeats history: a change (CLRs included) is
+		  applied when its page is in the table, the record is not
+		  older than the page's recLSN, and the page LSN is older than
+		  the record. Headers are compared the same way with their LSN.
+	undo	  rolls the losers back together, newest record first, with
+		  the same CLRs as PF_TxnAbort(), so a crash during recovery
+		  never undoes anything twice. Each loser ends with END.
+
+Files are found through the FILE records of the log and opened for the
+duration of recovery; records of files that no longer exist are skipped.
+A final checkpoint makes the recovered state the new restart point. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "pf.h"
+#include "pftypes.h"
+
+#define PF_REC_FD_UNKNOWN -1  /* file not looked up yet */
+#define PF_REC_FD_MISSING -2  /* file named in the log cannot be opened */
+
+typedef struct PFrectxn {
+    unsigned int id;
+    int aborting;          /* TRUE if its ABORT record was seen */
+    PF_LSN lastlsn;
+    PF_LSN undonext;
+} PFrectxn;
+
+typedef struct PFrecpage {
+    int fileid;
+    int page;              /* -1 for the file header */
+    PF_LSN reclsn;         /* 0 marks an empty slot */
+} PFrecpage;
+
+typedef struct PFrecfile {
+    char *name;            /* from its FILE record, NULL if unknown */
+    int fd;                /* PF fd, or PF_REC_FD_xxx */
+    int opened;            /* TRUE if recovery opened it */
+} PFrecfile;
+
+static PFrectxn *PFrectxns = NULL;   /* loser candidates */
+static int PFrecntxns = 0, PFrecmaxtxns = 0;
+static PFrecpage *PFrecdpt = NULL;   /* dirty page table, open addressing */
+static int PFrecdptsize = 0;         /* # of slots, a power of 2 */
+static int PFrecndpt = 0;
+static PFrecfile *PFrecfiles = NULL; /* by log file id */
+static int PFrecnfiles = 0;
+static int PFrecunixfd = -1;         /* the log file */
+static PF_LSN PFrecend = 0;          /* end of the valid log */
+static PF_RecoveryStats PFrecstats;
+
+static unsigned long long PFrecNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+/* Free the recovery tables */
+static void PFrecReset(void)
+{
+    int i;
+
+    for (i = 0; i < PFrecnfiles; i++)
+        free(PFrecfiles[i].name);
+    free(PFrecfiles);
+    free(PFrectxns);
+    free(PFrecdpt);
+    PFrecfiles = NULL;
+    PFrectxns = NULL;
+    PFrecdpt = NULL;
+    PFrecnfiles = PFrecntxns = PFrecmaxtxns = PFrecdptsize = PFrecndpt = 0;
+}
+
+/* Slot of transaction "id" in the table, -1 if absent */
+static int PFrecTxnFind(unsigned int id)
+{
+    int i;
+
+    for (i = 0; i < PFrecntxns; i++) {
+        if (PFrectxns[i].id == id)
+            return i;
+    }
+    return -1;
+}
+
+/* Slot of transaction "id", added if absent; -1 if out of memory */
+static int PFrecTxnAdd(unsigned int id)
+{
+    PFrectxn *newtab;
+    int i;
+
+    if ((i = PFrecTxnFind(id)) >= 0)
+        return i;
+    if (PFrecntxns == PFrecmaxtxns) {
+        int newmax = (PFrecmaxtxns == 0) ? 64 : 2 * PFrecmaxtxns;
+        if ((newtab = realloc(PFrectxns, newmax * sizeof(PFrectxn))) == NULL) {
+            PFerrno = PFE_NOMEM;
+            return -1;
+        }
+        PFrectxns = newtab;
+        PFrecmaxtxns = newmax;
+    }
+    i = PFrecntxns++;
+    memset(&PFrectxns[i], 0, sizeof(PFrectxn));
+    PFrectxns[i].id = id;
+    return i;
+}
+
+static void PFrecTxnRemove(unsigned int id)
+{
+    int i;
+
+    if ((i = PFrecTxnFind(id)) >= 0)
+        PFrectxns[i] = PFrectxns[--PFrecntxns];
+}
+
+/* Dirty page table slot of (fileid, page): the entry, or the empty slot
+   where it belongs */
+static PFrecpage *PFrecDptSlot(int fileid, int page)
+{
+    unsigned int h = ((unsigned int)fileid * 2654435761u) ^ ((unsigned int)page * 40503u);
+    int mask = PFrecdptsize - 1, i;
+
+    for (i = (int)(h & (unsigned int)mask);; i = (i + 1) & mask) {
+        PFrecpage *e = &PFrecdpt[i];
+        if (e->reclsn == 0 || (e->fileid == fileid && e->page == page))
+            return e;
+    }
+}
+
+/* Dirty page table entry of (fileid, page), NULL if none */
+static PFrecpage *PFrecDptFind(int fileid, int page)
+{
+    PFrecpage *e;
+
+    if (PFrecdptsize == 0)
+        return NULL;
+    e = PFrecDptSlot(fileid, page);
+    return (e->reclsn != 0) ? e : NULL;
+}
+
+/* Enter (fileid, page) with "reclsn" unless it is already in the table */
+static int PFrecDptAdd(int fileid, int page, PF_LSN reclsn)
+{
+    PFrecpage *e, *old;
+    int oldsize = PFrecdptsize, i;
+
+    if (2 * (PFrecndpt + 1) > PFrecdptsize) {
+        PFrecdptsize = (oldsize == 0) ? 1024 : 2 * oldsize;
+        old = PFrecdpt;
+        if ((PFrecdpt = calloc(PFrecdptsize, sizeof(PFrecpage))) == NULL) {
+            PFrecdpt = old;
+            PFrecdptsize = oldsize;
+            PFerrno = PFE_NOMEM;
+            return PFerrno;
+        }
+        for (i = 0; i < oldsize; i++) {
+            if (old[i].reclsn != 0)
+                *PFrecDptSlot(old[i].fileid, old[i].page) = old[i];
+        }
+        free(old);
+    }
+
+    e = PFrecDptSlot(fileid, page);
+    if (e->reclsn == 0) {
+        e->fileid = fileid;
+        e->page = page;
+        e->reclsn = reclsn;
+        PFrecndpt++;
+    }
+    return PFE_OK;
+}
+
+/* Remember that log file id "fileid" names the file "name" */
+static int PFrecFileName(int fileid, const char *name)
+{
+    PFrecfile *newtab;
+    int i;
+
+    if (fileid < 0)
+        return PFE_OK;
+    if (fileid >= PFrecnfiles) {
+        int newn = (fileid + 1 > 2 * PFrecnfiles) ? fileid + 1 : 2 * PFrecnfiles;
+        if ((newtab = realloc(PFrecfiles, newn * sizeof(PFrecfile))) == NULL) {
+            PFerrno = PFE_NOMEM;
+            return PFerrno;
+        }
+        for (i = PFrecnfiles; i < newn; i++) {
+            newtab[i].name = NULL;
+            newtab[i].fd = PF_REC_FD_UNKNOWN;
+            newtab[i].opened = FALSE;
+        }
+        PFrecfiles = newtab;
+        PFrecnfiles = newn;
+    }
+    if (PFrecfiles[fileid].name == NULL) {
+        if ((PFrecfiles[fileid].name = malloc(strlen(name) + 1)) == NULL) {
+            PFerrno = PFE_NOMEM;
+            return PFerrno;
+        }
+        strcpy(PFrecfiles[fileid].name, name);
+    }
+    return PFE_OK;
+}
+
+/* PF fd of log file id "fileid", opening the file if needed; -1 if the
+   file is unknown or cannot be opened */
+static int PFrecFile(int fileid)
+{
+    PFrecfile *f;
+    int fd;
+
+    if (fileid < 0 || fileid >= PFrecnfiles || PFrecfiles[fileid].name == NULL)
+        return -1;
+    f = &PFrecfiles[fileid];
+    if (f->fd == PF_REC_FD_MISSING)
+        return -1;
+    if (f->fd >= 0)
+        return f->fd;
+
+    if ((fd = PFfileByName(f->name)) < 0) {
+        if ((fd = PF_OpenFile(f->name)) < 0) {
+            f->fd = PF_REC_FD_MISSING;
+            return -1;
+        }
+        f->opened = TRUE;
+    }
+    PFfileSetLogId(fd, fileid);
+    f->fd = fd;
+    return fd;
+}
+
+/* Read function for redo: a page past the end of the file was allocated
+   but never written, and its log records replay onto a zeroed page */
+static int PFrecReadfcn(int fd, int pagenum, PFfpage *buf)
+{
+    int error = PFreadfcn(fd, pagenum, buf);
+
+    if (error == PFE_EOF) {
+        memset(buf, 0, sizeof(PFfpage));
+        return PFE_OK;
+    }
+    return error;
+}
+
+/* Analysis of one record "rec" at "lsn" */
+static int PFrecAnalyzeRec(const PFlogrec *rec, PF_LSN lsn, unsigned int *maxtxn, int *maxfile)
+{
+    int type = rec->type & ~PF_LOG_CLR, i, n;
+
+    if (rec->txn > *maxtxn)
+        *maxtxn = rec->txn;
+
+    switch (rec->type) {
+        case PF_LOG_FILE:
+            if (rec->fileid > *maxfile)
+                *maxfile = rec->fileid;
+            return PFrecFileName(rec->fileid, (const char *)(rec + 1));
+
+        case PF_LOG_CKPT_BEGIN: {
+            const PFckpt_begin *cb = (const PFckpt_begin *)(rec + 1);
+            if (cb->nexttxn > *maxtxn + 1)
+                *maxtxn = cb->nexttxn - 1;
+            if (cb->nextfile > *maxfile + 1)
+                *maxfile = cb->nextfile - 1;
+            return PFE_OK;
+        }
+
+        case PF_LOG_CKPT_TXNS: {
+            /* a transaction that ended before the snapshot is not in it */
+            const PFckpt_txn *ct = (const PFckpt_txn *)(rec + 1);
+            n = (int)((rec->len - sizeof(PFlogrec)) / sizeof(PFckpt_txn));
+            for (i = 0; i < n; i++) {
+                if (PFrecTxnFind(ct[i].id) >= 0)
+                    continue;
+                if (PFrecTxnAdd(ct[i].id) < 0)
+                    return PFerrno;
+                PFrectxns[PFrecntxns - 1].aborting = ct[i].aborting;
+                PFrectxns[PFrecntxns - 1].lastlsn = ct[i].lastlsn;
+                PFrectxns[PFrecntxns - 1].undonext = ct[i].undonext;
+            }
+            return PFE_OK;
+        }
+
+        case PF_LOG_CKPT_DPT: {
+            const PFckpt_page *cp = (const PFckpt_page *)(rec + 1);
+            n = (int)((rec->len - sizeof(PFlogrec)) / sizeof(PFckpt_page));
+            for (i = 0; i < n; i++) {
+                if (PFrecDptAdd(cp[i].fileid, cp[i].page, cp[i].reclsn) != PFE_OK)
+                    return PFerrno;
+            }
+            return PFE_OK;
+        }
+
+        case PF_LOG_COMMIT:
+        case PF_LOG_END:
+            PFrecTxnRemove(rec->txn);
+            return PFE_OK;
+    }
+
+    if (rec->txn == 0)
+        return PFE_OK;
+    if ((i = PFrecTxnAdd(rec->txn)) < 0)
+        return PFerrno;
+    PFrectxns[i].lastlsn = lsn;
+    if (rec->type == PF_LOG_ABORT)
+        PFrectxns[i].aborting = TRUE;
+    else if (rec->type & PF_LOG_CLR)
+        PFrectxns[i].undonext = rec->undonext;
+    else if (type == PF_LOG_UPDATE || type == PF_LOG_HEADER)
+        PFrectxns[i].undonext = lsn;
+
+    if (type == PF_LOG_UPDATE || type == PF_LOG_HEADER)
+        return PFrecDptAdd(rec->fileid, (type == PF_LOG_UPDATE) ? rec->page : -1, lsn);
+    return PFE_OK;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Analysis pass over the log file "unixfd", starting at the checkpoint
+	"master" (0 if none). Return the end of the valid log in "*end" and
+	the largest transaction and file ids in use. The tables it builds
+	are kept for PFrecRestart().
+
+RETURN VALUE:
+	PFE_OK if ok
+	PFE_LOGCORRUPT if "master" is not a checkpoint
+	PF error code otherwise
+*****************************************************************************/
+int PFrecAnalyze(int unixfd, PF_LSN master, PF_LSN *end, unsigned int *maxtxn, int *maxfile)
+{
+    PFlogscan scan;
+    PFlogrec *rec;
+    PF_LSN lsn;
+    unsigned long long t0 = PFrecNow();
+    int error, i;
+
+    PFrecReset();
+    memset(&PFrecstats, 0, sizeof(PFrecstats));
+    PFrecunixfd = unixfd;
+    *maxtxn = 0;
+    *maxfile = -1;
+
+    PFrecstats.checkpoint = (master != 0) ? master : sizeof(PFwal_hdr);
+    if ((error = PFwalScanOpen(&scan, unixfd, PFrecstats.checkpoint)) != PFE_OK)
+        return error;
+    while ((error = PFwalScanNext(&scan, &rec, &lsn)) == PFE_OK) {
+        if (master != 0 && lsn == master && rec->type != PF_LOG_CKPT_BEGIN)
+            break;
+        PFrecstats.records++;
+        if ((error = PFrecAnalyzeRec(rec, lsn, maxtxn, maxfile)) != PFE_OK)
+            break;
+    }
+    *end = PFrecend = scan.pos;
+    PFwalScanClose(&scan);
+    if (error != PFE_EOF && error != PFE_OK)
+        return error;
+    if (master != 0 && PFrecstats.records == 0) {
+        PFrecReset();
+        PFerrno = PFE_LOGCORRUPT;
+        return PFerrno;
+    }
+
+    PFrecstats.end = PFrecend;
+    PFrecstats.dirty = PFrecndpt;
+    PFrecstats.losers = PFrecntxns;
+    for (i = 0; i < PFrecdptsize; i++) {
+        if (PFrecdpt[i].reclsn != 0 &&
+            (PFrecstats.redo_start == 0 || PFrecdpt[i].reclsn < PFrecstats.redo_start))
+            PFrecstats.redo_start = PFrecdpt[i].reclsn;
+    }
+    PFrecstats.analysis_ns = PFrecNow() - t0;
+    return PFE_OK;
+}
+
+/* Redo the change "rec" at "lsn" if the data files miss it */
+static int PFrecRedoRec(const PFlogrec *rec, PF_LSN lsn)
+{
+    int type = rec->type & ~PF_LOG_CLR, fd, error;
+    PFrecpage *e;
+    PFbpage *bpage;
+    PFhdr_str hdr;
+    const PFhdr_str *hp;
+
+    e = PFrecDptFind(rec->fileid, (type == PF_LOG_UPDATE) ? rec->page : -1);
+    if (e == NULL || lsn < e->reclsn || (fd = PFrecFile(rec->fileid)) < 0)
+        return PFE_OK;
+
+    if (type == PF_LOG_HEADER) {
+        PFfileGetHdr(fd, &hdr);
+        if (hdr.lsn >= lsn)
+            return PFE_OK;
+        /* a HEADER record holds before and after images, its CLR only the one restored */
+        hp = (const PFhdr_str *)(rec + 1);
+        hdr = (rec->type & PF_LOG_CLR) ? hp[0] : hp[1];
+        hdr.lsn = lsn;
+        PFfileSetHdr(fd, &hdr);
+        PFrecstats.redone++;
+        return PFE_OK;
+    }
+
+    if ((error = PFbufFix(fd, rec->page, &bpage, PFrecReadfcn, PFwritefcn)) != PFE_OK)
+        return error;
+    if (bpage->fpage->lsn >= lsn)
+        return PFbufUnfixHandle(bpage, FALSE);
+    PFwalApply(bpage->fpage, rec, FALSE);
+    bpage->fpage->lsn = lsn;
+    if (bpage->reclsn == 0)
+        bpage->reclsn = lsn;
+    PFrecstats.redone++;
+    return PFbufUnfixHandle(bpage, TRUE);
+}
+
+/* Redo pass from the smallest recLSN to the end of the log */
+static int PFrecRedo(void)
+{
+    PFlogscan scan;
+    PFlogrec *rec;
+    PF_LSN lsn;
+    int type, error;
+
+    if (PFrecstats.redo_start == 0)
+        return PFE_OK;
+    if ((error = PFwalScanOpen(&scan, PFrecunixfd, PFrecstats.redo_start)) != PFE_OK)
+        return error;
+    while (scan.pos < PFrecend && (error = PFwalScanNext(&scan, &rec, &lsn)) == PFE_OK) {
+        type = rec->type & ~PF_LOG_CLR;
+        if (rec->type == PF_LOG_FILE)
+            error = PFrecFileName(rec->fileid, (const char *)(rec + 1));
+        else if (type == PF_LOG_UPDATE || type == PF_LOG_HEADER)
+            error = PFrecRedoRec(rec, lsn);
+        if (error != PFE_OK)
+            break;
+    }
+    PFwalScanClose(&scan);
+    return (error == PFE_EOF) ? PFE_OK : error;
+}
+
+/* Undo pass: roll the losers back together, newest record first */
+static int PFrecUndo(void)
+{
+    PFtxn **txns;
+    PFlogbuf *buf;
+    int n = PFrecntxns, i, best, error = PFE_OK;
+
+    if (n == 0)
+        return PFE_OK;
+    if ((txns = calloc(n, sizeof(PFtxn *))) == NULL ||
+        (buf = malloc(sizeof(PFlogbuf))) == NULL) {
+        free(txns);
+        PFerrno = PFE_NOMEM;
+        return PFerrno;
+    }
+
+    for (i = 0; i < n && error == PFE_OK; i++) {
+        if ((txns[i] = PFwalAdoptTxn(PFrectxns[i].id, PFrectxns[i].lastlsn,
+                                     PFrectxns[i].undonext)) == NULL)
+            error = PFerrno;
+        else if (!PFrectxns[i].aborting && PFwalLogTxn(txns[i], PF_LOG_ABORT) == 0)
+            error = PFerrno;
+    }
+
+    while (error == PFE_OK) {
+        best = -1;
+        for (i = 0; i < n; i++) {
+            if (txns[i] != NULL && (best < 0 || txns[i]->undonext > txns[best]->undonext))
+                best = i;
+        }
+        if (best < 0)
+            break;
+
+        if (txns[best]->undonext == 0) {
+            if (PFwalLogTxn(txns[best], PF_LOG_END) == 0) {
+                error = PFerrno;
+                break;
+            }
+            PFwalEndTxn(txns[best]);
+            txns[best] = NULL;
+            continue;
+        }
+
+        if ((error = PFwalRead(txns[best]->undonext, buf)) != PFE_OK)
+            break;
+        if (buf->rec.type & PF_LOG_CLR)
+            txns[best]->undonext = buf->rec.undonext;
+        else if ((buf->rec.type == PF_LOG_UPDATE || buf->rec.type == PF_LOG_HEADER) &&
+                 PFrecFile(buf->rec.fileid) >= 0) {
+            if ((error = PFwalUndo(txns[best], &buf->rec)) != PFE_OK)
+                break;
+            PFrecstats.undone++;
+        } else
+            txns[best]->undonext = buf->rec.prevlsn;
+    }
+
+    /* on error the remaining losers stay registered; the log cannot be closed */
+    free(buf);
+    free(txns);
+    return error;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Redo and undo passes after PFrecAnalyze(), with the log open. The
+	files recovery opened are closed again, which writes their pages
+	back, and a checkpoint is taken if the log had any record.
+
+RETURN VALUE:
+	PFE_OK if ok
+	PF error code otherwise
+*****************************************************************************/
+int PFrecRestart(void)
+{
+    unsigned long long t0;
+    int error, i;
+
+    t0 = PFrecNow();
+    error = PFrecRedo();
+    PFrecstats.redo_ns = PFrecNow() - t0;
+
+    t0 = PFrecNow();
+    if (error == PFE_OK)
+        error = PFrecUndo();
+    PFrecstats.undo_ns = PFrecNow() - t0;
+
+    for (i = 0; i < PFrecnfiles; i++) {
+        if (PFrecfiles[i].opened && PF_CloseFile(PFrecfiles[i].fd) != PFE_OK && error == PFE_OK)
+            error = PFerrno;
+    }
+    if (error == PFE_OK && PFrecstats.records > 0)
+        error = PF_Checkpoint();
+    PFrecReset();
+    return error;
+}
+
+/* Copy what the recovery of the last PF_WALOpen() did into "stats" */
+void PF_WALGetRecoveryStats(PF_RecoveryStats *stats)
+{
+    *stats = PFrecstats;
+}
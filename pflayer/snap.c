@@ -0,0 +1,626 @@
+/* snap.c: copy-on-write snapshots. The interface routines are:
+PF_BeginSnapshot(), PF_EndSnapshot(), PF_UseSnapshot(), PF_SnapshotSpill()
+and PF_GetSnapshotStats().
+
+A snapshot of an open file sees every page as it was when the snapshot
+began, while writers keep changing the file. A snapshot clock is advanced
+by each PF_BeginSnapshot(), and every page changed while a snapshot of its
+file is active records the clock value of its last change ("modepoch") in
+a version table. A snapshot begun with clock value E sees the current
+page if the page's modepoch is below E. Otherwise it sees the version kept
+when the page was changed over E: when a writer fixes a page that some
+active snapshot still sees, the buffer manager saves its image, and if the
+page is unfixed changed the image becomes a version for the snapshots
+begun since the change before. A page is thus copied at most once per
+snapshot, whatever the number of changes.
+
+A thread reads under a snapshot after PF_UseSnapshot(): PF_GetThisPage(),
+PF_PinPage(), PF_GetFirstPage() and PF_GetNextPage() on the snapshot's file
+then resolve the snapshot's version of the page into one of the
+snapshot's PF_SNAP_FRAMES private frames, so HF and AM scans work
+unchanged. Those pages are read-only. Reader frames are outside the buffer
+pool: a report neither pins pages writers need nor flushes the pool.
+
+Versions are kept in memory, up to the limit set by PF_SnapshotSpill();
+beyond it they are written to a spill file. A version is dropped once no
+active snapshot sees it. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "pf.h"
+#include "pftypes.h"
+
+int PFsnapOn = 0;                         /* # of active snapshots */
+static PFsnap *PFsnaps = NULL;            /* snapshot table, id = index + 1 */
+static int PFnsnaps = 0;                  /* # of entries in PFsnaps */
+static unsigned long PFsnapclock = 0;     /* advanced by each PF_BeginSnapshot() */
+static PFsnappage *PFsnaptbl[PF_SNAP_BUCKETS];
+static __thread int PFsnapcur = 0;        /* snapshot of the calling thread */
+static int PFspillfd = -1;                /* unix fd of the spill file */
+static long PFspillmax = -1;              /* versions kept in memory, -1 for all */
+static long PFspillslots = 0;             /* page slots in the spill file */
+static long *PFspillfree = NULL;          /* stack of free slots */
+static long PFspillnfree = 0;
+static long PFsnapmem = 0;                /* versions in memory */
+static PF_SnapStats PFsnapstats;
+
+#define PFsnapHash(fd, page) ((unsigned int)((fd) * 40503 + (page)) % PF_SNAP_BUCKETS)
+#define PFsnapValid(snap) ((snap) > 0 && (snap) <= PFnsnaps && PFsnaps[(snap) - 1].fd >= 0)
+
+/* Version table entry of page "page" of file "fd", NULL if none */
+static PFsnappage *PFsnapFind(int fd, int page)
+{
+    PFsnappage *sp;
+
+    for (sp = PFsnaptbl[PFsnapHash(fd, page)]; sp != NULL; sp = sp->next) {
+        if (sp->fd == fd && sp->page == page)
+            return sp;
+    }
+    return NULL;
+}
+
+/* Newest and oldest clock values of the active snapshots of file "fd" that
+   have page "page" (any snapshot if "page" is -1); FALSE if there is none */
+static int PFsnapRange(int fd, int page, unsigned long *newest, unsigned long *oldest)
+{
+    int i, found = FALSE;
+
+    for (i = 0; i < PFnsnaps; i++) {
+        if (PFsnaps[i].fd != fd || page >= PFsnaps[i].hdr.numpages)
+            continue;
+        if (!found || PFsnaps[i].epoch > *newest)
+            *newest = PFsnaps[i].epoch;
+        if (!found || PFsnaps[i].epoch < *oldest)
+            *oldest = PFsnaps[i].epoch;
+        found = TRUE;
+    }
+    return found;
+}
+
+/* TRUE if an active snapshot of file "fd" that has page "page" was begun
+   with a clock value in [lo, hi] */
+static int PFsnapSeen(int fd, int page, unsigned long lo, unsigned long hi)
+{
+    int i;
+
+    for (i = 0; i < PFnsnaps; i++) {
+        if (PFsnaps[i].fd == fd && page < PFsnaps[i].hdr.numpages &&
+            PFsnaps[i].epoch >= lo && PFsnaps[i].epoch <= hi)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/* Free version "v" and its spill slot */
+static void PFsnapFreeVersion(PFsnapver *v)
+{
+    if (v->slot >= 0)
+        PFspillfree[PFspillnfree++] = v->slot;
+    else {
+        free(v->image);
+        PFsnapmem--;
+    }
+    free(v);
+    PFsnapstats.versions--;
+}
+
+/* Move the image of version "v" to the spill file; it stays in memory if
+   there is no room */
+static void PFsnapSpill(PFsnapver *v)
+{
+    long slot, *grown;
+
+    if (PFspillnfree > 0)
+        slot = PFspillfree[--PFspillnfree];
+    else {
+        /* the free stack must be able to take every slot back */
+        if ((grown = realloc(PFspillfree, (PFspillslots + 1) * sizeof(long))) == NULL)
+            return;
+        PFspillfree = grown;
+        slot = PFspillslots++;
+    }
+    if (pwrite(PFspillfd, v->image, sizeof(PFfpage), (off_t)slot * (off_t)sizeof(PFfpage))
+            != (ssize_t)sizeof(PFfpage)) {
+        perror("PFsnapSpill: write");
+        PFspillfree[PFspillnfree++] = slot;
+        return;
+    }
+    free(v->image);
+    v->image = NULL;
+    v->slot = slot;
+    PFsnapmem--;
+    PFsnapstats.spilled++;
+}
+
+/* Drop the versions of file "fd" that no active snapshot sees, and the
+   table entries that no longer tell an active snapshot anything */
+static void PFsnapCollect(int fd)
+{
+    PFsnappage **link, *sp;
+    PFsnapver **vlink, *v;
+    unsigned long newest, oldest;
+    int active, b;
+
+    active = PFsnapRange(fd, -1, &newest, &oldest);
+    for (b = 0; b < PF_SNAP_BUCKETS; b++) {
+        for (link = &PFsnaptbl[b]; (sp = *link) != NULL; ) {
+            if (sp->fd != fd) {
+                link = &sp->next;
+                continue;
+            }
+            for (vlink = &sp->versions; (v = *vlink) != NULL; ) {
+                if (active && PFsnapSeen(fd, sp->page, v->lo, v->hi))
+                    vlink = &v->next;
+                else {
+                    *vlink = v->next;
+                    PFsnapFreeVersion(v);
+                }
+            }
+            if (sp->versions == NULL && (!active || sp->modepoch < oldest)) {
+                *link = sp->next;
+                free(sp);
+            } else
+                link = &sp->next;
+        }
+    }
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Called by the buffer manager when a writer fixes the page of
+	"bpage". If an active snapshot of its file sees the current image,
+	save the image in bpage->snapbefore for PFsnapCommit(). Pages added
+	after every snapshot began need no image.
+
+RETURN VALUE:
+	PFE_OK if ok
+	PFE_NOMEM if the image cannot be saved
+*****************************************************************************/
+int PFsnapCapture(PFbpage *bpage)
+{
+    PFsnappage *sp;
+    unsigned long newest, oldest;
+
+    if (bpage->snapbefore != NULL || !PFsnapRange(bpage->fd, bpage->page, &newest, &oldest))
+        return PFE_OK;
+    if ((sp = PFsnapFind(bpage->fd, bpage->page)) != NULL && sp->modepoch >= newest)
+        return PFE_OK;
+
+    if ((bpage->snapbefore = malloc(sizeof(PFfpage))) == NULL) {
+        PFerrno = PFE_NOMEM;
+        return PFerrno;
+    }
+    memcpy(bpage->snapbefore, bpage->fpage, sizeof(PFfpage));
+    PFsnapstats.captures++;
+    return PFE_OK;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Called by the buffer manager when the page of "bpage", captured by
+	PFsnapCapture(), is unfixed. If it changed, the saved image becomes a
+	version seen by the snapshots begun since the page's previous change,
+	and the page's modepoch becomes the current clock. The saved image is
+	released either way.
+
+RETURN VALUE:
+	PFE_OK if ok
+	PFE_NOMEM if the version cannot be recorded
+*****************************************************************************/
+int PFsnapCommit(PFbpage *bpage)
+{
+    PFfpage *before = bpage->snapbefore;
+    PFsnappage *sp;
+    PFsnapver *v;
+    unsigned int b;
+
+    bpage->snapbefore = NULL;
+    if (!bpage->dirty || (before->nextfree == bpage->fpage->nextfree &&
+                          memcmp(before->pagebuf, bpage->fpage->pagebuf, PF_PAGE_SIZE) == 0)) {
+        free(before);
+        return PFE_OK;
+    }
+
+    /* a snapshot that has ended since the page was fixed may have needed it */
+    sp = PFsnapFind(bpage->fd, bpage->page);
+    if (!PFsnapSeen(bpage->fd, bpage->page, sp != NULL ? sp->modepoch + 1 : 1, PFsnapclock)) {
+        if (sp != NULL)
+            sp->modepoch = PFsnapclock;
+        free(before);
+        return PFE_OK;
+    }
+
+    if (sp == NULL) {
+        if ((sp = malloc(sizeof(PFsnappage))) == NULL) {
+            free(before);
+            PFerrno = PFE_NOMEM;
+            return PFerrno;
+        }
+        b = PFsnapHash(bpage->fd, bpage->page);
+        sp->fd = bpage->fd;
+        sp->page = bpage->page;
+        sp->modepoch = 0;
+        sp->versions = NULL;
+        sp->next = PFsnaptbl[b];
+        PFsnaptbl[b] = sp;
+    }
+    if ((v = malloc(sizeof(PFsnapver))) == NULL) {
+        free(before);
+        PFerrno = PFE_NOMEM;
+        return PFerrno;
+    }
+    v->lo = sp->modepoch + 1;
+    v->hi = PFsnapclock;
+    v->image = before;
+    v->slot = -1;
+    v->next = sp->versions;
+    sp->versions = v;
+    sp->modepoch = PFsnapclock;
+
+    PFsnapmem++;
+    PFsnapstats.created++;
+    PFsnapstats.versions++;
+    if (PFspillfd >= 0 && PFsnapmem > PFspillmax)
+        PFsnapSpill(v);
+    return PFE_OK;
+}
+
+/* Read into "fpage" page "pagenum" of snapshot "s" as the snapshot sees it */
+static int PFsnapResolve(PFsnap *s, int pagenum, PFfpage *fpage)
+{
+    PFsnappage *sp;
+    PFsnapver *v;
+    PFbpage *bpage;
+    int error;
+
+    PFsnapstats.reads++;
+    if ((sp = PFsnapFind(s->fd, pagenum)) != NULL && sp->modepoch >= s->epoch) {
+        for (v = sp->versions; v != NULL; v = v->next) {
+            if (v->lo <= s->epoch && s->epoch <= v->hi)
+                break;
+        }
+        if (v == NULL) {
+            /* cannot happen: the page was changed without being captured */
+            fprintf(stderr, "PFsnapResolve: no version of page %d for snapshot %lu\n",
+                    pagenum, s->epoch);
+            PFerrno = PFE_INVALIDPAGE;
+            return PFerrno;
+        }
+        PFsnapstats.old_reads++;
+        if (v->image != NULL) {
+            memcpy(fpage, v->image, sizeof(PFfpage));
+            return PFE_OK;
+        }
+        PFsnapstats.spill_reads++;
+        if (pread(PFspillfd, fpage, sizeof(PFfpage), (off_t)v->slot * (off_t)sizeof(PFfpage))
+                != (ssize_t)sizeof(PFfpage)) {
+            PFerrno = PFE_UNIX;
+            perror("PFsnapResolve: spill read");
+            return PFerrno;
+        }
+        return PFE_OK;
+    }
+
+    /* the current image; a writer changing it now still has it saved */
+    if ((bpage = PFhashFind(s->fd, pagenum)) != NULL) {
+        memcpy(fpage, bpage->snapbefore != NULL ? bpage->snapbefore : bpage->fpage, sizeof(PFfpage));
+        return PFE_OK;
+    }
+    if ((error = PFreadfcn(s->fd, pagenum, fpage)) == PFE_EOF) {
+        memset(fpage, 0, sizeof(PFfpage));
+        return PFE_OK;
+    }
+    return error;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Begin a snapshot of the open file "fd". Pages fixed by writers now
+	are seen as they were when fixed.
+
+RETURN VALUE:
+	snapshot id (> 0) if ok
+	PF error code otherwise
+*****************************************************************************/
+int PF_BeginSnapshot(int fd)
+{
+    PFsnap *s, *grown;
+    int i, id, error;
+
+    if (!PFfileValid(fd)) {
+        PFerrno = PFE_FD;
+        return PFerrno;
+    }
+
+    for (id = 0; id < PFnsnaps && PFsnaps[id].fd >= 0; id++)
+        ;
+    if (id == PFnsnaps) {
+        if ((grown = realloc(PFsnaps, (PFnsnaps + 1) * sizeof(PFsnap))) == NULL) {
+            PFerrno = PFE_NOMEM;
+            return PFerrno;
+        }
+        PFsnaps = grown;
+        PFnsnaps++;
+        PFsnaps[id].fd = -1;
+        for (i = 0; i < PF_SNAP_FRAMES; i++)
+            PFsnaps[id].frames[i].fpage = NULL;
+    }
+    s = &PFsnaps[id];
+
+    for (i = 0; i < PF_SNAP_FRAMES; i++) {
+        if (s->frames[i].fpage == NULL &&
+            (s->frames[i].fpage = malloc(sizeof(PFfpage))) == NULL) {
+            PFerrno = PFE_NOMEM;
+            return PFerrno;
+        }
+        s->frames[i].fd = fd;
+        s->frames[i].page = -1;
+        s->frames[i].fixed = FALSE;
+        s->frames[i].dirty = FALSE;
+        s->frames[i].snap = TRUE;
+        s->frames[i].before = NULL;
+        s->frames[i].snapbefore = NULL;
+    }
+    PFfileGetHdr(fd, &s->hdr);
+    s->fd = fd;
+    s->epoch = ++PFsnapclock;
+    s->hand = 0;
+    PFsnapOn++;
+    PFsnapstats.begun++;
+
+    /* pages being changed now: the snapshot sees them as they were fixed */
+    if ((error = PFbufSnapCapture(fd)) != PFE_OK) {
+        PF_EndSnapshot(id + 1);
+        return error;
+    }
+    return id + 1;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	End snapshot "snap" and drop the page versions no other snapshot
+	sees. Its pages must be unfixed.
+
+RETURN VALUE:
+	PFE_OK if ok
+	PFE_INVALIDPAGE if "snap" is not an active snapshot
+	PFE_PAGEFIXED if one of its pages is still fixed
+*****************************************************************************/
+int PF_EndSnapshot(int snap)
+{
+    PFsnap *s;
+    int i, fd;
+
+    if (!PFsnapValid(snap)) {
+        PFerrno = PFE_INVALIDPAGE;
+        return PFerrno;
+    }
+    s = &PFsnaps[snap - 1];
+    for (i = 0; i < PF_SNAP_FRAMES; i++) {
+        if (s->frames[i].fixed) {
+            PFerrno = PFE_PAGEFIXED;
+            return PFerrno;
+        }
+    }
+
+    fd = s->fd;
+    s->fd = -1;
+    PFsnapOn--;
+    if (PFsnapcur == snap)
+        PFsnapcur = 0;
+    PFsnapCollect(fd);
+    return PFE_OK;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Make the calling thread read the file of snapshot "snap" as the
+	snapshot sees it, until it is called with 0 or the snapshot ends.
+	Other files, and other threads, are not affected.
+
+RETURN VALUE:
+	PFE_OK if ok
+	PFE_INVALIDPAGE if "snap" is neither 0 nor an active snapshot
+*****************************************************************************/
+int PF_UseSnapshot(int snap)
+{
+    if (snap != 0 && !PFsnapValid(snap)) {
+        PFerrno = PFE_INVALIDPAGE;
+        return PFerrno;
+    }
+    PFsnapcur = snap;
+    return PFE_OK;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Keep at most "mempages" page versions in memory and write the others
+	to the spill file "fname", which is created (and removed at once, so
+	that it disappears with the process). With a NULL "fname" all
+	versions stay in memory. No snapshot may be active.
+
+RETURN VALUE:
+	PFE_OK if ok
+	PFE_FILEOPEN if a snapshot is active
+	PFE_UNIX if the file cannot be created
+*****************************************************************************/
+int PF_SnapshotSpill(const char *fname, int mempages)
+{
+    if (PFsnapOn > 0) {
+        PFerrno = PFE_FILEOPEN;
+        return PFerrno;
+    }
+
+    if (PFspillfd >= 0)
+        close(PFspillfd);
+    free(PFspillfree);
+    PFspillfd = -1;
+    PFspillfree = NULL;
+    PFspillslots = PFspillnfree = 0;
+    PFspillmax = -1;
+    if (fname == NULL)
+        return PFE_OK;
+
+    if ((PFspillfd = open(fname, O_CREAT | O_TRUNC | O_RDWR, 0600)) < 0) {
+        PFerrno = PFE_UNIX;
+        perror("PF_SnapshotSpill: open");
+        return PFerrno;
+    }
+    unlink(fname);
+    PFspillmax = mempages;
+    return PFE_OK;
+}
+
+/* Copy the snapshot statistics into "stats" */
+void PF_GetSnapshotStats(PF_SnapStats *stats)
+{
+    *stats = PFsnapstats;
+}
+
+/* Snapshot the calling thread reads file "fd" under, 0 if none */
+int PFsnapCurrent(int fd)
+{
+    if (PFsnapcur != 0 && PFsnapValid(PFsnapcur) && PFsnaps[PFsnapcur - 1].fd == fd)
+        return PFsnapcur;
+    return 0;
+}
+
+/* TRUE if an active snapshot reads file "fd" */
+int PFsnapFileActive(int fd)
+{
+    unsigned long newest, oldest;
+
+    return PFsnapRange(fd, -1, &newest, &oldest);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	PF_PinPage() under snapshot "snap": fix page "pagenum" as the
+	snapshot sees it in one of its frames; "*handle" is the frame.
+
+RETURN VALUE:
+	PFE_OK if ok
+	PFE_PAGEFIXED if the page is already fixed ("*pagebuf" and "*handle"
+	are still set)
+	PFE_INVALIDPAGE if the page did not exist or was free in the snapshot
+	PFE_NOBUF if all of the snapshot's frames are fixed
+	PF error code otherwise
+*****************************************************************************/
+int PFsnapPin(int snap, int pagenum, char **pagebuf, PFbpage **handle)
+{
+    PFsnap *s = &PFsnaps[snap - 1];
+    PFbpage *frame = NULL;
+    int i, error;
+
+    *handle = NULL;
+    if (pagenum < 0 || pagenum >= s->hdr.numpages) {
+        PFerrno = PFE_INVALIDPAGE;
+        return PFerrno;
+    }
+
+    for (i = 0; i < PF_SNAP_FRAMES; i++) {
+        if (s->frames[i].page == pagenum) {
+            frame = &s->frames[i];
+            break;
+        }
+    }
+    if (frame != NULL) {
+        /* a snapshot's page never changes: the frame is still valid */
+        PFsnapstats.frame_hits++;
+        if (frame->fixed) {
+            *pagebuf = frame->fpage->pagebuf;
+            *handle = frame;
+            PFerrno = PFE_PAGEFIXED;
+            return PFerrno;
+        }
+    } else {
+        for (i = 0; i < PF_SNAP_FRAMES && s->frames[s->hand].fixed; i++)
+            s->hand = (s->hand + 1) % PF_SNAP_FRAMES;
+        if (i == PF_SNAP_FRAMES) {
+            PFerrno = PFE_NOBUF;
+            return PFerrno;
+        }
+        frame = &s->frames[s->hand];
+        s->hand = (s->hand + 1) % PF_SNAP_FRAMES;
+        frame->page = -1;
+        if ((error = PFsnapResolve(s, pagenum, frame->fpage)) != PFE_OK)
+            return error;
+        frame->page = pagenum;
+    }
+
+    if (frame->fpage->nextfree != PF_PAGE_USED) {
+        PFerrno = PFE_INVALIDPAGE;
+        return PFerrno;
+    }
+    frame->fixed = TRUE;
+    *pagebuf = frame->fpage->pagebuf;
+    *handle = frame;
+    return PFE_OK;
+}
+
+/* PF_GetNextPage() under snapshot "snap" */
+int PFsnapNext(int snap, int *pagenum, char **pagebuf)
+{
+    PFbpage *frame;
+    int page, error;
+
+    if (*pagenum < -1 || *pagenum >= PFsnaps[snap - 1].hdr.numpages) {
+        PFerrno = PFE_INVALIDPAGE;
+        return PFerrno;
+    }
+    for (page = *pagenum + 1; page < PFsnaps[snap - 1].hdr.numpages; page++) {
+        if ((error = PFsnapPin(snap, page, pagebuf, &frame)) == PFE_OK) {
+            *pagenum = page;
+            return PFE_OK;
+        }
+        if (error != PFE_INVALIDPAGE)
+            return error;
+    }
+    PFerrno = PFE_EOF;
+    return PFerrno;
+}
+
+/* PF_UnfixPage() under snapshot "snap" */
+int PFsnapUnfix(int snap, int pagenum)
+{
+    PFsnap *s = &PFsnaps[snap - 1];
+    int i;
+
+    for (i = 0; i < PF_SNAP_FRAMES; i++) {
+        if (s->frames[i].page == pagenum)
+            return PFsnapUnpin(&s->frames[i]);
+    }
+    PFerrno = PFE_PAGENOTINBUF;
+    return PFerrno;
+}
+
+/* PF_UnpinHandle() of a snapshot frame */
+int PFsnapUnpin(PFbpage *bpage)
+{
+    if (!bpage->fixed) {
+        PFerrno = PFE_PAGEUNFIXED;
+        return PFerrno;
+    }
+    bpage->fixed = FALSE;
+    return PFE_OK;
+}
+
+/* End the snapshots of file "fd"; called when it is closed */
+void PFsnapDropFile(int fd)
+{
+    int i;
+
+    for (i = 0; i < PFnsnaps; i++) {
+        if (PFsnaps[i].fd == fd) {
+            PFsnaps[i].fd = -1;
+            PFsnapOn--;
+            if (PFsnapcur == i + 1)
+                PFsnapcur = 0;
+        }
+    }
+    PFsnapCollect(fd);
+}
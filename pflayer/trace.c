@@ -0,0 +1,148 @@
+/* trace.c: page-access trace capture. The interface routines are:
+PF_TraceStart() and PF_TraceStop(). The buffer manager reports every
+PFbufGet(), PFbufUnfix(), PFbufAlloc() and PFbufReleaseFile() through the
+PFtrace() macro, which costs a single test while tracing is off.
+
+The trace file is a PFtrace_hdr followed by PFtrace_rec records; it can be
+replayed offline against other policies and pool sizes with pfsim. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include "pf.h"
+#include "pftypes.h"
+
+#define PF_TRACE_BUFRECS 4096 /* records buffered before a write() */
+
+int PFtraceOn = FALSE;                       /* TRUE while a trace is being captured */
+static int PFtracefd = -1;                   /* unix fd of the trace file */
+static PFtrace_rec *PFtracebuf = NULL;       /* records not yet written */
+static int PFtracecnt = 0;                   /* # of records in PFtracebuf */
+static unsigned long long PFtracestart = 0;  /* clock at PF_TraceStart() */
+
+static unsigned long long PFtraceNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+/* write out the buffered records */
+static int PFtraceFlush(void)
+{
+    ssize_t want = (ssize_t)(PFtracecnt * sizeof(PFtrace_rec));
+
+    if (PFtracecnt == 0)
+        return PFE_OK;
+
+    if (write(PFtracefd, (char *)PFtracebuf, want) != want) {
+        PFerrno = PFE_UNIX;
+        perror("PFtraceFlush: write");
+        return PFerrno;
+    }
+    PFtracecnt = 0;
+    return PFE_OK;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Start capturing page accesses into the trace file "fname". The file is
+	created or truncated. Only one trace can be active at a time.
+
+RETURN VALUE:
+	PFE_OK if ok
+	PF error code otherwise
+*****************************************************************************/
+int PF_TraceStart(const char *fname)
+{
+    PFtrace_hdr hdr;
+    int nframes, target;
+
+    if (PFtraceOn)
+        PF_TraceStop();
+
+    if ((PFtracebuf = malloc(PF_TRACE_BUFRECS * sizeof(PFtrace_rec))) == NULL) {
+        PFerrno = PFE_NOMEM;
+        return PFerrno;
+    }
+
+    if ((PFtracefd = open(fname, O_CREAT | O_TRUNC | O_WRONLY, 0664)) < 0) {
+        PFerrno = PFE_UNIX;
+        perror("PF_TraceStart: open");
+        free(PFtracebuf);
+        PFtracebuf = NULL;
+        return PFerrno;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, PF_TRACE_MAGIC, sizeof(hdr.magic));
+    hdr.recsize = sizeof(PFtrace_rec);
+    PF_GetBufferPoolSize(&nframes, &target);
+    hdr.maxbufs = target;
+    hdr.use_mru = USE_MRU;
+    if (write(PFtracefd, (char *)&hdr, sizeof(hdr)) != (ssize_t)sizeof(hdr)) {
+        PFerrno = PFE_UNIX;
+        perror("PF_TraceStart: write header");
+        close(PFtracefd);
+        PFtracefd = -1;
+        free(PFtracebuf);
+        PFtracebuf = NULL;
+        return PFerrno;
+    }
+
+    PFtracecnt = 0;
+    PFtracestart = PFtraceNow();
+    PFtraceOn = TRUE;
+    return PFE_OK;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Stop the active trace, flushing buffered records and closing the file.
+
+RETURN VALUE:
+	PFE_OK if ok
+	PF error code otherwise
+*****************************************************************************/
+int PF_TraceStop(void)
+{
+    int error;
+
+    if (!PFtraceOn)
+        return PFE_OK;
+
+    PFtraceOn = FALSE;
+    error = PFtraceFlush();
+    if (close(PFtracefd) == -1 && error == PFE_OK) {
+        PFerrno = error = PFE_UNIX;
+        perror("PF_TraceStop: close");
+    }
+    PFtracefd = -1;
+    free(PFtracebuf);
+    PFtracebuf = NULL;
+    return error;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Append one access record. Called through the PFtrace() macro only
+	while tracing is on. A failed write stops the trace.
+*****************************************************************************/
+void PFtraceRecord(int fd, int page, int op, int dirty, int hit)
+{
+    PFtrace_rec *rec = &PFtracebuf[PFtracecnt++];
+
+    rec->ts = PFtraceNow() - PFtracestart;
+    rec->fd = fd;
+    rec->page = page;
+    rec->op = (unsigned char)op;
+    rec->dirty = (unsigned char)(dirty != 0);
+    rec->hit = (unsigned char)(hit != 0);
+    memset(rec->pad, 0, sizeof(rec->pad));
+
+    if (PFtracecnt == PF_TRACE_BUFRECS && PFtraceFlush() != PFE_OK)
+        PF_TraceStop();
+}
@@ -0,0 +1,314 @@
+/* vcache.c: second-tier victim cache. The interface routines are:
+PF_VCacheOpen(), PF_VCacheClose(), PF_VCacheGetStats() and
+PF_VCacheResetStats().
+
+Pages evicted clean from the buffer pool (dirty victims once written back)
+are copied into slots of a preallocated cache file, normally on fast local
+storage, and found again through an in-memory index keyed by (fd, page).
+A buffer miss checks the cache before reading the origin file. The cache
+is exclusive: a hit moves the page back into the pool and frees its slot,
+so a page is never both buffered and cached, and a cached copy is never
+stale. All pages of a file are dropped when it is closed, since its PF fd
+may be reused. When no slot is free the slot under a round-robin hand is
+overwritten, roughly the oldest page, which keeps the cache file writes
+sequential. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "pf.h"
+#include "pftypes.h"
+
+#define PF_VC_FREE (-1) /* fd of a slot holding no page */
+
+typedef struct PFvcslot {
+    int fd;    /* PF fd of the cached page, or PF_VC_FREE */
+    int page;
+    int next;  /* next slot in the hash chain or free list, -1 ends it */
+} PFvcslot;
+
+int PFvcacheOn = FALSE;                /* TRUE while a cache file is open */
+static int PFvcfd = -1;                /* unix fd of the cache file */
+static char *PFvcfname = NULL;         /* name of the cache file */
+static int PFvcnslots = 0;             /* # of page slots in the file */
+static int PFvcadmit = PF_VC_ADMIT_REUSED;
+static PFvcslot *PFvcslots = NULL;     /* PFvcnslots slot descriptors */
+static int *PFvchash = NULL;           /* PFvcnslots hash chains */
+static int PFvcfree = -1;              /* first free slot */
+static int PFvchand = 0;               /* next slot to overwrite when full */
+static unsigned char *PFvcghost = NULL; /* PFvcnslots bits: victims refused recently */
+static int PFvcghostcnt = 0;           /* refusals since the ghost bits were cleared */
+static PF_VCacheStats PFvcstats;
+
+#define PFvcHash(fd, page) ((unsigned int)((fd) * 40503 + (page)) % (unsigned int)PFvcnslots)
+#define PFvcGhostBytes(nslots) (((nslots) + 7) / 8)
+#define PFvcOffset(slot) ((off_t)(slot) * (off_t)sizeof(PFfpage))
+
+/* Find the slot caching page "page" of file "fd"; -1 if none */
+static int PFvcFind(int fd, int page)
+{
+    int s;
+
+    for (s = PFvchash[PFvcHash(fd, page)]; s != -1; s = PFvcslots[s].next) {
+        if (PFvcslots[s].fd == fd && PFvcslots[s].page == page)
+            return s;
+    }
+    return -1;
+}
+
+/* Remove slot "s" from its hash chain and put it on the free list */
+static void PFvcFree(int s)
+{
+    int *link = &PFvchash[PFvcHash(PFvcslots[s].fd, PFvcslots[s].page)];
+
+    while (*link != s)
+        link = &PFvcslots[*link].next;
+    *link = PFvcslots[s].next;
+
+    PFvcslots[s].fd = PF_VC_FREE;
+    PFvcslots[s].page = -1;
+    PFvcslots[s].next = PFvcfree;
+    PFvcfree = s;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Open the victim cache file "fname" with room for "nslots" pages,
+	creating or truncating it and preallocating its space. "admit" is
+	the admission policy: PF_VC_ADMIT_ALL caches every victim,
+	PF_VC_ADMIT_REUSED only victims that were referenced again while
+	buffered or that were already evicted once recently, so pages
+	touched by a single pass never enter the cache. Only one cache can
+	be open; an open one is closed first.
+
+RETURN VALUE:
+	PFE_OK if ok
+	PF error code otherwise
+*****************************************************************************/
+int PF_VCacheOpen(const char *fname, int nslots, int admit)
+{
+    int s, error;
+
+    if (PFvcacheOn)
+        PF_VCacheClose();
+
+    if (nslots < 1) {
+        PFerrno = PFE_INVALIDPAGE;
+        return PFerrno;
+    }
+
+    PFvcslots = malloc(nslots * sizeof(PFvcslot));
+    PFvchash = malloc(nslots * sizeof(int));
+    PFvcfname = malloc(strlen(fname) + 1);
+    PFvcghost = calloc(PFvcGhostBytes(nslots), 1);
+    if (PFvcslots == NULL || PFvchash == NULL || PFvcfname == NULL || PFvcghost == NULL) {
+        PFerrno = PFE_NOMEM;
+        goto fail;
+    }
+    strcpy(PFvcfname, fname);
+
+    if ((PFvcfd = open(fname, O_CREAT | O_TRUNC | O_RDWR, 0664)) < 0) {
+        PFerrno = PFE_UNIX;
+        perror("PF_VCacheOpen: open");
+        goto fail;
+    }
+
+    /* reserve the space up front so admissions never extend the file */
+    if ((error = posix_fallocate(PFvcfd, 0, PFvcOffset(nslots))) != 0 &&
+        ftruncate(PFvcfd, PFvcOffset(nslots)) == -1) {
+        PFerrno = PFE_UNIX;
+        perror("PF_VCacheOpen: preallocate");
+        close(PFvcfd);
+        unlink(fname);
+        goto fail;
+    }
+
+    PFvcnslots = nslots;
+    PFvcfree = -1;
+    for (s = nslots - 1; s >= 0; s--) {
+        PFvcslots[s].fd = PF_VC_FREE;
+        PFvcslots[s].page = -1;
+        PFvcslots[s].next = PFvcfree;
+        PFvcfree = s;
+        PFvchash[s] = -1;
+    }
+    PFvchand = 0;
+    PFvcghostcnt = 0;
+    PFvcadmit = admit;
+    memset(&PFvcstats, 0, sizeof(PFvcstats));
+    PFvcacheOn = TRUE;
+    return PFE_OK;
+
+fail:
+    free(PFvcslots);
+    free(PFvchash);
+    free(PFvcfname);
+    free(PFvcghost);
+    PFvcslots = NULL;
+    PFvchash = NULL;
+    PFvcfname = NULL;
+    PFvcghost = NULL;
+    PFvcfd = -1;
+    return PFerrno;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Close and remove the victim cache file. Cached pages are simply
+	dropped: they are all clean.
+
+RETURN VALUE:
+	PFE_OK if ok
+	PFE_UNIX if the file cannot be closed
+*****************************************************************************/
+int PF_VCacheClose(void)
+{
+    int error = PFE_OK;
+
+    if (!PFvcacheOn)
+        return PFE_OK;
+
+    PFvcacheOn = FALSE;
+    if (close(PFvcfd) == -1) {
+        PFerrno = error = PFE_UNIX;
+        perror("PF_VCacheClose: close");
+    }
+    unlink(PFvcfname);
+
+    free(PFvcslots);
+    free(PFvchash);
+    free(PFvcfname);
+    free(PFvcghost);
+    PFvcslots = NULL;
+    PFvchash = NULL;
+    PFvcfname = NULL;
+    PFvcghost = NULL;
+    PFvcfd = -1;
+    PFvcnslots = 0;
+    return error;
+}
+
+/* Copy the victim cache statistics into "stats" */
+void PF_VCacheGetStats(PF_VCacheStats *stats)
+{
+    *stats = PFvcstats;
+}
+
+/* Zero the victim cache statistics */
+void PF_VCacheResetStats(void)
+{
+    memset(&PFvcstats, 0, sizeof(PFvcstats));
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Called by the buffer manager on a buffer miss. If page "page" of file
+	"fd" is cached, read it into "fpage" and free its slot.
+
+RETURN VALUE:
+	PFE_OK if the page was read from the cache
+	PFE_HASHNOTFOUND if it is not cached (or the cache read failed);
+	the caller then reads the origin file
+*****************************************************************************/
+int PFvcacheRead(int fd, int page, PFfpage *fpage)
+{
+    int s;
+
+    PFvcstats.lookups++;
+    if ((s = PFvcFind(fd, page)) == -1)
+        return PFE_HASHNOTFOUND;
+
+    if (pread(PFvcfd, (char *)fpage, sizeof(PFfpage), PFvcOffset(s)) != (ssize_t)sizeof(PFfpage)) {
+        perror("PFvcacheRead: read");
+        PFvcFree(s);
+        return PFE_HASHNOTFOUND;
+    }
+
+    PFvcFree(s);
+    PFvcstats.hits++;
+    return PFE_OK;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Called by the buffer manager when it evicts page "page" of file "fd",
+	whose clean contents are in "fpage". "reused" is TRUE if the page
+	was referenced again while buffered. The page is cached unless the
+	admission policy refuses it: PF_VC_ADMIT_REUSED refuses a page that
+	was not reused the first time it is evicted, and remembers the
+	refusal in a ghost bit so that it is admitted the next time. The
+	ghost bits are cleared after every PFvcnslots refusals so they only
+	describe recent evictions. When the cache is full the page in the
+	slot under the round-robin hand is overwritten. A failed write leaves
+	the page uncached.
+*****************************************************************************/
+void PFvcacheAdmit(int fd, int page, PFfpage *fpage, int reused)
+{
+    int s;
+    unsigned int b;
+
+    b = PFvcHash(fd, page);
+    if (PFvcadmit == PF_VC_ADMIT_REUSED && !reused) {
+        if (!(PFvcghost[b / 8] & (1 << (b % 8)))) {
+            PFvcghost[b / 8] |= 1 << (b % 8);
+            if (++PFvcghostcnt >= PFvcnslots) {
+                memset(PFvcghost, 0, PFvcGhostBytes(PFvcnslots));
+                PFvcghostcnt = 0;
+            }
+            PFvcstats.rejects++;
+            return;
+        }
+        PFvcghost[b / 8] &= ~(1 << (b % 8));
+    }
+
+    if (PFvcfree != -1) {
+        s = PFvcfree;
+        PFvcfree = PFvcslots[s].next;
+    } else {
+        /* full: every slot is in use, overwrite the one at the hand */
+        s = PFvchand;
+        PFvchand = (PFvchand + 1) % PFvcnslots;
+        PFvcFree(s);
+        PFvcfree = PFvcslots[s].next;
+        PFvcstats.replaced++;
+    }
+
+    if (pwrite(PFvcfd, (char *)fpage, sizeof(PFfpage), PFvcOffset(s)) != (ssize_t)sizeof(PFfpage)) {
+        perror("PFvcacheAdmit: write");
+        PFvcslots[s].next = PFvcfree;
+        PFvcfree = s;
+        return;
+    }
+
+    PFvcslots[s].fd = fd;
+    PFvcslots[s].page = page;
+    PFvcslots[s].next = PFvchash[b];
+    PFvchash[b] = s;
+    PFvcstats.admits++;
+}
+
+/* Drop the cached copy of page "page" of file "fd", if any */
+void PFvcacheDropPage(int fd, int page)
+{
+    int s;
+
+    if ((s = PFvcFind(fd, page)) != -1) {
+        PFvcFree(s);
+        PFvcstats.invalidated++;
+    }
+}
+
+/* Drop all cached pages of file "fd"; called when the file is closed */
+void PFvcacheDropFile(int fd)
+{
+    int s;
+
+    for (s = 0; s < PFvcnslots; s++) {
+        if (PFvcslots[s].fd == fd) {
+            PFvcFree(s);
+            PFvcstats.invalidated++;
+        }
+    }
+}
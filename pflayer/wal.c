@@ -0,0 +1,1278 @@
+/* wal.c: write-ahead log. The interface routines are: PF_WALOpen(),
+PF_WALClose(), PF_WALSetGroupDelay(), PF_WALGetStats(), PF_WALResetStats(),
+PF_TxnBegin(), PF_TxnCommit(), PF_TxnAbort(), PF_Checkpoint() and
+PF_WALSetCheckpointInterval().
+
+The log is one append-only file; the LSN of a record is its byte offset in
+the file. While a transaction is active in a thread, each page the thread
+fixes keeps a copy of its image at fix time (PFwalCapture()); unfixing the
+page dirty appends an UPDATE record holding the byte ranges that changed,
+before and after (PFwalLogPage()), and stamps the record's LSN in the page
+header. PF_AllocPage() and PF_DisposePage() log file header changes the
+same way. The buffer manager writes a dirty page only once the log is
+durable up to the page's LSN (PFwritefcn() calls PFwalFlush()), so data
+pages need no fsync of their own and can be written back lazily.
+
+Records are appended to one of two PF_WAL_BUFSIZE buffers. Commits are
+group committed: a committer that finds no flush in progress becomes the
+leader, swaps the buffers, then writes and fsyncs everything appended so
+far. Meanwhile other committers append to the other buffer and wait; when
+the leader is done one of them leads the next flush for all of them, so one
+fsync makes a whole batch of commits durable. The log routines are thread
+safe; the buffer manager is not, so threads must serialize page operations
+and may overlap only in PF_TxnCommit().
+
+Checkpoints are fuzzy: PF_Checkpoint() logs CKPT_BEGIN, writes back the
+dirty pages that were already dirty at the previous checkpoint, writes the
+file headers, then logs the active transactions and the dirty page table
+(page and recLSN) as of that moment and CKPT_END, without waiting for
+transactions to finish. Once the checkpoint is durable its CKPT_BEGIN LSN
+becomes the master record in the log header, where restart recovery
+(recover.c) starts. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include "pf.h"
+#include "pftypes.h"
+
+#define PF_LOG_GAP 8  /* unchanged bytes that still join two changed ranges */
+#define PF_LOG_MAXRANGES (sizeof(PFfpage) / (PF_LOG_GAP + 1) + 1)
+
+int PFwalOn = FALSE;                 /* TRUE while a log is open */
+static int PFwalfd = -1;             /* unix fd of the log file */
+static char *PFwalbuf[2] = {NULL, NULL};
+static int PFwalcur = 0;             /* buffer records are appended to */
+static size_t PFwallen = 0;          /* bytes in PFwalbuf[PFwalcur] */
+static PF_LSN PFwalbufstart = 0;     /* LSN of PFwalbuf[PFwalcur][0] */
+static PF_LSN PFwalwritten = 0;      /* log bytes written to the file */
+static PF_LSN PFwaldurable = 0;      /* log bytes written and synced */
+static int PFwalflushing = FALSE;    /* a leader is writing the other buffer */
+static unsigned long PFwalbatch = 0; /* commits appended since the last flush began */
+static long PFwaldelay = 0;          /* group commit delay (us) */
+static unsigned int PFwalnexttxn = 1;
+static int PFwalnextfile = 0;
+static PFtxn *PFwaltxns = NULL;      /* active transactions */
+static int PFwalnactive = 0;
+static PF_LSN PFwalckptbegin = 0;    /* CKPT_BEGIN of the last checkpoint (the master) */
+static PF_LSN PFwalckptend = 0;      /* end of the log after the last checkpoint */
+static long PFwalckptint = 0;        /* log bytes between automatic checkpoints, 0 for none */
+static PF_WALStats PFwalstats;
+static pthread_mutex_t PFwalmutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t PFwalcond = PTHREAD_COND_INITIALIZER;
+static __thread PFtxn *PFwaltxn = NULL;  /* transaction of the calling thread */
+
+static unsigned int PFcrctab[256];
+static pthread_once_t PFcrconce = PTHREAD_ONCE_INIT;
+
+static void PFcrcInit(void)
+{
+    unsigned int c;
+    int i, k;
+
+    for (i = 0; i < 256; i++) {
+        c = (unsigned int)i;
+        for (k = 0; k < 8; k++)
+            c = (c & 1) ? 0xEDB88320U ^ (c >> 1) : c >> 1;
+        PFcrctab[i] = c;
+    }
+}
+
+/* CRC-32 of "len" bytes at "data", continuing from "crc" (0 to start) */
+unsigned int PFcrc32(const void *data, size_t len, unsigned int crc)
+{
+    const unsigned char *p = data;
+
+    pthread_once(&PFcrconce, PFcrcInit);
+    crc = ~crc;
+    while (len-- > 0)
+        crc = PFcrctab[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+static unsigned long long PFwalNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+/* Write the current buffer to the file without syncing it. Called with the
+   mutex held and no flush in progress. */
+static int PFwalWriteOut(void)
+{
+    if (PFwallen > 0 &&
+        pwrite(PFwalfd, PFwalbuf[PFwalcur], PFwallen, (off_t)PFwalbufstart) != (ssize_t)PFwallen) {
+        PFerrno = PFE_UNIX;
+        perror("PFwalWriteOut: write");
+        return PFerrno;
+    }
+    PFwalbufstart += PFwallen;
+    PFwallen = 0;
+    PFwalwritten = PFwalbufstart;
+    return PFE_OK;
+}
+
+/* Append "rec" like PFwalAppend(), with the mutex held */
+static PF_LSN PFwalAppendLocked(PFlogrec *rec, PFtxn *txn)
+{
+    PF_LSN lsn;
+
+    while (rec->len % 8 != 0)
+        ((char *)rec)[rec->len++] = 0;
+    rec->txn = (txn != NULL) ? txn->id : 0;
+    rec->prevlsn = (txn != NULL) ? txn->lastlsn : 0;
+    rec->crc = 0;
+    rec->crc = PFcrc32(rec, rec->len, 0);
+
+    while (PFwallen + rec->len > PF_WAL_BUFSIZE) {
+        if (PFwalflushing)
+            pthread_cond_wait(&PFwalcond, &PFwalmutex);
+        else if (PFwalWriteOut() != PFE_OK)
+            return 0;
+    }
+    lsn = PFwalbufstart + PFwallen;
+    memcpy(PFwalbuf[PFwalcur] + PFwallen, rec, rec->len);
+    PFwallen += rec->len;
+    if (txn != NULL) {
+        txn->lastlsn = lsn;
+        if (rec->type == PF_LOG_COMMIT || rec->type == PF_LOG_END)
+            txn->done = TRUE;
+    }
+    if (rec->type == PF_LOG_COMMIT)
+        PFwalbatch++;
+    PFwalstats.records++;
+    PFwalstats.bytes += rec->len;
+    return lsn;
+}
+
+/* Append "rec" (rec->len bytes, padded here to a multiple of 8) for
+   transaction "txn", NULL for none. Return its LSN, 0 if the log cannot
+   be written. */
+static PF_LSN PFwalAppend(PFlogrec *rec, PFtxn *txn)
+{
+    PF_LSN lsn;
+
+    pthread_mutex_lock(&PFwalmutex);
+    lsn = PFwalAppendLocked(rec, txn);
+    pthread_mutex_unlock(&PFwalmutex);
+    return lsn;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Make the log durable past the record at LSN "lsn". A caller that
+	finds no flush in progress leads one: it takes the current buffer
+	with everything appended so far, writes and fsyncs it. Callers that
+	find a flush in progress wait for it; if their record was appended
+	after the leader took its buffer, one of them leads the next flush.
+	"forced" tells that a page write (not a commit) asked for the flush.
+
+RETURN VALUE:
+	PFE_OK if ok
+	PFE_UNIX if the log cannot be written or synced
+*****************************************************************************/
+static int PFwalSync(PF_LSN lsn, int forced)
+{
+    char *buf;
+    size_t len;
+    PF_LSN start;
+    unsigned long batch;
+    unsigned long long t0, ns;
+    int error = PFE_OK;
+
+    pthread_mutex_lock(&PFwalmutex);
+
+    /* an LSN past the end (a page stamped by an older log) needs everything */
+    if (lsn >= PFwalbufstart + PFwallen)
+        lsn = PFwalbufstart + PFwallen - 1;
+
+    while (PFwaldurable <= lsn && error == PFE_OK) {
+        if (PFwalflushing) {
+            pthread_cond_wait(&PFwalcond, &PFwalmutex);
+            continue;
+        }
+
+        PFwalflushing = TRUE;
+        if (PFwaldelay > 0 && PFwalnactive > 1) {
+            /* give the other active transactions a chance to join */
+            struct timespec ts;
+            ts.tv_sec = PFwaldelay / 1000000;
+            ts.tv_nsec = (PFwaldelay % 1000000) * 1000;
+            pthread_mutex_unlock(&PFwalmutex);
+            nanosleep(&ts, NULL);
+            pthread_mutex_lock(&PFwalmutex);
+        }
+        buf = PFwalbuf[PFwalcur];
+        len = PFwallen;
+        start = PFwalbufstart;
+        batch = PFwalbatch;
+        PFwalbatch = 0;
+        PFwalcur ^= 1;
+        PFwallen = 0;
+        PFwalbufstart += len;
+        pthread_mutex_unlock(&PFwalmutex);
+
+        t0 = PFwalNow();
+        if (len > 0 && pwrite(PFwalfd, buf, len, (off_t)start) != (ssize_t)len) {
+            error = PFE_UNIX;
+            perror("PFwalSync: write");
+        } else if (fdatasync(PFwalfd) == -1) {
+            error = PFE_UNIX;
+            perror("PFwalSync: fdatasync");
+        }
+        ns = PFwalNow() - t0;
+
+        pthread_mutex_lock(&PFwalmutex);
+        PFwalflushing = FALSE;
+        if (error == PFE_OK) {
+            PFwalwritten = PFwaldurable = start + len;
+            PFwalstats.flushes++;
+            if (forced)
+                PFwalstats.forced++;
+            if (batch > PFwalstats.group_max)
+                PFwalstats.group_max = batch;
+            PFhistAdd(&PFwalstats.fsync_lat, ns);
+        }
+        pthread_cond_broadcast(&PFwalcond);
+    }
+    pthread_mutex_unlock(&PFwalmutex);
+
+    if (error != PFE_OK)
+        PFerrno = error;
+    return error;
+}
+
+/* Called by PFwritefcn() before writing a page whose LSN is "lsn" */
+int PFwalFlush(PF_LSN lsn)
+{
+    return PFwalSync(lsn, TRUE);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Read the record at LSN "lsn" into "buf" and check it. Records still
+	in the log buffers are written out first.
+
+RETURN VALUE:
+	PFE_OK if ok
+	PFE_LOGCORRUPT if there is no valid record at "lsn"
+	PFE_UNIX if the log cannot be read
+*****************************************************************************/
+int PFwalRead(PF_LSN lsn, PFlogbuf *buf)
+{
+    unsigned int crc;
+    ssize_t n;
+
+    pthread_mutex_lock(&PFwalmutex);
+    while (lsn >= PFwalwritten && lsn < PFwalbufstart + PFwallen) {
+        if (PFwalflushing)
+            pthread_cond_wait(&PFwalcond, &PFwalmutex);
+        else if (PFwalWriteOut() != PFE_OK) {
+            pthread_mutex_unlock(&PFwalmutex);
+            return PFerrno;
+        }
+    }
+    pthread_mutex_unlock(&PFwalmutex);
+
+    n = pread(PFwalfd, buf->bytes, sizeof(PFlogrec), (off_t)lsn);
+    if (n < 0) {
+        PFerrno = PFE_UNIX;
+        perror("PFwalRead: read");
+        return PFerrno;
+    }
+    if (n != (ssize_t)sizeof(PFlogrec) || buf->rec.len < sizeof(PFlogrec) ||
+        buf->rec.len > PF_LOG_MAXREC ||
+        pread(PFwalfd, buf->bytes, buf->rec.len, (off_t)lsn) != (ssize_t)buf->rec.len) {
+        PFerrno = PFE_LOGCORRUPT;
+        return PFerrno;
+    }
+
+    crc = buf->rec.crc;
+    buf->rec.crc = 0;
+    if (PFcrc32(buf->bytes, buf->rec.len, 0) != crc) {
+        PFerrno = PFE_LOGCORRUPT;
+        return PFerrno;
+    }
+    buf->rec.crc = crc;
+    return PFE_OK;
+}
+
+/* Start reading the log file "unixfd" sequentially at LSN "from" */
+int PFwalScanOpen(PFlogscan *scan, int unixfd, PF_LSN from)
+{
+    if ((scan->buf = malloc(PF_WAL_BUFSIZE)) == NULL) {
+        PFerrno = PFE_NOMEM;
+        return PFerrno;
+    }
+    scan->unixfd = unixfd;
+    scan->bufstart = scan->pos = from;
+    scan->buflen = 0;
+    return PFE_OK;
+}
+
+/* Read PF_WAL_BUFSIZE bytes of the log from the scan position */
+static int PFwalScanFill(PFlogscan *scan)
+{
+    ssize_t n;
+
+    scan->bufstart = scan->pos;
+    scan->buflen = 0;
+    if ((n = pread(scan->unixfd, scan->buf, PF_WAL_BUFSIZE, (off_t)scan->pos)) < 0) {
+        PFerrno = PFE_UNIX;
+        perror("PFwalScanNext: read");
+        return PFerrno;
+    }
+    scan->buflen = (size_t)n;
+    return PFE_OK;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Return in "*rec" and "*lsn" the next record of the scan. "*rec"
+	points into the scan buffer and is valid until the next call. The
+	scan ends at the end of the file or at the first record that is torn
+	or fails its check; scan->pos is then the end of the valid log.
+
+RETURN VALUE:
+	PFE_OK if a record is returned
+	PFE_EOF at the end of the valid log
+	PFE_UNIX if the log cannot be read
+*****************************************************************************/
+int PFwalScanNext(PFlogscan *scan, PFlogrec **rec, PF_LSN *lsn)
+{
+    PFlogrec *r;
+    unsigned int crc;
+    int error;
+
+    if (scan->pos + sizeof(PFlogrec) > scan->bufstart + scan->buflen &&
+        (error = PFwalScanFill(scan)) != PFE_OK)
+        return error;
+    if (scan->pos + sizeof(PFlogrec) > scan->bufstart + scan->buflen)
+        return PFE_EOF;
+
+    r = (PFlogrec *)(scan->buf + (scan->pos - scan->bufstart));
+    if (r->len < sizeof(PFlogrec) || r->len > PF_LOG_MAXREC || r->len % 8 != 0)
+        return PFE_EOF;
+    if (scan->pos + r->len > scan->bufstart + scan->buflen) {
+        if ((error = PFwalScanFill(scan)) != PFE_OK)
+            return error;
+        r = (PFlogrec *)scan->buf;
+        if (r->len > scan->buflen)
+            return PFE_EOF;
+    }
+
+    crc = r->crc;
+    r->crc = 0;
+    if (PFcrc32(r, r->len, 0) != crc)
+        return PFE_EOF;
+    r->crc = crc;
+
+    *rec = r;
+    *lsn = scan->pos;
+    scan->pos += r->len;
+    return PFE_OK;
+}
+
+void PFwalScanClose(PFlogscan *scan)
+{
+    free(scan->buf);
+    scan->buf = NULL;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Open the log file "fname", creating it if needed, and start logging.
+	An existing log is recovered first (recover.c): analysis from its
+	master checkpoint, redo of the changes missing from the data files
+	and rollback of the transactions that were active at the crash; the
+	files named in the log are opened for this and closed again. A torn
+	record at the end of the log (from a crash during an append) is cut
+	off; records are appended after the last valid one. While the log is
+	open, PFwritefcn() no longer fsyncs data pages.
+
+RETURN VALUE:
+	PFE_OK if ok
+	PFE_TXNACTIVE if a log is open with transactions active
+	PFE_LOGCORRUPT if the file is not a log
+	PF error code otherwise
+*****************************************************************************/
+int PF_WALOpen(const char *fname)
+{
+    PFwal_hdr hdr;
+    PF_LSN size, end;
+    unsigned int maxtxn = 0;
+    int fd, maxfile = -1, error;
+    off_t off;
+
+    if (PFwalOn && (error = PF_WALClose()) != PFE_OK)
+        return error;
+
+    if ((fd = open(fname, O_CREAT | O_RDWR, 0664)) < 0) {
+        PFerrno = PFE_UNIX;
+        perror("PF_WALOpen: open");
+        return PFerrno;
+    }
+    if ((off = lseek(fd, 0, SEEK_END)) == -1) {
+        PFerrno = PFE_UNIX;
+        perror("PF_WALOpen: lseek");
+        close(fd);
+        return PFerrno;
+    }
+    size = (PF_LSN)off;
+
+    if (size == 0) {
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(hdr.magic, PF_WAL_MAGIC, sizeof(hdr.magic));
+        if (pwrite(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) || fsync(fd) == -1) {
+            PFerrno = PFE_UNIX;
+            perror("PF_WALOpen: write header");
+            close(fd);
+            return PFerrno;
+        }
+        end = sizeof(hdr);
+    } else {
+        if (pread(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) ||
+            memcmp(hdr.magic, PF_WAL_MAGIC, sizeof(hdr.magic)) != 0) {
+            close(fd);
+            PFerrno = PFE_LOGCORRUPT;
+            return PFerrno;
+        }
+        if ((error = PFrecAnalyze(fd, hdr.master, &end, &maxtxn, &maxfile)) != PFE_OK) {
+            close(fd);
+            return error;
+        }
+        if (end < size && ftruncate(fd, (off_t)end) == -1) {
+            PFerrno = PFE_UNIX;
+            perror("PF_WALOpen: truncate");
+            close(fd);
+            return PFerrno;
+        }
+    }
+
+    if ((PFwalbuf[0] = malloc(PF_WAL_BUFSIZE)) == NULL ||
+        (PFwalbuf[1] = malloc(PF_WAL_BUFSIZE)) == NULL) {
+        free(PFwalbuf[0]);
+        PFwalbuf[0] = NULL;
+        close(fd);
+        PFerrno = PFE_NOMEM;
+        return PFerrno;
+    }
+
+    PFwalfd = fd;
+    PFwalcur = 0;
+    PFwallen = 0;
+    PFwalbufstart = PFwalwritten = PFwaldurable = end;
+    PFwalbatch = 0;
+    PFwalnexttxn = maxtxn + 1;
+    PFwalnextfile = maxfile + 1;
+    PFwalckptbegin = hdr.master;
+    PFwalckptend = end;
+    PFfileResetLogIds();
+    PFwalOn = TRUE;
+
+    error = (size > 0) ? PFrecRestart() : PFE_OK;
+    memset(&PFwalstats, 0, sizeof(PFwalstats));
+    return error;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Take a checkpoint and close the log. Data pages written from now on
+	are fsynced again by PFwritefcn().
+
+RETURN VALUE:
+	PFE_OK if ok
+	PFE_TXNACTIVE if a transaction is active (the log stays open)
+	PFE_UNIX if the log cannot be flushed or closed
+*****************************************************************************/
+int PF_WALClose(void)
+{
+    int error;
+
+    if (!PFwalOn)
+        return PFE_OK;
+
+    pthread_mutex_lock(&PFwalmutex);
+    if (PFwaltxns != NULL) {
+        pthread_mutex_unlock(&PFwalmutex);
+        PFerrno = PFE_TXNACTIVE;
+        return PFerrno;
+    }
+    pthread_mutex_unlock(&PFwalmutex);
+
+    /* queued write-backs flush the log first; the checkpoint syncs them */
+    if (PFcleanOn)
+        PFcleanDrain();
+    /* the checkpoint leaves nothing to redo for the files closed so far */
+    if ((error = PF_Checkpoint()) != PFE_OK)
+        return error;
+
+    PFwalOn = FALSE;
+    if (close(PFwalfd) == -1) {
+        PFerrno = error = PFE_UNIX;
+        perror("PF_WALClose: close");
+    }
+    PFwalfd = -1;
+    free(PFwalbuf[0]);
+    free(PFwalbuf[1]);
+    PFwalbuf[0] = PFwalbuf[1] = NULL;
+    return error;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Let a commit that leads a log flush wait "usec" microseconds first,
+	when other transactions are active, so that more commits share its
+	fsync. 0 (the default) flushes at once; commits still batch up while
+	a flush is in progress.
+
+RETURN VALUE:
+	PFE_OK if ok
+	PFE_UNIX if "usec" is negative
+*****************************************************************************/
+int PF_WALSetGroupDelay(int usec)
+{
+    if (usec < 0) {
+        PFerrno = PFE_UNIX;
+        return PFerrno;
+    }
+    pthread_mutex_lock(&PFwalmutex);
+    PFwaldelay = usec;
+    pthread_mutex_unlock(&PFwalmutex);
+    return PFE_OK;
+}
+
+/* Copy the log statistics into "stats" */
+void PF_WALGetStats(PF_WALStats *stats)
+{
+    pthread_mutex_lock(&PFwalmutex);
+    *stats = PFwalstats;
+    pthread_mutex_unlock(&PFwalmutex);
+}
+
+/* Zero the log statistics */
+void PF_WALResetStats(void)
+{
+    pthread_mutex_lock(&PFwalmutex);
+    memset(&PFwalstats, 0, sizeof(PFwalstats));
+    pthread_mutex_unlock(&PFwalmutex);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Called by the buffer manager when it fixes the page of "bpage". If
+	the calling thread has a transaction active, save the page image so
+	that PFwalLogPage() can log what changes while it is fixed.
+
+RETURN VALUE:
+	PFE_OK if ok
+	PFE_NOMEM if the image cannot be saved
+*****************************************************************************/
+int PFwalCapture(PFbpage *bpage)
+{
+    PFtxn *txn = PFwaltxn;
+
+    if (txn == NULL || txn->undoing)
+        return PFE_OK;
+
+    if ((bpage->before = malloc(sizeof(PFfpage))) == NULL) {
+        PFerrno = PFE_NOMEM;
+        return PFerrno;
+    }
+    memcpy(bpage->before, bpage->fpage, sizeof(PFfpage));
+    txn->npinned++;
+    return PFE_OK;
+}
+
+/* Drop the image saved by PFwalCapture(); the page was unfixed unchanged */
+void PFwalDiscard(PFbpage *bpage)
+{
+    free(bpage->before);
+    bpage->before = NULL;
+    if (PFwaltxn != NULL)
+        PFwaltxn->npinned--;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Called by the buffer manager when the page of "bpage", fixed in a
+	transaction, is unfixed dirty. Compare the page with its image at
+	fix time and append an UPDATE record with the changed byte ranges;
+	ranges closer than PF_LOG_GAP bytes are merged. The page LSN is not
+	compared. The record's LSN is stamped in the page header.
+
+RETURN VALUE:
+	PFE_OK if ok (also when nothing changed)
+	PF error code if the log cannot be written
+*****************************************************************************/
+int PFwalLogPage(PFbpage *bpage)
+{
+    PFtxn *txn = PFwaltxn;
+    const unsigned char *old = (const unsigned char *)bpage->before;
+    const unsigned char *cur = (const unsigned char *)bpage->fpage;
+    const size_t lsnoff = offsetof(PFfpage, lsn), n = sizeof(PFfpage);
+    PFlogrange ranges[PF_LOG_MAXRANGES];
+    PFlogbuf *buf;
+    PFlogrange *rp;
+    char *p;
+    size_t i = 0, start, end;
+    int nr = 0, k, fileid;
+    PF_LSN lsn;
+
+    while (i < n) {
+        if (i == lsnoff) {
+            i += sizeof(PF_LSN);
+            continue;
+        }
+        if (i % 8 == 0 && i + 8 <= n && memcmp(old + i, cur + i, 8) == 0) {
+            i += 8;
+            continue;
+        }
+        if (old[i] == cur[i]) {
+            i++;
+            continue;
+        }
+
+        /* extend the range while changes are at most PF_LOG_GAP bytes apart */
+        start = i;
+        end = i + 1;
+        for (i = end; i < n && i != lsnoff && i - end < PF_LOG_GAP; i++) {
+            if (old[i] != cur[i])
+                end = i + 1;
+        }
+        ranges[nr].off = (unsigned short)start;
+        ranges[nr].len = (unsigned short)(end - start);
+        nr++;
+        i = end;
+    }
+
+    if (nr == 0) {
+        PFwalDiscard(bpage);
+        return PFE_OK;
+    }
+
+    if ((fileid = PFfileLogId(bpage->fd)) < 0)
+        return fileid;
+    if ((buf = malloc(sizeof(PFlogbuf))) == NULL) {
+        PFerrno = PFE_NOMEM;
+        return PFerrno;
+    }
+
+    buf->rec.type = PF_LOG_UPDATE;
+    buf->rec.nranges = (unsigned short)nr;
+    buf->rec.fileid = fileid;
+    buf->rec.page = bpage->page;
+    buf->rec.undonext = 0;
+    rp = (PFlogrange *)(&buf->rec + 1);
+    memcpy(rp, ranges, nr * sizeof(PFlogrange));
+    p = (char *)(rp + nr);
+    for (k = 0; k < nr; k++) {
+        memcpy(p, old + ranges[k].off, ranges[k].len);
+        p += ranges[k].len;
+        memcpy(p, cur + ranges[k].off, ranges[k].len);
+        p += ranges[k].len;
+    }
+    buf->rec.len = (unsigned int)(p - buf->bytes);
+
+    lsn = PFwalAppend(&buf->rec, txn);
+    free(buf);
+    if (lsn == 0)
+        return PFerrno;
+
+    txn->undonext = lsn;
+    bpage->fpage->lsn = lsn;
+    if (bpage->reclsn == 0)
+        bpage->reclsn = lsn;
+    PFwalDiscard(bpage);
+    return PFE_OK;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Log the change of the header of file "fd" from "before" to "after"
+	if the calling thread has a transaction active, and stamp the
+	record's LSN in "after".
+
+RETURN VALUE:
+	PFE_OK if ok
+	PF error code if the log cannot be written
+*****************************************************************************/
+int PFwalLogHeader(int fd, const PFhdr_str *before, PFhdr_str *after)
+{
+    PFtxn *txn = PFwaltxn;
+    PFlogbuf buf;
+    PFhdr_str *hp;
+    PF_LSN lsn;
+    int fileid;
+
+    if (txn == NULL || txn->undoing)
+        return PFE_OK;
+    if ((fileid = PFfileLogId(fd)) < 0)
+        return fileid;
+
+    buf.rec.type = PF_LOG_HEADER;
+    buf.rec.nranges = 0;
+    buf.rec.fileid = fileid;
+    buf.rec.page = -1;
+    buf.rec.undonext = 0;
+    hp = (PFhdr_str *)(&buf.rec + 1);
+    hp[0] = *before;
+    hp[1] = *after;
+    buf.rec.len = sizeof(PFlogrec) + 2 * sizeof(PFhdr_str);
+
+    if ((lsn = PFwalAppend(&buf.rec, txn)) == 0)
+        return PFerrno;
+    txn->undonext = lsn;
+    after->lsn = lsn;
+    return PFE_OK;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Log a FILE record that binds the file "fname" to log file id "id";
+	a new id is given out if "id" is negative.
+
+RETURN VALUE:
+	the file id (>= 0) if ok
+	PF error code if the log cannot be written
+*****************************************************************************/
+int PFwalLogFile(int id, const char *fname)
+{
+    PFlogbuf buf;
+    size_t n = strlen(fname) + 1;
+
+    if (sizeof(PFlogrec) + n + 8 > PF_LOG_MAXREC) {
+        PFerrno = PFE_UNIX;
+        return PFerrno;
+    }
+
+    if (id < 0) {
+        pthread_mutex_lock(&PFwalmutex);
+        id = PFwalnextfile++;
+        pthread_mutex_unlock(&PFwalmutex);
+    }
+
+    buf.rec.type = PF_LOG_FILE;
+    buf.rec.nranges = 0;
+    buf.rec.fileid = id;
+    buf.rec.page = -1;
+    buf.rec.undonext = 0;
+    memcpy(&buf.rec + 1, fname, n);
+    buf.rec.len = (unsigned int)(sizeof(PFlogrec) + n);
+
+    if (PFwalAppend(&buf.rec, NULL) == 0)
+        return PFerrno;
+    return id;
+}
+
+/* Copy the images of UPDATE record "rec" into "fpage": the before images
+   if "undo", else the after images (a CLR has only the latter) */
+void PFwalApply(PFfpage *fpage, const PFlogrec *rec, int undo)
+{
+    const PFlogrange *rp = (const PFlogrange *)(rec + 1);
+    const char *p = (const char *)(rp + rec->nranges);
+    int k;
+
+    for (k = 0; k < rec->nranges; k++) {
+        if (rec->type & PF_LOG_CLR) {
+            memcpy((char *)fpage + rp[k].off, p, rp[k].len);
+            p += rp[k].len;
+        } else {
+            memcpy((char *)fpage + rp[k].off, undo ? p : p + rp[k].len, rp[k].len);
+            p += 2 * rp[k].len;
+        }
+    }
+}
+
+/* Append a COMMIT, ABORT or END record for "txn"; return its LSN, 0 on error */
+PF_LSN PFwalLogTxn(PFtxn *txn, int type)
+{
+    PFlogbuf buf;
+
+    buf.rec.type = (unsigned short)type;
+    buf.rec.nranges = 0;
+    buf.rec.fileid = -1;
+    buf.rec.page = -1;
+    buf.rec.undonext = 0;
+    buf.rec.len = sizeof(PFlogrec);
+    return PFwalAppend(&buf.rec, txn);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Undo record "rec" of transaction "txn", an UPDATE or a HEADER record,
+	and log a CLR carrying the restored image, whose undonext skips past
+	"rec". Pages beyond a restored header's last page are dropped from
+	the buffer. Also used by recovery to roll back losers.
+
+RETURN VALUE:
+	PFE_OK if ok
+	PFE_FD if the record's file is not open
+	PF error code otherwise
+*****************************************************************************/
+int PFwalUndo(PFtxn *txn, PFlogrec *rec)
+{
+    PFlogbuf *clr;
+    PFbpage *bpage;
+    const PFhdr_str *hp;
+    PFhdr_str hdr;
+    PFlogrange *rp;
+    const char *src;
+    char *dst;
+    int fd, k, p, error;
+    PF_LSN lsn;
+
+    if ((fd = PFfileByLogId(rec->fileid)) < 0) {
+        PFerrno = PFE_FD;
+        return PFerrno;
+    }
+    if ((clr = malloc(sizeof(PFlogbuf))) == NULL) {
+        PFerrno = PFE_NOMEM;
+        return PFerrno;
+    }
+
+    /* the CLR: same ranges, before images only */
+    clr->rec = *rec;
+    clr->rec.type = rec->type | PF_LOG_CLR;
+    clr->rec.undonext = rec->prevlsn;
+    dst = (char *)(&clr->rec + 1);
+    src = (const char *)(rec + 1);
+
+    if (rec->type == PF_LOG_UPDATE) {
+        rp = (PFlogrange *)dst;
+        memcpy(rp, src, rec->nranges * sizeof(PFlogrange));
+        dst += rec->nranges * sizeof(PFlogrange);
+        src += rec->nranges * sizeof(PFlogrange);
+        for (k = 0; k < rec->nranges; k++) {
+            memcpy(dst, src, rp[k].len);
+            dst += rp[k].len;
+            src += 2 * rp[k].len;
+        }
+        clr->rec.len = (unsigned int)(dst - clr->bytes);
+
+        if ((error = PFbufFix(fd, rec->page, &bpage, PFreadfcn, PFwritefcn)) != PFE_OK) {
+            free(clr);
+            return error;
+        }
+        PFwalApply(bpage->fpage, rec, TRUE);
+        if ((lsn = PFwalAppend(&clr->rec, txn)) == 0) {
+            PFbufUnfixHandle(bpage, TRUE);
+            free(clr);
+            return PFerrno;
+        }
+        bpage->fpage->lsn = lsn;
+        if (bpage->reclsn == 0)
+            bpage->reclsn = lsn;
+        if ((error = PFbufUnfixHandle(bpage, TRUE)) != PFE_OK) {
+            free(clr);
+            return error;
+        }
+    } else {
+        hp = (const PFhdr_str *)src;
+        memcpy(dst, &hp[0], sizeof(PFhdr_str));
+        clr->rec.len = sizeof(PFlogrec) + sizeof(PFhdr_str);
+
+        for (p = hp[0].numpages; p < hp[1].numpages; p++) {
+            if ((error = PFbufDiscard(fd, p)) != PFE_OK) {
+                free(clr);
+                return error;
+            }
+        }
+        if ((lsn = PFwalAppend(&clr->rec, txn)) == 0) {
+            free(clr);
+            return PFerrno;
+        }
+        hdr = hp[0];
+        hdr.lsn = lsn;
+        PFfileSetHdr(fd, &hdr);
+    }
+
+    free(clr);
+    txn->undonext = rec->prevlsn;
+    return PFE_OK;
+}
+
+/* Register a transaction found active by recovery, to be rolled back */
+PFtxn *PFwalAdoptTxn(unsigned int id, PF_LSN lastlsn, PF_LSN undonext)
+{
+    PFtxn *txn;
+
+    if ((txn = calloc(1, sizeof(PFtxn))) == NULL) {
+        PFerrno = PFE_NOMEM;
+        return NULL;
+    }
+    txn->id = id;
+    txn->undoing = TRUE;
+    txn->lastlsn = lastlsn;
+    txn->undonext = undonext;
+
+    pthread_mutex_lock(&PFwalmutex);
+    txn->next = PFwaltxns;
+    if (PFwaltxns != NULL)
+        PFwaltxns->prev = txn;
+    PFwaltxns = txn;
+    PFwalnactive++;
+    pthread_mutex_unlock(&PFwalmutex);
+    return txn;
+}
+
+/* Unlink "txn" from the active list and free it */
+void PFwalEndTxn(PFtxn *txn)
+{
+    pthread_mutex_lock(&PFwalmutex);
+    if (txn->prev != NULL)
+        txn->prev->next = txn->next;
+    else
+        PFwaltxns = txn->next;
+    if (txn->next != NULL)
+        txn->next->prev = txn->prev;
+    PFwalnactive--;
+    pthread_mutex_unlock(&PFwalmutex);
+
+    if (PFwaltxn == txn)
+        PFwaltxn = NULL;
+    free(txn);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Start a transaction in the calling thread. Changes to pages fixed
+	by the thread and unfixed dirty until PF_TxnCommit() or PF_TxnAbort()
+	are logged, as are changes to file headers. A checkpoint is taken
+	first if PF_WALSetCheckpointInterval() bytes of log were written
+	since the last one.
+
+RETURN VALUE:
+	the transaction id (> 0) if ok
+	PFE_NOWAL if no log is open
+	PFE_TXNACTIVE if the thread already has a transaction
+	PFE_NOMEM if out of memory
+	PF error code if the checkpoint fails
+*****************************************************************************/
+int PF_TxnBegin(void)
+{
+    PFtxn *txn;
+    PF_LSN end;
+    int error;
+
+    if (!PFwalOn) {
+        PFerrno = PFE_NOWAL;
+        return PFerrno;
+    }
+    if (PFwaltxn != NULL) {
+        PFerrno = PFE_TXNACTIVE;
+        return PFerrno;
+    }
+
+    pthread_mutex_lock(&PFwalmutex);
+    end = PFwalbufstart + PFwallen;
+    pthread_mutex_unlock(&PFwalmutex);
+    if (PFwalckptint > 0 && end - PFwalckptend >= (PF_LSN)PFwalckptint &&
+        (error = PF_Checkpoint()) != PFE_OK)
+        return error;
+
+    if ((txn = calloc(1, sizeof(PFtxn))) == NULL) {
+        PFerrno = PFE_NOMEM;
+        return PFerrno;
+    }
+
+    pthread_mutex_lock(&PFwalmutex);
+    txn->id = PFwalnexttxn++;
+    txn->prev = NULL;
+    txn->next = PFwaltxns;
+    if (PFwaltxns != NULL)
+        PFwaltxns->prev = txn;
+    PFwaltxns = txn;
+    PFwalnactive++;
+    pthread_mutex_unlock(&PFwalmutex);
+
+    PFwaltxn = txn;
+    return (int)txn->id;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Commit the transaction of the calling thread: append its COMMIT
+	record and wait until the log is durable past it, sharing the fsync
+	with concurrent commits. A transaction that changed nothing logs
+	nothing. Its pages must be unfixed first.
+
+RETURN VALUE:
+	PFE_OK if ok
+	PFE_NOTXN if the thread has no transaction
+	PFE_PAGEFIXED if pages it fixed are still fixed
+	PF error code if the log cannot be written (the transaction stays
+	active and may be aborted)
+*****************************************************************************/
+int PF_TxnCommit(void)
+{
+    PFtxn *txn = PFwaltxn;
+    PF_LSN lsn;
+    int error;
+
+    if (txn == NULL) {
+        PFerrno = PFE_NOTXN;
+        return PFerrno;
+    }
+    if (txn->npinned > 0) {
+        PFerrno = PFE_PAGEFIXED;
+        return PFerrno;
+    }
+
+    if (txn->lastlsn != 0) {
+        if ((lsn = PFwalLogTxn(txn, PF_LOG_COMMIT)) == 0)
+            return PFerrno;
+        if ((error = PFwalSync(lsn, FALSE)) != PFE_OK)
+            return error;
+    }
+
+    PFwalEndTxn(txn);
+    pthread_mutex_lock(&PFwalmutex);
+    PFwalstats.commits++;
+    pthread_mutex_unlock(&PFwalmutex);
+    return PFE_OK;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Roll back the transaction of the calling thread: undo its page and
+	header changes newest first, logging a CLR for each, then log END.
+	The files it changed must still be open and its pages unfixed. The
+	log is not forced: a crash before the END record is durable simply
+	finishes the rollback during recovery.
+
+RETURN VALUE:
+	PFE_OK if ok
+	PFE_NOTXN if the thread has no transaction
+	PFE_PAGEFIXED if pages it fixed are still fixed
+	PF error code otherwise (the transaction stays active)
+*****************************************************************************/
+int PF_TxnAbort(void)
+{
+    PFtxn *txn = PFwaltxn;
+    PFlogbuf *buf;
+    int error = PFE_OK;
+
+    if (txn == NULL) {
+        PFerrno = PFE_NOTXN;
+        return PFerrno;
+    }
+    if (txn->npinned > 0) {
+        PFerrno = PFE_PAGEFIXED;
+        return PFerrno;
+    }
+
+    if (txn->lastlsn != 0) {
+        if ((buf = malloc(sizeof(PFlogbuf))) == NULL) {
+            PFerrno = PFE_NOMEM;
+            return PFerrno;
+        }
+        txn->undoing = TRUE;
+        if (PFwalLogTxn(txn, PF_LOG_ABORT) == 0)
+            error = PFerrno;
+
+        while (error == PFE_OK && txn->undonext != 0) {
+            if ((error = PFwalRead(txn->undonext, buf)) != PFE_OK)
+                break;
+            if (buf->rec.type & PF_LOG_CLR)
+                txn->undonext = buf->rec.undonext;
+            else if (buf->rec.type == PF_LOG_UPDATE || buf->rec.type == PF_LOG_HEADER)
+                error = PFwalUndo(txn, &buf->rec);
+            else
+                txn->undonext = buf->rec.prevlsn;
+        }
+        free(buf);
+
+        if (error == PFE_OK && PFwalLogTxn(txn, PF_LOG_END) == 0)
+            error = PFerrno;
+        if (error != PFE_OK)
+            return error;
+    }
+
+    PFwalEndTxn(txn);
+    pthread_mutex_lock(&PFwalmutex);
+    PFwalstats.aborts++;
+    pthread_mutex_unlock(&PFwalmutex);
+    return PFE_OK;
+}
+
+/* Fill in the header of a checkpoint record of "type" with "payload" bytes */
+static void PFwalCkptRec(PFlogbuf *buf, int type, size_t payload)
+{
+    buf->rec.type = (unsigned short)type;
+    buf->rec.nranges = 0;
+    buf->rec.fileid = -1;
+    buf->rec.page = -1;
+    buf->rec.undonext = 0;
+    buf->rec.len = (unsigned int)(sizeof(PFlogrec) + payload);
+}
+
+/* Append the CKPT_TXNS records: the transactions active now that have
+   logged something. This is one critical section, so no COMMIT or END
+   can fall between the snapshot and its record. */
+static int PFwalLogTxnTable(PFlogbuf *buf)
+{
+    const int max = (int)((PF_LOG_MAXREC - sizeof(PFlogrec)) / sizeof(PFckpt_txn));
+    PFckpt_txn *ents = (PFckpt_txn *)(&buf->rec + 1);
+    PFtxn *txn;
+    int n = 0, error = PFE_OK;
+
+    pthread_mutex_lock(&PFwalmutex);
+    for (txn = PFwaltxns; txn != NULL && error == PFE_OK; txn = txn->next) {
+        if (txn->lastlsn == 0 || txn->done)
+            continue;
+        ents[n].id = txn->id;
+        ents[n].aborting = txn->undoing;
+        ents[n].lastlsn = txn->lastlsn;
+        ents[n].undonext = txn->undonext;
+        if (++n == max) {
+            PFwalCkptRec(buf, PF_LOG_CKPT_TXNS, n * sizeof(PFckpt_txn));
+            if (PFwalAppendLocked(&buf->rec, NULL) == 0)
+                error = PFerrno;
+            n = 0;
+        }
+    }
+    if (n > 0 && error == PFE_OK) {
+        PFwalCkptRec(buf, PF_LOG_CKPT_TXNS, n * sizeof(PFckpt_txn));
+        if (PFwalAppendLocked(&buf->rec, NULL) == 0)
+            error = PFerrno;
+    }
+    pthread_mutex_unlock(&PFwalmutex);
+    return error;
+}
+
+/* Append the CKPT_DPT records for the "n" dirty pages "dpt" */
+static int PFwalLogDirtyTable(PFlogbuf *buf, const PFckpt_page *dpt, int n)
+{
+    const int max = (int)((PF_LOG_MAXREC - sizeof(PFlogrec)) / sizeof(PFckpt_page));
+    int i, k;
+
+    for (i = 0; i < n; i += k) {
+        k = (n - i < max) ? n - i : max;
+        memcpy(&buf->rec + 1, dpt + i, k * sizeof(PFckpt_page));
+        PFwalCkptRec(buf, PF_LOG_CKPT_DPT, k * sizeof(PFckpt_page));
+        if (PFwalAppend(&buf->rec, NULL) == 0)
+            return PFerrno;
+    }
+    return PFE_OK;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Take a fuzzy checkpoint. Transactions stay active and pages stay
+	fixed. Dirty pages that were already dirty at the previous
+	checkpoint are written back, so that redo never has to start more
+	than about two checkpoints back; the other dirty pages are recorded
+	with their recLSN. The data files are synced, then the checkpoint is
+	made durable and becomes the master record in the log header.
+
+RETURN VALUE:
+	PFE_OK if ok
+	PFE_NOWAL if no log is open
+	PF error code otherwise
+*****************************************************************************/
+int PF_Checkpoint(void)
+{
+    PFlogbuf *buf;
+    PFckpt_begin *cb;
+    PFckpt_page *dpt = NULL;
+    PF_LSN begin, end;
+    int n, i, error;
+
+    if (!PFwalOn) {
+        PFerrno = PFE_NOWAL;
+        return PFerrno;
+    }
+    if ((buf = malloc(sizeof(PFlogbuf))) == NULL) {
+        PFerrno = PFE_NOMEM;
+        return PFerrno;
+    }
+
+    PFwalCkptRec(buf, PF_LOG_CKPT_BEGIN, sizeof(PFckpt_begin));
+    cb = (PFckpt_begin *)(&buf->rec + 1);
+    pthread_mutex_lock(&PFwalmutex);
+    cb->nexttxn = PFwalnexttxn;
+    cb->nextfile = PFwalnextfile;
+    pthread_mutex_unlock(&PFwalmutex);
+    if ((begin = PFwalAppend(&buf->rec, NULL)) == 0) {
+        error = PFerrno;
+        goto done;
+    }
+
+    if (PFwalckptbegin != 0 &&
+        (error = PFbufFlushBefore(PFwalckptbegin, PFwritefcn)) != PFE_OK)
+        goto done;
+
+    /* the dirty page table is taken before the files are synced: a page
+       written after this may not be durable yet and must stay in it */
+    n = PFbufDirtyTable(NULL, 0);
+    if (n > 0 && (dpt = malloc(n * sizeof(PFckpt_page))) == NULL) {
+        error = PFerrno = PFE_NOMEM;
+        goto done;
+    }
+    n = PFbufDirtyTable(dpt, n);
+    for (i = 0; i < n; i++) {
+        if ((dpt[i].fileid = PFfileLogId(dpt[i].fileid)) < 0) {
+            error = dpt[i].fileid;
+            goto done;
+        }
+    }
+
+    if ((error = PFfileSyncAll()) != PFE_OK ||
+        (error = PFfileLogAll()) != PFE_OK ||
+        (error = PFwalLogTxnTable(buf)) != PFE_OK ||
+        (error = PFwalLogDirtyTable(buf, dpt, n)) != PFE_OK)
+        goto done;
+
+    PFwalCkptRec(buf, PF_LOG_CKPT_END, 0);
+    if ((end = PFwalAppend(&buf->rec, NULL)) == 0) {
+        error = PFerrno;
+        goto done;
+    }
+    if ((error = PFwalSync(end, FALSE)) != PFE_OK)
+        goto done;
+
+    if (pwrite(PFwalfd, &begin, sizeof(begin), offsetof(PFwal_hdr, master)) != (ssize_t)sizeof(begin) ||
+        fdatasync(PFwalfd) == -1) {
+        error = PFerrno = PFE_UNIX;
+        perror("PF_Checkpoint: write master");
+        goto done;
+    }
+
+    pthread_mutex_lock(&PFwalmutex);
+    PFwalckptbegin = begin;
+    PFwalckptend = PFwalbufstart + PFwallen;
+    PFwalstats.checkpoints++;
+    pthread_mutex_unlock(&PFwalmutex);
+
+done:
+    free(dpt);
+    free(buf);
+    return error;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Take a checkpoint from PF_TxnBegin() whenever "bytes" of log have
+	been written since the last one; 0 (the default) leaves checkpoints
+	to PF_Checkpoint() and PF_WALClose(). Smaller intervals bound the
+	redo work of restart recovery at the cost of more page writes.
+
+RETURN VALUE:
+	PFE_OK if ok
+	PFE_UNIX if "bytes" is negative
+*****************************************************************************/
+int PF_WALSetCheckpointInterval(long bytes)
+{
+    if (bytes < 0) {
+        PFerrno = PFE_UNIX;
+        return PFerrno;
+    }
+    PFwalckptint = bytes;
+    return PFE_OK;
+}
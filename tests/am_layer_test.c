@@ -13,6 +13,7 @@
 #define DATA_HF_FILE "courses_var.hf" /* HF file to scan; adjust if needed */
 #define RELNAME "courses"            /* base name for index files: courses.0, courses.1, ... */
 #define IDXNO_BASE 100                /* index number base to avoid clobbering others */
+#define SW_ROUNDS 3                   /* lookups of every key per swizzling setting */
 
 /* small helper timing */
 static double now_ms(void) {
@@ -21,6 +22,15 @@ static double now_ms(void) {
     return (double)t.tv_sec * 1000.0 + (double)t.tv_nsec / 1e6;
 }
 
+/* page-table probes per operation since the last PF_ResetGlobalStats() */
+static double probes_per_op(int nops) {
+    PF_Stats ps;
+    PF_GetGlobalStats(&ps);
+    return nops ? (double)ps.probes / (double)nops : 0.0;
+}
+static double build_probes;   /* probes per insert of the last build */
+static double lookup_probes;  /* probes per lookup of the last sample_lookup_time */
+
 /* simple container for (key, recId) */
 typedef struct { int key; int recPage; short recSlot; } Pair;
 
@@ -136,11 +146,13 @@ static double build_from_existing(Pair *pairs, int n, int index_no) {
     int fd = PF_OpenFile(fname);
     if (fd < 0) { fprintf(stderr, "open idx fail\n"); return -1; }
 
+    PF_ResetGlobalStats();
     double t0 = now_ms();
     for (int i = 0; i < n; ++i) {
         AM_InsertEntry(fd, 'i', (int)sizeof(int), (char *)&pairs[i].key, (pairs[i].recPage<<16) | (pairs[i].recSlot & 0xffff));
     }
     double t1 = now_ms();
+    build_probes = probes_per_op(n);
 
     PF_CloseFile(fd);
     return t1 - t0;
@@ -164,11 +176,13 @@ static double build_incremental_random(Pair *pairs, int n, int index_no) {
     int fd = PF_OpenFile(fname);
     if (fd < 0) { fprintf(stderr, "open idx fail\n"); free(sh); return -1; }
 
+    PF_ResetGlobalStats();
     double t0 = now_ms();
     for (int i = 0; i < n; ++i) {
         AM_InsertEntry(fd, 'i', (int)sizeof(int), (char *)&sh[i].key, (sh[i].recPage<<16) | (sh[i].recSlot & 0xffff));
     }
     double t1 = now_ms();
+    build_probes = probes_per_op(n);
 
     PF_CloseFile(fd);
     free(sh);
@@ -378,6 +392,7 @@ static double sample_lookup_time(int index_no, int keyToFind, int trials) {
     int fd = PF_OpenFile(fname);
     if (fd < 0) return -1;
 
+    PF_ResetGlobalStats();
     double t0 = now_ms();
     for (int i = 0; i < trials; ++i) {
         int sd = AM_OpenIndexScan(fd, 'i', sizeof(int), EQUAL, (char *)&keyToFind);
@@ -389,10 +404,38 @@ static double sample_lookup_time(int index_no, int keyToFind, int trials) {
         AM_CloseIndexScan(sd);
     }
     double t1 = now_ms();
+    lookup_probes = probes_per_op(trials);
     PF_CloseFile(fd);
     return (t1 - t0) / (double)trials;
 }
 
+/* look every key of "pairs" up SW_ROUNDS times with swizzling "on"; returns
+   ms per lookup, sets the probes per lookup and the entries found */
+static double swizzled_lookups(int index_no, Pair *pairs, int n, int on, double *probes, long *found) {
+    char fname[256]; snprintf(fname, sizeof(fname), "%s.%d", RELNAME, index_no);
+    int fd = PF_OpenFile(fname);
+    if (fd < 0) return -1;
+
+    PF_SetSwizzling(on);
+    *found = 0;
+    PF_ResetGlobalStats();
+    double t0 = now_ms();
+    for (int r = 0; r < SW_ROUNDS; ++r) {
+        for (int i = 0; i < n; ++i) {
+            int sd = AM_OpenIndexScan(fd, 'i', sizeof(int), EQUAL, (char *)&pairs[i].key);
+            if (sd < 0) continue;
+            while (AM_FindNextEntry(sd) >= 0)
+                (*found)++;
+            AM_CloseIndexScan(sd);
+        }
+    }
+    double t1 = now_ms();
+    *probes = probes_per_op(SW_ROUNDS * n);
+    PF_SetSwizzling(FALSE);
+    PF_CloseFile(fd);
+    return (t1 - t0) / (double)(SW_ROUNDS * n);
+}
+
 /* main: orchestrate the three methods and present table */
 int main(void) {
     printf("=== Index construction comparison ===\n");
@@ -413,16 +456,20 @@ int main(void) {
     /* Approach A: build-from-existing (preserve order) */
     int idxA = IDXNO_BASE + 1;
     double tA = build_from_existing(pairs, n, idxA);
+    double probesA = build_probes;
     char nameA[256]; snprintf(nameA, sizeof(nameA), "%s.%d", RELNAME, idxA);
     int pagesA = count_pf_pages(nameA);
     double lookupA = sample_lookup_time(idxA, sampleKeys[0], 3);
+    double lprobesA = lookup_probes;
 
     /* Approach B: incremental random */
     int idxB = IDXNO_BASE + 2;
     double tB = build_incremental_random(pairs, n, idxB);
+    double probesB = build_probes;
     char nameB[256]; snprintf(nameB, sizeof(nameB), "%s.%d", RELNAME, idxB);
     int pagesB = count_pf_pages(nameB);
     double lookupB = sample_lookup_time(idxB, sampleKeys[0], 3);
+    double lprobesB = lookup_probes;
 
     /* Approach C: bulk-load sorted */
     /* make sorted copy */
@@ -439,13 +486,32 @@ int main(void) {
     char nameC[256]; snprintf(nameC, sizeof(nameC), "%s.%d", RELNAME, idxC);
     int pagesC = count_pf_pages(nameC);
     double lookupC = sample_lookup_time(idxC, sampleKeys[0], 3);
+    double lprobesC = lookup_probes;
 
     /* print comparison table */
     printf("\n=== Results ===\n");
-    printf("%-20s %-12s %-12s %-12s\n", "Method", "Build ms", "Pages", "Lookup ms");
-    printf("%-20s %-12.2f %-12d %-12.4f\n", "Build-from-existing", tA, pagesA, lookupA);
-    printf("%-20s %-12.2f %-12d %-12.4f\n", "Incremental-random", tB, pagesB, lookupB);
-    printf("%-20s %-12.2f %-12d %-12.4f\n", "Bulk-load sorted", tC, pagesC, lookupC);
+    printf("%-20s %-12s %-12s %-12s %-12s %-12s\n", "Method", "Build ms", "Pages", "Lookup ms",
+           "Probes/ins", "Probes/look");
+    printf("%-20s %-12.2f %-12d %-12.4f %-12.2f %-12.2f\n", "Build-from-existing", tA, pagesA, lookupA,
+           probesA, lprobesA);
+    printf("%-20s %-12.2f %-12d %-12.4f %-12.2f %-12.2f\n", "Incremental-random", tB, pagesB, lookupB,
+           probesB, lprobesB);
+    printf("%-20s %-12.2f %-12d %-12.4f %-12s %-12.2f\n", "Bulk-load sorted", tC, pagesC, lookupC,
+           "-", lprobesC);
+
+    /* child pages reached through swizzled frames instead of hash probes */
+    double swProbesOff, swProbesOn;
+    long foundOff, foundOn;
+    double swOff = swizzled_lookups(idxB, pairs, n, FALSE, &swProbesOff, &foundOff);
+    double swOn = swizzled_lookups(idxB, pairs, n, TRUE, &swProbesOn, &foundOn);
+    printf("\n=== Swizzled lookups (incremental-random index, %d frames) ===\n", PF_MAX_BUFS);
+    printf("%-20s %-12s %-12s %-12s\n", "Swizzling", "Lookup ms", "Probes/look", "Entries");
+    printf("%-20s %-12.4f %-12.2f %-12ld\n", "off", swOff, swProbesOff, foundOff);
+    printf("%-20s %-12.4f %-12.2f %-12ld\n", "on", swOn, swProbesOn, foundOn);
+    if (foundOn != foundOff || foundOff < (long)SW_ROUNDS * n) {
+        printf("ERROR: swizzled lookups found %ld entries, %ld without\n", foundOn, foundOff);
+        return 1;
+    }
 
     free(pairs);
     free(pairs_sorted);
@@ -2,12 +2,28 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include "../hfLayer/hf.h"
 #include "../pflayer/pf.h"
 
 #define DATASET "../data/courses.txt"
 #define HF_FILE "courses_var.hf"
 #define STATIC_FILE "courses_static.bin"
+#define BULK_DATASET "../data/studregn.txt"
+#define BULK_FILE "studregn.hf"
+#define BULK_BATCH 256   /* records per HF_InsertRecords() call */
+#define BULK_DW "studregn.dw"  /* double-write scratch file for the second loads */
+#define QUERY_FIELD 2    /* studregn's course field */
+#define QUERY_COURSE "CS 101"
+#define TYPED_FILE "studregn_typed.hf"
+#define STUDREGN_FIELDS 10
+#define CREDITS_FIELD 7
+#define TYPED_PASSES 20   /* scans of each file, timed after a first one */
+#define TYPED_FRAMES 2048 /* pool size for them: both files stay buffered */
+
+/* studregn.txt as typed records: year;sem;course;...;roll;credits;; */
+int STUDREGN_TYPES[STUDREGN_FIELDS] = {HF_INT, HF_INT, HF_TEXT, HF_TEXT, HF_TEXT,
+                                       HF_TEXT, HF_INT, HF_REAL, HF_TEXT, HF_TEXT};
 
 /* List of static record sizes to test */
 int STATIC_SIZES[] = {64, 80, 128, 160};
@@ -34,21 +50,6 @@ void metrics_init(Metrics *m) {
     m->maxRecordLen = 0;
 }
 
-int get_total_pf_pages(const char *fname) {
-    int fd = PF_OpenFile(fname);
-    if (fd < 0) return 0;
-
-    int count = 0;
-    char *pg;
-    while (PF_GetThisPage(fd, count, &pg) == PFE_OK) {
-        PF_UnfixPage(fd, count, 0);
-        count++;
-    }
-
-    PF_CloseFile(fd);
-    return count;
-}
-
 //  LOAD INTO HF (variable-length slotted pages)
 void build_variable(Metrics *m) {
     printf("\n=== BUILD VARIABLE-LENGTH FILE ===\n");
@@ -91,13 +92,52 @@ void build_variable(Metrics *m) {
     }
 
     fclose(f);
-    HF_CloseFile(hffd);
 
-    m->totalPages = get_total_pf_pages(HF_FILE);
+    /* from the file's metadata page */
+    HF_Stats stats;
+    HF_GetStats(hffd, &stats);
+    m->totalPages = stats.totalPages;
+    if (stats.records != m->totalRecords)
+        printf("HF counts %d records, %d were inserted\n", stats.records, m->totalRecords);
+    HF_CloseFile(hffd);
 
     printf("Variable-length: %d records, %d pages\n", m->totalRecords, m->totalPages);
 }
 
+//   APPEND-ONLY HF (no free-space map): every record goes on the last page,
+//   or on a new one when it does not fit there
+#define HF_PAGE_HDR 12   // sizeof(HF_PageHdr)
+#define HF_SLOT_SIZE 8   // sizeof(HF_Slot)
+
+void build_append_only(Metrics *m) {
+    FILE *f = fopen(DATASET, "r");
+    if (!f) {
+        perror("dataset");
+        exit(1);
+    }
+
+    char line[512];
+    int room = 0;
+
+    while (fgets(line, sizeof(line), f)) {
+        trim(line);
+        if (line[0] == '\0') continue;
+
+        int len = strlen(line) + 1;
+        if (m->totalPages == 0 || room < len + HF_SLOT_SIZE) {
+            m->totalPages++;
+            room = PF_PAGE_SIZE - HF_PAGE_HDR;
+        }
+        room -= len + HF_SLOT_SIZE;
+
+        m->totalRecords++;
+        m->totalBytesStored += len;
+        if (len > m->maxRecordLen) m->maxRecordLen = len;
+    }
+
+    fclose(f);
+}
+
 //   STATIC STORAGE (fixed size)
 void build_static(Metrics *m, int recSize) {
     printf("\n=== BUILD STATIC FILE (recSize=%d) ===\n", recSize);
@@ -149,6 +189,7 @@ void build_static(Metrics *m, int recSize) {
 //for logging
 void print_metrics(
     Metrics *var,
+    Metrics *append,
     Metrics staticList[],
     int recSizes[]
 ) {
@@ -163,6 +204,12 @@ void print_metrics(
     printf("%-15s %-12s %-12d %-12d %.4f\n",
            "Variable", "-", var->totalPages, var->totalBytesStored, utilVar);
 
+    double utilAppend = (double)append->totalBytesStored /
+                        (append->totalPages * PF_PAGE_SIZE);
+
+    printf("%-15s %-12s %-12d %-12d %.4f\n",
+           "Append-only", "-", append->totalPages, append->totalBytesStored, utilAppend);
+
     /* Static sizes */
     for (int i = 0; i < NUM_STATIC_SIZES; i++) {
         int rs = recSizes[i];
@@ -176,6 +223,261 @@ void print_metrics(
     }
 }
 
+//   BULK LOAD: the time to read and trim the lines alone, then to load them
+//   one HF_InsertRecord() call per line, then BULK_BATCH lines per call
+enum { LOAD_PARSE, LOAD_SINGLE, LOAD_BATCH };
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+double bulk_load(int mode, int *records) {
+    static char lines[BULK_BATCH][512];
+    const void *recs[BULK_BATCH];
+    int lens[BULK_BATCH];
+    HF_RID rids[BULK_BATCH];
+    int hffd = -1, n = 0;
+
+    remove(BULK_FILE);
+    if (mode != LOAD_PARSE) {
+        HF_CreateFile(BULK_FILE);
+        if ((hffd = HF_OpenFile(BULK_FILE)) < 0) {
+            PF_PrintError("HF_OpenFile");
+            exit(1);
+        }
+    }
+    FILE *f = fopen(BULK_DATASET, "r");
+    if (!f) {
+        perror("bulk dataset");
+        exit(1);
+    }
+
+    double start = now_ms();
+    *records = 0;
+    while (fgets(lines[n], sizeof(lines[n]), f)) {
+        trim(lines[n]);
+        if (lines[n][0] == '\0') continue;
+
+        recs[n] = lines[n];
+        lens[n] = strlen(lines[n]) + 1;
+        if (mode == LOAD_SINGLE && HF_InsertRecord(hffd, recs[n], lens[n], &rids[n]) != HF_OK) {
+            PF_PrintError("HF_InsertRecord");
+            exit(1);
+        }
+        (*records)++;
+        if (mode == LOAD_BATCH && ++n == BULK_BATCH) {
+            if (HF_InsertRecords(hffd, recs, lens, n, rids) != HF_OK) {
+                PF_PrintError("HF_InsertRecords");
+                exit(1);
+            }
+            n = 0;
+        }
+    }
+    if (mode == LOAD_BATCH && n > 0 && HF_InsertRecords(hffd, recs, lens, n, rids) != HF_OK) {
+        PF_PrintError("HF_InsertRecords");
+        exit(1);
+    }
+    if (hffd >= 0)
+        HF_CloseFile(hffd);
+    double elapsed = now_ms() - start;
+
+    fclose(f);
+    remove(BULK_FILE);
+    return elapsed;
+}
+
+// "All registrations for QUERY_COURSE": every record copied out by
+// HF_ScanNext() and its field compared here, then the same with the term
+// tested in the page by HF_ScanOpenFiltered(). Returns the ms of each.
+void course_query(int *matches, int *filteredMatches, double *copyMs, double *filterMs) {
+    char line[512], rec[512];
+    HF_RID rid;
+    HF_Scan scan;
+    HF_Filter filter;
+    int hffd, len;
+
+    remove(BULK_FILE);
+    HF_CreateFile(BULK_FILE);
+    if ((hffd = HF_OpenFile(BULK_FILE)) < 0) {
+        PF_PrintError("HF_OpenFile");
+        exit(1);
+    }
+    FILE *f = fopen(BULK_DATASET, "r");
+    if (!f) {
+        perror("bulk dataset");
+        exit(1);
+    }
+    while (fgets(line, sizeof(line), f)) {
+        trim(line);
+        if (line[0] != '\0')
+            HF_InsertRecord(hffd, line, strlen(line) + 1, &rid);
+    }
+    fclose(f);
+
+    double start = now_ms();
+    *matches = 0;
+    HF_ScanOpen(hffd, &scan);
+    while (HF_ScanNext(&scan, &rid, rec, &len) == HF_OK) {
+        char *field = rec;
+        for (int i = 0; i < QUERY_FIELD && field; i++) {
+            field = strchr(field, ';');
+            if (field) field++;
+        }
+        if (field && strncmp(field, QUERY_COURSE ";", strlen(QUERY_COURSE) + 1) == 0)
+            (*matches)++;
+    }
+    HF_ScanClose(&scan);
+    *copyMs = now_ms() - start;
+
+    HF_FilterInit(&filter);
+    HF_FilterAdd(&filter, QUERY_FIELD, HF_EQ, HF_STRING, QUERY_COURSE);
+    start = now_ms();
+    *filteredMatches = 0;
+    HF_ScanOpenFiltered(hffd, &scan, &filter);
+    while (HF_ScanNext(&scan, &rid, rec, &len) == HF_OK)
+        (*filteredMatches)++;
+    HF_ScanClose(&scan);
+    *filterMs = now_ms() - start;
+
+    HF_CloseFile(hffd);
+    remove(BULK_FILE);
+}
+
+// The ';'-separated fields of "line", in place; empty ones are kept
+static int split(char *line, char *fields[], int max) {
+    int n = 0;
+    fields[n++] = line;
+    for (char *p = line; *p && n < max; p++)
+        if (*p == ';') {
+            *p = '\0';
+            fields[n++] = p + 1;
+        }
+    return n;
+}
+
+// Credits of QUERY_COURSE in BULK_FILE's text records, each split into its
+// fields as it is read
+static double text_credits(int hffd) {
+    char copy[512];
+    const void *view;
+    HF_RID rid;
+    HF_Scan scan;
+    int len;
+    double sum = 0;
+
+    HF_ScanOpen(hffd, &scan);
+    while (HF_ScanNextView(&scan, &rid, &view, &len) == HF_OK) {
+        char *fields[STUDREGN_FIELDS];
+        memcpy(copy, view, len);
+        if (split(copy, fields, STUDREGN_FIELDS) == STUDREGN_FIELDS &&
+            strcmp(fields[QUERY_FIELD], QUERY_COURSE) == 0)
+            sum += atof(fields[CREDITS_FIELD]);
+    }
+    HF_ScanClose(&scan);
+    return sum;
+}
+
+// The same of TYPED_FILE's typed records, with the fields found in place
+static double typed_credits(int typedFd) {
+    const void *view;
+    HF_RID rid;
+    HF_Scan scan;
+    int len;
+    double sum = 0;
+
+    HF_ScanOpen(typedFd, &scan);
+    while (HF_ScanNextView(&scan, &rid, &view, &len) == HF_OK) {
+        double credits;
+        int courseLen;
+        const void *course = HF_GetField(view, len, QUERY_FIELD, &courseLen);
+        if (course && courseLen == (int)strlen(QUERY_COURSE) &&
+            memcmp(course, QUERY_COURSE, courseLen) == 0 &&
+            HF_GetReal(view, len, CREDITS_FIELD, &credits) == HF_OK)
+            sum += credits;
+    }
+    HF_ScanClose(&scan);
+    return sum;
+}
+
+// studregn.txt loaded as text lines into BULK_FILE and as typed records
+// into TYPED_FILE, then the credits of QUERY_COURSE summed over each, with
+// both files in the pool. Returns the ms of one sum of each.
+void typed_query(int *pages, int *typedPages, double *sum, double *typedSum,
+                 double *textMs, double *typedMs) {
+    char line[512], copy[512], rec[512];
+    HF_Schema schema;
+    HF_Stats stats;
+    HF_RID rid;
+    int hffd, typedFd, len;
+
+    HF_SchemaInit(&schema, STUDREGN_FIELDS, STUDREGN_TYPES);
+    PF_ResizeBufferPool(TYPED_FRAMES);
+    remove(BULK_FILE);
+    remove(TYPED_FILE);
+    HF_CreateFile(BULK_FILE);
+    HF_CreateFile(TYPED_FILE);
+    if ((hffd = HF_OpenFile(BULK_FILE)) < 0 || (typedFd = HF_OpenFile(TYPED_FILE)) < 0) {
+        PF_PrintError("HF_OpenFile");
+        exit(1);
+    }
+    FILE *f = fopen(BULK_DATASET, "r");
+    if (!f) {
+        perror("bulk dataset");
+        exit(1);
+    }
+    while (fgets(line, sizeof(line), f)) {
+        char *fields[STUDREGN_FIELDS];
+        const void *values[STUDREGN_FIELDS];
+        int lens[STUDREGN_FIELDS], ints[STUDREGN_FIELDS];
+        double reals[STUDREGN_FIELDS];
+
+        trim(line);
+        strcpy(copy, line);
+        if (split(copy, fields, STUDREGN_FIELDS) != STUDREGN_FIELDS)
+            continue;   /* the title line */
+        for (int i = 0; i < STUDREGN_FIELDS; i++) {
+            lens[i] = strlen(fields[i]);
+            ints[i] = atoi(fields[i]);
+            reals[i] = atof(fields[i]);
+            values[i] = lens[i] == 0 ? NULL :
+                        STUDREGN_TYPES[i] == HF_INT ? (const void *)&ints[i] :
+                        STUDREGN_TYPES[i] == HF_REAL ? (const void *)&reals[i] : fields[i];
+        }
+        len = sizeof(rec);
+        if (HF_MakeRecord(&schema, values, lens, rec, &len) != HF_OK ||
+            HF_InsertRecord(typedFd, rec, len, &rid) != HF_OK ||
+            HF_InsertRecord(hffd, line, strlen(line) + 1, &rid) != HF_OK) {
+            PF_PrintError("typed load");
+            exit(1);
+        }
+    }
+    fclose(f);
+    HF_GetStats(hffd, &stats);
+    *pages = stats.totalPages;
+    HF_GetStats(typedFd, &stats);
+    *typedPages = stats.totalPages;
+
+    *sum = text_credits(hffd);
+    double start = now_ms();
+    for (int i = 0; i < TYPED_PASSES; i++)
+        text_credits(hffd);
+    *textMs = (now_ms() - start) / TYPED_PASSES;
+
+    *typedSum = typed_credits(typedFd);
+    start = now_ms();
+    for (int i = 0; i < TYPED_PASSES; i++)
+        typed_credits(typedFd);
+    *typedMs = (now_ms() - start) / TYPED_PASSES;
+
+    HF_CloseFile(hffd);
+    HF_CloseFile(typedFd);
+    remove(BULK_FILE);
+    remove(TYPED_FILE);
+    PF_ResizeBufferPool(PF_MAX_BUFS);
+}
+
 //main entry point
 int main() {
     printf("=== VARIABLE vs STATIC STORAGE EXPERIMENT ===\n");
@@ -186,6 +488,11 @@ int main() {
     metrics_init(&var);
     build_variable(&var);
 
+    /**** The same, as HF inserts did before the free-space map ****/
+    Metrics append;
+    metrics_init(&append);
+    build_append_only(&append);
+
     /**** Static builds ****/
     Metrics statList[16];
     for (int i = 0; i < NUM_STATIC_SIZES; i++) {
@@ -194,7 +501,51 @@ int main() {
     }
 
     /**** Print summary table ****/
-    print_metrics(&var, statList, STATIC_SIZES);
+    print_metrics(&var, &append, statList, STATIC_SIZES);
+
+    /**** Bulk load ****/
+    /* each evicted page is fsynced on its own unless the double-write
+       buffer is open, so the loads are timed both ways */
+    const char *modes[] = {"read only", "HF_InsertRecord", "HF_InsertRecords"};
+    printf("\n\n================== BULK LOAD (%s) ==================\n", BULK_DATASET);
+    printf("%-32s %-10s %-10s\n", "Load", "Records", "ms");
+    for (int mode = LOAD_PARSE; mode <= LOAD_BATCH; mode++) {
+        int records;
+        double ms = bulk_load(mode, &records);
+        printf("%-32s %-10d %.3f\n", modes[mode], records, ms);
+    }
+    for (int mode = LOAD_SINGLE; mode <= LOAD_BATCH; mode++) {
+        char label[64];
+        int records;
+        remove(BULK_DW);
+        if (PF_DWOpen(BULK_DW) != PFE_OK) {
+            PF_PrintError("PF_DWOpen");
+            exit(1);
+        }
+        double ms = bulk_load(mode, &records);
+        PF_DWClose();
+        remove(BULK_DW);
+        snprintf(label, sizeof(label), "%s, double-write", modes[mode]);
+        printf("%-32s %-10d %.3f\n", label, records, ms);
+    }
+
+    /**** Selective scan ****/
+    int matches, filteredMatches;
+    double copyMs, filterMs;
+    course_query(&matches, &filteredMatches, &copyMs, &filterMs);
+    printf("\n\n============ QUERY: field %d = \"%s\" ============\n", QUERY_FIELD, QUERY_COURSE);
+    printf("%-18s %-10s %-10s\n", "Scan", "Matches", "ms");
+    printf("%-18s %-10d %.3f\n", "copy, then test", matches, copyMs);
+    printf("%-18s %-10d %.3f\n", "filtered", filteredMatches, filterMs);
+
+    /**** Typed records ****/
+    int pages, typedPages;
+    double sum, typedSum, textMs, typedMs;
+    typed_query(&pages, &typedPages, &sum, &typedSum, &textMs, &typedMs);
+    printf("\n\n======== CREDITS OF \"%s\": TEXT vs TYPED RECORDS ========\n", QUERY_COURSE);
+    printf("%-18s %-10s %-10s %-10s\n", "Records", "Pages", "Credits", "ms");
+    printf("%-18s %-10d %-10.2f %.3f\n", "text, split", pages, sum, textMs);
+    printf("%-18s %-10d %-10.2f %.3f\n", "typed, in place", typedPages, typedSum, typedMs);
 
     return 0;
 }
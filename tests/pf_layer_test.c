@@ -6,11 +6,44 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/stat.h>
 
 #define DBFILE    "pf_testfile.db"
 #define HF_FILE   "courses.hf"
 #define DATASET   "../data/courses.txt"
+#define TRACEFILE "pf_trace.bin"
+#define VCFILE    "pf_vcache.bin"
 #define N_PAGES   2000
+#define VC_SLOTS  1024   /* victim cache size (pages) */
+#define VC_WSET   600    /* working set: > PF_MAX_BUFS, < VC_SLOTS */
+#define VC_READS  12000
+#define PSIFILE   "pf_psi.txt"
+#define RS_OPS    4000   /* operations between two pool resizes */
+#define WALFILE   "pf_wal.log"
+#define WAL_WRITES  2000 /* page writes per durability mode */
+#define WAL_TXN     50   /* writes per transaction (single thread) */
+#define WAL_THREADS 8
+#define WAL_TXNS    40   /* one-write transactions per thread */
+#define DWFILE    "pf_dblwr.bin"
+#define DW_WRITES 2000   /* page writes per durability mode */
+#define DW_TORN   5      /* page torn on disk and repaired */
+#define OLDFILE   "pf_oldformat.db"
+#define SNAPFILE  "pf_snap.bin"
+#define SNAP_MEM  64     /* page versions kept in memory before spilling */
+#define SNAP_INS  3      /* records inserted per record the report reads */
+#define CP_TAIL   300    /* pages freed at the end of the file before trimming */
+#define CL_OPS    6000   /* page accesses per victim selection setting */
+#define CL_WRITES 3      /* one access in CL_WRITES is a write */
+#define SH_THREADS 4     /* PF_ReadShared() reader threads */
+#define SH_HOT    8      /* pages the readers read */
+#define SH_PAGES  200    /* pages the PF thread reads and writes */
+#define SH_OPS    20000  /* PF thread page accesses */
+#define SH_SPAN   64     /* bytes at offset 16 a write sets to one value */
+#define LD_BATCH  256    /* records the loader inserts per HF_InsertRecords() call */
+#define SC_PASSES 20     /* full scans of HF_FILE per scan method */
+#define SC_FRAMES 1024   /* pool size for them: HF_FILE stays buffered */
 
 typedef struct {
     char code[16];
@@ -29,13 +62,171 @@ static void strip_newline(char *str) {
         str[len-2] = '\0';
     }
 }
-static inline void reset_pf(void) {
-    PF_physical_reads = PF_physical_writes = 0;
-    PF_logical_reads  = PF_logical_writes  = 0;
-    PF_page_alloc = PF_page_evicted = 0;
+static inline void reset_pf(int fd) {
+    PF_ResetGlobalStats();
+    PF_ResetStats(fd);
+}
+
+static double now_ms(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec * 1000.0 + (double)t.tv_nsec / 1e6;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* write a fake PSI memory.pressure file with the given "some avg10" */
+static void write_psi(const char *path, double avg10) {
+    FILE *f = fopen(path, "w");
+    if (!f) return;
+    fprintf(f, "some avg10=%.2f avg60=0.00 avg300=0.00 total=0\n"
+               "full avg10=0.00 avg60=0.00 avg300=0.00 total=0\n", avg10);
+    fclose(f);
+}
+
+/* shared by the group commit threads */
+static pthread_mutex_t wal_lock = PTHREAD_MUTEX_INITIALIZER;  /* serializes page operations */
+static unsigned char wal_shadow[N_PAGES];  /* expected page[3] of every page */
+static int wal_fd, wal_errors;
+
+/* WAL_TXNS transactions of one page write each; only the commits overlap */
+static void *wal_worker(void *arg) {
+    int t = (int)(long)arg;
+    for (int i = 0; i < WAL_TXNS; ++i) {
+        int pno = (t + WAL_THREADS * i) % N_PAGES;
+        char *page;
+        pthread_mutex_lock(&wal_lock);
+        if (PF_TxnBegin() < 0 || PF_GetThisPage(wal_fd, pno, &page) != PFE_OK) {
+            wal_errors++;
+            pthread_mutex_unlock(&wal_lock);
+            continue;
+        }
+        page[3] = (char)(wal_shadow[pno] = (unsigned char)(t * WAL_TXNS + i));
+        if (PF_UnfixPage(wal_fd, pno, 1) != PFE_OK)
+            wal_errors++;
+        pthread_mutex_unlock(&wal_lock);
+        if (PF_TxnCommit() != PFE_OK)
+            wal_errors++;
+    }
+    return NULL;
+}
+
+/* shared by the PF_ReadShared() readers */
+static volatile int sh_stop;
+static int sh_fd;
+
+typedef struct {
+    unsigned int seed;
+    unsigned long pins, notbuf, fixed, torn;
+} ShReader;
+
+/* read the hot pages without a lock until told to stop: a pinned page
+   must never show a write half done */
+static void *sh_reader(void *arg) {
+    ShReader *r = arg;
+    PF_Handle handle;
+    char *page;
+    int p, error;
+
+    while (!sh_stop) {
+        r->seed = r->seed * 1103515245u + 12345u;
+        p = (int)((r->seed >> 8) % SH_HOT);
+        if ((error = PF_ReadShared(sh_fd, p, &page, &handle)) != PFE_OK) {
+            if (error == PFE_PAGEFIXED) r->fixed++;
+            else r->notbuf++;
+            continue;
+        }
+        r->pins++;
+        for (int i = 1; i < SH_SPAN; ++i) {
+            if (page[16 + i] != page[16]) {
+                r->torn++;
+                break;
+            }
+        }
+        PF_ReleaseShared(handle);
+        sched_yield();  /* leave the PF thread its share of a small machine */
+    }
+    return NULL;
+}
+
+/* a chain through the kept pages of the compaction test: each page holds
+   its original number at offset 8 and the page of the next one at 12 */
+typedef struct {
+    int head;              /* page of the first kept page */
+    int where[N_PAGES];    /* page now holding original page i */
+    int pred[N_PAGES];     /* original page linking to page i, -1 for the head */
+    int moves;
+} Chain;
+
+/* PF_CompactFile() callback: repoint the link to the moved page */
+static int chain_relocate(int fd, int oldpage, int newpage, void *arg) {
+    Chain *c = arg;
+    char *page;
+    int id, err;
+
+    (void)oldpage;
+    if ((err = PF_GetThisPage(fd, newpage, &page)) != PFE_OK)
+        return err;
+    memcpy(&id, page + 8, sizeof(int));
+    PF_UnfixPage(fd, newpage, 0);
+    c->where[id] = newpage;
+    c->moves++;
+    if (c->pred[id] < 0) {
+        c->head = newpage;
+        return PFE_OK;
+    }
+    if ((err = PF_GetThisPage(fd, c->where[c->pred[id]], &page)) != PFE_OK)
+        return err;
+    memcpy(page + 12, &newpage, sizeof(int));
+    return PF_UnfixPage(fd, c->where[c->pred[id]], 1);
+}
+
+/* time a PF_GetNextPage() scan of "fd"; returns the # of used pages */
+static int scan_pages(int fd, double *ms) {
+    Stats t;
+    char *page;
+    int pno = -1, n = 0;
+
+    stats_reset(&t);
+    stats_start(&t);
+    while (PF_GetNextPage(fd, &pno, &page) == PFE_OK) {
+        n++;
+        PF_UnfixPage(fd, pno, 0);
+    }
+    stats_stop(&t);
+    *ms = stats_elapsed_ms(&t);
+    return n;
+}
+
+/* Insert the "n" records of "batch"; returns how many went in */
+static int insert_batch(int hf_fd, CourseRec *batch, int n) {
+    const void *recs[LD_BATCH] = {0};
+    int lens[LD_BATCH] = {0};
+    HF_RID rids[LD_BATCH];
+
+    for (int i = 0; i < n; ++i) {
+        recs[i] = &batch[i];
+        lens[i] = sizeof(CourseRec);
+    }
+    int err = HF_InsertRecords(hf_fd, recs, lens, n, rids);
+    if (err != PFE_OK) {
+        /* the records before the failed one went in */
+        int done = 0;
+        while (done < n && rids[done].pageNum >= 0)
+            done++;
+        printf("ERROR: Inserted %d of a batch of %d records (error: %d)\n", done, n, err);
+        PF_PrintError("HF_InsertRecords");
+        return done;
+    }
+    return n;
 }
 
 static int load_dataset(const char *path, int hf_fd) {
+    static CourseRec batch[LD_BATCH];
+    int nbatch = 0;
     FILE *f = fopen(path, "r");
     if (!f) {
         printf("ERROR: Failed to open dataset file: %s\n", path);
@@ -73,16 +264,13 @@ static int load_dataset(const char *path, int hf_fd) {
         tok = strtok_r(NULL, ";", &saveptr);
         if (tok) strncpy(c.type, tok, sizeof(c.type)-1);
 
-        HF_RID rid;
-        int err = HF_InsertRecord(hf_fd, &c, sizeof(c), &rid);
-        if (err != PFE_OK) {
-            printf("ERROR: Failed to insert record %d (error: %d)\n", count, err);
-            PF_PrintError("HF_InsertRecord");
-            continue;
+        if (nbatch == LD_BATCH) {
+            count += insert_batch(hf_fd, batch, nbatch);
+            nbatch = 0;
         }
-        
-        count++;
+        batch[nbatch++] = c;
     }
+    count += insert_batch(hf_fd, batch, nbatch);
 
     fclose(f);
     printf("INFO: Finished loading %d records from dataset\n", count);
@@ -155,8 +343,12 @@ int main(void) {
         }
         printf("INFO: PF_OpenFile succeeded, fd=%d\n", fd);
 
+        /* capture the LRU run so other pool sizes/policies can be simulated offline */
+        if (st == 0 && PF_TraceStart(TRACEFILE) != PFE_OK)
+            PF_PrintError("PF_TraceStart");
+
         /* ----- Create initial N pages ----- */
-        reset_pf();
+        reset_pf(fd);
         stats_reset(&s);
         printf("\n--- Creating %d initial pages ---\n", N_PAGES);
         stats_start(&s);
@@ -186,10 +378,12 @@ int main(void) {
         }
 
         stats_stop(&s);
+        stats_snapshot_from_pf(&s);
         {
             char label[128];
             snprintf(label, sizeof(label), "%s create %d pages", names[st], N_PAGES);
             stats_dump("pf_stats.txt", label, &s);
+            stats_dump_pf("pf_stats.txt", label, fd);
             printf("RESULT: %s - Page creation completed in %.3f ms\n", 
                    names[st], stats_elapsed_ms(&s));
         }
@@ -199,7 +393,7 @@ int main(void) {
             printf("\n--- Mix %d: R=%d, W=%d ---\n", 
                    i, mix[i].reads, mix[i].writes);
             
-            reset_pf();
+            reset_pf(fd);
             stats_reset(&s);
             stats_start(&s);
 
@@ -243,13 +437,17 @@ int main(void) {
             }
 
             stats_stop(&s);
+            stats_snapshot_from_pf(&s);
             char label[128];
             snprintf(label, sizeof(label), "%s mix R=%d W=%d (PF_MAX_BUFS=%d)",
                      names[st], mix[i].reads, mix[i].writes, PF_MAX_BUFS);
             stats_dump("pf_stats.txt", label, &s);
+            stats_dump_pf("pf_stats.txt", label, fd);
             
-            printf("RESULT: %s mix %d completed in %.3f ms\n", 
-                   names[st], i, stats_elapsed_ms(&s));
+            PF_Stats ps;
+            PF_GetStats(fd, &ps);
+            printf("RESULT: %s mix %d completed in %.3f ms (%lu of %lu misses wrote a dirty victim first)\n",
+                   names[st], i, stats_elapsed_ms(&s), ps.victim_writes, ps.misses);
             if (read_errors > 0 || write_errors > 0) {
                 printf("WARNING: read errors: %d, write errors: %d\n", 
                        read_errors, write_errors);
@@ -263,6 +461,844 @@ int main(void) {
         } else {
             printf("INFO: PF_CloseFile succeeded\n");
         }
+
+        if (st == 0 && PF_TraceStop() == PFE_OK)
+            printf("INFO: page trace written to %s (replay with ../pflayer/pfsim %s)\n",
+                   TRACEFILE, TRACEFILE);
+    }
+
+    /* ===== Victim cache: working set larger than the pool ===== */
+    printf("\n========================================\n");
+    printf("Testing second-tier victim cache (LRU, %d slots)\n", VC_SLOTS);
+    printf("========================================\n");
+    USE_MRU = 0;
+    for (int vc = 0; vc < 2; ++vc) {
+        if (vc && PF_VCacheOpen(VCFILE, VC_SLOTS, PF_VC_ADMIT_REUSED) != PFE_OK) {
+            PF_PrintError("PF_VCacheOpen");
+            return 1;
+        }
+
+        int fd = PF_OpenFile(DBFILE);
+        if (fd < 0) {
+            PF_PrintError("PF_OpenFile");
+            return 1;
+        }
+
+        reset_pf(fd);
+        stats_reset(&s);
+        stats_start(&s);
+
+        int bad = 0;
+        for (int r = 0; r < VC_READS; ++r) {
+            int pno = (r * 13) % VC_WSET;
+            char *page;
+            if (PF_GetThisPage(fd, pno, &page) != PFE_OK) {
+                bad++;
+                continue;
+            }
+            /* page[0] was set at creation; the mixes only touch page[1] */
+            if (page[0] != (char)(pno & 0xFF))
+                bad++;
+            PF_UnfixPage(fd, pno, 0);
+        }
+
+        stats_stop(&s);
+        stats_snapshot_from_pf(&s);
+        char label[128];
+        snprintf(label, sizeof(label), "LRU %d reads over %d pages, victim cache %s",
+                 VC_READS, VC_WSET, vc ? "on" : "off");
+        stats_dump("pf_stats.txt", label, &s);
+        stats_dump_pf("pf_stats.txt", label, fd);
+
+        printf("RESULT: victim cache %-3s: %.3f ms, origin reads=%lu, bad pages=%d\n",
+               vc ? "on" : "off", stats_elapsed_ms(&s), s.physical_reads, bad);
+        if (vc) {
+            PF_VCacheStats vs;
+            PF_VCacheGetStats(&vs);
+            printf("INFO: victim cache lookups=%lu hits=%lu admits=%lu rejects=%lu replaced=%lu\n",
+                   vs.lookups, vs.hits, vs.admits, vs.rejects, vs.replaced);
+        }
+        if (bad > 0) {
+            printf("ERROR: %d pages read back wrong\n", bad);
+            return 1;
+        }
+
+        PF_CloseFile(fd);
+    }
+    PF_VCacheClose();
+
+    /* ===== Online pool resizing during a read/write mix ===== */
+    printf("\n========================================\n");
+    printf("Testing online buffer pool resizing (LRU)\n");
+    printf("========================================\n");
+    {
+        static const int sizes[] = {20, 400, 50, 1000, 10, 200, 20};
+        const int nsizes = (int)(sizeof(sizes)/sizeof(sizes[0]));
+        static unsigned char shadow[N_PAGES];  /* expected page[2] of every page */
+        int fd = PF_OpenFile(DBFILE);
+        int bad = 0, nframes, target;
+        char *page;
+
+        if (fd < 0) {
+            PF_PrintError("PF_OpenFile");
+            return 1;
+        }
+        for (int p = 0; p < N_PAGES; ++p) {
+            if (PF_GetThisPage(fd, p, &page) != PFE_OK) { bad++; continue; }
+            shadow[p] = (unsigned char)page[2];
+            PF_UnfixPage(fd, p, 0);
+        }
+
+        for (int k = 0; k < nsizes; ++k) {
+            if (PF_ResizeBufferPool(sizes[k]) != PFE_OK)
+                PF_PrintError("PF_ResizeBufferPool");
+            reset_pf(fd);
+            stats_reset(&s);
+            stats_start(&s);
+
+            /* 3 reads : 1 write over a skewed set of pages */
+            for (int op = 0; op < RS_OPS; ++op) {
+                int pno = ((op * 7919) % N_PAGES) % (op & 1 ? N_PAGES : 300);
+                if (PF_GetThisPage(fd, pno, &page) != PFE_OK) { bad++; continue; }
+                if ((unsigned char)page[2] != shadow[pno])
+                    bad++;
+                if (op % 4 == 3) {
+                    page[2] = (char)(shadow[pno] = (unsigned char)(op + k));
+                    PF_UnfixPage(fd, pno, 1);
+                } else {
+                    PF_UnfixPage(fd, pno, 0);
+                }
+            }
+
+            stats_stop(&s);
+            stats_snapshot_from_pf(&s);
+            PF_GetBufferPoolSize(&nframes, &target);
+            char label[128];
+            snprintf(label, sizeof(label), "LRU resize to %d frames, %d ops", sizes[k], RS_OPS);
+            stats_dump("pf_stats.txt", label, &s);
+            printf("RESULT: pool %4d -> %4d frames: %8.0f ops/s, physical reads=%lu\n",
+                   sizes[k], nframes, RS_OPS / (stats_elapsed_ms(&s) / 1000.0), s.physical_reads);
+            if (nframes > target) {
+                printf("ERROR: pool holds %d frames, target %d\n", nframes, target);
+                bad++;
+            }
+        }
+
+        /* the writes must survive the shrinks: reread everything from disk */
+        PF_CloseFile(fd);
+        fd = PF_OpenFile(DBFILE);
+        for (int p = 0; p < N_PAGES; ++p) {
+            if (PF_GetThisPage(fd, p, &page) != PFE_OK) { bad++; continue; }
+            if ((unsigned char)page[2] != shadow[p])
+                bad++;
+            PF_UnfixPage(fd, p, 0);
+        }
+
+        /* pressure-driven sizing from a fake PSI file */
+        write_psi(PSIFILE, 50.0);
+        if (PF_PSIWatchStart(PSIFILE, 10, 100) != PFE_OK) {
+            PF_PrintError("PF_PSIWatchStart");
+            bad++;
+        }
+        PF_GetBufferPoolSize(&nframes, &target);
+        printf("INFO: PSI avg10=50.00 -> pool target %d\n", target);
+        if (target >= 20) bad++;
+        write_psi(PSIFILE, 0.0);
+        int t1 = PF_PSIPoll(), t2 = PF_PSIPoll();
+        printf("INFO: PSI avg10=0.00 -> pool target %d, then %d\n", t1, t2);
+        if (!(t1 > target && t2 > t1)) bad++;
+        PF_PSIWatchStop();
+        remove(PSIFILE);
+        PF_ResizeBufferPool(PF_MAX_BUFS);
+
+        PF_CloseFile(fd);
+        printf("RESULT: resize test %s (%d errors)\n", bad ? "FAILED" : "passed", bad);
+        if (bad)
+            return 1;
+    }
+
+    /* ===== Write-ahead log: lazy page writes, group commit, rollback ===== */
+    printf("\n========================================\n");
+    printf("Testing write-ahead log (LRU, %d frames)\n", PF_MAX_BUFS);
+    printf("========================================\n");
+    {
+        PF_WALStats ws;
+        int fd, bad = 0;
+        char *page;
+
+        remove(WALFILE);
+        fd = PF_OpenFile(DBFILE);
+        if (fd < 0) {
+            PF_PrintError("PF_OpenFile");
+            return 1;
+        }
+        for (int p = 0; p < N_PAGES; ++p) {
+            if (PF_GetThisPage(fd, p, &page) != PFE_OK) { bad++; continue; }
+            wal_shadow[p] = (unsigned char)page[3];
+            PF_UnfixPage(fd, p, 0);
+        }
+
+        /* the same writes with an fsync per written page, then through the log */
+        for (int wal = 0; wal < 2; ++wal) {
+            if (wal && PF_WALOpen(WALFILE) != PFE_OK) {
+                PF_PrintError("PF_WALOpen");
+                return 1;
+            }
+            reset_pf(fd);
+            stats_reset(&s);
+            stats_start(&s);
+            for (int w = 0; w < WAL_WRITES; ++w) {
+                int pno = (w * 7919) % N_PAGES;
+                if (wal && w % WAL_TXN == 0 && PF_TxnBegin() < 0) bad++;
+                if (PF_GetThisPage(fd, pno, &page) != PFE_OK) { bad++; continue; }
+                page[3] = (char)(wal_shadow[pno] = (unsigned char)(w + wal));
+                PF_UnfixPage(fd, pno, 1);
+                if (wal && w % WAL_TXN == WAL_TXN - 1 && PF_TxnCommit() != PFE_OK) bad++;
+            }
+            stats_stop(&s);
+            stats_snapshot_from_pf(&s);
+
+            PF_Stats ps;
+            PF_GetGlobalStats(&ps);
+            char label[128];
+            snprintf(label, sizeof(label), "LRU %d writes, %s", WAL_WRITES,
+                     wal ? "WAL, 50 writes/commit" : "fsync per page");
+            stats_dump("pf_stats.txt", label, &s);
+            if (wal) {
+                PF_WALGetStats(&ws);
+                printf("RESULT: WAL, %d writes/commit: %8.0f writes/s, %lu page writes, %lu log fsyncs (%lu forced by eviction)\n",
+                       WAL_TXN, WAL_WRITES / (stats_elapsed_ms(&s) / 1000.0), s.physical_writes,
+                       ws.flushes, ws.forced);
+            } else {
+                printf("RESULT: fsync per page:  %8.0f writes/s, %lu page writes, %lu fsyncs\n",
+                       WAL_WRITES / (stats_elapsed_ms(&s) / 1000.0), s.physical_writes,
+                       ps.fsync_lat.count);
+            }
+        }
+
+        /* group commit: concurrent one-write transactions share log fsyncs */
+        pthread_t tid[WAL_THREADS];
+        PF_WALResetStats();
+        wal_fd = fd;
+        wal_errors = 0;
+        stats_reset(&s);
+        stats_start(&s);
+        for (long t = 0; t < WAL_THREADS; ++t)
+            pthread_create(&tid[t], NULL, wal_worker, (void *)t);
+        for (int t = 0; t < WAL_THREADS; ++t)
+            pthread_join(tid[t], NULL);
+        stats_stop(&s);
+        PF_WALGetStats(&ws);
+        bad += wal_errors;
+        printf("RESULT: group commit, %d threads: %lu commits in %.3f ms, %lu log fsyncs (%.1f commits/fsync, largest batch %lu)\n",
+               WAL_THREADS, ws.commits, stats_elapsed_ms(&s), ws.flushes,
+               ws.flushes ? (double)ws.commits / ws.flushes : 0.0, ws.group_max);
+
+        /* rollback: page changes and an allocation are undone */
+        int pno, npno;
+        if (PF_TxnBegin() < 0) bad++;
+        for (int p = 0; p < 30; ++p) {
+            if (PF_GetThisPage(fd, p * 61, &page) != PFE_OK) { bad++; continue; }
+            page[3] = (char)~wal_shadow[p * 61];
+            PF_UnfixPage(fd, p * 61, 1);
+        }
+        if (PF_AllocPage(fd, &pno, &page) != PFE_OK) bad++;
+        else PF_UnfixPage(fd, pno, 1);
+        if (PF_TxnAbort() != PFE_OK) {
+            PF_PrintError("PF_TxnAbort");
+            bad++;
+        }
+        if (PF_AllocPage(fd, &npno, &page) != PFE_OK || npno != pno) {
+            printf("ERROR: allocation not rolled back (page %d, then %d)\n", pno, npno);
+            bad++;
+        } else {
+            PF_UnfixPage(fd, npno, 1);
+            PF_DisposePage(fd, npno);
+        }
+        PF_WALGetStats(&ws);
+        printf("INFO: rollback of 30 page writes + 1 allocation: %lu aborts\n", ws.aborts);
+
+        /* everything committed (and nothing aborted) is on disk after a reopen */
+        PF_CloseFile(fd);
+        fd = PF_OpenFile(DBFILE);
+        for (int p = 0; p < N_PAGES; ++p) {
+            if (PF_GetThisPage(fd, p, &page) != PFE_OK) { bad++; continue; }
+            if ((unsigned char)page[3] != wal_shadow[p])
+                bad++;
+            PF_UnfixPage(fd, p, 0);
+        }
+        PF_CloseFile(fd);
+        if (PF_WALClose() != PFE_OK) {
+            PF_PrintError("PF_WALClose");
+            bad++;
+        }
+        remove(WALFILE);
+        printf("RESULT: WAL test %s (%d errors)\n", bad ? "FAILED" : "passed", bad);
+        if (bad)
+            return 1;
+    }
+
+    /* ===== File format: a file of the old page layout is refused ===== */
+    {
+        /* the layout before pages carried an LSN: two ints of header, then
+           4096-byte pages */
+        int oldhdr[2] = {PF_PAGE_LIST_END, 1};
+        static char oldpage[PF_PAGE_SIZE];
+        FILE *fp = fopen(OLDFILE, "wb");
+        int err;
+
+        if (fp == NULL || fwrite(oldhdr, sizeof(oldhdr), 1, fp) != 1 ||
+            fwrite(oldpage, sizeof(oldpage), 1, fp) != 1) {
+            perror("old-format file");
+            return 1;
+        }
+        fclose(fp);
+        err = PF_OpenFile(OLDFILE);
+        printf("RESULT: old-format file %s (PF_OpenFile returned %d)\n",
+               err == PFE_BADFILE ? "refused" : "NOT refused", err);
+        if (err != PFE_BADFILE)
+            return 1;
+        remove(OLDFILE);
+    }
+
+    /* ===== Double-write buffer: batched page writes, torn-page repair ===== */
+    printf("\n========================================\n");
+    printf("Testing double-write buffer (LRU, %d pages per batch)\n", PF_DW_PAGES);
+    printf("========================================\n");
+    {
+        static unsigned char shadow[N_PAGES];  /* expected page[4] of every page */
+        PF_DWStats ds;
+        int fd, bad = 0;
+        char *page;
+
+        remove(DWFILE);
+        fd = PF_OpenFile(DBFILE);
+        if (fd < 0) {
+            PF_PrintError("PF_OpenFile");
+            return 1;
+        }
+        for (int p = 0; p < N_PAGES; ++p) {
+            if (PF_GetThisPage(fd, p, &page) != PFE_OK) { bad++; continue; }
+            shadow[p] = (unsigned char)page[4];
+            PF_UnfixPage(fd, p, 0);
+        }
+
+        /* the same writes with an fsync per written page, then in batches */
+        for (int dw = 0; dw < 2; ++dw) {
+            if (dw && PF_DWOpen(DWFILE) != PFE_OK) {
+                PF_PrintError("PF_DWOpen");
+                return 1;
+            }
+            reset_pf(fd);
+            stats_reset(&s);
+            stats_start(&s);
+            for (int w = 0; w < DW_WRITES; ++w) {
+                int pno = (w * 7919) % N_PAGES;
+                if (PF_GetThisPage(fd, pno, &page) != PFE_OK) { bad++; continue; }
+                page[4] = (char)(shadow[pno] = (unsigned char)(w + dw));
+                PF_UnfixPage(fd, pno, 1);
+            }
+            if (dw && PF_DWFlush() != PFE_OK) bad++;
+            stats_stop(&s);
+            stats_snapshot_from_pf(&s);
+
+            PF_Stats ps;
+            PF_GetGlobalStats(&ps);
+            char label[128];
+            snprintf(label, sizeof(label), "LRU %d writes, %s", DW_WRITES,
+                     dw ? "double-write batches" : "fsync per page");
+            stats_dump("pf_stats.txt", label, &s);
+            if (dw) {
+                PF_DWGetStats(&ds);
+                printf("RESULT: double-write:   %8.0f writes/s, %lu page writes, %lu batches, %lu fsyncs\n",
+                       DW_WRITES / (stats_elapsed_ms(&s) / 1000.0), s.physical_writes,
+                       ds.batches, ds.batches + ds.fsyncs);
+            } else {
+                printf("RESULT: fsync per page: %8.0f writes/s, %lu page writes, %lu fsyncs\n",
+                       DW_WRITES / (stats_elapsed_ms(&s) / 1000.0), s.physical_writes,
+                       ps.fsync_lat.count);
+            }
+        }
+
+        /* dirty a few pages so the last batch holds page DW_TORN, then tear
+           it on disk as a crash in the middle of its in-place write would */
+        for (int p = 0; p < 10; ++p) {
+            if (PF_GetThisPage(fd, p, &page) != PFE_OK) { bad++; continue; }
+            page[4] = (char)(shadow[p] = (unsigned char)(shadow[p] + 1));
+            PF_UnfixPage(fd, p, 1);
+        }
+        PF_CloseFile(fd);
+        {
+            PFfpage torn;
+            FILE *fp = fopen(DWFILE, "rb");
+            size_t n = 0;
+
+            /* keep a copy of the scratch file: closing the buffer empties it */
+            static PFdw_slot slots[PF_DW_PAGES];
+            if (fp != NULL) {
+                n = fread(slots, sizeof(PFdw_slot), PF_DW_PAGES, fp);
+                fclose(fp);
+            }
+            PF_DWClose();
+            fp = fopen(DWFILE, "wb");
+            if (fp == NULL || fwrite(slots, sizeof(PFdw_slot), n, fp) != n) bad++;
+            if (fp != NULL) fclose(fp);
+
+            memset(&torn, 0xAB, sizeof(torn));
+            fp = fopen(DBFILE, "r+b");
+            if (fp == NULL ||
+                fseek(fp, (long)PFpageOffset(DW_TORN) + (long)sizeof(PFfpage) / 2, SEEK_SET) != 0 ||
+                fwrite(&torn, sizeof(PFfpage) / 2, 1, fp) != 1) bad++;
+            if (fp != NULL) fclose(fp);
+        }
+
+        /* without the buffer the torn page is caught by its checksum */
+        fd = PF_OpenFile(DBFILE);
+        if (PF_GetThisPage(fd, DW_TORN, &page) != PFE_CHECKSUM) {
+            printf("ERROR: torn page %d not detected\n", DW_TORN);
+            bad++;
+        } else {
+            printf("INFO: torn page %d detected: PFE_CHECKSUM\n", DW_TORN);
+        }
+        PF_CloseFile(fd);
+
+        /* opening the buffer repairs it from the scratch copy */
+        if (PF_DWOpen(DWFILE) != PFE_OK) {
+            PF_PrintError("PF_DWOpen (restore)");
+            return 1;
+        }
+        PF_DWGetStats(&ds);
+        printf("INFO: PF_DWOpen restored %lu page(s)\n", ds.restored);
+        if (ds.restored != 1) bad++;
+        fd = PF_OpenFile(DBFILE);
+        for (int p = 0; p < N_PAGES; ++p) {
+            if (PF_GetThisPage(fd, p, &page) != PFE_OK) { bad++; continue; }
+            if ((unsigned char)page[4] != shadow[p])
+                bad++;
+            PF_UnfixPage(fd, p, 0);
+        }
+        PF_CloseFile(fd);
+        PF_DWClose();
+        remove(DWFILE);
+        printf("RESULT: double-write test %s (%d errors)\n", bad ? "FAILED" : "passed", bad);
+        if (bad)
+            return 1;
+    }
+
+    /* ===== Copy-on-write snapshots: a report scan during ingestion ===== */
+    printf("\n========================================\n");
+    printf("Testing copy-on-write snapshots (LRU, %d frames)\n", PF_MAX_BUFS);
+    printf("========================================\n");
+    {
+        PF_SnapStats ss;
+        HF_Scan scan;
+        HF_RID rid;
+        CourseRec rec, mark;
+        int hf_fd, len, before = 0, seen = 0, inserted = 0, after = 0, marked = 0, bad = 0;
+
+        if (PF_SnapshotSpill(SNAPFILE, SNAP_MEM) != PFE_OK) {
+            PF_PrintError("PF_SnapshotSpill");
+            return 1;
+        }
+        hf_fd = HF_OpenFile(HF_FILE);
+        if (hf_fd < 0) {
+            PF_PrintError("HF_OpenFile");
+            return 1;
+        }
+        HF_ScanOpen(hf_fd, &scan);
+        while (HF_ScanNext(&scan, &rid, &rec, &len) == HF_OK)
+            before++;
+        HF_ScanClose(&scan);
+
+        /* the report reads the file as it was at open; every record it
+           reads is followed by inserts, some into pages it has yet to read */
+        memset(&mark, 0, sizeof(mark));
+        strcpy(mark.code, "SNAP");
+        mark.credits = -1.0;
+        stats_reset(&s);
+        stats_start(&s);
+        if (HF_ScanOpenSnapshot(hf_fd, &scan) != HF_OK) {
+            PF_PrintError("HF_ScanOpenSnapshot");
+            return 1;
+        }
+        while (HF_ScanNext(&scan, &rid, &rec, &len) == HF_OK) {
+            seen++;
+            if (strcmp(rec.code, "SNAP") == 0)
+                marked++;
+            for (int k = 0; k < SNAP_INS; ++k) {
+                if (HF_InsertRecord(hf_fd, &mark, sizeof(mark), &rid) != HF_OK) bad++;
+                else inserted++;
+            }
+        }
+        PF_GetSnapshotStats(&ss);
+        HF_ScanClose(&scan);
+        stats_stop(&s);
+        printf("RESULT: snapshot report: %d records read (%d before), %d inserted meanwhile, %d new seen, %.3f ms\n",
+               seen, before, inserted, marked, stats_elapsed_ms(&s));
+        printf("INFO: snapshot: %lu before images, %lu versions (%lu spilled), %lu page reads (%lu old, %lu from spill), %lu frame hits\n",
+               ss.captures, ss.created, ss.spilled, ss.reads, ss.old_reads, ss.spill_reads, ss.frame_hits);
+        if (seen != before || marked != 0) {
+            printf("ERROR: the report saw the inserts\n");
+            bad++;
+        }
+
+        HF_ScanOpen(hf_fd, &scan);
+        while (HF_ScanNext(&scan, &rid, &rec, &len) == HF_OK)
+            after++;
+        HF_ScanClose(&scan);
+        if (after != before + inserted) {
+            printf("ERROR: %d records after the report, expected %d\n", after, before + inserted);
+            bad++;
+        }
+        HF_CloseFile(hf_fd);
+
+        /* page level: two snapshots of DBFILE, pages rewritten after each */
+        static unsigned char orig[N_PAGES];
+        int fd = PF_OpenFile(DBFILE), s1, s2;
+        char *page;
+        for (int p = 0; p < N_PAGES; ++p) {
+            if (PF_GetThisPage(fd, p, &page) != PFE_OK) { bad++; continue; }
+            orig[p] = (unsigned char)page[5];
+            PF_UnfixPage(fd, p, 0);
+        }
+        s1 = PF_BeginSnapshot(fd);
+        for (int p = 0; p < N_PAGES; p += 2) {
+            if (PF_GetThisPage(fd, p, &page) != PFE_OK) { bad++; continue; }
+            page[5] = (char)(orig[p] + 1);
+            PF_UnfixPage(fd, p, 1);
+        }
+        s2 = PF_BeginSnapshot(fd);
+        for (int p = 0; p < N_PAGES; ++p) {
+            if (PF_GetThisPage(fd, p, &page) != PFE_OK) { bad++; continue; }
+            page[5] = (char)(orig[p] + 2);
+            PF_UnfixPage(fd, p, 1);
+        }
+        for (int snap = 0; snap < 2; ++snap) {
+            PF_UseSnapshot(snap ? s2 : s1);
+            for (int p = 0; p < N_PAGES; ++p) {
+                unsigned char want = (unsigned char)(orig[p] + (snap && p % 2 == 0));
+                if (PF_GetThisPage(fd, p, &page) != PFE_OK) { bad++; continue; }
+                if ((unsigned char)page[5] != want)
+                    bad++;
+                if (PF_UnfixPage(fd, p, 1) != PFE_READONLY)
+                    bad++;
+            }
+            PF_UseSnapshot(0);
+        }
+        PF_EndSnapshot(s1);
+        PF_EndSnapshot(s2);
+        PF_GetSnapshotStats(&ss);
+        printf("INFO: 2 snapshots of %d pages: %lu versions kept, %lu spilled, %lu left after both end\n",
+               N_PAGES, ss.created, ss.spilled, ss.versions);
+        if (ss.versions != 0 || ss.spilled == 0)
+            bad++;
+        PF_CloseFile(fd);
+        PF_SnapshotSpill(NULL, 0);
+
+        printf("RESULT: snapshot test %s (%d errors)\n", bad ? "FAILED" : "passed", bad);
+        if (bad)
+            return 1;
+    }
+
+    /* ===== Full scans: copying records out vs viewing them in place ===== */
+    printf("\n========================================\n");
+    printf("Testing zero-copy and batched HF scans (%d passes, %d frames)\n", SC_PASSES, SC_FRAMES);
+    printf("========================================\n");
+    {
+        HF_Scan scan;
+        HF_RID rid;
+        CourseRec rec;
+        static HF_RecordBatch batch;
+        const void *view;
+        double sum[3] = {0, 0, 0}, ms[3];
+        long n[3] = {0, 0, 0};
+        int hf_fd, len;
+
+        /* per-record costs, not page reads: the file fits in the pool */
+        PF_ResizeBufferPool(SC_FRAMES);
+        hf_fd = HF_OpenFile(HF_FILE);
+        if (hf_fd < 0) {
+            PF_PrintError("HF_OpenFile");
+            return 1;
+        }
+        HF_ScanOpen(hf_fd, &scan);
+        while (HF_ScanNext(&scan, &rid, &rec, &len) == HF_OK)
+            ;
+        HF_ScanClose(&scan);
+        for (int m = 0; m < 3; ++m) {
+            stats_reset(&s);
+            stats_start(&s);
+            for (int pass = 0; pass < SC_PASSES; ++pass) {
+                HF_ScanOpen(hf_fd, &scan);
+                if (m == 0) {
+                    while (HF_ScanNext(&scan, &rid, &rec, &len) == HF_OK) {
+                        sum[m] += rec.credits;
+                        n[m]++;
+                    }
+                } else if (m == 1) {
+                    while (HF_ScanNextView(&scan, &rid, &view, &len) == HF_OK) {
+                        sum[m] += ((const CourseRec *)view)->credits;
+                        n[m]++;
+                    }
+                } else {
+                    while (HF_ScanNextBatch(&scan, &batch, HF_BATCH_MAX) == HF_OK) {
+                        for (int k = 0; k < batch.count; ++k)
+                            sum[m] += ((const CourseRec *)batch.rec[k])->credits;
+                        n[m] += batch.count;
+                    }
+                }
+                HF_ScanClose(&scan);
+            }
+            stats_stop(&s);
+            ms[m] = stats_elapsed_ms(&s);
+        }
+        HF_CloseFile(hf_fd);
+        PF_ResizeBufferPool(PF_MAX_BUFS);
+        printf("RESULT: HF_ScanNext:      %ld records, %.3f ms (%.0f records/ms)\n", n[0], ms[0], n[0] / ms[0]);
+        printf("RESULT: HF_ScanNextView:  %ld records, %.3f ms (%.0f records/ms)\n", n[1], ms[1], n[1] / ms[1]);
+        printf("RESULT: HF_ScanNextBatch: %ld records, %.3f ms (%.0f records/ms)\n", n[2], ms[2], n[2] / ms[2]);
+        if (n[0] != n[1] || sum[0] != sum[1] || n[0] != n[2] || sum[0] != sum[2]) {
+            printf("ERROR: the scans disagree\n");
+            return 1;
+        }
+    }
+
+    /* ===== Victim selection: clean victims first, background write-back ===== */
+    printf("\n========================================\n");
+    printf("Testing dirty-aware victim selection (LRU, %d frames)\n", PF_MAX_BUFS);
+    printf("========================================\n");
+    {
+        static const struct { const char *name; int window; int cleaner; } cfg[] = {
+            {"coldest page", 1, 0},
+            {"clean in window", PF_VICTIM_WINDOW, 0},
+            {"window + cleaner", PF_VICTIM_WINDOW, 1}
+        };
+        static unsigned char shadow[N_PAGES];  /* expected page[6] of every page */
+        static double lat[CL_OPS];             /* PF_GetThisPage() latencies (ms) */
+        unsigned int seed = 12345;
+        int fd = PF_OpenFile(DBFILE), bad = 0;
+        char *page;
+
+        if (fd < 0) {
+            PF_PrintError("PF_OpenFile");
+            return 1;
+        }
+        for (int p = 0; p < N_PAGES; ++p) {
+            if (PF_GetThisPage(fd, p, &page) != PFE_OK) { bad++; continue; }
+            shadow[p] = (unsigned char)page[6];
+            PF_UnfixPage(fd, p, 0);
+        }
+
+        for (int c = 0; c < (int)(sizeof(cfg) / sizeof(cfg[0])); ++c) {
+            PF_Stats ps;
+            double t0, t1;
+
+            PF_SetVictimWindow(cfg[c].window);
+            if (cfg[c].cleaner && PF_CleanerStart() != PFE_OK) {
+                PF_PrintError("PF_CleanerStart");
+                return 1;
+            }
+            reset_pf(fd);
+            t0 = now_ms();
+            for (int i = 0; i < CL_OPS; ++i) {
+                int p;
+                seed = seed * 1103515245u + 12345u;
+                p = (int)((seed >> 8) % N_PAGES);
+                lat[i] = now_ms();
+                if (PF_GetThisPage(fd, p, &page) != PFE_OK) { bad++; continue; }
+                lat[i] = now_ms() - lat[i];
+                if (i % CL_WRITES == 0) {
+                    page[6] = (char)++shadow[p];
+                    PF_UnfixPage(fd, p, 1);
+                } else {
+                    if ((unsigned char)page[6] != shadow[p])
+                        bad++;
+                    PF_UnfixPage(fd, p, 0);
+                }
+            }
+            t1 = now_ms();
+            if (cfg[c].cleaner)
+                PF_CleanerStop();
+            PF_GetStats(fd, &ps);
+            qsort(lat, CL_OPS, sizeof(double), cmp_double);
+            printf("RESULT: %-16s %lu misses, %lu wrote a dirty victim first (%.1f%%), "
+                   "%lu written by the cleaner; %.3f ms, get p50/p90/p99/max %.3f/%.3f/%.3f/%.3f ms\n",
+                   cfg[c].name, ps.misses, ps.victim_writes,
+                   ps.misses ? 100.0 * ps.victim_writes / ps.misses : 0.0,
+                   ps.cleaner_writes, t1 - t0, lat[CL_OPS / 2], lat[CL_OPS * 90 / 100],
+                   lat[CL_OPS * 99 / 100], lat[CL_OPS - 1]);
+            if (cfg[c].cleaner && ps.cleaner_writes == 0)
+                bad++;
+        }
+        PF_SetVictimWindow(PF_VICTIM_WINDOW);
+
+        /* every write reached the file, whoever wrote it */
+        PF_CloseFile(fd);
+        fd = PF_OpenFile(DBFILE);
+        for (int p = 0; p < N_PAGES; ++p) {
+            if (PF_GetThisPage(fd, p, &page) != PFE_OK) { bad++; continue; }
+            if ((unsigned char)page[6] != shadow[p])
+                bad++;
+            PF_UnfixPage(fd, p, 0);
+        }
+        PF_CloseFile(fd);
+        printf("RESULT: victim selection test %s (%d errors)\n", bad ? "FAILED" : "passed", bad);
+        if (bad)
+            return 1;
+    }
+
+    /* ===== Free-space reclamation: trim the free tail, compact the rest ===== */
+    printf("\n========================================\n");
+    printf("Testing free-space reclamation (LRU, %d pages)\n", N_PAGES);
+    printf("========================================\n");
+    {
+        static Chain chain;
+        struct stat st;
+        double ms_full, ms_trim, ms_comp;
+        int fd, prev = -1, kept = 0, last = -1, none = -1, total, cut, n, pno, id, bad = 0;
+        char *page;
+
+        fd = PF_OpenFile(DBFILE);
+        if (fd < 0) {
+            PF_PrintError("PF_OpenFile");
+            return 1;
+        }
+        /* keep two pages in three, free the rest and the last CP_TAIL */
+        for (int p = 0; p < N_PAGES; ++p) {
+            if (p % 3 == 1 || p >= N_PAGES - CP_TAIL) {
+                if (PF_DisposePage(fd, p) != PFE_OK) bad++;
+                continue;
+            }
+            if (PF_GetThisPage(fd, p, &page) != PFE_OK) { bad++; continue; }
+            memcpy(page + 8, &p, sizeof(int));
+            memcpy(page + 12, &none, sizeof(int));
+            PF_UnfixPage(fd, p, 1);
+            if (prev < 0)
+                chain.head = p;
+            else {
+                PF_GetThisPage(fd, prev, &page);
+                memcpy(page + 12, &p, sizeof(int));
+                PF_UnfixPage(fd, prev, 1);
+            }
+            chain.where[p] = p;
+            chain.pred[p] = prev;
+            prev = last = p;
+            kept++;
+        }
+        scan_pages(fd, &ms_full);
+        PF_CloseFile(fd);
+        stat(DBFILE, &st);
+        total = (int)((st.st_size - PF_HDR_SIZE) / sizeof(PFfpage));  /* earlier tests may have added pages */
+        fd = PF_OpenFile(DBFILE);
+
+        cut = PF_TrimTail(fd);
+        stat(DBFILE, &st);
+        printf("INFO: PF_TrimTail cut %d pages, file now %lld bytes\n", cut, (long long)st.st_size);
+        if (cut != total - last - 1 || st.st_size != PFpageOffset(last + 1))
+            bad++;
+        scan_pages(fd, &ms_trim);
+
+        /* compaction in a logged transaction, the callback's link fixes included */
+        remove(WALFILE);
+        if (PF_WALOpen(WALFILE) != PFE_OK) {
+            PF_PrintError("PF_WALOpen");
+            return 1;
+        }
+        cut = PF_CompactFile(fd, chain_relocate, &chain);
+        if (PF_WALClose() != PFE_OK) bad++;
+        remove(WALFILE);
+        stat(DBFILE, &st);
+        printf("INFO: PF_CompactFile cut %d pages in %d moves, file now %lld bytes\n",
+               cut, chain.moves, (long long)st.st_size);
+        if (cut != last + 1 - kept || st.st_size != PFpageOffset(kept))
+            bad++;
+        if (PF_CompactFile(fd, chain_relocate, &chain) != 0)
+            bad++;
+
+        /* the chain still visits every kept page, in the original order */
+        PF_CloseFile(fd);
+        fd = PF_OpenFile(DBFILE);
+        n = 0;
+        prev = -1;
+        for (pno = chain.head; pno >= 0 && n <= kept; ++n) {
+            if (pno >= kept || PF_GetThisPage(fd, pno, &page) != PFE_OK) { bad++; break; }
+            memcpy(&id, page + 8, sizeof(int));
+            if (id <= prev || chain.where[id] != pno) bad++;
+            prev = id;
+            memcpy(&id, page + 12, sizeof(int));
+            PF_UnfixPage(fd, pno, 0);
+            pno = id;
+        }
+        if (n != kept || scan_pages(fd, &ms_comp) != kept)
+            bad++;
+        PF_CloseFile(fd);
+        printf("RESULT: full scan of %d kept pages: %.3f ms with %d pages, %.3f ms trimmed, "
+               "%.3f ms compacted\n", kept, ms_full, total, ms_trim, ms_comp);
+
+        printf("RESULT: compaction test %s (%d errors)\n", bad ? "FAILED" : "passed", bad);
+        if (bad)
+            return 1;
+    }
+
+    /* ===== Shared reads: lock-free pins from other threads ===== */
+    printf("\n========================================\n");
+    printf("Testing lock-free shared reads (%d reader threads, %d frames)\n", SH_THREADS, PF_MAX_BUFS);
+    printf("========================================\n");
+    {
+        pthread_t tid[SH_THREADS];
+        static ShReader rd[SH_THREADS];
+        unsigned long pins = 0, notbuf = 0, fixed = 0, torn = 0;
+        unsigned int seed = 777;
+        PF_Handle handle;
+        char *page, *shpage;
+        int bad = 0;
+
+        if ((sh_fd = PF_OpenFile(DBFILE)) < 0) {
+            PF_PrintError("PF_OpenFile");
+            return 1;
+        }
+        sh_stop = 0;
+        for (int t = 0; t < SH_THREADS; ++t) {
+            rd[t].seed = 1000u + t;
+            pthread_create(&tid[t], NULL, sh_reader, &rd[t]);
+        }
+
+        /* the PF thread rewrites and evicts the pages the readers pin */
+        for (int i = 0; i < SH_OPS; ++i) {
+            int p;
+            seed = seed * 1103515245u + 12345u;
+            p = (int)((seed >> 8) % ((i & 1) ? SH_HOT : SH_PAGES));
+            if (PF_GetThisPage(sh_fd, p, &page) != PFE_OK) { bad++; continue; }
+            memset(page + 16, (char)i, SH_SPAN);
+            PF_UnfixPage(sh_fd, p, 1);
+        }
+        sh_stop = 1;
+        for (int t = 0; t < SH_THREADS; ++t) {
+            pthread_join(tid[t], NULL);
+            pins += rd[t].pins;
+            notbuf += rd[t].notbuf;
+            fixed += rd[t].fixed;
+            torn += rd[t].torn;
+        }
+        printf("RESULT: %lu shared pins, %lu not buffered, %lu fixed at the time, %lu torn\n",
+               pins, notbuf, fixed, torn);
+        if (torn != 0)
+            bad++;
+
+        /* a buffered page pins, unless the PF thread has it fixed */
+        if (PF_GetThisPage(sh_fd, 0, &page) != PFE_OK) bad++;
+        if (PF_ReadShared(sh_fd, 0, &shpage, &handle) != PFE_PAGEFIXED) bad++;
+        PF_UnfixPage(sh_fd, 0, 0);
+        if (PF_ReadShared(sh_fd, 0, &shpage, &handle) != PFE_OK || shpage != page)
+            bad++;
+        else
+            PF_ReleaseShared(handle);
+        PF_CloseFile(sh_fd);
+        if (PF_ReadShared(sh_fd, 0, &shpage, &handle) != PFE_PAGENOTINBUF) bad++;
+
+        printf("RESULT: shared read test %s (%d errors)\n", bad ? "FAILED" : "passed", bad);
+        if (bad)
+            return 1;
     }
 
     printf("\n=== All tests completed successfully! ===\n");
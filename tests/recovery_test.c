@@ -0,0 +1,210 @@
+/* recovery_test.c: crash recovery of a B+-tree load.
+ *
+ * For each load size and checkpoint interval a child process creates an
+ * index, opens the write-ahead log and inserts keys in transactions of
+ * TXN_KEYS inserts. Once LOAD_KEYS[i] keys are committed the parent kills it
+ * with SIGKILL while it is inside AM_InsertEntry(), leaving a transaction
+ * half done (possibly in the middle of a node split) and the index file
+ * stale. The parent then reopens the log, which runs restart recovery, and
+ * checks that every committed key is found and that none of the killed
+ * transaction's keys are, unless its commit had become durable. It prints
+ * the recovery time against the log size. */
+#define _DEFAULT_SOURCE /* MAP_ANONYMOUS */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "../pflayer/pf.h"
+#include "../amlayer/am.h"
+
+#define IDXBASE "crash"
+#define IDXNO 1
+#define IDXFILE "crash.1"
+#define LOGFILE "crash_wal.log"
+#define TXN_KEYS 10
+#define POOL_PAGES 8
+#define MAX_KEYS 1000000
+#define KEY(i) ((int)(((long)(i) * 40503L) % 1000003L))
+
+static const int LOAD_KEYS[] = {2000, 8000, 32000};
+static const long CKPT_BYTES[] = {0, 256 * 1024};
+
+/* shared with the child */
+typedef struct {
+    volatile int committed;   /* keys of committed transactions */
+    volatile int in_insert;   /* TRUE while inside AM_InsertEntry() */
+    volatile int pending;     /* inserts done by the open transaction */
+    volatile int failed;      /* the child hit an error */
+} Shared;
+
+static double now_ms(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec * 1000.0 + (double)t.tv_nsec / 1e6;
+}
+
+/* the child: load keys until killed */
+static void load(Shared *sh, long ckpt) {
+    int fd, i, k, key;
+
+    PF_Init();
+    if (PF_WALOpen(LOGFILE) != PFE_OK) {
+        PF_PrintError("PF_WALOpen");
+        sh->failed = 1;
+        _exit(1);
+    }
+    PF_WALSetCheckpointInterval(ckpt);
+    /* a pool smaller than a transaction's pages: evictions force its
+       records to the log before it commits, so the crash leaves a loser */
+    PF_ResizeBufferPool(POOL_PAGES);
+    if (AM_CreateIndex(IDXBASE, IDXNO, 'i', sizeof(int)) != AME_OK ||
+        (fd = PF_OpenFile(IDXFILE)) < 0) {
+        fprintf(stderr, "AM_CreateIndex: AM_Errno %d\n", AM_Errno);
+        PF_PrintError("PF");
+        sh->failed = 1;
+        _exit(1);
+    }
+
+    for (i = 0; i + TXN_KEYS <= MAX_KEYS; i += TXN_KEYS) {
+        sh->pending = 0;
+        if (PF_TxnBegin() < 0) {
+            PF_PrintError("PF_TxnBegin");
+            sh->failed = 1;
+            _exit(1);
+        }
+        for (k = i; k < i + TXN_KEYS; k++) {
+            key = KEY(k);
+            sh->in_insert = 1;
+            if (AM_InsertEntry(fd, 'i', sizeof(int), (char *)&key, k) != AME_OK) {
+                fprintf(stderr, "AM_InsertEntry: AM_Errno %d\n", AM_Errno);
+                PF_PrintError("PF");
+                sh->failed = 1;
+                _exit(1);
+            }
+            sh->in_insert = 0;
+            sh->pending++;
+        }
+        if (PF_TxnCommit() != PFE_OK) {
+            PF_PrintError("PF_TxnCommit");
+            sh->failed = 1;
+            _exit(1);
+        }
+        sh->committed = i + TXN_KEYS;
+    }
+    _exit(0);
+}
+
+/* # of entries an AM scan with operator "op" on "key" returns (ALL scans
+   everything); "*rid" is the last recId */
+static int scan_count(int fd, int op, int key, int *rid) {
+    int sd, r, n = 0;
+
+    if ((sd = AM_OpenIndexScan(fd, 'i', sizeof(int), op, (op == ALL) ? NULL : (char *)&key)) < 0)
+        return -1;
+    while ((r = AM_FindNextEntry(sd)) >= 0) {
+        *rid = r;
+        n++;
+    }
+    AM_CloseIndexScan(sd);
+    return n;
+}
+
+static int run(int nkeys, long ckpt) {
+    Shared *sh;
+    pid_t pid;
+    struct stat st;
+    PF_RecoveryStats rs;
+    int fd, i, rid, committed, total, errors = 0;
+    double t0, t1;
+
+    remove(IDXFILE);
+    remove(LOGFILE);
+    sh = mmap(NULL, sizeof(Shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (sh == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    memset(sh, 0, sizeof(Shared));
+
+    if ((pid = fork()) < 0) {
+        perror("fork");
+        return 1;
+    }
+    if (pid == 0)
+        load(sh, ckpt);
+
+    /* wait for the load, then kill the child inside an insert, with
+       part of its transaction already logged */
+    while (sh->committed < nkeys && !sh->failed)
+        ;
+    while (!(sh->in_insert && sh->pending >= TXN_KEYS / 2) && !sh->failed)
+        ;
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    committed = sh->committed;
+    if (sh->failed) {
+        printf("ERROR: load failed before the crash\n");
+        return 1;
+    }
+
+    stat(LOGFILE, &st);
+    PF_Init();
+    t0 = now_ms();
+    if (PF_WALOpen(LOGFILE) != PFE_OK) {
+        PF_PrintError("PF_WALOpen (recovery)");
+        return 1;
+    }
+    t1 = now_ms();
+    PF_WALGetRecoveryStats(&rs);
+
+    if ((fd = PF_OpenFile(IDXFILE)) < 0) {
+        PF_PrintError("PF_OpenFile");
+        return 1;
+    }
+    for (i = 0; i < committed; i++) {
+        rid = -1;
+        if (scan_count(fd, EQUAL, KEY(i), &rid) != 1 || rid != i) {
+            if (errors++ < 5)
+                printf("ERROR: committed key %d (recId %d) not found after recovery\n", KEY(i), i);
+        }
+    }
+    total = scan_count(fd, ALL, 0, &rid);
+    if (total != committed && total != committed + TXN_KEYS) {
+        printf("ERROR: %d entries after recovery, expected %d or %d\n",
+               total, committed, committed + TXN_KEYS);
+        errors++;
+    }
+    PF_CloseFile(fd);
+    PF_WALClose();
+
+    printf("RESULT: %6d keys, checkpoint every %4ld KB: log %7.0f KB, recovery %8.3f ms "
+           "(analysis %.3f, redo %.3f, undo %.3f), %lu records analyzed, %lu redone, "
+           "%lu undone, %lu loser(s), %d entries\n",
+           committed, ckpt / 1024, st.st_size / 1024.0, t1 - t0,
+           rs.analysis_ns / 1e6, rs.redo_ns / 1e6, rs.undo_ns / 1e6,
+           rs.records, rs.redone, rs.undone, rs.losers, total);
+
+    munmap(sh, sizeof(Shared));
+    remove(IDXFILE);
+    remove(LOGFILE);
+    return errors != 0;
+}
+
+int main(void) {
+    int i, j, fail = 0;
+
+    printf("=== Crash recovery of an AM_InsertEntry load ===\n");
+    for (j = 0; j < (int)(sizeof(CKPT_BYTES) / sizeof(CKPT_BYTES[0])); j++) {
+        for (i = 0; i < (int)(sizeof(LOAD_KEYS) / sizeof(LOAD_KEYS[0])); i++)
+            fail |= run(LOAD_KEYS[i], CKPT_BYTES[j]);
+    }
+    printf("RESULT: recovery test %s\n", fail ? "FAILED" : "passed");
+    return fail;
+}
@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include "../pflayer/pf.h"
 
 /* ===============================
    Statistics
@@ -67,4 +68,16 @@ static inline void stats_dump(const char *filename, const char *label, Stats *s)
     fclose(f);
 }
 
+/* append the PF per-file statistics (hits, misses, latency histograms) of "fd" */
+static inline void stats_dump_pf(const char *filename, const char *label, int fd) {
+    PF_Stats ps;
+    if (PF_GetStats(fd, &ps) != PFE_OK) return;
+
+    FILE *f = fopen(filename, "a");
+    if (!f) return;
+    PF_PrintStats(f, label, &ps);
+    fprintf(f, "---------------------------------------------\n\n");
+    fclose(f);
+}
+
 #endif